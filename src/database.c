@@ -18,7 +18,13 @@
  */
 
 #include "database.h"
+#include "database_file_storage.h"
+#ifdef PUNICA_LMDB
+#include "database_lmdb_storage.h"
+#endif
+#include "database_snapshot.h"
 #include <uuid/uuid.h>
+#include <gnutls/crypto.h>
 #include "settings.h"
 #include "rest/rest_core_types.h"
 #include "linked_list.h"
@@ -34,8 +40,22 @@
 #define DATABASE_ALL_KEYS_SET       0x3F
 
 #define DATABASE_CREDENTIALS_MAX_SIZE 1024
+#define DATABASE_FINGERPRINT_SIZE     32
 
-static credentials_mode_t credentials_type_from_string(const char *string)
+typedef enum
+{
+    DATABASE_INDEX_UUID,
+    DATABASE_INDEX_NAME,
+    DATABASE_INDEX_PSK_IDENTITY,
+    DATABASE_INDEX_FINGERPRINT,
+    DATABASE_INDEX_SERIAL,
+    DATABASE_INDEX_COUNT,
+} database_index_t;
+
+_Static_assert(DATABASE_INDEX_COUNT == DATABASE_ENTRY_INDEX_COUNT,
+               "database entry index chains don't match the indexes");
+
+credentials_mode_t credentials_type_from_string(const char *string)
 {
     if (strcasecmp(string, "psk") == 0)
     {
@@ -75,129 +95,479 @@ static credentials_mode_t credentials_type_from_json(json_t *j_object)
     return credentials_type_from_string(mode);
 }
 
+int database_serialize(device_database_t *device_database, punica_database_format_t format,
+                       void **data, size_t *length)
+{
+    json_t *j_database;
+
+    if (format == PUNICA_DATABASE_FORMAT_BINARY)
+    {
+        return database_snapshot_serialize(device_database->list, data, length);
+    }
+
+    j_database = json_array();
+    if (j_database == NULL)
+    {
+        return -1;
+    }
+
+    if (database_list_to_json_array(device_database->list, j_database))
+    {
+        json_decref(j_database);
+        return -1;
+    }
+
+    *data = json_dumps(j_database, 0);
+    json_decref(j_database);
+    if (*data == NULL)
+    {
+        return -1;
+    }
+
+    *length = strlen(*data);
+    return 0;
+}
+
+static database_storage_t *database_storage_init(const coap_settings_t *settings)
+{
+    switch (settings->database_storage)
+    {
+    case PUNICA_DATABASE_STORAGE_FILE:
+        return database_file_storage_init(settings);
+    case PUNICA_DATABASE_STORAGE_LMDB:
+#ifdef PUNICA_LMDB
+        return database_lmdb_storage_init(settings);
+#else
+        fprintf(stderr, "%s:%d - lmdb database storage is not supported by this build\r\n",
+                __FILE__, __LINE__);
+        return NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
 int database_load_file(rest_context_t *rest)
 {
-    json_error_t error;
-    size_t index;
-    json_t *j_entry;
-    json_t *j_database = NULL;
-    int ret = 1;
-    database_entry_t *curr;
+    database_storage_t *storage;
 
-    linked_list_t *device_list = linked_list_new();
-    if (device_list == 0)
+    device_database_t *device_database = database_new();
+    if (device_database == NULL)
     {
         fprintf(stderr, "%s:%d - failed to allocate device list\r\n",
                 __FILE__, __LINE__);
-        goto exit;
+        return 1;
     }
 
-    rest->devicesList = device_list;
+    rest->devices = device_database;
     if (rest->settings->coap.database_file == NULL)
     {
 //      internal list created, nothing more to do here
-        ret = 0;
-        goto exit;
+        return 0;
     }
 
-    j_database = json_load_file(rest->settings->coap.database_file, 0, &error);
-    if (j_database == NULL)
+    // running without storage would silently lose every change
+    storage = database_storage_init(&rest->settings->coap);
+    if (storage == NULL)
     {
-        fprintf(stdout, "%s:%d - database file not found, must be created with /devices REST API\r\n",
-                __FILE__, __LINE__);
-        ret = 0;
-        goto exit;
+        fprintf(stderr, "%s:%d - failed to open database storage\r\n", __FILE__, __LINE__);
+        database_delete(device_database);
+        rest->devices = NULL;
+        return 1;
     }
 
-    if (!json_is_array(j_database))
+    if (storage->f_load(storage, device_database))
     {
-        fprintf(stderr, "%s:%d - database file must contain a json array\r\n",
-                __FILE__, __LINE__);
-        linked_list_delete(device_list);
-        goto exit;
+        storage->f_close(storage, device_database);
+        database_delete(device_database);
+        rest->devices = NULL;
+        return 1;
     }
 
-    int array_size = json_array_size(j_database);
-    if (array_size == 0)
-    {
-//      empty array, must be populated with /devices REST API
-        ret = 0;
-        goto exit;
+    device_database->storage = storage;
+
+    return 0;
+}
+
+static hash_table_t *database_index_table(device_database_t *device_database,
+                                          database_index_t index)
+{
+    switch (index)
+    {
+    case DATABASE_INDEX_UUID:
+        return device_database->by_uuid;
+    case DATABASE_INDEX_NAME:
+        return device_database->by_name;
+    case DATABASE_INDEX_PSK_IDENTITY:
+        return device_database->by_psk_identity;
+    case DATABASE_INDEX_FINGERPRINT:
+        return device_database->by_fingerprint;
+    case DATABASE_INDEX_SERIAL:
+        return device_database->by_serial;
+    default:
+        return NULL;
     }
+}
 
-    json_array_foreach(j_database, index, j_entry)
-    {
-        if (database_validate_entry(j_entry))
+static int database_certificate_fingerprint(const void *certificate, size_t length,
+                                            uint8_t *fingerprint)
+{
+    return gnutls_hash_fast(GNUTLS_DIG_SHA256, certificate, length, fingerprint);
+}
+
+/*
+ * Finds entry's key in the index, fingerprint buffer is used if key has to
+ * be computed. Returns false if entry is not indexed.
+ */
+static bool database_entry_key(const database_entry_t *device_entry, database_index_t index,
+                               uint8_t *fingerprint, const void **key, size_t *length)
+{
+    switch (index)
+    {
+    case DATABASE_INDEX_UUID:
+        *key = device_entry->uuid;
+        *length = strlen(device_entry->uuid);
+        return true;
+    case DATABASE_INDEX_NAME:
+        *key = device_entry->name;
+        *length = strlen(device_entry->name);
+        return true;
+    case DATABASE_INDEX_PSK_IDENTITY:
+        if (device_entry->mode != DEVICE_CREDENTIALS_PSK || device_entry->public_key == NULL)
         {
-            fprintf(stdout, "Found error(s) in device entry no. %ld\n", index);
-            continue;
+            return false;
         }
-
-        curr = database_create_entry(j_entry);
-        if (curr == NULL)
+        *key = device_entry->public_key;
+        *length = device_entry->public_key_len;
+        return true;
+    case DATABASE_INDEX_FINGERPRINT:
+        if (device_entry->mode != DEVICE_CREDENTIALS_CERT || device_entry->public_key == NULL
+            || database_certificate_fingerprint(device_entry->public_key,
+                                                device_entry->public_key_len, fingerprint))
+        {
+            return false;
+        }
+        *key = fingerprint;
+        *length = DATABASE_FINGERPRINT_SIZE;
+        return true;
+    case DATABASE_INDEX_SERIAL:
+        if (device_entry->serial == NULL)
         {
-            fprintf(stdout, "Internal server error while managing device entry\n");
-            continue;
+            return false;
         }
+        *key = device_entry->serial;
+        *length = device_entry->serial_len;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int database_index_add(device_database_t *device_database, database_index_t index,
+                              database_entry_t *device_entry)
+{
+    hash_table_t *table = database_index_table(device_database, index);
+    uint8_t fingerprint[DATABASE_FINGERPRINT_SIZE];
+    database_entry_t *first;
+    const void *key;
+    size_t length;
 
-        linked_list_add(device_list, (void *)curr);
+    if (!database_entry_key(device_entry, index, fingerprint, &key, &length))
+    {
+        return 0;
     }
-    ret = 0;
 
-exit:
-    json_decref(j_database);
-    return ret;
+    // first added entry keeps the key, later ones are chained after it
+    first = hash_table_get(table, key, length);
+    if (first != NULL)
+    {
+        first->index_prev[index]->index_next[index] = device_entry;
+        device_entry->index_prev[index] = first->index_prev[index];
+        device_entry->index_next[index] = NULL;
+        first->index_prev[index] = device_entry;
+        return 0;
+    }
+
+    if (hash_table_put(table, key, length, device_entry))
+    {
+        return -1;
+    }
+
+    device_entry->index_prev[index] = device_entry;
+    device_entry->index_next[index] = NULL;
+    return 0;
+}
+
+static void database_index_remove(device_database_t *device_database, database_index_t index,
+                                  database_entry_t *device_entry)
+{
+    hash_table_t *table = database_index_table(device_database, index);
+    uint8_t fingerprint[DATABASE_FINGERPRINT_SIZE];
+    database_entry_t *prev, *next, *first;
+    const void *key;
+    size_t length;
+
+    prev = device_entry->index_prev[index];
+    next = device_entry->index_next[index];
+    if (prev == NULL)
+    {
+        return;
+    }
+
+    device_entry->index_prev[index] = NULL;
+    device_entry->index_next[index] = NULL;
+
+    // entry in the middle of the chain is unlinked without a lookup
+    if (prev->index_next[index] == device_entry && next != NULL)
+    {
+        prev->index_next[index] = next;
+        next->index_prev[index] = prev;
+        return;
+    }
+
+    if (!database_entry_key(device_entry, index, fingerprint, &key, &length))
+    {
+        return;
+    }
+
+    if (prev->index_next[index] == device_entry)
+    {
+        // newest entry of the chain
+        prev->index_next[index] = NULL;
+        first = hash_table_get(table, key, length);
+        first->index_prev[index] = prev;
+    }
+    else if (next != NULL)
+    {
+        // next oldest entry takes over the key
+        next->index_prev[index] = prev;
+        hash_table_put(table, key, length, next);
+    }
+    else
+    {
+        hash_table_remove(table, key, length);
+    }
+}
+
+device_database_t *database_new(void)
+{
+    device_database_t *device_database;
+
+    device_database = calloc(1, sizeof(device_database_t));
+    if (device_database == NULL)
+    {
+        return NULL;
+    }
+
+    device_database->list = linked_list_new();
+    device_database->by_uuid = hash_table_new();
+    device_database->by_name = hash_table_new();
+    device_database->by_psk_identity = hash_table_new();
+    device_database->by_fingerprint = hash_table_new();
+    device_database->by_serial = hash_table_new();
+
+    if (device_database->list == NULL
+        || device_database->by_uuid == NULL
+        || device_database->by_name == NULL
+        || device_database->by_psk_identity == NULL
+        || device_database->by_fingerprint == NULL
+        || device_database->by_serial == NULL)
+    {
+        database_delete(device_database);
+        return NULL;
+    }
+
+    return device_database;
 }
 
-int devices_database_unload(linked_list_t *devices_database)
+void database_delete(device_database_t *device_database)
 {
     linked_list_entry_t *list_entry;
 
-    if (devices_database == NULL)
+    if (device_database == NULL)
     {
-        return 0;
+        return;
+    }
+
+    if (device_database->storage != NULL)
+    {
+        device_database->storage->f_close(device_database->storage, device_database);
+    }
+
+    if (device_database->list != NULL)
+    {
+        for (list_entry = device_database->list->head;
+             list_entry != NULL; list_entry = list_entry->next)
+        {
+            database_free_entry(list_entry->data);
+        }
+
+        linked_list_delete(device_database->list);
     }
 
-    for (list_entry = devices_database->head;
-         list_entry != NULL; list_entry = list_entry->next)
+    // mapped entries are freed already
+    database_snapshot_close(device_database->snapshot);
+
+    hash_table_delete(device_database->by_uuid);
+    hash_table_delete(device_database->by_name);
+    hash_table_delete(device_database->by_psk_identity);
+    hash_table_delete(device_database->by_fingerprint);
+    hash_table_delete(device_database->by_serial);
+    free(device_database);
+}
+
+int database_add_entry(device_database_t *device_database, database_entry_t *device_entry)
+{
+    database_index_t index;
+
+    memset(device_entry->index_next, 0, sizeof(device_entry->index_next));
+    memset(device_entry->index_prev, 0, sizeof(device_entry->index_prev));
+
+    device_entry->list_entry = linked_list_add(device_database->list, device_entry);
+    device_entry->sequence = ++device_database->sequence;
+
+    for (index = 0; index < DATABASE_INDEX_COUNT; index++)
     {
-        database_free_entry(list_entry->data);
+        if (database_index_add(device_database, index, device_entry))
+        {
+            database_remove_entry(device_database, device_entry);
+            return -1;
+        }
     }
 
-    linked_list_delete(devices_database);
     return 0;
 }
 
-database_entry_t *database_get_entry_by_uuid(linked_list_t *device_list, const char *uuid)
+void database_remove_entry(device_database_t *device_database, database_entry_t *device_entry)
+{
+    database_index_t index;
+
+    linked_list_remove_entry(device_database->list, device_entry->list_entry);
+    device_entry->list_entry = NULL;
+
+    for (index = 0; index < DATABASE_INDEX_COUNT; index++)
+    {
+        database_index_remove(device_database, index, device_entry);
+    }
+}
+
+int database_rename_entry(device_database_t *device_database, database_entry_t *device_entry,
+                          const char *name)
 {
-    linked_list_entry_t *device_entry;
-    database_entry_t *device_data;
+    char *new_name;
+
+    new_name = strdup(name);
+    if (new_name == NULL)
+    {
+        return -1;
+    }
+
+    database_index_remove(device_database, DATABASE_INDEX_NAME, device_entry);
+
+    free(device_entry->name);
+    device_entry->name = new_name;
+    free(device_entry->json);
+    device_entry->json = NULL;
+
+    return database_index_add(device_database, DATABASE_INDEX_NAME, device_entry);
+}
+
+linked_list_entry_t *database_list_after(device_database_t *device_database, const char *uuid,
+                                         uint64_t sequence)
+{
+    linked_list_entry_t *list_entry;
+    database_entry_t *device_entry;
+
+    if (uuid == NULL && sequence == 0)
+    {
+        return device_database->list->head;
+    }
 
-    for (device_entry = device_list->head; device_entry != NULL; device_entry = device_entry->next)
+    device_entry = (uuid != NULL) ? database_get_entry_by_uuid(device_database, uuid) : NULL;
+    if (device_entry != NULL && device_entry->sequence == sequence)
     {
-        device_data = (database_entry_t *)device_entry->data;
+        return device_entry->list_entry->next;
+    }
+
+    for (list_entry = device_database->list->head; list_entry != NULL;
+         list_entry = list_entry->next)
+    {
+        device_entry = (database_entry_t *)list_entry->data;
 
-        if (strcmp(uuid, device_data->uuid) == 0)
+        if (device_entry->sequence < sequence)
         {
-            return device_data;
+            return list_entry;
         }
     }
 
     return NULL;
 }
 
+database_entry_t *database_get_entry_by_uuid(device_database_t *device_database,
+                                             const char *uuid)
+{
+    return hash_table_get(device_database->by_uuid, uuid, strlen(uuid));
+}
+
+database_entry_t *database_get_entry_by_name(device_database_t *device_database,
+                                             const char *name)
+{
+    return hash_table_get(device_database->by_name, name, strlen(name));
+}
+
+database_entry_t *database_get_entry_by_psk_identity(device_database_t *device_database,
+                                                     const void *identity, size_t length)
+{
+    return hash_table_get(device_database->by_psk_identity, identity, length);
+}
+
+database_entry_t *database_get_entry_by_certificate(device_database_t *device_database,
+                                                    const void *certificate, size_t length)
+{
+    uint8_t fingerprint[DATABASE_FINGERPRINT_SIZE];
+    database_entry_t *device_entry;
+
+    if (database_certificate_fingerprint(certificate, length, fingerprint))
+    {
+        return NULL;
+    }
+
+    device_entry = hash_table_get(device_database->by_fingerprint, fingerprint,
+                                  sizeof(fingerprint));
+    if (device_entry == NULL
+        || device_entry->public_key_len != length
+        || memcmp(device_entry->public_key, certificate, length) != 0)
+    {
+        return NULL;
+    }
+
+    return device_entry;
+}
+
+database_entry_t *database_get_entry_by_serial(device_database_t *device_database,
+                                               const void *serial, size_t length)
+{
+    return hash_table_get(device_database->by_serial, serial, length);
+}
+
 void database_free_entry(database_entry_t *device_entry)
 {
     if (device_entry)
     {
-        if (device_entry->uuid)
-        {
-            free(device_entry->uuid);
-        }
         if (device_entry->name)
         {
             free(device_entry->name);
         }
+        free(device_entry->json);
+        if (device_entry->mapped)
+        {
+            free(device_entry);
+            return;
+        }
+        if (device_entry->uuid)
+        {
+            free(device_entry->uuid);
+        }
         if (device_entry->public_key)
         {
             free(device_entry->public_key);
@@ -415,8 +785,9 @@ exit:
     return device_entry;
 }
 
-database_entry_t *database_create_new_entry(json_t *j_device_object, linked_list_t *device_list,
-                                            const char *certificate, const char *private_key)
+database_entry_t *database_create_new_entry(json_t *j_device_object,
+                                            device_database_t *device_database,
+                                            device_signer_t *signer)
 {
     uuid_t b_uuid;
     char uuid[64];
@@ -456,7 +827,7 @@ database_entry_t *database_create_new_entry(json_t *j_device_object, linked_list
         goto exit;
     }
 
-    if (device_new_credentials(device_entry, device_list, certificate, private_key))
+    if (device_new_credentials(device_entry, device_database, signer))
     {
         goto exit;
     }
@@ -471,74 +842,77 @@ exit:
     return device_entry;
 }
 
-int database_list_to_json_array(linked_list_t *device_list, json_t *j_array)
+json_t *database_entry_to_json(database_entry_t *device_entry)
 {
-    linked_list_entry_t *list_entry;
-    database_entry_t *device_entry;
-    json_t *j_entry;
     char base64_secret_key[DATABASE_CREDENTIALS_MAX_SIZE];
     char base64_public_key[DATABASE_CREDENTIALS_MAX_SIZE];
     char base64_serial[DATABASE_CREDENTIALS_MAX_SIZE];
     size_t base64_length;
     const char *mode_string;
 
-    if (device_list == NULL || !json_is_array(j_array))
+    memset(base64_secret_key, 0, sizeof(base64_secret_key));
+    memset(base64_public_key, 0, sizeof(base64_public_key));
+    memset(base64_serial, 0, sizeof(base64_serial));
+
+    base64_length = sizeof(base64_secret_key);
+    if (base64_encode(device_entry->secret_key, device_entry->secret_key_len, base64_secret_key,
+                      &base64_length))
     {
-        return -1;
+        return NULL;
     }
 
-    for (list_entry = device_list->head; list_entry != NULL; list_entry = list_entry->next)
+    base64_length = sizeof(base64_public_key);
+    if (base64_encode(device_entry->public_key, device_entry->public_key_len, base64_public_key,
+                      &base64_length))
     {
-        device_entry = (database_entry_t *)list_entry->data;
+        return NULL;
+    }
 
-        memset(base64_secret_key, 0, sizeof(base64_secret_key));
-        memset(base64_public_key, 0, sizeof(base64_public_key));
-        memset(base64_serial, 0, sizeof(base64_serial));
+    base64_length = sizeof(base64_serial);
+    if (base64_encode(device_entry->serial, device_entry->serial_len, base64_serial, &base64_length))
+    {
+        return NULL;
+    }
 
-        base64_length = sizeof(base64_secret_key);
-        if (base64_encode(device_entry->secret_key, device_entry->secret_key_len, base64_secret_key,
-                          &base64_length))
-        {
-            return -1;
-        }
+    if (device_entry->mode == DEVICE_CREDENTIALS_PSK)
+    {
+        mode_string = "psk";
+    }
+    else if (device_entry->mode == DEVICE_CREDENTIALS_CERT)
+    {
+        mode_string = "cert";
+    }
+    else if (device_entry->mode == DEVICE_CREDENTIALS_NONE)
+    {
+        mode_string = "none";
+    }
+    else
+    {
+        return NULL;
+    }
 
-        base64_length = sizeof(base64_public_key);
-        if (base64_encode(device_entry->public_key, device_entry->public_key_len, base64_public_key,
-                          &base64_length))
-        {
-            return -1;
-        }
+    return json_pack("{s:s, s:s, s:s, s:s, s:s, s:s}",
+                     "uuid", device_entry->uuid,
+                     "name", device_entry->name,
+                     "mode", mode_string,
+                     "secret_key", base64_secret_key,
+                     "public_key", base64_public_key,
+                     "serial", base64_serial);
+}
 
-        base64_length = sizeof(base64_serial);
-        if (base64_encode(device_entry->serial, device_entry->serial_len, base64_serial, &base64_length))
-        {
-            return -1;
-        }
+int database_list_to_json_array(linked_list_t *device_list, json_t *j_array)
+{
+    linked_list_entry_t *list_entry;
+    json_t *j_entry;
 
-        if (device_entry->mode == DEVICE_CREDENTIALS_PSK)
-        {
-            mode_string = "psk";
-        }
-        else if (device_entry->mode == DEVICE_CREDENTIALS_CERT)
-        {
-            mode_string = "cert";
-        }
-        else if (device_entry->mode == DEVICE_CREDENTIALS_NONE)
-        {
-            mode_string = "none";
-        }
-        else
-        {
-            return -1;
-        }
+    if (device_list == NULL || !json_is_array(j_array))
+    {
+        return -1;
+    }
 
-        j_entry = json_pack("{s:s, s:s, s:s, s:s, s:s, s:s}",
-                            "uuid", device_entry->uuid,
-                            "name", device_entry->name,
-                            "mode", mode_string,
-                            "secret_key", base64_secret_key,
-                            "public_key", base64_public_key,
-                            "serial", base64_serial);
+    for (list_entry = device_list->head; list_entry != NULL; list_entry = list_entry->next)
+    {
+        j_entry = database_entry_to_json((database_entry_t *)list_entry->data);
         if (j_entry == NULL)
         {
             return -1;
@@ -546,10 +920,50 @@ int database_list_to_json_array(linked_list_t *device_list, json_t *j_array)
 
         if (json_array_append_new(j_array, j_entry))
         {
-            json_decref(j_entry);
             return -1;
         }
     }
 
     return 0;
 }
+
+int database_save_added_entry(device_database_t *device_database, database_entry_t *device_entry)
+{
+    return database_save_added_entries(device_database, &device_entry, 1);
+}
+
+int database_save_added_entries(device_database_t *device_database,
+                                database_entry_t **device_entries, size_t count)
+{
+    if (device_database->storage == NULL)
+    {
+        return 0;
+    }
+
+    return device_database->storage->f_add(device_database->storage, device_database,
+                                           device_entries, count);
+}
+
+int database_save_renamed_entry(device_database_t *device_database,
+                                database_entry_t *device_entry)
+{
+    if (device_database->storage == NULL)
+    {
+        return 0;
+    }
+
+    return device_database->storage->f_rename(device_database->storage, device_database,
+                                              device_entry);
+}
+
+int database_save_removed_entry(device_database_t *device_database,
+                                database_entry_t *device_entry)
+{
+    if (device_database->storage == NULL)
+    {
+        return 0;
+    }
+
+    return device_database->storage->f_remove(device_database->storage, device_database,
+                                              device_entry);
+}
@@ -21,20 +21,138 @@
 #define DATABASE_H
 
 #include "punica.h"
+#include "database_storage.h"
+#include "hash_table.h"
+#include "linked_list.h"
+
+/*
+ * Device registry. Devices are kept in a list (newest first) and in
+ * hash indexes on uuid, name, PSK identity, certificate fingerprint and
+ * serial. List must only be modified with database_*_entry() functions,
+ * which keep indexes consistent.
+ *
+ * Several devices may share a name, the index then points at the first one.
+ *
+ * Every added entry gets a sequence number greater than any before it, so
+ * list is ordered by descending sequence.
+ *
+ * If database file is specified, devices are loaded from storage and changes
+ * are persisted with database_save_*_entry() functions.
+ */
+struct device_database_t
+{
+    linked_list_t *list;
+    hash_table_t *by_uuid;
+    hash_table_t *by_name;
+    hash_table_t *by_psk_identity;
+    hash_table_t *by_fingerprint;
+    hash_table_t *by_serial;
+    database_storage_t *storage;
+    // binary database file entries were loaded from
+    struct database_snapshot_t *snapshot;
+    uint64_t sequence;
+};
 
 int database_load_file(rest_context_t *rest);
-int devices_database_unload(linked_list_t *devices_database);
+
+device_database_t *database_new(void);
+void database_delete(device_database_t *device_database);
+
+credentials_mode_t credentials_type_from_string(const char *string);
 
 int database_validate_entry(json_t *j_device_object);
 int database_validate_new_entry(json_t *j_new_device_object);
 
 database_entry_t *database_create_entry(json_t *j_device_object);
-database_entry_t *database_create_new_entry(json_t *j_new_device_object, linked_list_t *device_list,
-                                            const char *certificate, const char *private_key);
+/*
+ * Creates entry with new uuid and credentials. If device database is NULL,
+ * certificate serial is not checked for uniqueness.
+ */
+database_entry_t *database_create_new_entry(json_t *j_new_device_object,
+                                            device_database_t *device_database,
+                                            device_signer_t *signer);
 void database_free_entry(database_entry_t *device_entry);
 
+/*
+ * Adds entry to the registry, entry is owned by the registry afterwards
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int database_add_entry(device_database_t *device_database, database_entry_t *device_entry);
+
+/*
+ * Removes entry from the registry, caller has to free it
+ */
+void database_remove_entry(device_database_t *device_database, database_entry_t *device_entry);
+
+/*
+ * Changes name of a registered entry
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int database_rename_entry(device_database_t *device_database, database_entry_t *device_entry,
+                          const char *name);
+
+/*
+ * Finds list position following an entry, so that listing can be continued
+ * after the lock was released. If the entry was removed meanwhile, listing
+ * continues with the next older entry.
+ *
+ * Parameters:
+ *      device_database - device database pointer,
+ *      uuid - uuid of the last listed entry, NULL if only sequence is known,
+ *      sequence - sequence number of the last listed entry, 0 together with
+ *                 NULL uuid starts from list head
+ *
+ * Returns:
+ *      list entry to continue with,
+ *      NULL if there are no more entries
+ */
+linked_list_entry_t *database_list_after(device_database_t *device_database, const char *uuid,
+                                         uint64_t sequence);
+
+json_t *database_entry_to_json(database_entry_t *device_entry);
 int database_list_to_json_array(linked_list_t *device_list, json_t *j_array);
 
-database_entry_t *database_get_entry_by_uuid(linked_list_t *device_list, const char *uuid);
+/*
+ * Serializes all entries into database file content of the given format
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int database_serialize(device_database_t *device_database, punica_database_format_t format,
+                       void **data, size_t *length);
+
+/*
+ * Saves a change made with database_*_entry() functions to storage, removed
+ * entry must be saved before it is freed
+ *
+ * Returns:
+ *      0 on success or if database file is not specified,
+ *      negative value on error
+ */
+int database_save_added_entry(device_database_t *device_database, database_entry_t *device_entry);
+int database_save_added_entries(device_database_t *device_database,
+                                database_entry_t **device_entries, size_t count);
+int database_save_renamed_entry(device_database_t *device_database,
+                                database_entry_t *device_entry);
+int database_save_removed_entry(device_database_t *device_database,
+                                database_entry_t *device_entry);
+
+database_entry_t *database_get_entry_by_uuid(device_database_t *device_database,
+                                             const char *uuid);
+database_entry_t *database_get_entry_by_name(device_database_t *device_database,
+                                             const char *name);
+database_entry_t *database_get_entry_by_psk_identity(device_database_t *device_database,
+                                                     const void *identity, size_t length);
+database_entry_t *database_get_entry_by_certificate(device_database_t *device_database,
+                                                    const void *certificate, size_t length);
+database_entry_t *database_get_entry_by_serial(device_database_t *device_database,
+                                               const void *serial, size_t length);
 
 #endif //DATABASE_H
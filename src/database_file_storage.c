@@ -0,0 +1,344 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "database_file_storage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "database_journal.h"
+#include "database_snapshot.h"
+
+typedef struct
+{
+    database_storage_t api;
+    const char *database_file;
+    punica_database_format_t format;
+    database_journal_settings_t journal_settings;
+    database_journal_t *journal;
+} file_storage_context_t;
+
+static int file_storage_load(void *context_p, device_database_t *device_database);
+static int file_storage_add(void *context_p, device_database_t *device_database,
+                            database_entry_t **device_entries, size_t count);
+static int file_storage_rename(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry);
+static int file_storage_remove(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry);
+static void file_storage_close(void *context_p, device_database_t *device_database);
+
+database_storage_t *database_file_storage_init(const coap_settings_t *settings)
+{
+    file_storage_context_t *context;
+
+    context = calloc(1, sizeof(file_storage_context_t));
+    if (context == NULL)
+    {
+        return NULL;
+    }
+
+    context->database_file = settings->database_file;
+    context->format = settings->database_format;
+    context->journal_settings = settings->journal;
+
+    context->api.f_load = file_storage_load;
+    context->api.f_add = file_storage_add;
+    context->api.f_rename = file_storage_rename;
+    context->api.f_remove = file_storage_remove;
+    context->api.f_close = file_storage_close;
+
+    return &context->api;
+}
+
+static void file_storage_apply_record(json_t *j_record, void *context)
+{
+    device_database_t *device_database = (device_database_t *)context;
+    database_entry_t *device_entry;
+    json_t *j_device;
+    const char *operation, *uuid, *name;
+
+    operation = json_string_value(json_object_get(j_record, "op"));
+    if (operation == NULL)
+    {
+        return;
+    }
+
+    // records of an interrupted compaction may already be in the snapshot
+    if (strcmp(operation, "add") == 0)
+    {
+        j_device = json_object_get(j_record, "device");
+        if (database_validate_entry(j_device)
+            || database_get_entry_by_uuid(device_database,
+                                          json_string_value(json_object_get(j_device, "uuid"))))
+        {
+            return;
+        }
+
+        device_entry = database_create_entry(j_device);
+        if (device_entry != NULL && database_add_entry(device_database, device_entry))
+        {
+            database_free_entry(device_entry);
+        }
+        return;
+    }
+
+    uuid = json_string_value(json_object_get(j_record, "uuid"));
+    if (uuid == NULL)
+    {
+        return;
+    }
+
+    device_entry = database_get_entry_by_uuid(device_database, uuid);
+    if (device_entry == NULL)
+    {
+        return;
+    }
+
+    if (strcmp(operation, "rename") == 0)
+    {
+        name = json_string_value(json_object_get(j_record, "name"));
+        if (name != NULL)
+        {
+            database_rename_entry(device_database, device_entry, name);
+        }
+    }
+    else if (strcmp(operation, "remove") == 0)
+    {
+        database_remove_entry(device_database, device_entry);
+        database_free_entry(device_entry);
+    }
+}
+
+static int file_storage_checkpoint(file_storage_context_t *context,
+                                   device_database_t *device_database)
+{
+    void *data;
+    size_t length;
+    int ret;
+
+    if (database_serialize(device_database, context->format, &data, &length))
+    {
+        return -1;
+    }
+
+    ret = database_journal_checkpoint(context->database_file, data, length);
+    free(data);
+
+    return ret;
+}
+
+static void file_storage_load_snapshot(device_database_t *device_database)
+{
+    size_t index;
+    database_entry_t *curr;
+
+    for (index = 0; index < database_snapshot_size(device_database->snapshot); index++)
+    {
+        curr = malloc(sizeof(database_entry_t));
+        if (curr == NULL)
+        {
+            fprintf(stdout, "Internal server error while managing device entry\n");
+            continue;
+        }
+
+        if (database_snapshot_get_entry(device_database->snapshot, index, curr))
+        {
+            fprintf(stdout, "Found error(s) in device entry no. %ld\n", index);
+            free(curr);
+            continue;
+        }
+
+        if (database_add_entry(device_database, curr))
+        {
+            fprintf(stdout, "Internal server error while managing device entry\n");
+            database_free_entry(curr);
+        }
+    }
+}
+
+static int file_storage_load(void *context_p, device_database_t *device_database)
+{
+    file_storage_context_t *context = (file_storage_context_t *)context_p;
+    json_error_t error;
+    size_t index;
+    json_t *j_entry;
+    json_t *j_database = NULL;
+    int ret = -1, snapshot_status;
+    bool converted = false;
+    database_entry_t *curr;
+
+    snapshot_status = database_snapshot_open(context->database_file, &device_database->snapshot);
+    if (snapshot_status == 0)
+    {
+        file_storage_load_snapshot(device_database);
+        converted = (context->format != PUNICA_DATABASE_FORMAT_BINARY);
+        goto replay;
+    }
+    else if (snapshot_status < 0)
+    {
+        fprintf(stderr, "%s:%d - binary database file is damaged\r\n",
+                __FILE__, __LINE__);
+        goto exit;
+    }
+
+    j_database = json_load_file(context->database_file, 0, &error);
+    if (j_database == NULL)
+    {
+        fprintf(stdout, "%s:%d - database file not found, must be created with /devices REST API\r\n",
+                __FILE__, __LINE__);
+    }
+    else if (!json_is_array(j_database))
+    {
+        fprintf(stderr, "%s:%d - database file must contain a json array\r\n",
+                __FILE__, __LINE__);
+        goto exit;
+    }
+
+    json_array_foreach(j_database, index, j_entry)
+    {
+        if (database_validate_entry(j_entry))
+        {
+            fprintf(stdout, "Found error(s) in device entry no. %ld\n", index);
+            continue;
+        }
+
+        curr = database_create_entry(j_entry);
+        if (curr == NULL)
+        {
+            fprintf(stdout, "Internal server error while managing device entry\n");
+            continue;
+        }
+
+        if (database_add_entry(device_database, curr))
+        {
+            fprintf(stdout, "Internal server error while managing device entry\n");
+            database_free_entry(curr);
+        }
+    }
+    converted = (j_database != NULL && context->format != PUNICA_DATABASE_FORMAT_JSON);
+
+replay:
+//  changes made since last snapshot are folded into a new one
+    if ((database_journal_replay(context->database_file, file_storage_apply_record,
+                                 device_database) > 0 || converted)
+        && file_storage_checkpoint(context, device_database) != 0)
+    {
+        fprintf(stderr, "%s:%d - failed to write database file\r\n", __FILE__, __LINE__);
+    }
+
+    context->journal = database_journal_new(context->database_file, &context->journal_settings);
+    if (context->journal == NULL)
+    {
+        fprintf(stderr, "%s:%d - failed to open database journal\r\n", __FILE__, __LINE__);
+        goto exit;
+    }
+    ret = 0;
+
+exit:
+    json_decref(j_database);
+    return ret;
+}
+
+static int file_storage_save_record(file_storage_context_t *context,
+                                    device_database_t *device_database, json_t *j_record)
+{
+    void *data;
+    size_t length;
+    int ret;
+
+    if (j_record == NULL)
+    {
+        return -1;
+    }
+
+    ret = database_journal_append(context->journal, j_record);
+    json_decref(j_record);
+    if (ret != 0 || !database_journal_needs_compaction(context->journal))
+    {
+        return ret;
+    }
+
+    if (database_serialize(device_database, context->format, &data, &length))
+    {
+        return -1;
+    }
+
+    return database_journal_compact(context->journal, data, length);
+}
+
+static int file_storage_add(void *context_p, device_database_t *device_database,
+                            database_entry_t **device_entries, size_t count)
+{
+    file_storage_context_t *context = (file_storage_context_t *)context_p;
+    json_t *j_records;
+    size_t index;
+
+    j_records = json_array();
+    if (j_records == NULL)
+    {
+        return -1;
+    }
+
+    for (index = 0; index < count; index++)
+    {
+        if (json_array_append_new(j_records,
+                                  json_pack("{s:s, s:o}",
+                                            "op", "add",
+                                            "device", database_entry_to_json(device_entries[index]))))
+        {
+            json_decref(j_records);
+            return -1;
+        }
+    }
+
+    return file_storage_save_record(context, device_database, j_records);
+}
+
+static int file_storage_rename(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry)
+{
+    file_storage_context_t *context = (file_storage_context_t *)context_p;
+
+    return file_storage_save_record(context, device_database,
+                                    json_pack("{s:s, s:s, s:s}",
+                                              "op", "rename",
+                                              "uuid", device_entry->uuid,
+                                              "name", device_entry->name));
+}
+
+static int file_storage_remove(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry)
+{
+    file_storage_context_t *context = (file_storage_context_t *)context_p;
+
+    return file_storage_save_record(context, device_database,
+                                    json_pack("{s:s, s:s}",
+                                              "op", "remove",
+                                              "uuid", device_entry->uuid));
+}
+
+static void file_storage_close(void *context_p, device_database_t *device_database)
+{
+    file_storage_context_t *context = (file_storage_context_t *)context_p;
+
+    database_journal_delete(context->journal);
+    free(context);
+}
@@ -0,0 +1,40 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DATABASE_FILE_STORAGE_H
+#define DATABASE_FILE_STORAGE_H
+
+#include "database_storage.h"
+#include "settings.h"
+
+/*
+ * Initialize storage in a database file. Database file is a snapshot in
+ * json or binary format, changes are appended to a journal next to it and
+ * are folded into the snapshot on startup and in background.
+ *
+ * Parameters:
+ *      settings - CoAP settings (database file, format and journal settings)
+ *
+ * Returns:
+ *      storage API pointer on success,
+ *      NULL on error
+ */
+database_storage_t *database_file_storage_init(const coap_settings_t *settings);
+
+#endif // DATABASE_FILE_STORAGE_H
@@ -0,0 +1,629 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "database_journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+#define JOURNAL_SUFFIX      ".journal"
+#define JOURNAL_OLD_SUFFIX  ".journal.old"
+#define SNAPSHOT_SUFFIX     ".tmp"
+
+struct database_journal_t
+{
+    char *database_file;
+    char *journal_file;
+    char *journal_old_file;
+    database_journal_settings_t settings;
+    int fd;
+    size_t records;
+    // partial record could not be removed, journal can't be appended to
+    bool broken;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool running;
+    bool dirty;
+    struct timespec sync_deadline;
+    // journal started over, old one has to be synced before the snapshot is written
+    int old_fd;
+    void *snapshot;
+    size_t snapshot_length;
+    bool compacting;
+};
+
+static char *database_journal_path(const char *database_file, const char *suffix)
+{
+    size_t length = strlen(database_file);
+    char *path;
+
+    path = malloc(length + strlen(suffix) + 1);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(path, database_file, length);
+    strcpy(path + length, suffix);
+
+    return path;
+}
+
+static void database_journal_sync_directory(const char *file)
+{
+    char *path;
+    int fd;
+
+    path = strdup(file);
+    if (path == NULL)
+    {
+        return;
+    }
+
+    // renames and unlinks are durable only after directory is synced
+    fd = open(dirname(path), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+
+    free(path);
+}
+
+static int database_journal_write_snapshot(const char *database_file, const void *snapshot,
+                                           size_t length)
+{
+    char *snapshot_file;
+    size_t written = 0;
+    ssize_t ret;
+    int fd, status = -1;
+
+    snapshot_file = database_journal_path(database_file, SNAPSHOT_SUFFIX);
+    if (snapshot_file == NULL)
+    {
+        return -1;
+    }
+
+    fd = open(snapshot_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        goto exit;
+    }
+
+    while (written < length)
+    {
+        ret = write(fd, (const uint8_t *)snapshot + written, length - written);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            close(fd);
+            goto exit;
+        }
+
+        written += ret;
+    }
+
+    if (fsync(fd) != 0)
+    {
+        close(fd);
+        goto exit;
+    }
+    close(fd);
+
+    if (rename(snapshot_file, database_file) != 0)
+    {
+        goto exit;
+    }
+
+    database_journal_sync_directory(database_file);
+    status = 0;
+
+exit:
+    if (status != 0)
+    {
+        unlink(snapshot_file);
+    }
+    free(snapshot_file);
+
+    return status;
+}
+
+static void database_journal_deadline(struct timespec *deadline, uint32_t delay_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+
+    deadline->tv_sec += delay_ms / 1000;
+    deadline->tv_nsec += (delay_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static void database_journal_run_compaction(database_journal_t *journal)
+{
+    void *snapshot = journal->snapshot;
+    size_t snapshot_length = journal->snapshot_length;
+    int old_fd = journal->old_fd;
+
+    journal->snapshot = NULL;
+    journal->old_fd = -1;
+
+    pthread_mutex_unlock(&journal->mutex);
+
+    if (old_fd >= 0)
+    {
+        fdatasync(old_fd);
+        close(old_fd);
+    }
+
+    // old journal is kept if snapshot fails, it is replayed on next start
+    if (database_journal_write_snapshot(journal->database_file, snapshot, snapshot_length) == 0)
+    {
+        unlink(journal->journal_old_file);
+        database_journal_sync_directory(journal->journal_old_file);
+    }
+    else
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to write database snapshot \"%s\"\n",
+                    journal->database_file);
+    }
+    free(snapshot);
+
+    pthread_mutex_lock(&journal->mutex);
+    journal->compacting = false;
+}
+
+static void database_journal_run_sync(database_journal_t *journal)
+{
+    int fd;
+
+    journal->dirty = false;
+
+    // duplicate survives the journal being started over meanwhile
+    fd = dup(journal->fd);
+
+    pthread_mutex_unlock(&journal->mutex);
+
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        close(fd);
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+}
+
+static void *database_journal_thread(void *arg)
+{
+    database_journal_t *journal = (database_journal_t *)arg;
+    struct timespec now;
+
+    pthread_mutex_lock(&journal->mutex);
+
+    while (true)
+    {
+        if (journal->snapshot != NULL)
+        {
+            database_journal_run_compaction(journal);
+            continue;
+        }
+
+        if (journal->dirty)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            if (!journal->running
+                || now.tv_sec > journal->sync_deadline.tv_sec
+                || (now.tv_sec == journal->sync_deadline.tv_sec
+                    && now.tv_nsec >= journal->sync_deadline.tv_nsec))
+            {
+                database_journal_run_sync(journal);
+                continue;
+            }
+
+            pthread_cond_timedwait(&journal->cond, &journal->mutex, &journal->sync_deadline);
+            continue;
+        }
+
+        if (!journal->running)
+        {
+            break;
+        }
+
+        pthread_cond_wait(&journal->cond, &journal->mutex);
+    }
+
+    pthread_mutex_unlock(&journal->mutex);
+
+    return NULL;
+}
+
+database_journal_t *database_journal_new(const char *database_file,
+                                         const database_journal_settings_t *settings)
+{
+    database_journal_t *journal;
+    pthread_condattr_t cond_attributes;
+
+    journal = calloc(1, sizeof(database_journal_t));
+    if (journal == NULL)
+    {
+        return NULL;
+    }
+
+    journal->fd = -1;
+    journal->old_fd = -1;
+    journal->settings = *settings;
+    journal->database_file = strdup(database_file);
+    journal->journal_file = database_journal_path(database_file, JOURNAL_SUFFIX);
+    journal->journal_old_file = database_journal_path(database_file, JOURNAL_OLD_SUFFIX);
+    if (journal->database_file == NULL
+        || journal->journal_file == NULL
+        || journal->journal_old_file == NULL)
+    {
+        goto error;
+    }
+
+    journal->fd = open(journal->journal_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (journal->fd < 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to open database journal \"%s\": %s\n",
+                    journal->journal_file, strerror(errno));
+        goto error;
+    }
+
+    pthread_condattr_init(&cond_attributes);
+    pthread_condattr_setclock(&cond_attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&journal->cond, &cond_attributes);
+    pthread_condattr_destroy(&cond_attributes);
+    pthread_mutex_init(&journal->mutex, NULL);
+
+    journal->running = true;
+    if (pthread_create(&journal->thread, NULL, database_journal_thread, journal) != 0)
+    {
+        pthread_cond_destroy(&journal->cond);
+        pthread_mutex_destroy(&journal->mutex);
+        goto error;
+    }
+
+    return journal;
+
+error:
+    if (journal->fd >= 0)
+    {
+        close(journal->fd);
+    }
+    free(journal->database_file);
+    free(journal->journal_file);
+    free(journal->journal_old_file);
+    free(journal);
+
+    return NULL;
+}
+
+void database_journal_delete(database_journal_t *journal)
+{
+    if (journal == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+    journal->running = false;
+    pthread_cond_signal(&journal->cond);
+    pthread_mutex_unlock(&journal->mutex);
+
+    pthread_join(journal->thread, NULL);
+
+    close(journal->fd);
+    pthread_cond_destroy(&journal->cond);
+    pthread_mutex_destroy(&journal->mutex);
+    free(journal->database_file);
+    free(journal->journal_file);
+    free(journal->journal_old_file);
+    free(journal);
+}
+
+static char *database_journal_format(json_t *j_record, size_t *length, size_t *records)
+{
+    char *line, *lines = NULL, *new_lines;
+    size_t index, line_length;
+    json_t *j_item;
+
+    if (!json_is_array(j_record))
+    {
+        line = json_dumps(j_record, JSON_COMPACT);
+        if (line == NULL)
+        {
+            return NULL;
+        }
+
+        *length = strlen(line);
+        line[(*length)++] = '\n';
+        *records = 1;
+        return line;
+    }
+
+    *length = 0;
+    *records = 0;
+    json_array_foreach(j_record, index, j_item)
+    {
+        line = json_dumps(j_item, JSON_COMPACT);
+        if (line == NULL)
+        {
+            free(lines);
+            return NULL;
+        }
+
+        line_length = strlen(line);
+        new_lines = realloc(lines, *length + line_length + 1);
+        if (new_lines == NULL)
+        {
+            free(line);
+            free(lines);
+            return NULL;
+        }
+
+        lines = new_lines;
+        memcpy(lines + *length, line, line_length);
+        *length += line_length;
+        lines[(*length)++] = '\n';
+        (*records)++;
+        free(line);
+    }
+
+    return lines;
+}
+
+int database_journal_append(database_journal_t *journal, json_t *j_record)
+{
+    char *line;
+    size_t length, records, written = 0;
+    ssize_t ret;
+    off_t offset;
+
+    if (json_is_array(j_record) && json_array_size(j_record) == 0)
+    {
+        return 0;
+    }
+
+    // single write keeps the lines whole, unless the disk is full
+    line = database_journal_format(j_record, &length, &records);
+    if (line == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+
+    offset = journal->broken ? -1 : lseek(journal->fd, 0, SEEK_END);
+    if (offset < 0)
+    {
+        pthread_mutex_unlock(&journal->mutex);
+        free(line);
+        return -1;
+    }
+
+    while (written < length)
+    {
+        ret = write(journal->fd, line + written, length - written);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            log_message(LOG_LEVEL_ERROR, "Failed to write database journal: %s\n",
+                        strerror(errno));
+
+            // records appended later must not follow a partial line
+            if (written > 0 && ftruncate(journal->fd, offset) != 0)
+            {
+                log_message(LOG_LEVEL_FATAL, "Failed to truncate database journal: %s\n",
+                            strerror(errno));
+                journal->broken = true;
+            }
+
+            pthread_mutex_unlock(&journal->mutex);
+            free(line);
+            return -1;
+        }
+
+        written += ret;
+    }
+
+    journal->records += records;
+
+    if (journal->settings.sync_interval == 0)
+    {
+        fdatasync(journal->fd);
+    }
+    else if (!journal->dirty)
+    {
+        journal->dirty = true;
+        database_journal_deadline(&journal->sync_deadline, journal->settings.sync_interval);
+        pthread_cond_signal(&journal->cond);
+    }
+
+    pthread_mutex_unlock(&journal->mutex);
+
+    free(line);
+
+    return 0;
+}
+
+bool database_journal_needs_compaction(database_journal_t *journal)
+{
+    bool needed;
+
+    if (journal->settings.compaction_size == 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+    needed = !journal->compacting && journal->records >= journal->settings.compaction_size;
+    pthread_mutex_unlock(&journal->mutex);
+
+    return needed;
+}
+
+int database_journal_compact(database_journal_t *journal, void *snapshot, size_t length)
+{
+    int fd;
+
+    pthread_mutex_lock(&journal->mutex);
+
+    if (journal->compacting)
+    {
+        pthread_mutex_unlock(&journal->mutex);
+        free(snapshot);
+        return 0;
+    }
+
+    if (rename(journal->journal_file, journal->journal_old_file) != 0)
+    {
+        pthread_mutex_unlock(&journal->mutex);
+        free(snapshot);
+        return -1;
+    }
+
+    fd = open(journal->journal_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        // keep appending to the old journal, it is replayed on next start anyway
+        log_message(LOG_LEVEL_ERROR, "Failed to open database journal \"%s\": %s\n",
+                    journal->journal_file, strerror(errno));
+        rename(journal->journal_old_file, journal->journal_file);
+        pthread_mutex_unlock(&journal->mutex);
+        free(snapshot);
+        return -1;
+    }
+
+    journal->old_fd = journal->fd;
+    journal->fd = fd;
+    journal->records = 0;
+    journal->snapshot = snapshot;
+    journal->snapshot_length = length;
+    journal->compacting = true;
+    pthread_cond_signal(&journal->cond);
+
+    pthread_mutex_unlock(&journal->mutex);
+
+    return 0;
+}
+
+static size_t database_journal_replay_file(const char *journal_file,
+                                           database_journal_apply_cb_t apply, void *context)
+{
+    FILE *file;
+    char *line = NULL;
+    size_t line_size = 0, records = 0;
+    json_t *j_record;
+
+    file = fopen(journal_file, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    while (getline(&line, &line_size, file) > 0)
+    {
+        j_record = json_loads(line, 0, NULL);
+        if (!json_is_object(j_record))
+        {
+            // last record could be partially written before a crash
+            log_message(LOG_LEVEL_WARN, "Damaged record in database journal \"%s\", "
+                        "ignoring the rest\n", journal_file);
+            json_decref(j_record);
+            break;
+        }
+
+        apply(j_record, context);
+        json_decref(j_record);
+        records++;
+    }
+
+    free(line);
+    fclose(file);
+
+    return records;
+}
+
+size_t database_journal_replay(const char *database_file, database_journal_apply_cb_t apply,
+                               void *context)
+{
+    char *journal_file, *journal_old_file;
+    size_t records = 0;
+
+    journal_file = database_journal_path(database_file, JOURNAL_SUFFIX);
+    journal_old_file = database_journal_path(database_file, JOURNAL_OLD_SUFFIX);
+
+    if (journal_file != NULL && journal_old_file != NULL)
+    {
+        records += database_journal_replay_file(journal_old_file, apply, context);
+        records += database_journal_replay_file(journal_file, apply, context);
+    }
+
+    free(journal_file);
+    free(journal_old_file);
+
+    return records;
+}
+
+int database_journal_checkpoint(const char *database_file, const void *snapshot, size_t length)
+{
+    char *journal_file, *journal_old_file;
+    int ret = -1;
+
+    journal_file = database_journal_path(database_file, JOURNAL_SUFFIX);
+    journal_old_file = database_journal_path(database_file, JOURNAL_OLD_SUFFIX);
+
+    if (journal_file != NULL && journal_old_file != NULL
+        && database_journal_write_snapshot(database_file, snapshot, length) == 0)
+    {
+        unlink(journal_old_file);
+        unlink(journal_file);
+        database_journal_sync_directory(database_file);
+        ret = 0;
+    }
+
+    free(journal_file);
+    free(journal_old_file);
+
+    return ret;
+}
@@ -0,0 +1,151 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DATABASE_JOURNAL_H
+#define DATABASE_JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <jansson.h>
+
+/*
+ * Append-only journal of database changes, stored next to the database file
+ * as "<database_file>.journal", one json record per line. Database file
+ * itself is a snapshot, journal records are applied on top of it on startup.
+ *
+ * Records are flushed to disk by a background thread every sync_interval
+ * milliseconds, so that bursts of changes share one fsync. Once journal
+ * holds compaction_size records, a new snapshot is written by the same
+ * thread and the journal is started over.
+ *
+ * Journal functions are thread safe, except database_journal_delete(), which
+ * must not be called concurrently with other calls.
+ */
+typedef struct database_journal_t database_journal_t;
+
+typedef struct
+{
+    uint32_t sync_interval;
+    uint32_t compaction_size;
+} database_journal_settings_t;
+
+/*
+ * Called for every replayed journal record
+ *
+ * Parameters:
+ *      j_record - journal record,
+ *      context - user data passed to database_journal_replay()
+ */
+typedef void (*database_journal_apply_cb_t)(json_t *j_record, void *context);
+
+/*
+ * Opens journal of a database file for appending
+ *
+ * Parameters:
+ *      database_file - database file path,
+ *      settings - journal settings
+ *
+ * Returns:
+ *      pointer to a new journal on success,
+ *      NULL on error
+ */
+database_journal_t *database_journal_new(const char *database_file,
+                                         const database_journal_settings_t *settings);
+
+/*
+ * Flushes journal, waits for running compaction and closes the journal
+ *
+ * Parameters:
+ *      journal - journal pointer
+ */
+void database_journal_delete(database_journal_t *journal);
+
+/*
+ * Appends record to the journal. Partially written record is truncated away,
+ * and if that fails, all later appends fail.
+ *
+ * Parameters:
+ *      journal - journal pointer,
+ *      j_record - record to append, or array of records that are written
+ *                 and synced together
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int database_journal_append(database_journal_t *journal, json_t *j_record);
+
+/*
+ * Checks if journal has grown enough to be compacted and no compaction is
+ * running already
+ *
+ * Parameters:
+ *      journal - journal pointer
+ *
+ * Returns:
+ *      true if database_journal_compact() should be called
+ */
+bool database_journal_needs_compaction(database_journal_t *journal);
+
+/*
+ * Starts journal over and writes the snapshot in background
+ *
+ * Parameters:
+ *      journal - journal pointer,
+ *      snapshot - database file content including all appended records,
+ *                 is freed by the journal,
+ *      length - content length in bytes
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int database_journal_compact(database_journal_t *journal, void *snapshot, size_t length);
+
+/*
+ * Applies journal records of a database file, including records of an
+ * interrupted compaction. Reading stops at first damaged record.
+ *
+ * Parameters:
+ *      database_file - database file path,
+ *      apply - callback called for every record,
+ *      context - user data passed to callback
+ *
+ * Returns:
+ *      number of applied records
+ */
+size_t database_journal_replay(const char *database_file, database_journal_apply_cb_t apply,
+                               void *context);
+
+/*
+ * Writes database snapshot and removes journal files. Must not be called
+ * while journal of the database file is open.
+ *
+ * Parameters:
+ *      database_file - database file path,
+ *      snapshot - database file content,
+ *      length - content length in bytes
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int database_journal_checkpoint(const char *database_file, const void *snapshot, size_t length);
+
+#endif // DATABASE_JOURNAL_H
@@ -0,0 +1,431 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "database_lmdb_storage.h"
+
+#include <lmdb.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "database_file_storage.h"
+#include "database_journal.h"
+#include "logging.h"
+
+#define LMDB_STORAGE_SUFFIX     ".mdb"
+// address space only, file grows with the data
+#define LMDB_STORAGE_MAP_SIZE   ((size_t)1 << (sizeof(size_t) > 4 ? 36 : 30))
+// key stored next to devices once database file was imported, can't be a uuid
+#define LMDB_STORAGE_IMPORTED   "punica:imported"
+
+typedef struct
+{
+    database_storage_t api;
+    const coap_settings_t *settings;
+    MDB_env *env;
+    MDB_dbi dbi;
+    // devices are only exported if all of them were loaded
+    bool loaded;
+} lmdb_storage_context_t;
+
+static int lmdb_storage_load(void *context_p, device_database_t *device_database);
+static int lmdb_storage_add(void *context_p, device_database_t *device_database,
+                            database_entry_t **device_entries, size_t count);
+static int lmdb_storage_rename(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry);
+static int lmdb_storage_remove(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry);
+static void lmdb_storage_close(void *context_p, device_database_t *device_database);
+
+database_storage_t *database_lmdb_storage_init(const coap_settings_t *settings)
+{
+    lmdb_storage_context_t *context;
+    MDB_txn *txn;
+    char *path;
+    int ret;
+
+    context = calloc(1, sizeof(lmdb_storage_context_t));
+    path = malloc(strlen(settings->database_file) + sizeof(LMDB_STORAGE_SUFFIX));
+    if (context == NULL || path == NULL)
+    {
+        free(context);
+        free(path);
+        return NULL;
+    }
+    strcpy(path, settings->database_file);
+    strcat(path, LMDB_STORAGE_SUFFIX);
+
+    context->settings = settings;
+
+    ret = mdb_env_create(&context->env);
+    if (ret == 0)
+    {
+        ret = mdb_env_set_mapsize(context->env, LMDB_STORAGE_MAP_SIZE);
+    }
+    if (ret == 0)
+    {
+        ret = mdb_env_open(context->env, path, MDB_NOSUBDIR, 0600);
+    }
+    if (ret == 0)
+    {
+        ret = mdb_txn_begin(context->env, NULL, 0, &txn);
+    }
+    if (ret == 0)
+    {
+        ret = mdb_dbi_open(txn, NULL, 0, &context->dbi);
+        if (ret == 0)
+        {
+            ret = mdb_txn_commit(txn);
+        }
+        else
+        {
+            mdb_txn_abort(txn);
+        }
+    }
+    free(path);
+
+    if (ret != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to open lmdb database storage: %s\n",
+                    mdb_strerror(ret));
+        if (context->env != NULL)
+        {
+            mdb_env_close(context->env);
+        }
+        free(context);
+        return NULL;
+    }
+
+    context->api.f_load = lmdb_storage_load;
+    context->api.f_add = lmdb_storage_add;
+    context->api.f_rename = lmdb_storage_rename;
+    context->api.f_remove = lmdb_storage_remove;
+    context->api.f_close = lmdb_storage_close;
+
+    return &context->api;
+}
+
+static int lmdb_storage_put(lmdb_storage_context_t *context, MDB_txn *txn,
+                            database_entry_t *device_entry)
+{
+    MDB_val key, value;
+    json_t *j_entry;
+    char *data;
+    int ret;
+
+    j_entry = database_entry_to_json(device_entry);
+    if (j_entry == NULL)
+    {
+        return -1;
+    }
+
+    data = json_dumps(j_entry, JSON_COMPACT);
+    json_decref(j_entry);
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    key.mv_data = device_entry->uuid;
+    key.mv_size = strlen(device_entry->uuid);
+    value.mv_data = data;
+    value.mv_size = strlen(data);
+
+    ret = mdb_put(txn, context->dbi, &key, &value, 0);
+    free(data);
+
+    return (ret == 0) ? 0 : -1;
+}
+
+static bool lmdb_storage_is_marker(const MDB_val *key)
+{
+    return key->mv_size == strlen(LMDB_STORAGE_IMPORTED)
+           && memcmp(key->mv_data, LMDB_STORAGE_IMPORTED, key->mv_size) == 0;
+}
+
+/*
+ * Writes entries in one transaction, import marker is written in the same
+ * transaction, so that database file is never imported twice
+ */
+static int lmdb_storage_write(lmdb_storage_context_t *context, database_entry_t **device_entries,
+                              size_t count, bool imported)
+{
+    MDB_txn *txn;
+    MDB_val key, value;
+    size_t index;
+    int ret;
+
+    ret = mdb_txn_begin(context->env, NULL, 0, &txn);
+    if (ret != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to begin lmdb transaction: %s\n", mdb_strerror(ret));
+        return -1;
+    }
+
+    for (index = 0; index < count; index++)
+    {
+        if (lmdb_storage_put(context, txn, device_entries[index]))
+        {
+            mdb_txn_abort(txn);
+            return -1;
+        }
+    }
+
+    if (imported)
+    {
+        key.mv_data = LMDB_STORAGE_IMPORTED;
+        key.mv_size = strlen(LMDB_STORAGE_IMPORTED);
+        value.mv_data = "";
+        value.mv_size = 0;
+
+        ret = mdb_put(txn, context->dbi, &key, &value, 0);
+        if (ret != 0)
+        {
+            mdb_txn_abort(txn);
+            log_message(LOG_LEVEL_ERROR, "Failed to write lmdb import marker: %s\n",
+                        mdb_strerror(ret));
+            return -1;
+        }
+    }
+
+    ret = mdb_txn_commit(txn);
+    if (ret != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to commit lmdb transaction: %s\n", mdb_strerror(ret));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int lmdb_storage_import(lmdb_storage_context_t *context,
+                               device_database_t *device_database)
+{
+    database_storage_t *file_storage;
+    database_entry_t **device_entries;
+    linked_list_entry_t *list_entry;
+    size_t count = 0;
+    int ret;
+
+    file_storage = database_file_storage_init(context->settings);
+    if (file_storage == NULL)
+    {
+        return -1;
+    }
+
+    ret = file_storage->f_load(file_storage, device_database);
+    file_storage->f_close(file_storage, device_database);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    for (list_entry = device_database->list->head; list_entry != NULL;
+         list_entry = list_entry->next)
+    {
+        count++;
+    }
+
+    // allocation size is never zero
+    device_entries = malloc((count + 1) * sizeof(database_entry_t *));
+    if (device_entries == NULL)
+    {
+        return -1;
+    }
+
+    count = 0;
+    for (list_entry = device_database->list->head; list_entry != NULL;
+         list_entry = list_entry->next)
+    {
+        device_entries[count++] = (database_entry_t *)list_entry->data;
+    }
+
+    ret = lmdb_storage_write(context, device_entries, count, true);
+    free(device_entries);
+
+    if (ret == 0)
+    {
+        log_message(LOG_LEVEL_INFO, "Imported %zu devices into lmdb database storage\n", count);
+    }
+
+    return ret;
+}
+
+static int lmdb_storage_load(void *context_p, device_database_t *device_database)
+{
+    lmdb_storage_context_t *context = (lmdb_storage_context_t *)context_p;
+    database_entry_t *device_entry;
+    MDB_txn *txn;
+    MDB_cursor *cursor;
+    MDB_val key, value;
+    MDB_stat stat;
+    json_t *j_entry;
+    size_t index = 0;
+    bool imported;
+    int ret;
+
+    ret = mdb_txn_begin(context->env, NULL, MDB_RDONLY, &txn);
+    if (ret != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to read lmdb database storage: %s\n",
+                    mdb_strerror(ret));
+        return -1;
+    }
+
+    // database file is imported once, environment emptied later must stay empty
+    key.mv_data = LMDB_STORAGE_IMPORTED;
+    key.mv_size = strlen(LMDB_STORAGE_IMPORTED);
+    ret = mdb_get(txn, context->dbi, &key, &value);
+    imported = (ret == 0);
+    if (ret == MDB_NOTFOUND)
+    {
+        ret = mdb_stat(txn, context->dbi, &stat);
+    }
+
+    if (ret == 0 && !imported && stat.ms_entries == 0)
+    {
+        mdb_txn_abort(txn);
+        ret = lmdb_storage_import(context, device_database);
+        context->loaded = (ret == 0);
+        return ret;
+    }
+
+    if (ret == 0)
+    {
+        ret = mdb_cursor_open(txn, context->dbi, &cursor);
+    }
+    if (ret != 0)
+    {
+        mdb_txn_abort(txn);
+        log_message(LOG_LEVEL_ERROR, "Failed to read lmdb database storage: %s\n",
+                    mdb_strerror(ret));
+        return -1;
+    }
+
+    while (mdb_cursor_get(cursor, &key, &value, MDB_NEXT) == 0)
+    {
+        if (lmdb_storage_is_marker(&key))
+        {
+            continue;
+        }
+
+        j_entry = json_loadb(value.mv_data, value.mv_size, 0, NULL);
+        if (database_validate_entry(j_entry))
+        {
+            log_message(LOG_LEVEL_WARN, "Found error(s) in device entry no. %ld\n", index);
+            json_decref(j_entry);
+            index++;
+            continue;
+        }
+
+        device_entry = database_create_entry(j_entry);
+        json_decref(j_entry);
+        if (device_entry == NULL)
+        {
+            log_message(LOG_LEVEL_ERROR, "Internal server error while managing device entry\n");
+        }
+        else if (database_add_entry(device_database, device_entry))
+        {
+            log_message(LOG_LEVEL_ERROR, "Internal server error while managing device entry\n");
+            database_free_entry(device_entry);
+        }
+        index++;
+    }
+
+    mdb_cursor_close(cursor);
+    mdb_txn_abort(txn);
+    context->loaded = true;
+
+    return 0;
+}
+
+static int lmdb_storage_add(void *context_p, device_database_t *device_database,
+                            database_entry_t **device_entries, size_t count)
+{
+    lmdb_storage_context_t *context = (lmdb_storage_context_t *)context_p;
+
+    return lmdb_storage_write(context, device_entries, count, false);
+}
+
+static int lmdb_storage_rename(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry)
+{
+    lmdb_storage_context_t *context = (lmdb_storage_context_t *)context_p;
+
+    return lmdb_storage_write(context, &device_entry, 1, false);
+}
+
+static int lmdb_storage_remove(void *context_p, device_database_t *device_database,
+                               database_entry_t *device_entry)
+{
+    lmdb_storage_context_t *context = (lmdb_storage_context_t *)context_p;
+    MDB_txn *txn;
+    MDB_val key;
+    int ret;
+
+    ret = mdb_txn_begin(context->env, NULL, 0, &txn);
+    if (ret != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to begin lmdb transaction: %s\n", mdb_strerror(ret));
+        return -1;
+    }
+
+    key.mv_data = device_entry->uuid;
+    key.mv_size = strlen(device_entry->uuid);
+
+    ret = mdb_del(txn, context->dbi, &key, NULL);
+    if (ret != 0 && ret != MDB_NOTFOUND)
+    {
+        mdb_txn_abort(txn);
+        return -1;
+    }
+
+    ret = mdb_txn_commit(txn);
+    if (ret != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to commit lmdb transaction: %s\n", mdb_strerror(ret));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void lmdb_storage_close(void *context_p, device_database_t *device_database)
+{
+    lmdb_storage_context_t *context = (lmdb_storage_context_t *)context_p;
+    void *data;
+    size_t length;
+
+    // database file is kept as an export, environment stays the primary copy
+    if (context->loaded
+        && database_serialize(device_database, context->settings->database_format, &data,
+                              &length) == 0)
+    {
+        if (database_journal_checkpoint(context->settings->database_file, data, length) != 0)
+        {
+            log_message(LOG_LEVEL_ERROR, "Failed to export devices to database file\n");
+        }
+        free(data);
+    }
+
+    mdb_dbi_close(context->env, context->dbi);
+    mdb_env_close(context->env);
+    free(context);
+}
@@ -0,0 +1,45 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DATABASE_LMDB_STORAGE_H
+#define DATABASE_LMDB_STORAGE_H
+
+#include "database_storage.h"
+#include "settings.h"
+
+/*
+ * Initialize storage in an LMDB environment ("<database_file>.mdb"). Every
+ * device is a separate record keyed by uuid, so changes are written in
+ * O(log N) with a transaction each, which is durable once committed.
+ *
+ * If the environment is empty, devices are imported from the database file
+ * (and its journal) on load. On close, devices are exported to the database
+ * file in configured database_format, so that it can be read by file
+ * storage again.
+ *
+ * Parameters:
+ *      settings - CoAP settings (database file and format)
+ *
+ * Returns:
+ *      storage API pointer on success,
+ *      NULL on error
+ */
+database_storage_t *database_lmdb_storage_init(const coap_settings_t *settings);
+
+#endif // DATABASE_LMDB_STORAGE_H
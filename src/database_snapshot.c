@@ -0,0 +1,331 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "database_snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC          "PUNICADB"
+#define SNAPSHOT_MAGIC_SIZE     8
+#define SNAPSHOT_VERSION        1
+// written in native byte order, files of other architectures are rejected
+#define SNAPSHOT_BYTE_ORDER     0x01020304
+
+typedef enum
+{
+    SNAPSHOT_FIELD_UUID,
+    SNAPSHOT_FIELD_NAME,
+    SNAPSHOT_FIELD_PUBLIC_KEY,
+    SNAPSHOT_FIELD_SECRET_KEY,
+    SNAPSHOT_FIELD_SERIAL,
+    SNAPSHOT_FIELD_COUNT,
+} snapshot_field_id_t;
+
+typedef struct
+{
+    char magic[SNAPSHOT_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t record_count;
+    uint64_t arena_size;
+} snapshot_header_t;
+
+typedef struct
+{
+    // offset in arena, strings are followed by a null byte
+    uint64_t offset;
+    uint64_t length;
+} snapshot_field_t;
+
+typedef struct
+{
+    uint32_t mode;
+    uint32_t reserved;
+    snapshot_field_t fields[SNAPSHOT_FIELD_COUNT];
+} snapshot_record_t;
+
+struct database_snapshot_t
+{
+    void *data;
+    size_t length;
+    const snapshot_record_t *records;
+    size_t record_count;
+    const uint8_t *arena;
+    size_t arena_size;
+};
+
+int database_snapshot_open(const char *file, database_snapshot_t **snapshot)
+{
+    database_snapshot_t *new_snapshot;
+    const snapshot_header_t *header;
+    struct stat file_stat;
+    void *data;
+    int fd;
+
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return (errno == ENOENT) ? 1 : -1;
+    }
+
+    if (fstat(fd, &file_stat) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t)file_stat.st_size < sizeof(snapshot_header_t))
+    {
+        close(fd);
+        return 1;
+    }
+
+    data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    header = (const snapshot_header_t *)data;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0)
+    {
+        munmap(data, file_stat.st_size);
+        return 1;
+    }
+
+    if (header->version != SNAPSHOT_VERSION
+        || header->byte_order != SNAPSHOT_BYTE_ORDER
+        || header->record_count > (file_stat.st_size - sizeof(snapshot_header_t))
+        / sizeof(snapshot_record_t)
+        || header->arena_size != file_stat.st_size - sizeof(snapshot_header_t)
+        - header->record_count * sizeof(snapshot_record_t))
+    {
+        munmap(data, file_stat.st_size);
+        return -1;
+    }
+
+    new_snapshot = calloc(1, sizeof(database_snapshot_t));
+    if (new_snapshot == NULL)
+    {
+        munmap(data, file_stat.st_size);
+        return -1;
+    }
+
+    // records are only read, hint kernel to map them in ahead
+    madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+
+    new_snapshot->data = data;
+    new_snapshot->length = file_stat.st_size;
+    new_snapshot->records = (const snapshot_record_t *)(header + 1);
+    new_snapshot->record_count = header->record_count;
+    new_snapshot->arena = (const uint8_t *)(new_snapshot->records + header->record_count);
+    new_snapshot->arena_size = header->arena_size;
+
+    *snapshot = new_snapshot;
+
+    return 0;
+}
+
+void database_snapshot_close(database_snapshot_t *snapshot)
+{
+    if (snapshot == NULL)
+    {
+        return;
+    }
+
+    munmap(snapshot->data, snapshot->length);
+    free(snapshot);
+}
+
+size_t database_snapshot_size(database_snapshot_t *snapshot)
+{
+    return snapshot->record_count;
+}
+
+static const void *database_snapshot_field(database_snapshot_t *snapshot,
+                                           const snapshot_field_t *field, bool string)
+{
+    if (field->offset > snapshot->arena_size
+        || field->length > snapshot->arena_size - field->offset)
+    {
+        return NULL;
+    }
+
+    if (string && (field->length == snapshot->arena_size - field->offset
+                   || snapshot->arena[field->offset + field->length] != '\0'))
+    {
+        return NULL;
+    }
+
+    return snapshot->arena + field->offset;
+}
+
+int database_snapshot_get_entry(database_snapshot_t *snapshot, size_t index,
+                                database_entry_t *device_entry)
+{
+    const snapshot_record_t *record;
+    const void *fields[SNAPSHOT_FIELD_COUNT];
+    int field;
+
+    if (index >= snapshot->record_count)
+    {
+        return -1;
+    }
+
+    record = &snapshot->records[index];
+
+    if (record->mode != DEVICE_CREDENTIALS_PSK
+        && record->mode != DEVICE_CREDENTIALS_CERT
+        && record->mode != DEVICE_CREDENTIALS_NONE)
+    {
+        return -1;
+    }
+
+    for (field = 0; field < SNAPSHOT_FIELD_COUNT; field++)
+    {
+        fields[field] = database_snapshot_field(snapshot, &record->fields[field],
+                                                field == SNAPSHOT_FIELD_UUID
+                                                || field == SNAPSHOT_FIELD_NAME);
+        if (fields[field] == NULL)
+        {
+            return -1;
+        }
+    }
+
+    memset(device_entry, 0, sizeof(database_entry_t));
+
+    // name is the only field that can be changed later
+    device_entry->name = strdup(fields[SNAPSHOT_FIELD_NAME]);
+    if (device_entry->name == NULL)
+    {
+        return -1;
+    }
+
+    device_entry->mapped = true;
+    device_entry->mode = record->mode;
+    device_entry->uuid = (char *)fields[SNAPSHOT_FIELD_UUID];
+    if (record->fields[SNAPSHOT_FIELD_PUBLIC_KEY].length > 0)
+    {
+        device_entry->public_key = (uint8_t *)fields[SNAPSHOT_FIELD_PUBLIC_KEY];
+        device_entry->public_key_len = record->fields[SNAPSHOT_FIELD_PUBLIC_KEY].length;
+    }
+    if (record->fields[SNAPSHOT_FIELD_SECRET_KEY].length > 0)
+    {
+        device_entry->secret_key = (uint8_t *)fields[SNAPSHOT_FIELD_SECRET_KEY];
+        device_entry->secret_key_len = record->fields[SNAPSHOT_FIELD_SECRET_KEY].length;
+    }
+    if (record->fields[SNAPSHOT_FIELD_SERIAL].length > 0)
+    {
+        device_entry->serial = (uint8_t *)fields[SNAPSHOT_FIELD_SERIAL];
+        device_entry->serial_len = record->fields[SNAPSHOT_FIELD_SERIAL].length;
+    }
+
+    return 0;
+}
+
+static void database_snapshot_put_field(snapshot_field_t *field, uint8_t *arena,
+                                        size_t *arena_size, const void *value, size_t length,
+                                        bool string)
+{
+    field->offset = *arena_size;
+    field->length = length;
+
+    if (length > 0)
+    {
+        memcpy(arena + *arena_size, value, length);
+    }
+    *arena_size += length;
+
+    if (string)
+    {
+        arena[(*arena_size)++] = '\0';
+    }
+}
+
+int database_snapshot_serialize(linked_list_t *device_list, void **data, size_t *length)
+{
+    linked_list_entry_t *list_entry;
+    database_entry_t *device_entry;
+    snapshot_header_t *header;
+    snapshot_record_t *record;
+    uint8_t *buffer, *arena;
+    size_t record_count = 0, arena_size = 0;
+
+    // sizes are counted first, so that content is built in a single buffer
+    for (list_entry = device_list->head; list_entry != NULL; list_entry = list_entry->next)
+    {
+        device_entry = (database_entry_t *)list_entry->data;
+
+        record_count++;
+        arena_size += strlen(device_entry->uuid) + 1
+                      + strlen(device_entry->name) + 1
+                      + device_entry->public_key_len
+                      + device_entry->secret_key_len
+                      + device_entry->serial_len;
+    }
+
+    *length = sizeof(snapshot_header_t) + record_count * sizeof(snapshot_record_t) + arena_size;
+    buffer = calloc(1, *length);
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+
+    header = (snapshot_header_t *)buffer;
+    memcpy(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    header->version = SNAPSHOT_VERSION;
+    header->byte_order = SNAPSHOT_BYTE_ORDER;
+    header->record_count = record_count;
+    header->arena_size = arena_size;
+
+    record = (snapshot_record_t *)(header + 1);
+    arena = (uint8_t *)(record + record_count);
+    arena_size = 0;
+
+    for (list_entry = device_list->head; list_entry != NULL; list_entry = list_entry->next)
+    {
+        device_entry = (database_entry_t *)list_entry->data;
+
+        record->mode = device_entry->mode;
+        database_snapshot_put_field(&record->fields[SNAPSHOT_FIELD_UUID], arena, &arena_size,
+                                    device_entry->uuid, strlen(device_entry->uuid), true);
+        database_snapshot_put_field(&record->fields[SNAPSHOT_FIELD_NAME], arena, &arena_size,
+                                    device_entry->name, strlen(device_entry->name), true);
+        database_snapshot_put_field(&record->fields[SNAPSHOT_FIELD_PUBLIC_KEY], arena, &arena_size,
+                                    device_entry->public_key, device_entry->public_key_len, false);
+        database_snapshot_put_field(&record->fields[SNAPSHOT_FIELD_SECRET_KEY], arena, &arena_size,
+                                    device_entry->secret_key, device_entry->secret_key_len, false);
+        database_snapshot_put_field(&record->fields[SNAPSHOT_FIELD_SERIAL], arena, &arena_size,
+                                    device_entry->serial, device_entry->serial_len, false);
+        record++;
+    }
+
+    *data = buffer;
+
+    return 0;
+}
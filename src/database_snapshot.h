@@ -0,0 +1,101 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DATABASE_SNAPSHOT_H
+#define DATABASE_SNAPSHOT_H
+
+#include <stddef.h>
+
+#include "linked_list.h"
+#include "rest/rest_utils.h"
+
+/*
+ * Binary database file. It consists of a header, an array of fixed size
+ * device records and an arena holding device strings and keys, which are
+ * referenced by records with offsets. Strings in the arena are null
+ * terminated.
+ *
+ * File is mapped into memory read only, entries read from it point into the
+ * mapping and stay valid until the snapshot is closed, even if the file is
+ * replaced meanwhile.
+ */
+typedef struct database_snapshot_t database_snapshot_t;
+
+/*
+ * Maps a binary database file
+ *
+ * Parameters:
+ *      file - database file path,
+ *      snapshot - pointer to snapshot, is set after return
+ *
+ * Returns:
+ *      0 on success,
+ *      1 if file does not exist or is not a binary database file,
+ *      negative value on error
+ */
+int database_snapshot_open(const char *file, database_snapshot_t **snapshot);
+
+/*
+ * Unmaps binary database file
+ *
+ * Parameters:
+ *      snapshot - snapshot pointer
+ */
+void database_snapshot_close(database_snapshot_t *snapshot);
+
+/*
+ * Parameters:
+ *      snapshot - snapshot pointer
+ *
+ * Returns:
+ *      number of device records
+ */
+size_t database_snapshot_size(database_snapshot_t *snapshot);
+
+/*
+ * Fills device entry from a snapshot record. Uuid and credentials of the
+ * entry point into the snapshot, name is allocated.
+ *
+ * Parameters:
+ *      snapshot - snapshot pointer,
+ *      index - record index,
+ *      device_entry - entry to fill
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value if record is damaged
+ */
+int database_snapshot_get_entry(database_snapshot_t *snapshot, size_t index,
+                                database_entry_t *device_entry);
+
+/*
+ * Serializes device list into binary database file content
+ *
+ * Parameters:
+ *      device_list - list of database_entry_t,
+ *      data - pointer to allocated content, is set after return,
+ *      length - pointer to content length, is set after return
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int database_snapshot_serialize(linked_list_t *device_list, void **data, size_t *length);
+
+#endif // DATABASE_SNAPSHOT_H
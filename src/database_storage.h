@@ -0,0 +1,119 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DATABASE_STORAGE_H
+#define DATABASE_STORAGE_H
+
+#include <stddef.h>
+
+#include "rest/rest_utils.h"
+
+/*
+ * Device database storage API. Storage keeps devices of the registry
+ * persistent, registry itself is always held in memory. Storage
+ * implementation depends on coap.database_storage setting:
+ *
+ *      For database file with a journal call database_file_storage_init()
+ *
+ *      For LMDB environment call database_lmdb_storage_init()
+ *
+ * All API initialization functions return a database_storage_t pointer that
+ * needs to be provided to all API functions as the first parameter. Storage
+ * functions are not thread safe, calls must be serialized by caller.
+ */
+
+/*
+ * Adds stored devices to the registry
+ *
+ * Parameters:
+ *      context - storage context pointer,
+ *      device_database - empty device registry
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+typedef int (*f_storage_load_t)(void *context, device_database_t *device_database);
+
+/*
+ * Stores devices added to the registry, all of them or none
+ *
+ * Parameters:
+ *      context - storage context pointer,
+ *      device_database - device registry,
+ *      device_entries - added entries,
+ *      count - number of added entries
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+typedef int (*f_storage_add_t)(void *context, device_database_t *device_database,
+                               database_entry_t **device_entries, size_t count);
+
+/*
+ * Stores new name of a registered device
+ *
+ * Parameters:
+ *      context - storage context pointer,
+ *      device_database - device registry,
+ *      device_entry - renamed entry
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+typedef int (*f_storage_rename_t)(void *context, device_database_t *device_database,
+                                  database_entry_t *device_entry);
+
+/*
+ * Removes device from storage, called before the entry is freed
+ *
+ * Parameters:
+ *      context - storage context pointer,
+ *      device_database - device registry,
+ *      device_entry - removed entry
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+typedef int (*f_storage_remove_t)(void *context, device_database_t *device_database,
+                                  database_entry_t *device_entry);
+
+/*
+ * Flushes pending changes and frees storage context. Called while registry
+ * still holds all devices.
+ *
+ * Parameters:
+ *      context - storage context pointer,
+ *      device_database - device registry
+ */
+typedef void (*f_storage_close_t)(void *context, device_database_t *device_database);
+
+typedef struct database_storage_t
+{
+    f_storage_load_t    f_load;
+    f_storage_add_t     f_add;
+    f_storage_rename_t  f_rename;
+    f_storage_remove_t  f_remove;
+    f_storage_close_t   f_close;
+} database_storage_t;
+
+#endif // DATABASE_STORAGE_H
@@ -18,20 +18,82 @@
  */
 
 #include "dtls_connection_api.h"
+#include <errno.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <gnutls/dtls.h>
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
 #include "database.h"
-#include "linked_list.h"
+#include "dtls_session_cache.h"
+#include "egress_queue.h"
+#include "handshake_limiter.h"
+#include "hash_table.h"
+#include "sockaddr_key.h"
+#include "timer_wheel.h"
 
 #define BUFFER_SIZE 1024
+#define EGRESS_SIZE 1024
+#define DATAGRAM_SIZE 1500
+#define RECORD_HEADER_SIZE 13
+#define CONTENT_TYPE_HANDSHAKE 22
+#define CONTENT_TYPE_APPLICATION_DATA 23
+#define HANDSHAKE_HEADER_SIZE 12
+#define HANDSHAKE_TYPE_CLIENT_HELLO 1
+// major version of all DTLS versions
+#define DTLS_VERSION_MAJOR 0xfe
+// sessions of the same host a migrating record is tried against
+#define MIGRATION_CANDIDATES 8
+// migrating records per second tried from all hosts and from a single host
+#define MIGRATION_RATE 512
+#define MIGRATION_HOST_RATE 8
+#define CRYPTO_QUEUE_SIZE 256
+#define STATS_INTERVAL 300
+
+typedef struct _device_connection_t device_connection_t;
+typedef struct secure_connection_context_t secure_connection_context_t;
+
+typedef struct
+{
+    device_connection_t *conn;
+    // set by worker, as handshake records can still be queued once it's done
+    bool handshake;
+    int result;
+    size_t length;
+    // peer's public data, set by worker once handshake succeeds
+    void *public_data;
+    size_t public_data_size;
+    // received datagram, replaced by decrypted application data
+    uint8_t data[DATAGRAM_SIZE];
+} dtls_crypto_job_t;
 
-typedef struct _device_connection_t
+/*
+ * Single producer, single consumer job ring. Jobs are submitted at 'head' by
+ * the main thread, completed at 'done' by the worker and released at 'tail'
+ * by the main thread once their results are consumed.
+ */
+typedef struct
+{
+    pthread_t thread;
+    secure_connection_context_t *context;
+    int event_fd;
+    atomic_size_t head;
+    atomic_size_t done;
+    size_t tail;
+    // results handed out, but still in use until the next receive
+    size_t consumed;
+    dtls_crypto_job_t jobs[CRYPTO_QUEUE_SIZE];
+} dtls_crypto_worker_t;
+
+struct _device_connection_t
 {
     int sock;
     gnutls_session_t session;
@@ -39,17 +101,56 @@ typedef struct _device_connection_t
     socklen_t addr_size;
     void *device_identifier;
     bool handshake_done;
-} device_connection_t;
-
-typedef struct secure_connection_context_t
+    egress_queue_t *egress;
+    egress_bucket_t bucket;
+    sockaddr_key_t key;
+    timer_wheel_timer_t idle_timer;
+    time_t last_activity;
+    // connections of the same host, i.e. with same address but any port
+    device_connection_t *host_prev;
+    device_connection_t *host_next;
+    // datagram to be read by gnutls, NULL once it's read
+    const uint8_t *pull_data;
+    size_t pull_length;
+    // connection is owned by this worker's thread while it has pending jobs
+    dtls_crypto_worker_t *worker;
+    unsigned int pending_jobs;
+    bool closing;
+    // handshake state as seen by crypto worker
+    bool worker_handshake_done;
+};
+
+struct secure_connection_context_t
 {
     connection_api_t api;
-    linked_list_t *connection_list;
+    // device_connection_t entries keyed by sockaddr_key_t
+    hash_table_t *connection_table;
+    // device_connection_t lists keyed by sockaddr_key_t with zero port
+    hash_table_t *host_table;
+    unsigned long migrated_count;
+    handshake_limiter_settings_t handshake_limits;
+    handshake_limiter_t *limiter;
+    handshake_limiter_t *migration_limiter;
+    size_t half_open_count;
+    unsigned long junk_count;
     device_connection_t *conn_listen;
     int port;
     int address_family;
     const char *certificate_file;
     const char *private_key_file;
+    egress_pacing_settings_t pacing;
+    egress_queue_t *egress;
+    timer_wheel_t *idle_wheel;
+    uint32_t idle_timeout;
+    uint32_t handshake_timeout;
+    unsigned long reaped_count;
+    uint32_t session_cache_size;
+    uint32_t session_lifetime;
+    bool session_tickets;
+    dtls_session_cache_t *session_cache;
+    gnutls_datum_t ticket_key;
+    time_t ticket_key_time;
+    time_t stats_time;
     gnutls_certificate_credentials_t server_cert;
     gnutls_priority_t priority_cache;
     gnutls_datum_t cookie_key;
@@ -57,7 +158,17 @@ typedef struct secure_connection_context_t
     void *data;
     f_psk_cb_t psk_cb;
     f_handshake_done_cb_t handshake_done_cb;
-} secure_connection_context_t;
+    uint32_t crypto_workers_count;
+    dtls_crypto_worker_t *crypto_workers;
+    unsigned int next_worker;
+    atomic_bool crypto_running;
+    // signalled by workers once jobs are done
+    int result_fd;
+    // socket and result_fd, returned to the event loop instead of the socket
+    int poll_fd;
+    uint8_t datagram[DATAGRAM_SIZE];
+    uint8_t migrated[DATAGRAM_SIZE];
+};
 
 static int dtls_connection_start(void *context_p);
 static int dtls_connection_receive(void *context_p, uint8_t *buffer, size_t size,
@@ -65,7 +176,14 @@ static int dtls_connection_receive(void *context_p, uint8_t *buffer, size_t size
                                    struct timeval *tv);
 static int dtls_connection_send(void *context_p, session_t connection, uint8_t *buffer,
                                 size_t length);
+static int dtls_connection_receive_batch(void *context_p, connection_packet_t *packets,
+                                         size_t count);
 static int dtls_connection_close(void *context_p, session_t connection);
+static int dtls_connection_free(secure_connection_context_t *context, device_connection_t *conn);
+static int dtls_crypto_start(secure_connection_context_t *context);
+static void dtls_crypto_stop(secure_connection_context_t *context);
+static int dtls_connection_flush(void *context_p);
+static int dtls_connection_reap(void *context_p, f_session_in_use_cb_t in_use_cb, void *data);
 static int dtls_connection_stop(void *context_p);
 
 static credentials_mode_t get_session_ciphersuite(gnutls_session_t session)
@@ -119,31 +237,42 @@ static int dtls_connection_set_identifier(session_t connection, void *identifier
     return 0;
 }
 
-static int dtls_connection_handshake_done(device_connection_t *conn,
-                                          credentials_mode_t ciphersuite)
+/*
+ * Copies peer's public data, i.e. PSK identity or PEM encoded certificate,
+ * to a newly allocated buffer, that is later used to find device identifier
+ */
+static int dtls_connection_get_public_data(gnutls_session_t session, void **public_data,
+                                           size_t *public_data_size)
 {
-    void *public_data;
+    credentials_mode_t ciphersuite;
+    const char *psk_identity;
     gnutls_x509_crt_t cert;
     const gnutls_datum_t *cert_list;
-    size_t public_data_size = 0;
-    secure_connection_context_t *context;
-    int ret;
+    size_t size = 0;
+    void *data;
 
-    context = gnutls_session_get_ptr(conn->session);
+    ciphersuite = get_session_ciphersuite(session);
 
     if (ciphersuite == DEVICE_CREDENTIALS_PSK)
     {
-        public_data = (void *)gnutls_psk_server_get_username(conn->session);
-        if (public_data == NULL)
+        psk_identity = gnutls_psk_server_get_username(session);
+        if (psk_identity == NULL)
+        {
+            return -1;
+        }
+
+        size = strlen(psk_identity);
+        data = malloc(size + 1);
+        if (data == NULL)
         {
             return -1;
         }
 
-        public_data_size = strlen(public_data);
+        memcpy(data, psk_identity, size + 1);
     }
     else if (ciphersuite == DEVICE_CREDENTIALS_CERT)
     {
-        cert_list = gnutls_certificate_get_peers(conn->session, NULL);
+        cert_list = gnutls_certificate_get_peers(session, NULL);
         if (cert_list == NULL)
         {
             return -1;
@@ -158,17 +287,17 @@ static int dtls_connection_handshake_done(device_connection_t *conn,
             return -1;
         }
 
-        gnutls_x509_crt_export(cert, GNUTLS_X509_FMT_PEM, NULL, &public_data_size);
+        gnutls_x509_crt_export(cert, GNUTLS_X509_FMT_PEM, NULL, &size);
 
-        public_data = malloc(public_data_size);
-        if (public_data == NULL)
+        data = malloc(size);
+        if (data == NULL)
         {
             gnutls_x509_crt_deinit(cert);
             return -1;
         }
-        if (gnutls_x509_crt_export(cert, GNUTLS_X509_FMT_PEM, public_data, &public_data_size))
+        if (gnutls_x509_crt_export(cert, GNUTLS_X509_FMT_PEM, data, &size))
         {
-            free(public_data);
+            free(data);
             gnutls_x509_crt_deinit(cert);
             return -1;
         }
@@ -180,15 +309,26 @@ static int dtls_connection_handshake_done(device_connection_t *conn,
         return -1;
     }
 
+    *public_data = data;
+    *public_data_size = size;
+
+    return 0;
+}
+
+static int dtls_connection_handshake_done(secure_connection_context_t *context,
+                                          device_connection_t *conn, void *public_data,
+                                          size_t public_data_size)
+{
+    int ret;
+
     ret = context->handshake_done_cb(conn, public_data, public_data_size, context->data);
 
-    if (ciphersuite == DEVICE_CREDENTIALS_CERT)
+    if (conn->handshake_done == false)
     {
-        free(public_data);
+        conn->handshake_done = true;
+        context->half_open_count--;
     }
 
-    conn->handshake_done = true;
-
     return ret;
 }
 
@@ -196,76 +336,49 @@ static ssize_t dtls_connection_net_send(gnutls_transport_ptr_t context, const vo
                                         size_t size)
 {
     device_connection_t *conn = (device_connection_t *)context;
+    egress_bucket_t *bucket;
+
+    // listening connection answers unknown peers, they are paced only globally
+    bucket = (conn->session != NULL) ? &conn->bucket : NULL;
+
+    if (egress_queue_push(conn->egress, bucket, (struct sockaddr *)&conn->addr, conn->addr_size,
+                          data, size) != 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
 
-    return sendto(conn->sock, data, size, 0, (struct sockaddr *)&conn->addr, conn->addr_size);
+    return size;
 }
 
+/*
+ * Datagrams are read once by the receiving code, which then points the
+ * connection at it, so gnutls never reads the socket itself
+ */
 static ssize_t dtls_connection_net_recv(gnutls_transport_ptr_t context, void *data, size_t size)
 {
     device_connection_t *conn = (device_connection_t *)context;
-    int ret;
-    struct sockaddr addr;
-    socklen_t addr_size;
-
-    addr_size = sizeof(addr);
-    ret = recvfrom(conn->sock, data, size, 0, &addr, &addr_size);
-    if (ret < 0)
-    {
-        return ret;
-    }
+    size_t length;
 
-    if (addr_size == conn->addr_size
-        && memcmp(&addr, &conn->addr, sizeof(addr)) == 0)
+    if (conn->pull_data == NULL)
     {
-        return ret;
+        gnutls_transport_set_errno(conn->session, EAGAIN);
+        return -1;
     }
 
-    gnutls_transport_set_errno(conn->session, EAGAIN);
+    // datagram is truncated like recvfrom() would do
+    length = (conn->pull_length < size) ? conn->pull_length : size;
+    memcpy(data, conn->pull_data, length);
+    conn->pull_data = NULL;
 
-    return -1;
+    return length;
 }
 
 static int dtls_connection_net_recv_timeout(gnutls_transport_ptr_t context, unsigned int ms)
 {
     device_connection_t *conn = (device_connection_t *)context;
-    struct timeval tv;
-    fd_set fd;
-    int ret;
-    uint8_t buffer[1024];
-    size_t buffer_length;
-    struct sockaddr addr;
-    socklen_t addr_size;
-
-    tv.tv_sec = ms / 1000;
-    tv.tv_usec = (ms % 1000) * 1000;
-
-    FD_ZERO(&fd);
-    FD_SET(conn->sock, &fd);
-
-    ret = select(conn->sock + 1, &fd, NULL, NULL, &tv);
-    if (ret <= 0)
-    {
-        return ret;
-    }
-
-    buffer_length = sizeof(buffer);
-    addr_size = sizeof(addr);
-
-    ret = recvfrom(conn->sock, buffer, buffer_length, MSG_PEEK, &addr, &addr_size);
-    if (ret < 0)
-    {
-        return ret;
-    }
-
-    if (addr_size == conn->addr_size
-        && memcmp(&addr, &conn->addr, sizeof(addr)) == 0)
-    {
-        return ret;
-    }
 
-    gnutls_transport_set_errno(conn->session, EAGAIN);
-
-    return -1;
+    return (conn->pull_data != NULL) ? 1 : 0;
 }
 
 static int dtls_connection_new_socket(secure_connection_context_t *context)
@@ -360,6 +473,17 @@ static int dtls_connection_init(secure_connection_context_t *context,
 
     gnutls_session_set_ptr(connection->session, context);
 
+    if (context->session_cache != NULL)
+    {
+        dtls_session_cache_attach(context->session_cache, connection->session,
+                                  context->session_lifetime);
+    }
+    if (context->session_tickets
+        && gnutls_session_ticket_enable_server(connection->session, &context->ticket_key))
+    {
+        goto exit;
+    }
+
     ret = 0;
 exit:
     if (ret)
@@ -383,14 +507,8 @@ static int dtls_connection_psk_callback(gnutls_session_t session, const char *na
         return -1;
     }
 
-    key->data = malloc(psk_len);
-    if (key->data == NULL)
-    {
-        return -1;
-    }
-
+    key->data = psk_buff;
     key->size = psk_len;
-    memcpy(key->data, psk_buff, psk_len);
 
     return 0;
 }
@@ -415,9 +533,7 @@ static device_connection_t *dtls_connection_new_listen(secure_connection_context
     return conn;
 }
 
-connection_api_t *dtls_connection_api_init(int port, int address_family,
-                                           const char *certificate_file,
-                                           const char *private_key_file,
+connection_api_t *dtls_connection_api_init(const coap_settings_t *settings, int address_family,
                                            void *data, f_psk_cb_t psk_cb,
                                            f_handshake_done_cb_t handshake_done_cb)
 {
@@ -428,18 +544,32 @@ connection_api_t *dtls_connection_api_init(int port, int address_family,
         return NULL;
     }
 
-    context->port = port;
+    context->port = settings->port;
     context->address_family = address_family;
-    context->certificate_file = certificate_file;
-    context->private_key_file = private_key_file;
+    context->certificate_file = settings->certificate_file;
+    context->private_key_file = settings->private_key_file;
+    context->pacing = settings->pacing;
+    context->idle_timeout = settings->idle_timeout;
+    context->handshake_timeout = settings->handshake_timeout;
+    context->session_cache_size = settings->session_cache_size;
+    context->session_lifetime = settings->session_lifetime;
+    context->session_tickets = settings->session_tickets;
+    context->crypto_workers_count = settings->crypto_workers;
+    context->handshake_limits = settings->handshake_limits;
+    context->result_fd = -1;
+    context->poll_fd = -1;
     context->data = data;
     context->psk_cb = psk_cb;
     context->handshake_done_cb = handshake_done_cb;
 
     context->api.f_start = dtls_connection_start;
     context->api.f_receive = dtls_connection_receive;
+    context->api.f_receive_batch = (context->crypto_workers_count > 0)
+                                   ? dtls_connection_receive_batch : NULL;
     context->api.f_send = dtls_connection_send;
     context->api.f_close = dtls_connection_close;
+    context->api.f_flush = dtls_connection_flush;
+    context->api.f_reap = dtls_connection_reap;
     context->api.f_stop = dtls_connection_stop;
     context->api.f_get_identifier = dtls_connection_get_identifier;
     context->api.f_set_identifier = dtls_connection_set_identifier;
@@ -457,6 +587,12 @@ void dtls_connection_api_deinit(void *context_p)
 static int dtls_connection_start(void *context_p)
 {
     secure_connection_context_t *context = (secure_connection_context_t *)context_p;
+    const handshake_limiter_settings_t migration_limits =
+    {
+        .rate = MIGRATION_RATE,
+        .host_rate = MIGRATION_HOST_RATE,
+        .half_open = 0,
+    };
     int ret = -1;
 
     if (gnutls_global_init())
@@ -496,23 +632,74 @@ static int dtls_connection_start(void *context_p)
     {
         goto exit;
     }
+    if (context->session_tickets
+        && gnutls_session_ticket_key_generate(&context->ticket_key) != GNUTLS_E_SUCCESS)
+    {
+        goto exit;
+    }
+    if (context->session_cache_size > 0)
+    {
+        context->session_cache = dtls_session_cache_new(context->session_cache_size);
+        if (context->session_cache == NULL)
+        {
+            goto exit;
+        }
+    }
 
-    context->connection_list = linked_list_new();
-    if (context->connection_list == NULL)
+    context->connection_table = hash_table_new();
+    context->host_table = hash_table_new();
+    if (context->connection_table == NULL || context->host_table == NULL)
     {
+        hash_table_delete(context->connection_table);
+        hash_table_delete(context->host_table);
         goto exit;
     }
 
     context->conn_listen = dtls_connection_new_listen(context);
     if (context->conn_listen == NULL)
     {
-        linked_list_delete(context->connection_list);
+        hash_table_delete(context->connection_table);
+        hash_table_delete(context->host_table);
+        goto exit;
+    }
+
+    context->egress = egress_queue_new(context->conn_listen->sock, EGRESS_SIZE, &context->pacing);
+    context->idle_wheel = timer_wheel_new(timer_wheel_now());
+    context->ticket_key_time = timer_wheel_now();
+    context->stats_time = context->ticket_key_time;
+    context->limiter = handshake_limiter_new(&context->handshake_limits);
+    context->migration_limiter = handshake_limiter_new(&migration_limits);
+    if (context->egress == NULL || context->idle_wheel == NULL || context->limiter == NULL
+        || context->migration_limiter == NULL)
+    {
+        egress_queue_delete(context->egress);
+        timer_wheel_delete(context->idle_wheel);
+        handshake_limiter_delete(context->limiter);
+        handshake_limiter_delete(context->migration_limiter);
+        hash_table_delete(context->connection_table);
+        hash_table_delete(context->host_table);
+        close(context->conn_listen->sock);
+        free(context->conn_listen);
+        goto exit;
+    }
+    context->conn_listen->egress = context->egress;
+
+    if (context->crypto_workers_count > 0 && dtls_crypto_start(context))
+    {
+        egress_queue_delete(context->egress);
+        timer_wheel_delete(context->idle_wheel);
+        handshake_limiter_delete(context->limiter);
+        handshake_limiter_delete(context->migration_limiter);
+        hash_table_delete(context->connection_table);
+        hash_table_delete(context->host_table);
+        close(context->conn_listen->sock);
+        free(context->conn_listen);
         goto exit;
     }
 
     gnutls_psk_set_server_credentials_function(context->server_psk, dtls_connection_psk_callback);
 
-    ret = context->conn_listen->sock;
+    ret = (context->crypto_workers_count > 0) ? context->poll_fd : context->conn_listen->sock;
 
 exit:
     if (ret <= 0)
@@ -521,14 +708,91 @@ exit:
         gnutls_certificate_free_credentials(context->server_cert);
         gnutls_priority_deinit(context->priority_cache);
         gnutls_psk_free_server_credentials(context->server_psk);
+        gnutls_free(context->ticket_key.data);
+        dtls_session_cache_delete(context->session_cache);
+        context->session_cache = NULL;
     }
     return ret;
 }
 
+static uint32_t dtls_connection_timeout(secure_connection_context_t *context,
+                                        device_connection_t *conn)
+{
+    if (conn->handshake_done == false && context->handshake_timeout > 0)
+    {
+        return context->handshake_timeout;
+    }
+
+    return context->idle_timeout;
+}
+
+static void dtls_connection_host_key(const sockaddr_key_t *key, sockaddr_key_t *host_key)
+{
+    *host_key = *key;
+    host_key->port = 0;
+}
+
+static int dtls_connection_host_link(secure_connection_context_t *context,
+                                     device_connection_t *conn)
+{
+    sockaddr_key_t host_key;
+    device_connection_t *head;
+
+    dtls_connection_host_key(&conn->key, &host_key);
+    head = hash_table_get(context->host_table, &host_key, sizeof(host_key));
+
+    if (hash_table_put(context->host_table, &host_key, sizeof(host_key), conn))
+    {
+        return -1;
+    }
+
+    conn->host_prev = NULL;
+    conn->host_next = head;
+    if (head != NULL)
+    {
+        head->host_prev = conn;
+    }
+
+    return 0;
+}
+
+static void dtls_connection_host_unlink(secure_connection_context_t *context,
+                                        device_connection_t *conn)
+{
+    sockaddr_key_t host_key;
+
+    if (conn->host_prev != NULL)
+    {
+        conn->host_prev->host_next = conn->host_next;
+    }
+    else
+    {
+        dtls_connection_host_key(&conn->key, &host_key);
+        if (conn->host_next != NULL)
+        {
+            // replaces existing entry, can't fail
+            hash_table_put(context->host_table, &host_key, sizeof(host_key), conn->host_next);
+        }
+        else
+        {
+            hash_table_remove(context->host_table, &host_key, sizeof(host_key));
+        }
+    }
+
+    if (conn->host_next != NULL)
+    {
+        conn->host_next->host_prev = conn->host_prev;
+    }
+
+    conn->host_prev = NULL;
+    conn->host_next = NULL;
+}
+
 static device_connection_t *dtls_connection_new_incoming(secure_connection_context_t *context,
                                                          gnutls_dtls_prestate_st *prestate)
 {
     device_connection_t *conn;
+    uint32_t timeout;
 
     conn = calloc(1, sizeof(device_connection_t));
     if (conn == NULL)
@@ -540,6 +804,20 @@ static device_connection_t *dtls_connection_new_incoming(secure_connection_conte
     memcpy(&conn->addr, &context->conn_listen->addr, sizeof(struct sockaddr_storage));
     memcpy(&conn->addr_size, &context->conn_listen->addr_size, sizeof(socklen_t));
     conn->handshake_done = false;
+    conn->egress = context->egress;
+
+    if (context->crypto_workers_count > 0)
+    {
+        // sessions stay with the worker they were given to
+        conn->worker = &context->crypto_workers[context->next_worker++
+                                                % context->crypto_workers_count];
+    }
+
+    if (sockaddr_key_init(&conn->key, (struct sockaddr *)&conn->addr, conn->addr_size))
+    {
+        free(conn);
+        return NULL;
+    }
 
     if (dtls_connection_init(context, conn, prestate))
     {
@@ -547,214 +825,944 @@ static device_connection_t *dtls_connection_new_incoming(secure_connection_conte
         return NULL;
     }
 
+    if (hash_table_put(context->connection_table, &conn->key, sizeof(conn->key), conn))
+    {
+        gnutls_deinit(conn->session);
+        free(conn);
+        return NULL;
+    }
+
+    if (dtls_connection_host_link(context, conn))
+    {
+        hash_table_remove(context->connection_table, &conn->key, sizeof(conn->key));
+        gnutls_deinit(conn->session);
+        free(conn);
+        return NULL;
+    }
+
+    context->half_open_count++;
+
+    conn->last_activity = timer_wheel_now();
+    timeout = dtls_connection_timeout(context, conn);
+    if (timeout > 0)
+    {
+        timer_wheel_schedule(context->idle_wheel, &conn->idle_timer, conn->last_activity + timeout);
+    }
+
     return conn;
 }
 
-static device_connection_t *dtls_connection_find(linked_list_t *connection_list,
+static device_connection_t *dtls_connection_find(hash_table_t *connection_table,
                                                  const struct sockaddr_storage *addr, const socklen_t addr_size)
 {
-    device_connection_t *conn;
-    linked_list_entry_t *conn_entry;
+    sockaddr_key_t key;
 
-    for (conn_entry = connection_list->head; conn_entry != NULL; conn_entry = conn_entry->next)
+    if (sockaddr_key_init(&key, (const struct sockaddr *)addr, addr_size))
     {
-        conn = (device_connection_t *)conn_entry->data;
-
-        if (conn->addr_size == addr_size
-            && memcmp(&conn->addr, addr, addr_size) == 0)
-        {
-            return conn;
-        }
+        return NULL;
     }
 
-    return NULL;
+    return hash_table_get(connection_table, &key, sizeof(key));
 }
 
-static int dtls_connection_receive(void *context_p, uint8_t *buffer, size_t size,
-                                   session_t *connection, struct timeval *tv)
+/*
+ * Admission control of a datagram from unknown peer. Only ClientHello can
+ * start a session, it must carry a valid cookie (HelloVerifyRequest is sent
+ * otherwise) and new session must fit into handshake limits. Everything is
+ * checked before any per peer state is allocated.
+ *
+ * Returns 0 if handshake with the peer can be started
+ */
+static int dtls_connection_admit(secure_connection_context_t *context, const uint8_t *datagram,
+                                 size_t length, gnutls_dtls_prestate_st *prestate)
 {
-    secure_connection_context_t *context = (secure_connection_context_t *)context_p;
-    fd_set read_fds;
-    int ret, sock;
-    device_connection_t *conn;
-    gnutls_dtls_prestate_st prestate;
-    credentials_mode_t ciphersuite;
-    const char *err_str;
-
-//  to reduce code redundancy
-    sock = context->conn_listen->sock;
-
-    FD_ZERO(&read_fds);
-    FD_SET(sock, &read_fds);
+    device_connection_t *listen = context->conn_listen;
+    sockaddr_key_t key;
+    int ret;
 
-    ret = select(sock + 1, &read_fds, NULL, NULL, tv);
-    if (ret <= 0)
+    if (length < RECORD_HEADER_SIZE + HANDSHAKE_HEADER_SIZE
+        || datagram[0] != CONTENT_TYPE_HANDSHAKE
+        || datagram[1] != DTLS_VERSION_MAJOR
+        || datagram[RECORD_HEADER_SIZE] != HANDSHAKE_TYPE_CLIENT_HELLO)
     {
-        return ret;
+        context->junk_count++;
+        return -1;
     }
 
-    if (FD_ISSET(sock, &read_fds))
+    // canonical address, as sockaddr_storage has unused trailing bytes
+    if (sockaddr_key_init(&key, (struct sockaddr *)&listen->addr, listen->addr_size))
     {
-        context->conn_listen->addr_size = sizeof(context->conn_listen->addr);
-
-        ret = recvfrom(sock, buffer, size, MSG_PEEK, (struct sockaddr *)&context->conn_listen->addr,
-                       &context->conn_listen->addr_size);
-        if (ret > 0)
-        {
-            conn = dtls_connection_find(context->connection_list, &context->conn_listen->addr,
-                                        context->conn_listen->addr_size);
-
-            if (conn == NULL)
-            {
-                memset(&prestate, 0, sizeof(gnutls_dtls_prestate_st));
+        return -1;
+    }
 
-                ret = gnutls_dtls_cookie_verify(&context->cookie_key, &context->conn_listen->addr,
-                                                sizeof(context->conn_listen->addr), buffer, ret, &prestate);
+    memset(prestate, 0, sizeof(gnutls_dtls_prestate_st));
 
-                if (ret == GNUTLS_E_BAD_COOKIE)
-                {
-                    gnutls_dtls_cookie_send(&context->cookie_key, &context->conn_listen->addr,
-                                            sizeof(context->conn_listen->addr), &prestate, context->conn_listen, dtls_connection_net_send);
-                    recvfrom(sock, buffer, size, 0, NULL, NULL);
-                }
-                else if (ret == GNUTLS_E_SUCCESS)
-                {
-                    conn = dtls_connection_new_incoming(context, &prestate);
-                    if (conn != NULL)
-                    {
-                        linked_list_add(context->connection_list, conn);
-                    }
-                    else
-                    {
-                        log_message(LOG_LEVEL_ERROR, "Failed to connect with new device\n");
-                    }
-                }
-                else
-                {
-                    recvfrom(sock, buffer, size, 0, NULL, NULL);
-                }
-            }
+    ret = gnutls_dtls_cookie_verify(&context->cookie_key, &key, sizeof(key), (void *)datagram,
+                                    length, prestate);
+    if (ret == GNUTLS_E_BAD_COOKIE)
+    {
+        gnutls_dtls_cookie_send(&context->cookie_key, &key, sizeof(key), prestate, listen,
+                                dtls_connection_net_send);
+        return -1;
+    }
+    else if (ret != GNUTLS_E_SUCCESS)
+    {
+        return -1;
+    }
 
-            if (conn != NULL)
-            {
-                if (conn->handshake_done == false)
-                {
-                    ret = gnutls_handshake(conn->session);
-
-                    //handshake continues until success
-                    if (ret == GNUTLS_E_SUCCESS)
-                    {
-                        ciphersuite = get_session_ciphersuite(conn->session);
-
-                        if (dtls_connection_handshake_done(conn, ciphersuite))
-                        {
-                            log_message(LOG_LEVEL_WARN, "Failed to store connection identifier\n");
-                            dtls_connection_close(context, conn);
-                        }
-
-                        return 0;
-                    }
-                    else if (ret != GNUTLS_E_AGAIN)
-                    {
-                        err_str = gnutls_strerror(ret);
-                        log_message(LOG_LEVEL_WARN, "Handshake failed with message: '%s'\n", err_str);
-
-                        dtls_connection_close(context, conn);
-                        return 0;
-                    }
-                }
-                else
-                {
-                    conn->addr_size = sizeof(conn->addr);
-
-                    do
-                    {
-                        ret = recvfrom(conn->sock, buffer, size, MSG_PEEK, (struct sockaddr *)&conn->addr,
-                                       &conn->addr_size);
-                        ret = gnutls_record_recv(conn->session, buffer, ret);
-                    } while (ret == GNUTLS_E_AGAIN);
-
-                    if (ret < 0)
-                    {
-                        dtls_connection_close(context, conn);
-                        ret = 0;
-                    }
-                    else
-                    {
-                        *connection = conn;
-                    }
-
-                    return ret;
-                }
-            }
-        }
+    // cookie proves that the peer owns its address, so it can be rate limited
+    if (!handshake_limiter_admit(context->limiter, &key, context->half_open_count))
+    {
+        log_message(LOG_LEVEL_DEBUG, "New DTLS session refused by handshake limits\n");
+        return -1;
     }
 
     return 0;
 }
 
-static int dtls_connection_close(void *context_p, session_t connection)
+/*
+ * Peer address changes when NAT rebinds a device's port. Record from an
+ * unknown address is tried against established sessions of the same host,
+ * and the session follows the new address only once the record is
+ * authenticated (and passes replay protection) by that session.
+ *
+ * GnuTLS has no DTLS connection IDs to demultiplex records by, so this is a
+ * best effort. Only the newest sessions of the host are tried, so behind a
+ * large NAT (e.g. CGNAT) a rebound device may not be found and has to
+ * handshake again. Every record costs up to MIGRATION_CANDIDATES decryption
+ * attempts, so attempts are rate limited per source host.
+ */
+static int dtls_connection_migrate(secure_connection_context_t *context, const uint8_t *record,
+                                   size_t record_length, uint8_t *buffer, size_t size,
+                                   device_connection_t **migrated)
 {
-    secure_connection_context_t *context = (secure_connection_context_t *)context_p;
-    device_connection_t *conn = (device_connection_t *)connection;
-    int ret;
+    device_connection_t *listen = context->conn_listen;
+    device_connection_t *conn;
+    sockaddr_key_t key, host_key;
+    int candidates, ret;
 
-    if (conn == NULL)
+    if (sockaddr_key_init(&key, (struct sockaddr *)&listen->addr, listen->addr_size))
     {
         return 0;
     }
+    dtls_connection_host_key(&key, &host_key);
 
-    linked_list_remove(context->connection_list, conn);
+    conn = hash_table_get(context->host_table, &host_key, sizeof(host_key));
+    if (conn == NULL || !handshake_limiter_admit(context->migration_limiter, &key, 0))
+    {
+        return 0;
+    }
 
-    if (conn->session)
+    for (candidates = 0; conn != NULL && candidates < MIGRATION_CANDIDATES;
+         conn = conn->host_next)
     {
-        do
+        // session busy in a crypto worker can't be touched
+        if (conn->handshake_done == false || conn->pending_jobs > 0)
         {
-            ret = gnutls_bye(conn->session, GNUTLS_SHUT_WR);
-        } while (ret == GNUTLS_E_AGAIN);
+            continue;
+        }
+        candidates++;
 
-        if (ret != GNUTLS_E_SUCCESS)
+        conn->pull_data = record;
+        conn->pull_length = record_length;
+
+        // records failing authentication are discarded without harming the session
+        ret = gnutls_record_recv(conn->session, buffer, size);
+
+        conn->pull_data = NULL;
+
+        if (ret <= 0)
         {
-            return -1;
+            continue;
         }
-        gnutls_deinit(conn->session);
-    }
 
-    free(conn);
-    return 0;
-}
+        hash_table_remove(context->connection_table, &conn->key, sizeof(conn->key));
+        memcpy(&conn->addr, &listen->addr, listen->addr_size);
+        conn->addr_size = listen->addr_size;
+        conn->key = key;
 
-static int dtls_connection_send(void *context_p, session_t connection, uint8_t *buffer,
-                                size_t length)
-{
-    device_connection_t *conn = (device_connection_t *)connection;
+        if (hash_table_put(context->connection_table, &conn->key, sizeof(conn->key), conn))
+        {
+            dtls_connection_close(context, conn);
+            return 0;
+        }
 
-    return gnutls_record_send(conn->session, buffer, length);
+        context->migrated_count++;
+        log_message(LOG_LEVEL_INFO, "Secure peer changed address (%lu in total)\n",
+                    context->migrated_count);
+
+        *migrated = conn;
+        return ret;
+    }
+
+    return 0;
 }
 
-static int dtls_connection_stop(void *context_p)
+static int dtls_connection_receive(void *context_p, uint8_t *buffer, size_t size,
+                                   session_t *connection, struct timeval *tv)
 {
     secure_connection_context_t *context = (secure_connection_context_t *)context_p;
+    device_connection_t *listen = context->conn_listen;
+    fd_set read_fds;
+    int ret, length;
     device_connection_t *conn;
-    linked_list_entry_t *conn_entry, *conn_next;
-
-    for (conn_entry = context->connection_list->head; conn_entry != NULL; conn_entry = conn_next)
+    gnutls_dtls_prestate_st prestate;
+    void *public_data = NULL;
+    size_t public_data_size;
+    const char *err_str;
+
+    FD_ZERO(&read_fds);
+    FD_SET(listen->sock, &read_fds);
+
+    ret = select(listen->sock + 1, &read_fds, NULL, NULL, tv);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    listen->addr_size = sizeof(listen->addr);
+
+    // datagram is read only once, gnutls gets it from memory
+    length = recvfrom(listen->sock, context->datagram, sizeof(context->datagram), 0,
+                      (struct sockaddr *)&listen->addr, &listen->addr_size);
+    if (length <= 0)
+    {
+        return 0;
+    }
+
+    conn = dtls_connection_find(context->connection_table, &listen->addr, listen->addr_size);
+
+    if (conn == NULL && length >= RECORD_HEADER_SIZE
+        && context->datagram[0] == CONTENT_TYPE_APPLICATION_DATA)
+    {
+        // only handshake records can start a new session
+        ret = dtls_connection_migrate(context, context->datagram, length, buffer, size, &conn);
+        if (conn != NULL)
+        {
+            conn->last_activity = timer_wheel_now();
+            *connection = conn;
+        }
+
+        return ret;
+    }
+
+    if (conn == NULL)
     {
-        conn_next = conn_entry->next;
-        conn = (device_connection_t *)conn_entry->data;
+        if (dtls_connection_admit(context, context->datagram, length, &prestate))
+        {
+            return 0;
+        }
+
+        conn = dtls_connection_new_incoming(context, &prestate);
+        if (conn == NULL)
+        {
+            log_message(LOG_LEVEL_ERROR, "Failed to connect with new device\n");
+            return 0;
+        }
+    }
+
+    // idle timer is not touched, it checks last activity once it expires
+    conn->last_activity = timer_wheel_now();
+
+    conn->pull_data = context->datagram;
+    conn->pull_length = length;
+
+    if (conn->handshake_done == false)
+    {
+        ret = gnutls_handshake(conn->session);
+        conn->pull_data = NULL;
+
+        //handshake continues until success
+        if (ret == GNUTLS_E_SUCCESS)
+        {
+            log_message(LOG_LEVEL_DEBUG, "DTLS handshake done (%s)\n",
+                        gnutls_session_is_resumed(conn->session) ? "resumed" : "full");
+
+            if (dtls_connection_get_public_data(conn->session, &public_data, &public_data_size)
+                || dtls_connection_handshake_done(context, conn, public_data, public_data_size))
+            {
+                log_message(LOG_LEVEL_WARN, "Failed to store connection identifier\n");
+                dtls_connection_close(context, conn);
+            }
+            free(public_data);
+        }
+        else if (ret != GNUTLS_E_AGAIN)
+        {
+            err_str = gnutls_strerror(ret);
+            log_message(LOG_LEVEL_WARN, "Handshake failed with message: '%s'\n", err_str);
+
+            dtls_connection_close(context, conn);
+        }
+
+        return 0;
+    }
+
+    ret = gnutls_record_recv(conn->session, buffer, size);
+    conn->pull_data = NULL;
+
+    // record was discarded, e.g. a replayed or corrupted one
+    if (ret == GNUTLS_E_AGAIN)
+    {
+        return 0;
+    }
+
+    if (ret < 0)
+    {
+        dtls_connection_close(context, conn);
+        return 0;
+    }
+
+    *connection = conn;
+    return ret;
+}
+
+static void dtls_crypto_job_run(dtls_crypto_job_t *job)
+{
+    device_connection_t *conn = job->conn;
+
+    conn->pull_data = job->data;
+    conn->pull_length = job->length;
+
+    job->handshake = !conn->worker_handshake_done;
+    job->public_data = NULL;
+
+    if (job->handshake)
+    {
+        job->result = gnutls_handshake(conn->session);
+        if (job->result == GNUTLS_E_SUCCESS)
+        {
+            conn->worker_handshake_done = true;
+
+            if (dtls_connection_get_public_data(conn->session, &job->public_data,
+                                                &job->public_data_size))
+            {
+                job->public_data = NULL;
+            }
+        }
+    }
+    else
+    {
+        // record was already read, so data can be overwritten with its contents
+        job->result = gnutls_record_recv(conn->session, job->data, sizeof(job->data));
+    }
+
+    conn->pull_data = NULL;
+}
+
+static void *dtls_crypto_worker_thread(void *data)
+{
+    dtls_crypto_worker_t *worker = (dtls_crypto_worker_t *)data;
+    secure_connection_context_t *context = worker->context;
+    size_t done, head;
+    uint64_t events = 1;
+
+    for (;;)
+    {
+        done = atomic_load_explicit(&worker->done, memory_order_relaxed);
+        head = atomic_load_explicit(&worker->head, memory_order_acquire);
+
+        if (done == head)
+        {
+            // submitted jobs are finished before stopping
+            if (!atomic_load(&context->crypto_running))
+            {
+                break;
+            }
+
+            if (read(worker->event_fd, &events, sizeof(events)) < 0 && errno != EINTR)
+            {
+                log_message(LOG_LEVEL_FATAL, "DTLS crypto worker failed: %s\n", strerror(errno));
+                break;
+            }
+            continue;
+        }
+
+        dtls_crypto_job_run(&worker->jobs[done % CRYPTO_QUEUE_SIZE]);
+
+        atomic_store_explicit(&worker->done, done + 1, memory_order_release);
+
+        events = 1;
+        if (write(context->result_fd, &events, sizeof(events)) < 0)
+        {
+            log_message(LOG_LEVEL_ERROR, "Failed to signal DTLS crypto results\n");
+        }
+    }
+
+    return NULL;
+}
+
+static int dtls_crypto_submit(device_connection_t *conn, const uint8_t *data, size_t length)
+{
+    dtls_crypto_worker_t *worker = conn->worker;
+    dtls_crypto_job_t *job;
+    size_t head;
+    uint64_t events = 1;
+
+    head = atomic_load_explicit(&worker->head, memory_order_relaxed);
+    if (head - worker->tail >= CRYPTO_QUEUE_SIZE || length > sizeof(job->data))
+    {
+        return -1;
+    }
+
+    job = &worker->jobs[head % CRYPTO_QUEUE_SIZE];
+    job->conn = conn;
+    job->length = length;
+    memcpy(job->data, data, length);
+
+    conn->pending_jobs++;
+    atomic_store_explicit(&worker->head, head + 1, memory_order_release);
+
+    if (write(worker->event_fd, &events, sizeof(events)) < 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to wake DTLS crypto worker\n");
+    }
+
+    return 0;
+}
+
+/*
+ * Returns true if job result has to be handled, otherwise job
+ * belongs to a connection that was closed meanwhile
+ */
+static bool dtls_crypto_job_release(secure_connection_context_t *context, dtls_crypto_job_t *job)
+{
+    device_connection_t *conn = job->conn;
+
+    conn->pending_jobs--;
+    if (conn->closing == false)
+    {
+        return true;
+    }
+
+    free(job->public_data);
+    job->public_data = NULL;
+
+    if (conn->pending_jobs == 0 && dtls_connection_free(context, conn))
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to deinit session with client\n");
+    }
+
+    return false;
+}
+
+static int dtls_crypto_collect(secure_connection_context_t *context,
+                               connection_packet_t *packets, size_t count)
+{
+    dtls_crypto_worker_t *worker;
+    dtls_crypto_job_t *job;
+    device_connection_t *conn;
+    size_t done, received = 0;
+    uint64_t events = 1;
+    uint32_t i;
+
+    for (i = 0; i < context->crypto_workers_count && received < count; i++)
+    {
+        worker = &context->crypto_workers[i];
+        done = atomic_load_explicit(&worker->done, memory_order_acquire);
+
+        while (worker->tail + worker->consumed != done && received < count)
+        {
+            job = &worker->jobs[(worker->tail + worker->consumed) % CRYPTO_QUEUE_SIZE];
+            worker->consumed++;
+
+            if (dtls_crypto_job_release(context, job) == false)
+            {
+                continue;
+            }
+            conn = job->conn;
+
+            if (job->handshake && job->result == GNUTLS_E_SUCCESS)
+            {
+                log_message(LOG_LEVEL_DEBUG, "DTLS handshake done (%s)\n",
+                            gnutls_session_is_resumed(conn->session) ? "resumed" : "full");
+
+                if (job->public_data == NULL
+                    || dtls_connection_handshake_done(context, conn, job->public_data,
+                                                      job->public_data_size))
+                {
+                    log_message(LOG_LEVEL_WARN, "Failed to store connection identifier\n");
+                    dtls_connection_close(context, conn);
+                }
+
+                free(job->public_data);
+                job->public_data = NULL;
+            }
+            else if (job->handshake && job->result != GNUTLS_E_AGAIN)
+            {
+                log_message(LOG_LEVEL_WARN, "Handshake failed with message: '%s'\n",
+                            gnutls_strerror(job->result));
+                dtls_connection_close(context, conn);
+            }
+            else if (!job->handshake && job->result > 0)
+            {
+                packets[received].buffer = job->data;
+                packets[received].length = job->result;
+                packets[received].connection = conn;
+                received++;
+            }
+            else if (!job->handshake && job->result != GNUTLS_E_AGAIN)
+            {
+                dtls_connection_close(context, conn);
+            }
+        }
+    }
+
+    // result_fd was drained, so results left for the next call have to be signalled again
+    for (i = 0; i < context->crypto_workers_count; i++)
+    {
+        worker = &context->crypto_workers[i];
+        if (worker->tail + worker->consumed != atomic_load(&worker->done))
+        {
+            if (write(context->result_fd, &events, sizeof(events)) < 0)
+            {
+                log_message(LOG_LEVEL_ERROR, "Failed to signal DTLS crypto results\n");
+            }
+            break;
+        }
+    }
+
+    return received;
+}
+
+static void dtls_crypto_stop(secure_connection_context_t *context)
+{
+    dtls_crypto_worker_t *worker;
+    dtls_crypto_job_t *job;
+    uint64_t events = 1;
+    size_t done;
+    uint32_t i;
+
+    atomic_store(&context->crypto_running, false);
+
+    for (i = 0; i < context->crypto_workers_count; i++)
+    {
+        if (write(context->crypto_workers[i].event_fd, &events, sizeof(events)) < 0)
+        {
+            log_message(LOG_LEVEL_ERROR, "Failed to wake DTLS crypto worker\n");
+        }
+    }
+
+    for (i = 0; i < context->crypto_workers_count; i++)
+    {
+        worker = &context->crypto_workers[i];
+        pthread_join(worker->thread, NULL);
+
+        // workers finish submitted jobs, results left are dropped
+        done = atomic_load(&worker->done);
+        worker->tail += worker->consumed;
+        for (; worker->tail != done; worker->tail++)
+        {
+            job = &worker->jobs[worker->tail % CRYPTO_QUEUE_SIZE];
+            if (dtls_crypto_job_release(context, job))
+            {
+                free(job->public_data);
+            }
+        }
+
+        close(worker->event_fd);
+    }
+
+    free(context->crypto_workers);
+    context->crypto_workers = NULL;
+    context->crypto_workers_count = 0;
+
+    close(context->poll_fd);
+    close(context->result_fd);
+}
+
+static int dtls_crypto_start(secure_connection_context_t *context)
+{
+    dtls_crypto_worker_t *worker;
+    struct epoll_event event;
+    uint32_t count, i;
+
+    context->crypto_workers = calloc(context->crypto_workers_count, sizeof(dtls_crypto_worker_t));
+    if (context->crypto_workers == NULL)
+    {
+        return -1;
+    }
+
+    context->result_fd = eventfd(0, EFD_NONBLOCK);
+    context->poll_fd = epoll_create1(0);
+    if (context->result_fd < 0 || context->poll_fd < 0)
+    {
+        goto error;
+    }
 
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = context->conn_listen->sock;
+    if (epoll_ctl(context->poll_fd, EPOLL_CTL_ADD, context->conn_listen->sock, &event))
+    {
+        goto error;
+    }
+
+    event.data.fd = context->result_fd;
+    if (epoll_ctl(context->poll_fd, EPOLL_CTL_ADD, context->result_fd, &event))
+    {
+        goto error;
+    }
+
+    atomic_store(&context->crypto_running, true);
+
+    count = context->crypto_workers_count;
+    for (i = 0; i < count; i++)
+    {
+        worker = &context->crypto_workers[i];
+        worker->context = context;
+        atomic_init(&worker->head, 0);
+        atomic_init(&worker->done, 0);
+
+        worker->event_fd = eventfd(0, 0);
+        if (worker->event_fd < 0)
+        {
+            break;
+        }
+
+        if (pthread_create(&worker->thread, NULL, dtls_crypto_worker_thread, worker))
+        {
+            close(worker->event_fd);
+            break;
+        }
+    }
+
+    if (i < count)
+    {
+        // stop the workers that were started
+        context->crypto_workers_count = i;
+        dtls_crypto_stop(context);
+        return -1;
+    }
+
+    log_message(LOG_LEVEL_INFO, "Started %u DTLS crypto workers\n", count);
+
+    return 0;
+
+error:
+    if (context->poll_fd >= 0)
+    {
+        close(context->poll_fd);
+    }
+    if (context->result_fd >= 0)
+    {
+        close(context->result_fd);
+    }
+    free(context->crypto_workers);
+    context->crypto_workers = NULL;
+    return -1;
+}
+
+/*
+ * Receives datagrams in the main thread and hands them over to crypto workers.
+ * Handshakes and record decryption run in workers, results of previously
+ * submitted datagrams are returned.
+ */
+static int dtls_connection_receive_batch(void *context_p, connection_packet_t *packets,
+                                         size_t count)
+{
+    secure_connection_context_t *context = (secure_connection_context_t *)context_p;
+    device_connection_t *listen = context->conn_listen;
+    device_connection_t *conn;
+    gnutls_dtls_prestate_st prestate;
+    size_t received = 0, i;
+    uint64_t events;
+    uint32_t w;
+    int length, ret;
+
+    if (read(context->result_fd, &events, sizeof(events)) < 0 && errno != EAGAIN)
+    {
+        return -1;
+    }
+
+    // buffers returned by the previous call are not used anymore
+    for (w = 0; w < context->crypto_workers_count; w++)
+    {
+        context->crypto_workers[w].tail += context->crypto_workers[w].consumed;
+        context->crypto_workers[w].consumed = 0;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        listen->addr_size = sizeof(listen->addr);
+
+        length = recvfrom(listen->sock, context->datagram, sizeof(context->datagram),
+                          MSG_DONTWAIT, (struct sockaddr *)&listen->addr, &listen->addr_size);
+        if (length < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                log_message(LOG_LEVEL_ERROR, "Failed to receive datagram: %s\n", strerror(errno));
+            }
+            break;
+        }
+
+        conn = dtls_connection_find(context->connection_table, &listen->addr, listen->addr_size);
+
+        if (conn == NULL && length >= RECORD_HEADER_SIZE
+            && context->datagram[0] == CONTENT_TYPE_APPLICATION_DATA)
+        {
+            ret = dtls_connection_migrate(context, context->datagram, length, context->migrated,
+                                          sizeof(context->migrated), &conn);
+            if (conn != NULL)
+            {
+                conn->last_activity = timer_wheel_now();
+
+                packets[received].buffer = context->migrated;
+                packets[received].length = ret;
+                packets[received].connection = conn;
+                received++;
+
+                // migrated record buffer is in use until the next call
+                break;
+            }
+            continue;
+        }
+
+        if (conn == NULL)
+        {
+            if (dtls_connection_admit(context, context->datagram, length, &prestate))
+            {
+                continue;
+            }
+
+            conn = dtls_connection_new_incoming(context, &prestate);
+            if (conn == NULL)
+            {
+                log_message(LOG_LEVEL_ERROR, "Failed to connect with new device\n");
+                continue;
+            }
+        }
+
+        conn->last_activity = timer_wheel_now();
+
+        if (dtls_crypto_submit(conn, context->datagram, length))
+        {
+            log_message(LOG_LEVEL_DEBUG, "DTLS crypto queue is full, datagram dropped\n");
+        }
+    }
+
+    return received + dtls_crypto_collect(context, packets + received, count - received);
+}
+
+static int dtls_connection_close(void *context_p, session_t connection)
+{
+    secure_connection_context_t *context = (secure_connection_context_t *)context_p;
+    device_connection_t *conn = (device_connection_t *)connection;
+
+    if (conn == NULL || conn->closing)
+    {
+        return 0;
+    }
+
+    hash_table_remove(context->connection_table, &conn->key, sizeof(conn->key));
+    dtls_connection_host_unlink(context, conn);
+    timer_wheel_cancel(context->idle_wheel, &conn->idle_timer);
+
+    if (conn->handshake_done == false)
+    {
+        context->half_open_count--;
+    }
+
+    // freed once crypto worker is done with the session
+    if (conn->pending_jobs > 0)
+    {
+        conn->closing = true;
+        return 0;
+    }
+
+    return dtls_connection_free(context, conn);
+}
+
+static int dtls_connection_free(secure_connection_context_t *context, device_connection_t *conn)
+{
+    int ret;
+
+    if (conn->session)
+    {
+        do
+        {
+            ret = gnutls_bye(conn->session, GNUTLS_SHUT_WR);
+        } while (ret == GNUTLS_E_AGAIN);
+
+        if (ret != GNUTLS_E_SUCCESS)
+        {
+            return -1;
+        }
+        gnutls_deinit(conn->session);
+    }
+
+    egress_queue_forget(context->egress, &conn->bucket);
+
+    free(conn);
+    return 0;
+}
+
+static int dtls_connection_flush(void *context_p)
+{
+    secure_connection_context_t *context = (secure_connection_context_t *)context_p;
+
+    return egress_queue_flush(context->egress);
+}
+
+static int dtls_connection_send(void *context_p, session_t connection, uint8_t *buffer,
+                                size_t length)
+{
+    device_connection_t *conn = (device_connection_t *)connection;
+
+    return gnutls_record_send(conn->session, buffer, length);
+}
+
+typedef struct
+{
+    secure_connection_context_t *context;
+    f_session_in_use_cb_t in_use_cb;
+    void *data;
+    time_t now;
+    int reaped;
+} dtls_connection_reaper_t;
+
+static void dtls_connection_idle_cb(timer_wheel_timer_t *timer, void *data)
+{
+    dtls_connection_reaper_t *reaper = (dtls_connection_reaper_t *)data;
+    secure_connection_context_t *context = reaper->context;
+    device_connection_t *conn;
+    uint32_t timeout;
+
+    conn = (device_connection_t *)((uint8_t *)timer - offsetof(device_connection_t, idle_timer));
+
+    // timeout changes once handshake is done
+    timeout = dtls_connection_timeout(context, conn);
+    if (timeout == 0)
+    {
+        return;
+    }
+
+    if (conn->last_activity + timeout > reaper->now)
+    {
+        timer_wheel_schedule(context->idle_wheel, timer, conn->last_activity + timeout);
+        return;
+    }
+
+    if (conn->handshake_done && reaper->in_use_cb != NULL && reaper->in_use_cb(conn, reaper->data))
+    {
+        timer_wheel_schedule(context->idle_wheel, timer, reaper->now + timeout);
+        return;
+    }
+
+    if (dtls_connection_close(context, conn))
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to deinit session with client\n");
+        return;
+    }
+    reaper->reaped++;
+}
+
+static void dtls_connection_rotate_ticket_key(secure_connection_context_t *context, time_t now)
+{
+    gnutls_datum_t key;
+
+    if (now - context->ticket_key_time < (time_t)context->session_lifetime)
+    {
+        return;
+    }
+
+    // sessions copy the key when initialized, so the old one can be freed right away
+    if (gnutls_session_ticket_key_generate(&key) != GNUTLS_E_SUCCESS)
+    {
+        log_message(LOG_LEVEL_WARN, "Failed to rotate session ticket key\n");
+        return;
+    }
+
+    gnutls_free(context->ticket_key.data);
+    context->ticket_key = key;
+    context->ticket_key_time = now;
+}
+
+static int dtls_connection_reap(void *context_p, f_session_in_use_cb_t in_use_cb, void *data)
+{
+    secure_connection_context_t *context = (secure_connection_context_t *)context_p;
+    dtls_connection_reaper_t reaper =
+    {
+        .context = context,
+        .in_use_cb = in_use_cb,
+        .data = data,
+        .now = timer_wheel_now(),
+        .reaped = 0,
+    };
+    dtls_session_cache_stats_t stats;
+    unsigned long refused, migrations;
+
+    timer_wheel_advance(context->idle_wheel, reaper.now, dtls_connection_idle_cb, &reaper);
+
+    if (reaper.reaped > 0)
+    {
+        context->reaped_count += reaper.reaped;
+        log_message(LOG_LEVEL_INFO, "Reaped %d idle secure peers (%lu in total, %zu connected)\n",
+                    reaper.reaped, context->reaped_count,
+                    hash_table_size(context->connection_table));
+    }
+
+    if (context->session_cache != NULL && reaper.now - context->stats_time >= STATS_INTERVAL)
+    {
+        dtls_session_cache_get_stats(context->session_cache, &stats);
+        log_message(LOG_LEVEL_INFO, "Session cache: %zu entries, %lu resumed, %lu not found\n",
+                    stats.entries, stats.hits, stats.misses);
+        context->stats_time = reaper.now;
+    }
+
+    if (context->session_tickets)
+    {
+        dtls_connection_rotate_ticket_key(context, reaper.now);
+    }
+
+    refused = handshake_limiter_take_refused(context->limiter);
+    migrations = handshake_limiter_take_refused(context->migration_limiter);
+    if (refused > 0 || migrations > 0 || context->junk_count > 0)
+    {
+        log_message(LOG_LEVEL_INFO, "Refused %lu new secure sessions and %lu address changes, "
+                    "dropped %lu unexpected datagrams\n",
+                    refused, migrations, context->junk_count);
+        context->junk_count = 0;
+    }
+
+    return reaper.reaped;
+}
+
+static int dtls_connection_stop(void *context_p)
+{
+    secure_connection_context_t *context = (secure_connection_context_t *)context_p;
+    hash_table_iterator_t iterator;
+    void *conn;
+
+    if (context->crypto_workers != NULL)
+    {
+        dtls_crypto_stop(context);
+    }
+
+    hash_table_iterator_init(&iterator, context->connection_table);
+    while (hash_table_iterator_next(&iterator, &conn))
+    {
         if (dtls_connection_close(context, conn))
         {
             log_message(LOG_LEVEL_ERROR, "Failed to deinit session with client\n");
         }
     }
 
-    linked_list_delete(context->connection_list);
+    hash_table_delete(context->connection_table);
+    hash_table_delete(context->host_table);
+    timer_wheel_delete(context->idle_wheel);
+    handshake_limiter_delete(context->limiter);
+    handshake_limiter_delete(context->migration_limiter);
+
+    egress_queue_flush(context->egress);
+    egress_queue_delete(context->egress);
 
     gnutls_free(context->cookie_key.data);
     gnutls_certificate_free_credentials(context->server_cert);
     gnutls_priority_deinit(context->priority_cache);
     gnutls_psk_free_server_credentials(context->server_psk);
+    gnutls_free(context->ticket_key.data);
+    dtls_session_cache_delete(context->session_cache);
     gnutls_global_deinit();
 
     close(context->conn_listen->sock);
@@ -27,10 +27,8 @@
  *
  * Parameters:
  *      api - API context pointer. Is set after return,
- *      port - UDP port to bind to,
+ *      settings - CoAP settings (port, certificate and private key files, pacing and timeouts),
  *      address_family - UDP socket family. Can be: AF_INET, AF_INET6 or AF_UNSPEC,
- *      cert_file - path to a ECDHE-ECDSA certificate in file system,
- *      key_file - path to a matching x509 private key file,
  *      data - pointer to a data structure for use in a PSK authentication callback,
  *      psk_cb - pointer to callback used during DTLS handshake with PSK key exchange
  *
@@ -38,8 +36,9 @@
  *      0 on success,
  *      negative value on error
  */
-connection_api_t *dtls_connection_api_init(int port, int address_family, const char *cert_file,
-                                           const char *key_file, void *data, f_psk_cb_t psk_cb, f_handshake_done_cb_t handshake_done_cb);
+connection_api_t *dtls_connection_api_init(const coap_settings_t *settings, int address_family,
+                                           void *data, f_psk_cb_t psk_cb,
+                                           f_handshake_done_cb_t handshake_done_cb);
 
 /*
  * Deinitialize a DTLS connection context
@@ -0,0 +1,273 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "dtls_session_cache.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_table.h"
+
+typedef struct dtls_session_entry_t
+{
+    // least recently used list, head is the most recently used entry
+    struct dtls_session_entry_t *prev;
+    struct dtls_session_entry_t *next;
+    gnutls_datum_t key;
+    gnutls_datum_t data;
+} dtls_session_entry_t;
+
+struct dtls_session_cache_t
+{
+    pthread_mutex_t mutex;
+    hash_table_t *table;
+    dtls_session_entry_t *head;
+    dtls_session_entry_t *tail;
+    size_t capacity;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+static void dtls_session_cache_unlink(dtls_session_cache_t *cache, dtls_session_entry_t *entry)
+{
+    if (entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        cache->head = entry->next;
+    }
+
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        cache->tail = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void dtls_session_cache_link(dtls_session_cache_t *cache, dtls_session_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+
+    if (cache->head != NULL)
+    {
+        cache->head->prev = entry;
+    }
+    else
+    {
+        cache->tail = entry;
+    }
+
+    cache->head = entry;
+}
+
+static void dtls_session_cache_remove_entry(dtls_session_cache_t *cache,
+                                            dtls_session_entry_t *entry)
+{
+    hash_table_remove(cache->table, entry->key.data, entry->key.size);
+    dtls_session_cache_unlink(cache, entry);
+
+    free(entry->key.data);
+    free(entry->data.data);
+    free(entry);
+}
+
+static int dtls_session_cache_store(void *context, gnutls_datum_t key, gnutls_datum_t data)
+{
+    dtls_session_cache_t *cache = (dtls_session_cache_t *)context;
+    dtls_session_entry_t *entry;
+
+    entry = calloc(1, sizeof(dtls_session_entry_t));
+    if (entry == NULL)
+    {
+        return -1;
+    }
+
+    entry->key.data = malloc(key.size);
+    entry->data.data = malloc(data.size);
+    if (entry->key.data == NULL || entry->data.data == NULL)
+    {
+        free(entry->key.data);
+        free(entry->data.data);
+        free(entry);
+        return -1;
+    }
+
+    memcpy(entry->key.data, key.data, key.size);
+    entry->key.size = key.size;
+    memcpy(entry->data.data, data.data, data.size);
+    entry->data.size = data.size;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    // session is stored again after renegotiation
+    dtls_session_entry_t *old = hash_table_get(cache->table, key.data, key.size);
+    if (old != NULL)
+    {
+        dtls_session_cache_remove_entry(cache, old);
+    }
+
+    if (hash_table_size(cache->table) >= cache->capacity && cache->tail != NULL)
+    {
+        dtls_session_cache_remove_entry(cache, cache->tail);
+    }
+
+    if (hash_table_put(cache->table, entry->key.data, entry->key.size, entry))
+    {
+        pthread_mutex_unlock(&cache->mutex);
+
+        free(entry->key.data);
+        free(entry->data.data);
+        free(entry);
+        return -1;
+    }
+
+    dtls_session_cache_link(cache, entry);
+
+    pthread_mutex_unlock(&cache->mutex);
+
+    return 0;
+}
+
+static gnutls_datum_t dtls_session_cache_retrieve(void *context, gnutls_datum_t key)
+{
+    dtls_session_cache_t *cache = (dtls_session_cache_t *)context;
+    dtls_session_entry_t *entry;
+    gnutls_datum_t data = { NULL, 0 };
+
+    pthread_mutex_lock(&cache->mutex);
+
+    entry = hash_table_get(cache->table, key.data, key.size);
+    if (entry == NULL)
+    {
+        cache->misses++;
+        pthread_mutex_unlock(&cache->mutex);
+        return data;
+    }
+
+    // GnuTLS frees returned data with gnutls_free()
+    data.data = gnutls_malloc(entry->data.size);
+    if (data.data != NULL)
+    {
+        memcpy(data.data, entry->data.data, entry->data.size);
+        data.size = entry->data.size;
+
+        dtls_session_cache_unlink(cache, entry);
+        dtls_session_cache_link(cache, entry);
+        cache->hits++;
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+
+    return data;
+}
+
+static int dtls_session_cache_remove(void *context, gnutls_datum_t key)
+{
+    dtls_session_cache_t *cache = (dtls_session_cache_t *)context;
+    dtls_session_entry_t *entry;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    entry = hash_table_get(cache->table, key.data, key.size);
+    if (entry != NULL)
+    {
+        dtls_session_cache_remove_entry(cache, entry);
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+
+    return (entry != NULL) ? 0 : -1;
+}
+
+dtls_session_cache_t *dtls_session_cache_new(size_t capacity)
+{
+    dtls_session_cache_t *cache;
+
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(dtls_session_cache_t));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache->table = hash_table_new();
+    if (cache->table == NULL)
+    {
+        free(cache);
+        return NULL;
+    }
+
+    cache->capacity = capacity;
+    pthread_mutex_init(&cache->mutex, NULL);
+
+    return cache;
+}
+
+void dtls_session_cache_delete(dtls_session_cache_t *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    while (cache->head != NULL)
+    {
+        dtls_session_cache_remove_entry(cache, cache->head);
+    }
+
+    hash_table_delete(cache->table);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+void dtls_session_cache_attach(dtls_session_cache_t *cache, gnutls_session_t session,
+                               unsigned int lifetime)
+{
+    gnutls_db_set_ptr(session, cache);
+    gnutls_db_set_store_function(session, dtls_session_cache_store);
+    gnutls_db_set_retrieve_function(session, dtls_session_cache_retrieve);
+    gnutls_db_set_remove_function(session, dtls_session_cache_remove);
+    gnutls_db_set_cache_expiration(session, lifetime);
+}
+
+void dtls_session_cache_get_stats(dtls_session_cache_t *cache, dtls_session_cache_stats_t *stats)
+{
+    pthread_mutex_lock(&cache->mutex);
+
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->entries = hash_table_size(cache->table);
+
+    pthread_mutex_unlock(&cache->mutex);
+}
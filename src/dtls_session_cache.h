@@ -0,0 +1,81 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DTLS_SESSION_CACHE_H
+#define DTLS_SESSION_CACHE_H
+
+#include <stddef.h>
+#include <gnutls/gnutls.h>
+
+/*
+ * Bounded in-memory DTLS session resumption database. Once the cache is full,
+ * least recently used sessions are evicted.
+ *
+ * Cache functions are thread safe.
+ */
+typedef struct dtls_session_cache_t dtls_session_cache_t;
+
+typedef struct
+{
+    unsigned long hits;
+    unsigned long misses;
+    size_t entries;
+} dtls_session_cache_stats_t;
+
+/*
+ * Creates a new session cache
+ *
+ * Parameters:
+ *      capacity - maximum number of cached sessions
+ *
+ * Returns:
+ *      pointer to a new session cache on success,
+ *      NULL on error
+ */
+dtls_session_cache_t *dtls_session_cache_new(size_t capacity);
+
+/*
+ * Frees session cache and all cached sessions
+ *
+ * Parameters:
+ *      cache - session cache pointer
+ */
+void dtls_session_cache_delete(dtls_session_cache_t *cache);
+
+/*
+ * Installs cache as session database of a server session
+ *
+ * Parameters:
+ *      cache - session cache pointer,
+ *      session - GnuTLS session,
+ *      lifetime - seconds resumption data stays valid
+ */
+void dtls_session_cache_attach(dtls_session_cache_t *cache, gnutls_session_t session,
+                               unsigned int lifetime);
+
+/*
+ * Retrieves cache usage counters
+ *
+ * Parameters:
+ *      cache - session cache pointer,
+ *      stats - pointer to counters, is set after return
+ */
+void dtls_session_cache_get_stats(dtls_session_cache_t *cache, dtls_session_cache_stats_t *stats);
+
+#endif // DTLS_SESSION_CACHE_H
@@ -0,0 +1,423 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE // sendmmsg()
+
+#include "egress_queue.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+
+#define EGRESS_QUEUE_BUFFER_SIZE    1500
+#define EGRESS_QUEUE_BATCH_SIZE     64
+#define EGRESS_QUEUE_RETRY_MS       10
+// bucket tokens are counted in thousandths of a packet
+#define EGRESS_TOKEN                1000
+// bucket capacity in milliseconds worth of rate
+#define EGRESS_BUCKET_WINDOW        100
+
+typedef struct
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    egress_bucket_t *bucket;
+    size_t length;
+    uint8_t buffer[EGRESS_QUEUE_BUFFER_SIZE];
+} egress_packet_t;
+
+struct egress_queue_t
+{
+    pthread_mutex_t mutex;
+    int sock;
+    egress_pacing_settings_t pacing;
+    egress_bucket_t global_bucket;
+
+    egress_packet_t *packets;
+    // queued packets in send order
+    egress_packet_t **pending;
+    size_t pending_count;
+    // stack of unused packets
+    egress_packet_t **unused;
+    size_t unused_count;
+    size_t capacity;
+
+    struct mmsghdr msgs[EGRESS_QUEUE_BATCH_SIZE];
+    struct iovec iovecs[EGRESS_QUEUE_BATCH_SIZE];
+    size_t batch_index[EGRESS_QUEUE_BATCH_SIZE];
+};
+
+typedef enum
+{
+    EGRESS_SEND,
+    EGRESS_PEER_BLOCKED,
+    EGRESS_GLOBAL_BLOCKED,
+} egress_verdict_t;
+
+static uint64_t egress_queue_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void egress_bucket_refill(egress_bucket_t *bucket, uint32_t rate, uint64_t now)
+{
+    uint64_t capacity;
+
+    capacity = (uint64_t)rate * EGRESS_BUCKET_WINDOW;
+    if (capacity < EGRESS_TOKEN)
+    {
+        capacity = EGRESS_TOKEN;
+    }
+
+    // fresh bucket starts full
+    if (bucket->timestamp == 0)
+    {
+        bucket->tokens = capacity;
+    }
+    else
+    {
+        // milliseconds multiplied by packets per second gives thousandths of a packet
+        bucket->tokens += (now - bucket->timestamp) * rate;
+        if (bucket->tokens > capacity)
+        {
+            bucket->tokens = capacity;
+        }
+    }
+
+    bucket->timestamp = now;
+}
+
+static int egress_bucket_wait(egress_bucket_t *bucket, uint32_t rate)
+{
+    return (EGRESS_TOKEN - bucket->tokens + rate - 1) / rate;
+}
+
+static egress_verdict_t egress_queue_take_token(egress_queue_t *queue, egress_bucket_t *bucket,
+                                                uint64_t now, int *delay)
+{
+    int wait;
+
+    if (queue->pacing.rate > 0 && queue->global_bucket.tokens < EGRESS_TOKEN)
+    {
+        wait = egress_bucket_wait(&queue->global_bucket, queue->pacing.rate);
+        if (*delay == 0 || wait < *delay)
+        {
+            *delay = wait;
+        }
+        return EGRESS_GLOBAL_BLOCKED;
+    }
+
+    if (queue->pacing.peer_rate > 0 && bucket != NULL)
+    {
+        egress_bucket_refill(bucket, queue->pacing.peer_rate, now);
+        if (bucket->tokens < EGRESS_TOKEN)
+        {
+            wait = egress_bucket_wait(bucket, queue->pacing.peer_rate);
+            if (*delay == 0 || wait < *delay)
+            {
+                *delay = wait;
+            }
+            return EGRESS_PEER_BLOCKED;
+        }
+        bucket->tokens -= EGRESS_TOKEN;
+    }
+
+    if (queue->pacing.rate > 0)
+    {
+        queue->global_bucket.tokens -= EGRESS_TOKEN;
+    }
+
+    return EGRESS_SEND;
+}
+
+// gives back tokens of a datagram that was not sent after all
+static void egress_queue_refund_token(egress_queue_t *queue, egress_bucket_t *bucket)
+{
+    if (queue->pacing.peer_rate > 0 && bucket != NULL)
+    {
+        bucket->tokens += EGRESS_TOKEN;
+    }
+
+    if (queue->pacing.rate > 0)
+    {
+        queue->global_bucket.tokens += EGRESS_TOKEN;
+    }
+}
+
+static void egress_queue_release(egress_queue_t *queue, size_t index)
+{
+    queue->unused[queue->unused_count++] = queue->pending[index];
+    queue->pending[index] = NULL;
+}
+
+static int egress_queue_flush_unsafe(egress_queue_t *queue)
+{
+    egress_packet_t *packet;
+    egress_verdict_t verdict;
+    uint64_t now;
+    size_t i, j, batch_count;
+    int sent, delay = 0;
+    bool stop = false;
+
+    if (queue->pending_count == 0)
+    {
+        return 0;
+    }
+
+    now = egress_queue_now();
+    if (queue->pacing.rate > 0)
+    {
+        egress_bucket_refill(&queue->global_bucket, queue->pacing.rate, now);
+    }
+
+    i = 0;
+    while (!stop && i < queue->pending_count)
+    {
+        batch_count = 0;
+
+        // blocked destinations keep their order, as their bucket stays empty during the scan
+        for (; i < queue->pending_count && batch_count < EGRESS_QUEUE_BATCH_SIZE; i++)
+        {
+            packet = queue->pending[i];
+
+            verdict = egress_queue_take_token(queue, packet->bucket, now, &delay);
+            if (verdict == EGRESS_GLOBAL_BLOCKED)
+            {
+                stop = true;
+                break;
+            }
+            else if (verdict == EGRESS_PEER_BLOCKED)
+            {
+                continue;
+            }
+
+            memset(&queue->msgs[batch_count], 0, sizeof(struct mmsghdr));
+            queue->iovecs[batch_count].iov_base = packet->buffer;
+            queue->iovecs[batch_count].iov_len = packet->length;
+            queue->msgs[batch_count].msg_hdr.msg_iov = &queue->iovecs[batch_count];
+            queue->msgs[batch_count].msg_hdr.msg_iovlen = 1;
+            queue->msgs[batch_count].msg_hdr.msg_name = &packet->addr;
+            queue->msgs[batch_count].msg_hdr.msg_namelen = packet->addr_len;
+            queue->batch_index[batch_count] = i;
+            batch_count++;
+        }
+
+        if (batch_count == 0)
+        {
+            break;
+        }
+
+        sent = sendmmsg(queue->sock, queue->msgs, batch_count, MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                // drop undeliverable datagram, otherwise it would block the queue
+                log_message(LOG_LEVEL_ERROR, "sendmmsg() error: %s\n", strerror(errno));
+                egress_queue_refund_token(queue, queue->pending[queue->batch_index[0]]->bucket);
+                egress_queue_release(queue, queue->batch_index[0]);
+            }
+            sent = 0;
+        }
+
+        for (j = 0; j < (size_t)sent; j++)
+        {
+            egress_queue_release(queue, queue->batch_index[j]);
+        }
+
+        // datagrams left in the queue are paced again on the next flush
+        for (j = sent; j < batch_count; j++)
+        {
+            packet = queue->pending[queue->batch_index[j]];
+            if (packet != NULL)
+            {
+                egress_queue_refund_token(queue, packet->bucket);
+            }
+        }
+
+        // socket send buffer is full
+        if ((size_t)sent < batch_count)
+        {
+            if (delay == 0 || delay > EGRESS_QUEUE_RETRY_MS)
+            {
+                delay = EGRESS_QUEUE_RETRY_MS;
+            }
+            break;
+        }
+    }
+
+    for (i = 0, j = 0; i < queue->pending_count; i++)
+    {
+        if (queue->pending[i] != NULL)
+        {
+            queue->pending[j++] = queue->pending[i];
+        }
+    }
+    queue->pending_count = j;
+
+    if (queue->pending_count == 0)
+    {
+        return 0;
+    }
+
+    return (delay > 0) ? delay : 1;
+}
+
+egress_queue_t *egress_queue_new(int sock, size_t capacity,
+                                 const egress_pacing_settings_t *pacing)
+{
+    egress_queue_t *queue;
+    size_t i;
+
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+
+    queue = calloc(1, sizeof(egress_queue_t));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+
+    queue->packets = calloc(capacity, sizeof(egress_packet_t));
+    queue->pending = calloc(capacity, sizeof(egress_packet_t *));
+    queue->unused = calloc(capacity, sizeof(egress_packet_t *));
+    if (queue->packets == NULL || queue->pending == NULL || queue->unused == NULL)
+    {
+        free(queue->packets);
+        free(queue->pending);
+        free(queue->unused);
+        free(queue);
+        return NULL;
+    }
+
+    for (i = 0; i < capacity; i++)
+    {
+        queue->unused[i] = &queue->packets[i];
+    }
+    queue->unused_count = capacity;
+    queue->capacity = capacity;
+    queue->sock = sock;
+
+    if (pacing != NULL)
+    {
+        queue->pacing = *pacing;
+    }
+
+    pthread_mutex_init(&queue->mutex, NULL);
+
+    return queue;
+}
+
+void egress_queue_delete(egress_queue_t *queue)
+{
+    if (queue == NULL)
+    {
+        return;
+    }
+
+    if (queue->pending_count > 0)
+    {
+        log_message(LOG_LEVEL_WARN, "Dropping %zu unsent datagrams\n", queue->pending_count);
+    }
+
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->packets);
+    free(queue->pending);
+    free(queue->unused);
+    free(queue);
+}
+
+int egress_queue_push(egress_queue_t *queue, egress_bucket_t *bucket,
+                      const struct sockaddr *addr, socklen_t addr_len,
+                      const uint8_t *buffer, size_t length)
+{
+    egress_packet_t *packet;
+
+    if (length > EGRESS_QUEUE_BUFFER_SIZE || addr_len > sizeof(struct sockaddr_storage))
+    {
+        log_message(LOG_LEVEL_ERROR, "Datagram of %zu bytes is too large to send\n", length);
+        return -1;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->unused_count == 0)
+    {
+        egress_queue_flush_unsafe(queue);
+    }
+
+    if (queue->unused_count == 0)
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        log_message(LOG_LEVEL_WARN, "Egress queue is full, dropping datagram\n");
+        return -1;
+    }
+
+    packet = queue->unused[--queue->unused_count];
+    memcpy(&packet->addr, addr, addr_len);
+    packet->addr_len = addr_len;
+    packet->bucket = bucket;
+    packet->length = length;
+    memcpy(packet->buffer, buffer, length);
+
+    queue->pending[queue->pending_count++] = packet;
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    return 0;
+}
+
+int egress_queue_flush(egress_queue_t *queue)
+{
+    int ret;
+
+    pthread_mutex_lock(&queue->mutex);
+    ret = egress_queue_flush_unsafe(queue);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return ret;
+}
+
+void egress_queue_forget(egress_queue_t *queue, egress_bucket_t *bucket)
+{
+    size_t i;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    for (i = 0; i < queue->pending_count; i++)
+    {
+        if (queue->pending[i]->bucket == bucket)
+        {
+            queue->pending[i]->bucket = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+}
@@ -0,0 +1,118 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EGRESS_QUEUE_H
+#define EGRESS_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * Outgoing datagram queue of a single socket. Queued datagrams are sent in
+ * batches with sendmmsg() when the queue is flushed, optionally paced with
+ * token buckets (global and per destination). Buckets hold 100 ms worth of
+ * rate, so paced datagrams are spread out instead of being sent in bursts.
+ *
+ * Queue functions are thread safe.
+ */
+typedef struct egress_queue_t egress_queue_t;
+
+typedef struct
+{
+    uint32_t rate;      // packets per second to all destinations, 0 - unlimited
+    uint32_t peer_rate; // packets per second to a single destination, 0 - unlimited
+} egress_pacing_settings_t;
+
+/*
+ * Per destination token bucket, embedded into a connection structure.
+ * Must be zero initialized.
+ */
+typedef struct
+{
+    uint64_t tokens;
+    uint64_t timestamp;
+} egress_bucket_t;
+
+/*
+ * Creates a new egress queue
+ *
+ * Parameters:
+ *      sock - socket to send datagrams through,
+ *      capacity - maximum number of queued datagrams,
+ *      pacing - pacing settings, NULL disables pacing
+ *
+ * Returns:
+ *      pointer to a new egress queue on success,
+ *      NULL on error
+ */
+egress_queue_t *egress_queue_new(int sock, size_t capacity,
+                                 const egress_pacing_settings_t *pacing);
+
+/*
+ * Drops queued datagrams and frees the egress queue
+ *
+ * Parameters:
+ *      queue - egress queue pointer
+ */
+void egress_queue_delete(egress_queue_t *queue);
+
+/*
+ * Copies datagram into the queue. If the queue is full, it is flushed first,
+ * and the datagram is dropped if that frees no space.
+ *
+ * Parameters:
+ *      queue - egress queue pointer,
+ *      bucket - destination token bucket, NULL to skip per destination pacing,
+ *      addr - destination address,
+ *      addr_len - length of addr,
+ *      buffer - datagram data,
+ *      length - length of datagram
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value if datagram could not be queued
+ */
+int egress_queue_push(egress_queue_t *queue, egress_bucket_t *bucket,
+                      const struct sockaddr *addr, socklen_t addr_len,
+                      const uint8_t *buffer, size_t length);
+
+/*
+ * Sends as many queued datagrams as pacing allows
+ *
+ * Parameters:
+ *      queue - egress queue pointer
+ *
+ * Returns:
+ *      0 if the queue is empty,
+ *      positive number of milliseconds until the next flush attempt
+ */
+int egress_queue_flush(egress_queue_t *queue);
+
+/*
+ * Detaches destination token bucket from queued datagrams, must be called
+ * before the bucket is freed. Detached datagrams are still sent.
+ *
+ * Parameters:
+ *      queue - egress queue pointer,
+ *      bucket - destination token bucket
+ */
+void egress_queue_forget(egress_queue_t *queue, egress_bucket_t *bucket);
+
+#endif // EGRESS_QUEUE_H
@@ -0,0 +1,305 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "linked_list.h"
+
+#define EVENT_LOOP_MAX_EVENTS 16
+
+typedef struct
+{
+    int fd;
+    f_event_cb_t callback;
+    void *data;
+} event_handler_t;
+
+struct event_loop_t
+{
+    int epoll_fd;
+    int timer_fd;
+    int wakeup_fd;
+    event_handler_t timer_handler;
+    event_handler_t wakeup_handler;
+    f_event_cb_t timer_cb;
+    void *timer_data;
+    linked_list_t *handlers;
+};
+
+static int event_loop_watch(event_loop_t *loop, event_handler_t *handler)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = handler;
+
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, handler->fd, &event);
+}
+
+static void event_loop_timer_cb(event_loop_t *loop, void *data)
+{
+    uint64_t value;
+
+    // drain descriptor, otherwise level-triggered epoll would report it again
+    if (read(loop->timer_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    {
+        return;
+    }
+
+    loop->timer_cb(loop, loop->timer_data);
+}
+
+static void event_loop_wakeup_cb(event_loop_t *loop, void *data)
+{
+    uint64_t value;
+
+    if (read(loop->wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    {
+        return;
+    }
+
+    loop->timer_cb(loop, loop->timer_data);
+}
+
+event_loop_t *event_loop_new(f_event_cb_t timer_cb, void *data)
+{
+    event_loop_t *loop;
+
+    if (timer_cb == NULL)
+    {
+        return NULL;
+    }
+
+    loop = calloc(1, sizeof(event_loop_t));
+    if (loop == NULL)
+    {
+        return NULL;
+    }
+
+    loop->epoll_fd = -1;
+    loop->timer_fd = -1;
+    loop->wakeup_fd = -1;
+    loop->timer_cb = timer_cb;
+    loop->timer_data = data;
+
+    loop->handlers = linked_list_new();
+    if (loop->handlers == NULL)
+    {
+        goto error;
+    }
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->epoll_fd < 0 || loop->timer_fd < 0 || loop->wakeup_fd < 0)
+    {
+        goto error;
+    }
+
+    loop->timer_handler.fd = loop->timer_fd;
+    loop->timer_handler.callback = event_loop_timer_cb;
+    loop->wakeup_handler.fd = loop->wakeup_fd;
+    loop->wakeup_handler.callback = event_loop_wakeup_cb;
+
+    if (event_loop_watch(loop, &loop->timer_handler)
+        || event_loop_watch(loop, &loop->wakeup_handler))
+    {
+        goto error;
+    }
+
+    return loop;
+
+error:
+    event_loop_delete(loop);
+    return NULL;
+}
+
+void event_loop_delete(event_loop_t *loop)
+{
+    linked_list_entry_t *entry;
+
+    if (loop == NULL)
+    {
+        return;
+    }
+
+    if (loop->handlers != NULL)
+    {
+        for (entry = loop->handlers->head; entry != NULL; entry = entry->next)
+        {
+            free(entry->data);
+        }
+        linked_list_delete(loop->handlers);
+    }
+
+    if (loop->wakeup_fd >= 0)
+    {
+        close(loop->wakeup_fd);
+    }
+    if (loop->timer_fd >= 0)
+    {
+        close(loop->timer_fd);
+    }
+    if (loop->epoll_fd >= 0)
+    {
+        close(loop->epoll_fd);
+    }
+
+    free(loop);
+}
+
+int event_loop_add(event_loop_t *loop, int fd, f_event_cb_t callback, void *data)
+{
+    event_handler_t *handler;
+
+    if (fd < 0 || callback == NULL)
+    {
+        return -1;
+    }
+
+    handler = malloc(sizeof(event_handler_t));
+    if (handler == NULL)
+    {
+        return -1;
+    }
+
+    handler->fd = fd;
+    handler->callback = callback;
+    handler->data = data;
+
+    if (event_loop_watch(loop, handler))
+    {
+        free(handler);
+        return -1;
+    }
+
+    linked_list_add(loop->handlers, handler);
+
+    return 0;
+}
+
+int event_loop_pause(event_loop_t *loop, int fd, bool paused)
+{
+    linked_list_entry_t *entry;
+    event_handler_t *handler;
+    struct epoll_event event;
+
+    for (entry = loop->handlers->head; entry != NULL; entry = entry->next)
+    {
+        handler = (event_handler_t *)entry->data;
+        if (handler->fd != fd)
+        {
+            continue;
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.events = paused ? 0 : EPOLLIN;
+        event.data.ptr = handler;
+
+        return epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+
+    return -1;
+}
+
+int event_loop_set_timer(event_loop_t *loop, long timeout_ms)
+{
+    struct itimerspec timer;
+
+    memset(&timer, 0, sizeof(timer));
+
+    if (timeout_ms <= 0)
+    {
+        // zero value would disarm the timer
+        timer.it_value.tv_nsec = 1;
+    }
+    else
+    {
+        timer.it_value.tv_sec = timeout_ms / 1000;
+        timer.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }
+
+    return timerfd_settime(loop->timer_fd, 0, &timer, NULL);
+}
+
+int event_loop_set_timer_min(event_loop_t *loop, long timeout_ms)
+{
+    struct itimerspec timer;
+    long remaining_ms;
+
+    if (timerfd_gettime(loop->timer_fd, &timer) != 0)
+    {
+        return -1;
+    }
+
+    // disarmed timer has zero value
+    if (timer.it_value.tv_sec != 0 || timer.it_value.tv_nsec != 0)
+    {
+        remaining_ms = timer.it_value.tv_sec * 1000 + timer.it_value.tv_nsec / 1000000;
+        if (remaining_ms <= timeout_ms)
+        {
+            return 0;
+        }
+    }
+
+    return event_loop_set_timer(loop, timeout_ms);
+}
+
+int event_loop_wakeup(event_loop_t *loop)
+{
+    uint64_t value = 1;
+
+    if (write(loop->wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int event_loop_run_once(event_loop_t *loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    event_handler_t *handler;
+    int count, i;
+
+    count = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+    if (count < 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        handler = (event_handler_t *)events[i].data.ptr;
+        handler->callback(loop, handler->data);
+    }
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * epoll based event loop. Watched file descriptors, a timer and a wakeup
+ * channel are serviced only when they become ready.
+ *
+ * Timer expiration and wakeup requests share a single callback, which is
+ * expected to do periodic work and rearm the timer with event_loop_set_timer().
+ */
+typedef struct event_loop_t event_loop_t;
+
+/*
+ * Called when a watched file descriptor is readable, the timer expires
+ * or a wakeup is requested
+ *
+ * Parameters:
+ *      loop - event loop pointer,
+ *      data - pointer to data provided during callback registration
+ */
+typedef void (*f_event_cb_t)(event_loop_t *loop, void *data);
+
+/*
+ * Creates a new event loop
+ *
+ * Parameters:
+ *      timer_cb - callback called on timer expiration or wakeup request,
+ *      data - pointer to data later provided to timer_cb
+ *
+ * Returns:
+ *      pointer to a new event loop on success,
+ *      NULL on error
+ */
+event_loop_t *event_loop_new(f_event_cb_t timer_cb, void *data);
+
+/*
+ * Closes all event loop descriptors and frees the event loop.
+ * Watched file descriptors are not closed.
+ *
+ * Parameters:
+ *      loop - event loop pointer
+ */
+void event_loop_delete(event_loop_t *loop);
+
+/*
+ * Starts watching file descriptor for incoming data
+ *
+ * Parameters:
+ *      loop - event loop pointer,
+ *      fd - file descriptor,
+ *      callback - callback called when fd is readable,
+ *      data - pointer to data later provided to callback
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int event_loop_add(event_loop_t *loop, int fd, f_event_cb_t callback, void *data);
+
+/*
+ * Stops or resumes watching file descriptor added with event_loop_add(),
+ * callback is not called while file descriptor is paused
+ *
+ * Parameters:
+ *      loop - event loop pointer,
+ *      fd - watched file descriptor,
+ *      paused - true to stop watching, false to resume
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int event_loop_pause(event_loop_t *loop, int fd, bool paused);
+
+/*
+ * Arms the timer, previous timer value is discarded
+ *
+ * Parameters:
+ *      loop - event loop pointer,
+ *      timeout_ms - milliseconds until timer expiration, zero expires immediately
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int event_loop_set_timer(event_loop_t *loop, long timeout_ms);
+
+/*
+ * Arms the timer only if it would expire earlier than currently armed timer
+ *
+ * Parameters:
+ *      loop - event loop pointer,
+ *      timeout_ms - milliseconds until timer expiration, zero expires immediately
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int event_loop_set_timer_min(event_loop_t *loop, long timeout_ms);
+
+/*
+ * Requests timer callback to be called as soon as possible.
+ * Can be called from any thread.
+ *
+ * Parameters:
+ *      loop - event loop pointer
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int event_loop_wakeup(event_loop_t *loop);
+
+/*
+ * Waits for at least one event and calls corresponding callbacks
+ *
+ * Parameters:
+ *      loop - event loop pointer
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error (errno is set, EINTR if interrupted by a signal)
+ */
+int event_loop_run_once(event_loop_t *loop);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,195 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "handshake_limiter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// must be a power of two
+#define HANDSHAKE_LIMITER_HOST_BUCKETS  4096
+// bucket tokens are counted in thousandths of a session
+#define HANDSHAKE_LIMITER_TOKEN         1000
+// bucket capacity in milliseconds worth of rate
+#define HANDSHAKE_LIMITER_WINDOW        1000
+
+typedef struct
+{
+    uint64_t tokens;
+    uint64_t timestamp;
+} handshake_bucket_t;
+
+struct handshake_limiter_t
+{
+    handshake_limiter_settings_t settings;
+    uint64_t seed;
+    unsigned long refused;
+    handshake_bucket_t global_bucket;
+    handshake_bucket_t host_buckets[HANDSHAKE_LIMITER_HOST_BUCKETS];
+};
+
+static uint64_t handshake_limiter_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t handshake_limiter_seed(void)
+{
+    uint64_t seed;
+    FILE *f;
+
+    f = fopen("/dev/urandom", "r");
+    if (f != NULL)
+    {
+        if (fread(&seed, sizeof(seed), 1, f) == 1)
+        {
+            fclose(f);
+            return seed;
+        }
+        fclose(f);
+    }
+
+    return (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+}
+
+static size_t handshake_limiter_host_index(handshake_limiter_t *limiter,
+                                           const sockaddr_key_t *key)
+{
+    uint64_t hash = limiter->seed;
+    size_t i;
+
+    // port is left out, so that a host can't get new buckets by changing it
+    for (i = 0; i < sizeof(key->address); i++)
+    {
+        hash = (hash ^ key->address[i]) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ key->scope_id) * 0x100000001b3ULL;
+
+    // final avalanche, as only the lowest bits are used
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash & (HANDSHAKE_LIMITER_HOST_BUCKETS - 1);
+}
+
+static bool handshake_bucket_has_token(handshake_bucket_t *bucket, uint32_t rate, uint64_t now)
+{
+    uint64_t capacity;
+
+    if (rate == 0)
+    {
+        return true;
+    }
+
+    capacity = (uint64_t)rate * HANDSHAKE_LIMITER_WINDOW;
+
+    // fresh bucket starts full
+    if (bucket->timestamp == 0)
+    {
+        bucket->tokens = capacity;
+    }
+    else
+    {
+        // milliseconds multiplied by sessions per second gives thousandths of a session
+        bucket->tokens += (now - bucket->timestamp) * rate;
+        if (bucket->tokens > capacity)
+        {
+            bucket->tokens = capacity;
+        }
+    }
+
+    bucket->timestamp = now;
+
+    return bucket->tokens >= HANDSHAKE_LIMITER_TOKEN;
+}
+
+static void handshake_bucket_take_token(handshake_bucket_t *bucket, uint32_t rate)
+{
+    if (rate > 0)
+    {
+        bucket->tokens -= HANDSHAKE_LIMITER_TOKEN;
+    }
+}
+
+handshake_limiter_t *handshake_limiter_new(const handshake_limiter_settings_t *settings)
+{
+    handshake_limiter_t *limiter;
+
+    limiter = calloc(1, sizeof(handshake_limiter_t));
+    if (limiter == NULL)
+    {
+        return NULL;
+    }
+
+    limiter->settings = *settings;
+    limiter->seed = handshake_limiter_seed();
+
+    return limiter;
+}
+
+void handshake_limiter_delete(handshake_limiter_t *limiter)
+{
+    free(limiter);
+}
+
+bool handshake_limiter_admit(handshake_limiter_t *limiter, const sockaddr_key_t *key,
+                             size_t half_open)
+{
+    handshake_bucket_t *host_bucket;
+    uint64_t now;
+
+    if (limiter->settings.half_open > 0 && half_open >= limiter->settings.half_open)
+    {
+        limiter->refused++;
+        return false;
+    }
+
+    now = handshake_limiter_now();
+    host_bucket = &limiter->host_buckets[handshake_limiter_host_index(limiter, key)];
+
+    // tokens are taken only if both buckets have them
+    if (!handshake_bucket_has_token(host_bucket, limiter->settings.host_rate, now)
+        || !handshake_bucket_has_token(&limiter->global_bucket, limiter->settings.rate, now))
+    {
+        limiter->refused++;
+        return false;
+    }
+
+    handshake_bucket_take_token(host_bucket, limiter->settings.host_rate);
+    handshake_bucket_take_token(&limiter->global_bucket, limiter->settings.rate);
+
+    return true;
+}
+
+unsigned long handshake_limiter_take_refused(handshake_limiter_t *limiter)
+{
+    unsigned long refused = limiter->refused;
+
+    limiter->refused = 0;
+
+    return refused;
+}
@@ -0,0 +1,93 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HANDSHAKE_LIMITER_H
+#define HANDSHAKE_LIMITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sockaddr_key.h"
+
+/*
+ * Admission control for new DTLS sessions. New sessions are limited by a
+ * global token bucket, by token buckets of source hosts and by the number
+ * of sessions that have not finished their handshake yet.
+ *
+ * Hosts are hashed into a fixed table of buckets with a random seed, so the
+ * limiter never allocates memory after creation and can't be flooded with
+ * spoofed addresses. Hosts sharing a bucket share its rate.
+ *
+ * Limiter is not thread safe.
+ */
+typedef struct handshake_limiter_t handshake_limiter_t;
+
+typedef struct
+{
+    uint32_t rate;          // new sessions per second from all hosts, 0 - unlimited
+    uint32_t host_rate;     // new sessions per second from a single host, 0 - unlimited
+    uint32_t half_open;     // sessions with unfinished handshake, 0 - unlimited
+} handshake_limiter_settings_t;
+
+/*
+ * Creates a new handshake limiter
+ *
+ * Parameters:
+ *      settings - limits
+ *
+ * Returns:
+ *      pointer to a new limiter on success,
+ *      NULL on error
+ */
+handshake_limiter_t *handshake_limiter_new(const handshake_limiter_settings_t *settings);
+
+/*
+ * Frees handshake limiter
+ *
+ * Parameters:
+ *      limiter - limiter pointer
+ */
+void handshake_limiter_delete(handshake_limiter_t *limiter);
+
+/*
+ * Decides whether a new session from the peer can be created and takes
+ * tokens from the buckets if it can
+ *
+ * Parameters:
+ *      limiter - limiter pointer,
+ *      key - canonical peer address, port is ignored,
+ *      half_open - current number of sessions with unfinished handshake
+ *
+ * Returns:
+ *      true if session can be created,
+ *      false otherwise
+ */
+bool handshake_limiter_admit(handshake_limiter_t *limiter, const sockaddr_key_t *key,
+                             size_t half_open);
+
+/*
+ * Returns number of refused sessions since the previous call
+ *
+ * Parameters:
+ *      limiter - limiter pointer
+ */
+unsigned long handshake_limiter_take_refused(handshake_limiter_t *limiter);
+
+#endif // HANDSHAKE_LIMITER_H
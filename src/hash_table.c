@@ -0,0 +1,334 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "hash_table.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HASH_TABLE_INITIAL_SIZE 64
+
+struct hash_table_entry_t
+{
+    struct hash_table_entry_t *next;
+    uint64_t hash;
+    void *value;
+    size_t key_length;
+    uint8_t key[];
+};
+
+struct hash_table_t
+{
+    hash_table_entry_t **buckets;
+    size_t bucket_count;
+    size_t size;
+    uint64_t seed[2];
+};
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND            \
+    do                      \
+    {                       \
+        v0 += v1;           \
+        v1 = ROTL(v1, 13);  \
+        v1 ^= v0;           \
+        v0 = ROTL(v0, 32);  \
+        v2 += v3;           \
+        v3 = ROTL(v3, 16);  \
+        v3 ^= v2;           \
+        v0 += v3;           \
+        v3 = ROTL(v3, 21);  \
+        v3 ^= v0;           \
+        v2 += v1;           \
+        v1 = ROTL(v1, 17);  \
+        v1 ^= v2;           \
+        v2 = ROTL(v2, 32);  \
+    } while (0)
+
+// SipHash-2-4
+static uint64_t hash_table_hash(const uint64_t seed[2], const uint8_t *data, size_t length)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ seed[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ seed[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ seed[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ seed[1];
+    uint64_t m, b = ((uint64_t)length) << 56;
+    size_t i, tail = length & 7;
+    const uint8_t *end = data + length - tail;
+
+    for (; data != end; data += 8)
+    {
+        m = 0;
+        for (i = 0; i < 8; i++)
+        {
+            m |= ((uint64_t)data[i]) << (8 * i);
+        }
+
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    for (i = 0; i < tail; i++)
+    {
+        b |= ((uint64_t)data[i]) << (8 * i);
+    }
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void hash_table_seed(uint64_t seed[2])
+{
+    FILE *f;
+
+    f = fopen("/dev/urandom", "r");
+    if (f != NULL)
+    {
+        if (fread(seed, sizeof(uint64_t), 2, f) == 2)
+        {
+            fclose(f);
+            return;
+        }
+        fclose(f);
+    }
+
+    seed[0] = (uint64_t)time(NULL);
+    seed[1] = (uint64_t)getpid() ^ (uint64_t)(uintptr_t)seed;
+}
+
+static int hash_table_grow(hash_table_t *table)
+{
+    hash_table_entry_t **buckets;
+    hash_table_entry_t *entry, *next;
+    size_t bucket_count, i, index;
+
+    bucket_count = table->bucket_count * 2;
+    buckets = calloc(bucket_count, sizeof(hash_table_entry_t *));
+    if (buckets == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < table->bucket_count; i++)
+    {
+        for (entry = table->buckets[i]; entry != NULL; entry = next)
+        {
+            next = entry->next;
+            index = entry->hash & (bucket_count - 1);
+            entry->next = buckets[index];
+            buckets[index] = entry;
+        }
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->bucket_count = bucket_count;
+
+    return 0;
+}
+
+static hash_table_entry_t **hash_table_find(hash_table_t *table, uint64_t hash,
+                                            const void *key, size_t key_length)
+{
+    hash_table_entry_t **entry;
+
+    for (entry = &table->buckets[hash & (table->bucket_count - 1)]; *entry != NULL;
+         entry = &(*entry)->next)
+    {
+        if ((*entry)->hash == hash
+            && (*entry)->key_length == key_length
+            && memcmp((*entry)->key, key, key_length) == 0)
+        {
+            break;
+        }
+    }
+
+    return entry;
+}
+
+hash_table_t *hash_table_new(void)
+{
+    hash_table_t *table;
+
+    table = calloc(1, sizeof(hash_table_t));
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    table->buckets = calloc(HASH_TABLE_INITIAL_SIZE, sizeof(hash_table_entry_t *));
+    if (table->buckets == NULL)
+    {
+        free(table);
+        return NULL;
+    }
+
+    table->bucket_count = HASH_TABLE_INITIAL_SIZE;
+    hash_table_seed(table->seed);
+
+    return table;
+}
+
+void hash_table_delete(hash_table_t *table)
+{
+    hash_table_entry_t *entry, *next;
+    size_t i;
+
+    if (table == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < table->bucket_count; i++)
+    {
+        for (entry = table->buckets[i]; entry != NULL; entry = next)
+        {
+            next = entry->next;
+            free(entry);
+        }
+    }
+
+    free(table->buckets);
+    free(table);
+}
+
+void *hash_table_get(hash_table_t *table, const void *key, size_t key_length)
+{
+    hash_table_entry_t **entry;
+
+    entry = hash_table_find(table, hash_table_hash(table->seed, key, key_length), key, key_length);
+
+    return (*entry != NULL) ? (*entry)->value : NULL;
+}
+
+int hash_table_put(hash_table_t *table, const void *key, size_t key_length, void *value)
+{
+    hash_table_entry_t **entry;
+    hash_table_entry_t *new_entry;
+    uint64_t hash;
+
+    if (value == NULL)
+    {
+        return -1;
+    }
+
+    hash = hash_table_hash(table->seed, key, key_length);
+
+    entry = hash_table_find(table, hash, key, key_length);
+    if (*entry != NULL)
+    {
+        (*entry)->value = value;
+        return 0;
+    }
+
+    // keep load factor below 3/4, table still works if it can't grow
+    if (table->size + 1 > table->bucket_count / 4 * 3)
+    {
+        hash_table_grow(table);
+    }
+
+    new_entry = malloc(sizeof(hash_table_entry_t) + key_length);
+    if (new_entry == NULL)
+    {
+        return -1;
+    }
+
+    new_entry->hash = hash;
+    new_entry->value = value;
+    new_entry->key_length = key_length;
+    memcpy(new_entry->key, key, key_length);
+
+    entry = &table->buckets[hash & (table->bucket_count - 1)];
+    new_entry->next = *entry;
+    *entry = new_entry;
+    table->size++;
+
+    return 0;
+}
+
+void *hash_table_remove(hash_table_t *table, const void *key, size_t key_length)
+{
+    hash_table_entry_t **entry;
+    hash_table_entry_t *removed;
+    void *value;
+
+    entry = hash_table_find(table, hash_table_hash(table->seed, key, key_length), key, key_length);
+    if (*entry == NULL)
+    {
+        return NULL;
+    }
+
+    removed = *entry;
+    *entry = removed->next;
+    table->size--;
+
+    value = removed->value;
+    free(removed);
+
+    return value;
+}
+
+size_t hash_table_size(hash_table_t *table)
+{
+    return table->size;
+}
+
+void hash_table_iterator_init(hash_table_iterator_t *iterator, hash_table_t *table)
+{
+    iterator->table = table;
+    iterator->bucket = 0;
+    iterator->next = table->buckets[0];
+}
+
+bool hash_table_iterator_next(hash_table_iterator_t *iterator, void **value)
+{
+    hash_table_t *table = iterator->table;
+
+    while (iterator->next == NULL)
+    {
+        if (++iterator->bucket >= table->bucket_count)
+        {
+            return false;
+        }
+        iterator->next = table->buckets[iterator->bucket];
+    }
+
+    // advance before returning, so that the current entry can be removed
+    *value = iterator->next->value;
+    iterator->next = iterator->next->next;
+
+    return true;
+}
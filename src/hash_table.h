@@ -0,0 +1,140 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HASH_TABLE_H
+#define HASH_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Hash table with binary keys. Keys are copied into the table, values are
+ * stored as pointers and never freed by the table.
+ *
+ * Keys are hashed with SipHash and a random per-table seed, so that keys
+ * chosen by remote peers can't be used to degrade lookups.
+ *
+ * Hash table is not thread safe.
+ */
+typedef struct hash_table_t hash_table_t;
+
+typedef struct hash_table_entry_t hash_table_entry_t;
+
+/*
+ * Iterator, allows removing the current entry while iterating
+ */
+typedef struct
+{
+    hash_table_t *table;
+    size_t bucket;
+    hash_table_entry_t *next;
+} hash_table_iterator_t;
+
+/*
+ * Creates a new hash table
+ *
+ * Returns:
+ *      pointer to a new hash table on success,
+ *      NULL on error
+ */
+hash_table_t *hash_table_new(void);
+
+/*
+ * Frees hash table and its keys, values are not freed
+ *
+ * Parameters:
+ *      table - hash table pointer
+ */
+void hash_table_delete(hash_table_t *table);
+
+/*
+ * Finds value by key
+ *
+ * Parameters:
+ *      table - hash table pointer,
+ *      key - key data,
+ *      key_length - length of key
+ *
+ * Returns:
+ *      value pointer if found,
+ *      NULL otherwise
+ */
+void *hash_table_get(hash_table_t *table, const void *key, size_t key_length);
+
+/*
+ * Inserts value, replaces value of an existing key
+ *
+ * Parameters:
+ *      table - hash table pointer,
+ *      key - key data (copied),
+ *      key_length - length of key,
+ *      value - value pointer, must not be NULL
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int hash_table_put(hash_table_t *table, const void *key, size_t key_length, void *value);
+
+/*
+ * Removes key from the table
+ *
+ * Parameters:
+ *      table - hash table pointer,
+ *      key - key data,
+ *      key_length - length of key
+ *
+ * Returns:
+ *      removed value pointer,
+ *      NULL if key was not found
+ */
+void *hash_table_remove(hash_table_t *table, const void *key, size_t key_length);
+
+/*
+ * Returns number of entries in the table
+ *
+ * Parameters:
+ *      table - hash table pointer
+ */
+size_t hash_table_size(hash_table_t *table);
+
+/*
+ * Initializes iterator to the beginning of the table. Table must not be
+ * modified while iterating, except for removing the current entry.
+ *
+ * Parameters:
+ *      iterator - iterator pointer,
+ *      table - hash table pointer
+ */
+void hash_table_iterator_init(hash_table_iterator_t *iterator, hash_table_t *table);
+
+/*
+ * Advances iterator to the next entry
+ *
+ * Parameters:
+ *      iterator - iterator pointer,
+ *      value - pointer to value pointer, is set after return
+ *
+ * Returns:
+ *      true if entry was found,
+ *      false at the end of the table
+ */
+bool hash_table_iterator_next(hash_table_iterator_t *iterator, void **value);
+
+#endif // HASH_TABLE_H
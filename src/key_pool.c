@@ -0,0 +1,259 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE // syscall()
+
+#include "key_pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+// nice value of the refill thread
+#define KEY_POOL_NICE       19
+
+// seconds waited after a failed key generation, doubled up to the maximum
+#define KEY_POOL_RETRY_MIN  1
+#define KEY_POOL_RETRY_MAX  300
+
+struct key_pool_t
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool running;
+
+    // stack of ready keys
+    gnutls_x509_privkey_t *keys;
+    size_t count;
+    size_t size;
+
+    unsigned long generated;
+    unsigned long taken;
+    unsigned long empty;
+};
+
+static int key_pool_generate(gnutls_x509_privkey_t *key)
+{
+    if (gnutls_x509_privkey_init(key))
+    {
+        return -1;
+    }
+
+    if (gnutls_x509_privkey_generate(*key, GNUTLS_PK_EC,
+                                     GNUTLS_CURVE_TO_BITS(GNUTLS_ECC_CURVE_SECP256R1), 0))
+    {
+        gnutls_x509_privkey_deinit(*key);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Waits until the retry delay passes or the pool is deleted,
+ * called with the mutex locked
+ */
+static void key_pool_backoff(key_pool_t *pool, time_t delay)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += delay;
+
+    // taken keys signal the condition too, those wakeups are ignored
+    while (pool->running)
+    {
+        if (pthread_cond_timedwait(&pool->cond, &pool->mutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+}
+
+static void *key_pool_thread(void *arg)
+{
+    key_pool_t *pool = (key_pool_t *)arg;
+    gnutls_x509_privkey_t key;
+    time_t delay = KEY_POOL_RETRY_MIN;
+
+    /*
+     * Lowest nice value instead of idle scheduling, the thread takes the pool
+     * mutex and must not be starved while holding it. Nice value is per
+     * thread on Linux.
+     */
+    if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), KEY_POOL_NICE) != 0)
+    {
+        log_message(LOG_LEVEL_WARN, "Failed to lower key pool thread priority\n");
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (pool->running)
+    {
+        if (pool->count == pool->size)
+        {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (key_pool_generate(&key))
+        {
+            log_message(LOG_LEVEL_ERROR,
+                        "Failed to generate key for key pool, retrying in %ld s\n",
+                        (long)delay);
+
+            pthread_mutex_lock(&pool->mutex);
+            key_pool_backoff(pool, delay);
+
+            delay = (delay * 2 < KEY_POOL_RETRY_MAX) ? delay * 2 : KEY_POOL_RETRY_MAX;
+            continue;
+        }
+        delay = KEY_POOL_RETRY_MIN;
+
+        pthread_mutex_lock(&pool->mutex);
+
+        if (!pool->running || pool->count == pool->size)
+        {
+            gnutls_x509_privkey_deinit(key);
+            continue;
+        }
+
+        pool->keys[pool->count++] = key;
+        pool->generated++;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+key_pool_t *key_pool_new(size_t size)
+{
+    key_pool_t *pool;
+
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(key_pool_t));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    pool->keys = calloc(size, sizeof(gnutls_x509_privkey_t));
+    if (pool->keys == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pool->size = size;
+    pool->running = true;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    if (pthread_create(&pool->thread, NULL, key_pool_thread, pool) != 0)
+    {
+        pthread_cond_destroy(&pool->cond);
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool->keys);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void key_pool_delete(key_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->running = false;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pthread_join(pool->thread, NULL);
+
+    while (pool->count > 0)
+    {
+        gnutls_x509_privkey_deinit(pool->keys[--pool->count]);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->keys);
+    free(pool);
+}
+
+int key_pool_take(key_pool_t *pool, gnutls_x509_privkey_t *key)
+{
+    unsigned long empty;
+
+    if (pool == NULL)
+    {
+        return key_pool_generate(key);
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->count > 0)
+    {
+        *key = pool->keys[--pool->count];
+        pool->taken++;
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+        return 0;
+    }
+
+    empty = ++pool->empty;
+    pthread_mutex_unlock(&pool->mutex);
+
+    log_message(LOG_LEVEL_INFO, "Key pool is empty, generating key on demand (%lu times)\n",
+                empty);
+
+    return key_pool_generate(key);
+}
+
+void key_pool_get_stats(key_pool_t *pool, key_pool_stats_t *stats)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    stats->generated = pool->generated;
+    stats->taken = pool->taken;
+    stats->empty = pool->empty;
+    stats->available = pool->count;
+
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,87 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEY_POOL_H
+#define KEY_POOL_H
+
+#include <stddef.h>
+#include <gnutls/x509.h>
+
+/*
+ * Pool of pre-generated P-256 device keys. Keys are generated by a
+ * background thread with the lowest nice priority, so that refilling the
+ * pool yields CPU to everything else.
+ *
+ * Pool functions are thread safe.
+ */
+typedef struct key_pool_t key_pool_t;
+
+typedef struct
+{
+    unsigned long generated;
+    unsigned long taken;
+    // keys generated on demand, because the pool was empty
+    unsigned long empty;
+    size_t available;
+} key_pool_stats_t;
+
+/*
+ * Creates a new key pool and starts filling it
+ *
+ * Parameters:
+ *      size - number of keys kept ready
+ *
+ * Returns:
+ *      pointer to a new key pool on success,
+ *      NULL on error
+ */
+key_pool_t *key_pool_new(size_t size);
+
+/*
+ * Stops key generation and frees key pool with all its keys
+ *
+ * Parameters:
+ *      pool - key pool pointer
+ */
+void key_pool_delete(key_pool_t *pool);
+
+/*
+ * Takes a key from the pool, generates it right away if the pool is empty
+ *
+ * Parameters:
+ *      pool - key pool pointer, may be NULL to always generate a new key,
+ *      key - pointer to key, is set after return and must be deinitialized
+ *            by caller
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int key_pool_take(key_pool_t *pool, gnutls_x509_privkey_t *key);
+
+/*
+ * Retrieves key pool usage counters
+ *
+ * Parameters:
+ *      pool - key pool pointer,
+ *      stats - pointer to counters, is set after return
+ */
+void key_pool_get_stats(key_pool_t *pool, key_pool_stats_t *stats);
+
+#endif // KEY_POOL_H
@@ -63,7 +63,7 @@ void linked_list_delete(linked_list_t *list)
     free(list);
 }
 
-void linked_list_add(linked_list_t *list, void *data)
+linked_list_entry_t *linked_list_add(linked_list_t *list, void *data)
 {
     linked_list_entry_t *entry;
 
@@ -73,42 +73,66 @@ void linked_list_add(linked_list_t *list, void *data)
     assert(entry != NULL);
 
     entry->next = list->head;
+    entry->prev = NULL;
     entry->data = data;
+    if (list->head != NULL)
+    {
+        list->head->prev = entry;
+    }
     list->head = entry;
 
     pthread_mutex_unlock(&list->mutex);
+
+    return entry;
+}
+
+static void linked_list_unlink(linked_list_t *list, linked_list_entry_t *entry)
+{
+    if (entry->prev == NULL)
+    {
+        list->head = entry->next;
+    }
+    else
+    {
+        entry->prev->next = entry->next;
+    }
+
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+
+    entry->next = NULL;
+    entry->prev = NULL;
+    free(entry);
 }
 
 void linked_list_remove(linked_list_t *list, void *data)
 {
     pthread_mutex_lock(&list->mutex);
 
-    linked_list_entry_t *entry, *previous;
+    linked_list_entry_t *entry;
 
     for (entry = list->head; entry != NULL; entry = entry->next)
     {
         if (entry->data == data)
         {
-            if (entry == list->head)
-            {
-                list->head = entry->next;
-                entry->next = NULL;
-                free(entry);
-            }
-            else
-            {
-                previous->next = entry->next;
-                entry->next = NULL;
-                free(entry);
-            }
+            linked_list_unlink(list, entry);
 
             pthread_mutex_unlock(&list->mutex);
             return;
         }
-
-        previous = entry;
     }
 
     assert(false);
 }
 
+void linked_list_remove_entry(linked_list_t *list, linked_list_entry_t *entry)
+{
+    pthread_mutex_lock(&list->mutex);
+
+    linked_list_unlink(list, entry);
+
+    pthread_mutex_unlock(&list->mutex);
+}
+
@@ -26,6 +26,7 @@
 typedef struct linked_list_entry_t
 {
     struct linked_list_entry_t *next;
+    struct linked_list_entry_t *prev;
     void *data;
 } linked_list_entry_t;
 
@@ -56,8 +57,10 @@ void linked_list_delete(linked_list_t *list);
  *
  * @param[in]  list  Pointer to the list
  * @param[in]  data  Data entry to be added
+ *
+ * @return Pointer to the list entry holding the data
  */
-void linked_list_add(linked_list_t *list, void *data);
+linked_list_entry_t *linked_list_add(linked_list_t *list, void *data);
 
 /**
  * Removes data entry from the list. The data MUST be present in the list,
@@ -69,4 +72,12 @@ void linked_list_add(linked_list_t *list, void *data);
  */
 void linked_list_remove(linked_list_t *list, void *data);
 
+/**
+ * Removes list entry returned by linked_list_add() without searching for it.
+ *
+ * @param[in]  list   Pointer to the list
+ * @param[in]  entry  List entry to be removed, it is freed
+ */
+void linked_list_remove_entry(linked_list_t *list, linked_list_entry_t *entry);
+
 #endif // REST_LIST_H
@@ -28,6 +28,8 @@
 
 #include <punica/version.h>
 #include "database.h"
+#include "event_loop.h"
+#include "hash_table.h"
 #include "punica.h"
 #include "udp_connection_api.h"
 #include "dtls_connection_api.h"
@@ -39,6 +41,11 @@
 #include "plugin_manager/basic_plugin_manager.h"
 #include "plugin_manager/basic_core.h"
 
+#define PUNICA_STEP_INTERVAL    5
+#define PUNICA_RECEIVE_BUDGET   32
+// milliseconds between notification delivery retries while coap socket is paused
+#define PUNICA_CONGESTION_INTERVAL  100
+
 static volatile int punica_quit;
 static void sigint_handler(int signo)
 {
@@ -98,12 +105,11 @@ static connection_api_t *api_init(coap_settings_t *coap, void *data, f_psk_cb_t
 {
     if (coap->security_mode == PUNICA_COAP_MODE_INSECURE)
     {
-        return udp_connection_api_init(coap->port, AF_INET6);
+        return udp_connection_api_init(coap, AF_INET6);
     }
     else if (coap->security_mode == PUNICA_COAP_MODE_SECURE)
     {
-        return dtls_connection_api_init(coap->port, AF_INET6, coap->certificate_file,
-                                        coap->private_key_file, data, psk_cb, handshake_done_cb);
+        return dtls_connection_api_init(coap, AF_INET6, data, psk_cb, handshake_done_cb);
     }
     else
     {
@@ -171,33 +177,13 @@ void client_monitor_cb(uint16_t clientID, lwm2m_uri_t *uriP, int status,
     case COAP_204_CHANGED:
         if (status == COAP_201_CREATED)
         {
-            rest_notif_registration_t *regNotif = rest_notif_registration_new();
-
-            if (regNotif != NULL)
-            {
-                rest_notif_registration_set(regNotif, client->name);
-                rest_notify_registration(rest, regNotif);
-            }
-            else
-            {
-                log_message(LOG_LEVEL_ERROR, "[MONITOR] Failed to allocate registration notification!\n");
-            }
+            rest_notify_registration(rest, client->name);
 
             log_message(LOG_LEVEL_INFO, "[MONITOR] Client %d registered.\n", clientID);
         }
         else
         {
-            rest_notif_update_t *updateNotif = rest_notif_update_new();
-
-            if (updateNotif != NULL)
-            {
-                rest_notif_update_set(updateNotif, client->name);
-                rest_notify_update(rest, updateNotif);
-            }
-            else
-            {
-                log_message(LOG_LEVEL_ERROR, "[MONITOR] Failed to allocate update notification!\n");
-            }
+            rest_notify_update(rest, client->name);
 
             log_message(LOG_LEVEL_INFO, "[MONITOR] Client %d updated.\n", clientID);
         }
@@ -225,17 +211,7 @@ void client_monitor_cb(uint16_t clientID, lwm2m_uri_t *uriP, int status,
 
     case COAP_202_DELETED:
     {
-        rest_notif_deregistration_t *deregNotif = rest_notif_deregistration_new();
-
-        if (deregNotif != NULL)
-        {
-            rest_notif_deregistration_set(deregNotif, client->name);
-            rest_notify_deregistration(rest, deregNotif);
-        }
-        else
-        {
-            log_message(LOG_LEVEL_ERROR, "[MONITOR] Failed to allocate deregistration notification!\n");
-        }
+        rest_notify_deregistration(rest, client->name);
 
         log_message(LOG_LEVEL_INFO, "[MONITOR] Client %d deregistered.\n", clientID);
         break;
@@ -251,57 +227,65 @@ int identifier_find_callback(session_t connection, void *public_data, size_t pub
 {
     rest_context_t *rest = (rest_context_t *)data;
     database_entry_t *device_data;
-    linked_list_entry_t *device_entry;
-    linked_list_t *device_list = rest->devicesList;
     connection_api_t *conn_api = rest->connection_api;
+    int ret = -1;
 
-    if (device_list == NULL)
+    if (rest->devices == NULL)
     {
         return -1;
     }
 
-    for (device_entry = device_list->head; device_entry != NULL; device_entry = device_entry->next)
+    rest_lock(rest);
+
+    device_data = database_get_entry_by_psk_identity(rest->devices, public_data,
+                                                     public_data_length);
+    if (device_data == NULL)
     {
-        device_data = (database_entry_t *)device_entry->data;
+        device_data = database_get_entry_by_certificate(rest->devices, public_data,
+                                                        public_data_length);
+    }
 
-        if (public_data_length == device_data->public_key_len
-            && memcmp(public_data, device_data->public_key, device_data->public_key_len) == 0)
-        {
-            conn_api->f_set_identifier(connection, device_data->uuid);
-            return 0;
-        }
+    if (device_data != NULL)
+    {
+        conn_api->f_set_identifier(connection, device_data->uuid);
+        ret = 0;
     }
 
-    return -1;
+    rest_unlock(rest);
+
+    return ret;
 }
 
 int psk_find_callback(const char *name, void *data, uint8_t **psk_buffer, size_t *psk_len)
 {
     database_entry_t *device_data;
-    linked_list_entry_t *device_entry;
     rest_context_t *rest = (rest_context_t *)data;
-    linked_list_t *device_list = rest->devicesList;
 
-    if (device_list == NULL)
+    int ret = -1;
+
+    if (rest->devices == NULL)
     {
         return -1;
     }
 
-    for (device_entry = device_list->head; device_entry != NULL; device_entry = device_entry->next)
-    {
-        device_data = (database_entry_t *)device_entry->data;
+    // devices can be changed through REST API meanwhile
+    rest_lock(rest);
 
-        if (device_data->mode == DEVICE_CREDENTIALS_PSK
-            && device_data->public_key_len == strlen(name)
-            && memcmp(name, device_data->public_key, device_data->public_key_len) == 0)
+    device_data = database_get_entry_by_psk_identity(rest->devices, name, strlen(name));
+    if (device_data != NULL)
+    {
+        *psk_buffer = malloc(device_data->secret_key_len);
+        if (*psk_buffer != NULL)
         {
-            *psk_buffer = device_data->secret_key;
+            memcpy(*psk_buffer, device_data->secret_key, device_data->secret_key_len);
             *psk_len = device_data->secret_key_len;
-            return 0;
+            ret = 0;
         }
     }
 
-    return -1;
+    rest_unlock(rest);
+
+    return ret;
 }
 
 uint8_t lwm2m_buffer_send(session_t session, uint8_t *buffer, size_t length, void *user_data)
@@ -333,7 +317,6 @@ bool lwm2m_name_is_valid(const char *name, session_t session, void *user_data)
 {
     rest_context_t *rest = (rest_context_t *)user_data;
     connection_api_t *api = rest->connection_api;
-    linked_list_t *device_list = rest->devicesList;
     database_entry_t *device_entry;
     const char *uuid;
 
@@ -348,7 +331,7 @@ bool lwm2m_name_is_valid(const char *name, session_t session, void *user_data)
         return false;
     }
 
-    device_entry = database_get_entry_by_uuid(device_list, uuid);
+    device_entry = database_get_entry_by_uuid(rest->devices, uuid);
     if (device_entry == NULL)
     {
         return false;
@@ -357,16 +340,197 @@ bool lwm2m_name_is_valid(const char *name, session_t session, void *user_data)
     return strcmp(name, device_entry->name) == 0;
 }
 
-int main(int argc, char *argv[])
+typedef struct
+{
+    lwm2m_context_t *lwm2m;
+    // sessions of registered clients, built on first use
+    hash_table_t *sessions;
+} punica_session_set_t;
+
+static bool punica_session_in_use(session_t session, void *data)
+{
+    punica_session_set_t *set = (punica_session_set_t *)data;
+    lwm2m_client_t *client;
+
+    // most reaper passes don't find idle peers, so the set is only built when needed
+    if (set->sessions == NULL)
+    {
+        set->sessions = hash_table_new();
+        if (set->sessions == NULL)
+        {
+            return true;
+        }
+
+        for (client = set->lwm2m->clientList; client != NULL; client = client->next)
+        {
+            if (hash_table_put(set->sessions, &client->sessionH, sizeof(client->sessionH), client))
+            {
+                hash_table_delete(set->sessions);
+                set->sessions = NULL;
+                return true;
+            }
+        }
+    }
+
+    return hash_table_get(set->sessions, &session, sizeof(session)) != NULL;
+}
+
+static void punica_reap_connections(rest_context_t *rest)
+{
+    connection_api_t *conn_api = rest->connection_api;
+    punica_session_set_t set =
+    {
+        .lwm2m = rest->lwm2m,
+        .sessions = NULL,
+    };
+
+    conn_api->f_reap(conn_api, punica_session_in_use, &set);
+
+    hash_table_delete(set.sessions);
+}
+
+static void punica_step_cb(event_loop_t *loop, void *data)
+{
+    rest_context_t *rest = (rest_context_t *)data;
+    time_t timeout = PUNICA_STEP_INTERVAL;
+    int res;
+
+    rest_lock(rest);
+    res = lwm2m_step(rest->lwm2m, &timeout);
+    if (res)
+    {
+        log_message(LOG_LEVEL_ERROR, "lwm2m_step() error: %d\n", res);
+    }
+
+    if (timeout > PUNICA_STEP_INTERVAL)
+    {
+        timeout = PUNICA_STEP_INTERVAL;
+    }
+
+    // armed before rest_step(), which can only bring the timer closer
+    if (event_loop_set_timer(loop, timeout * 1000) != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to set timer: %s\n", strerror(errno));
+    }
+
+    res = rest_step(rest, NULL);
+    if (res)
+    {
+        log_message(LOG_LEVEL_ERROR, "rest_step() error: %d\n", res);
+    }
+
+    punica_reap_connections(rest);
+    rest_unlock(rest);
+}
+
+static void punica_receive_batch(rest_context_t *rest)
+{
+    connection_api_t *conn_api = rest->connection_api;
+    static connection_packet_t packets[PUNICA_RECEIVE_BUDGET];
+    size_t budget;
+    int res, count, i;
+
+    // every packet can queue an event, read only as many as the queue can take
+    budget = rest_notifications_space(rest);
+    if (budget == 0)
+    {
+        return;
+    }
+    else if (budget > PUNICA_RECEIVE_BUDGET)
+    {
+        budget = PUNICA_RECEIVE_BUDGET;
+    }
+
+    count = conn_api->f_receive_batch(conn_api, packets, budget);
+    if (count < 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "conn_api->f_receive_batch() error: %d\n", count);
+        return;
+    }
+
+    rest_lock(rest);
+    for (i = 0; i < count; i++)
+    {
+        lwm2m_handle_packet(rest->lwm2m, packets[i].buffer, packets[i].length,
+                            packets[i].connection);
+    }
+
+    res = rest_step(rest, NULL);
+    if (res)
+    {
+        log_message(LOG_LEVEL_ERROR, "rest_step() error: %d\n", res);
+    }
+    rest_unlock(rest);
+}
+
+static void punica_receive_cb(event_loop_t *loop, void *data)
 {
+    rest_context_t *rest = (rest_context_t *)data;
+    connection_api_t *conn_api = rest->connection_api;
+    static uint8_t buffer[1500];
     struct timeval tv;
+    session_t connection;
+    int res, count;
+
+    if (conn_api->f_receive_batch != NULL)
+    {
+        punica_receive_batch(rest);
+        return;
+    }
+
+    /*
+     * Socket is level-triggered, so the budget only bounds how long
+     * timer and wakeup events can be delayed by a burst of packets.
+     */
+    for (count = 0; count < PUNICA_RECEIVE_BUDGET; count++)
+    {
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+
+        res = conn_api->f_receive(conn_api, buffer, sizeof(buffer), &connection, &tv);
+        if (res < 0)
+        {
+            if (errno != EINTR)
+            {
+                log_message(LOG_LEVEL_ERROR, "conn_api->f_receive() error: %d\n", res);
+            }
+            break;
+        }
+        else if (res == 0)
+        {
+            break;
+        }
+
+        rest_lock(rest);
+        lwm2m_handle_packet(rest->lwm2m, buffer, res, connection);
+        rest_unlock(rest);
+
+        if (rest_notifications_congested(rest))
+        {
+            break;
+        }
+    }
+
+    // deliver events produced by handled packets without waiting for the timer
+    rest_lock(rest);
+    res = rest_step(rest, NULL);
+    if (res)
+    {
+        log_message(LOG_LEVEL_ERROR, "rest_step() error: %d\n", res);
+    }
+    rest_unlock(rest);
+}
+
+int main(int argc, char *argv[])
+{
     int res;
+    int sock;
+    bool congested, coap_paused = false;
     rest_context_t rest;
     connection_api_t *conn_api;
-    uint8_t buffer[1500];
+    event_loop_t *event_loop;
     basic_punica_core_t *punica_core;
     basic_plugin_manager_t *plugin_manager;
-    session_t connection;
 
     static settings_t settings =
     {
@@ -386,6 +550,21 @@ int main(int argc, char *argv[])
                     .expiration_time = 3600,
                 },
             },
+            .notifications = {
+                .queue_size = 65536,
+                .overflow = REST_EVENTS_OVERFLOW_DROP,
+                .retention = 4096,
+            },
+            .callback = {
+                .max_events = 10000,
+                .max_bytes = 1048576,
+                .linger = 0,
+                .compression = REST_DISPATCHER_COMPRESSION_NONE,
+                .retry_min = 1000,
+                .retry_max = 60000,
+                .memory_limit = 16777216,
+                .spool_directory = NULL,
+            },
         },
         .coap = {
             .security_mode = PUNICA_COAP_MODE_INSECURE,
@@ -393,6 +572,24 @@ int main(int argc, char *argv[])
             .private_key_file = NULL,
             .certificate_file = NULL,
             .database_file = NULL,
+            .database_format = PUNICA_DATABASE_FORMAT_JSON,
+            .database_storage = PUNICA_DATABASE_STORAGE_FILE,
+            .journal = {
+                .sync_interval = 100,
+                .compaction_size = 1024,
+            },
+            .idle_timeout = 300,
+            .handshake_timeout = 30,
+            .session_cache_size = 4096,
+            .session_lifetime = 3600,
+            .session_tickets = false,
+            .crypto_workers = 0,
+            .key_pool_size = 32,
+            .handshake_limits = {
+                .rate = 0,
+                .host_rate = 20,
+                .half_open = 1024,
+            },
         },
         .logging = {
             .level = LOG_LEVEL_WARN,
@@ -418,7 +615,10 @@ int main(int argc, char *argv[])
 
     init_signals();
 
-    rest_init(&rest, &settings);
+    if (rest_init(&rest, &settings) != 0)
+    {
+        return -1;
+    }
 
     conn_api = api_init(&settings.coap, &rest, psk_find_callback, identifier_find_callback);
     if (conn_api == NULL)
@@ -431,8 +631,8 @@ int main(int argc, char *argv[])
     /* Socket section */
     log_message(LOG_LEVEL_INFO, "Creating coap socket on port %d\n", settings.coap.port);
 
-    res = conn_api->f_start(conn_api);
-    if (res < 0)
+    sock = conn_api->f_start(conn_api);
+    if (sock < 0)
     {
         log_message(LOG_LEVEL_FATAL, "Failed to create socket!\n");
         return -1;
@@ -450,6 +650,23 @@ int main(int argc, char *argv[])
 
     lwm2m_set_monitoring_callback(rest.lwm2m, client_monitor_cb, &rest);
 
+    /* Event loop section */
+    event_loop = event_loop_new(punica_step_cb, &rest);
+    if (event_loop == NULL)
+    {
+        log_message(LOG_LEVEL_FATAL, "Failed to create event loop!\n");
+        return -1;
+    }
+
+    if (event_loop_add(event_loop, sock, punica_receive_cb, &rest) != 0
+        || event_loop_set_timer(event_loop, 0) != 0)
+    {
+        log_message(LOG_LEVEL_FATAL, "Failed to watch coap socket!\n");
+        return -1;
+    }
+
+    rest.event_loop = event_loop;
+
     /* REST server section */
     struct _u_instance instance;
 
@@ -479,6 +696,8 @@ int main(int argc, char *argv[])
                                &rest_devices_put_cb, &rest);
     ulfius_add_endpoint_by_val(&instance, "POST", "/devices", NULL, 10,
                                &rest_devices_post_cb, &rest);
+    ulfius_add_endpoint_by_val(&instance, "POST", "/devices", "batch", 10,
+                               &rest_devices_batch_post_cb, &rest);
     ulfius_add_endpoint_by_val(&instance, "DELETE", "/devices", ":id", 10,
                                &rest_devices_delete_cb, &rest);
 
@@ -493,8 +712,18 @@ int main(int argc, char *argv[])
                                &rest_notifications_put_callback_cb, &rest);
     ulfius_add_endpoint_by_val(&instance, "DELETE", "/notification/callback", NULL, 10,
                                &rest_notifications_delete_callback_cb, &rest);
+    ulfius_add_endpoint_by_val(&instance, "GET", "/notification/callbacks", NULL, 10,
+                               &rest_notifications_get_callbacks_cb, &rest);
+    ulfius_add_endpoint_by_val(&instance, "GET", "/notification/callbacks", ":name", 10,
+                               &rest_notifications_get_callbacks_name_cb, &rest);
+    ulfius_add_endpoint_by_val(&instance, "PUT", "/notification/callbacks", ":name", 10,
+                               &rest_notifications_put_callbacks_name_cb, &rest);
+    ulfius_add_endpoint_by_val(&instance, "DELETE", "/notification/callbacks", ":name", 10,
+                               &rest_notifications_delete_callbacks_name_cb, &rest);
     ulfius_add_endpoint_by_val(&instance, "GET", "/notification/pull", NULL, 10,
                                &rest_notifications_pull_cb, &rest);
+    ulfius_add_endpoint_by_val(&instance, "GET", "/notification/stream", NULL, 10,
+                               &rest_notifications_stream_cb, &rest);
 
     // Subscriptions
     ulfius_add_endpoint_by_val(&instance, "PUT", "/subscriptions", ":name/*", 10,
@@ -565,37 +794,32 @@ int main(int argc, char *argv[])
     /* Main section */
     while (!punica_quit)
     {
-        tv.tv_sec = 5;
-        tv.tv_usec = 0;
-
-        rest_lock(&rest);
-        res = lwm2m_step(rest.lwm2m, &tv.tv_sec);
-        if (res)
+        if (event_loop_run_once(event_loop) != 0 && errno != EINTR)
         {
-            log_message(LOG_LEVEL_ERROR, "lwm2m_step() error: %d\n", res);
+            log_message(LOG_LEVEL_ERROR, "event_loop_run_once() error: %s\n", strerror(errno));
         }
 
-        res = rest_step(&rest, &tv);
-        if (res)
+        // hold back CoAP packets while their notifications can't be queued
+        congested = rest_notifications_congested(&rest);
+        if (congested != coap_paused)
         {
-            log_message(LOG_LEVEL_ERROR, "rest_step() error: %d\n", res);
+            if (event_loop_pause(event_loop, sock, congested) != 0)
+            {
+                log_message(LOG_LEVEL_ERROR, "Failed to pause coap socket: %s\n", strerror(errno));
+            }
+            coap_paused = congested;
         }
-        rest_unlock(&rest);
 
-        res = conn_api->f_receive(conn_api, buffer, sizeof(buffer), &connection, &tv);
-        if (res < 0)
+        if (coap_paused && event_loop_set_timer_min(event_loop, PUNICA_CONGESTION_INTERVAL) != 0)
         {
-            if (errno == EINTR)
-            {
-                continue;
-            }
-            log_message(LOG_LEVEL_ERROR, "conn_api->f_receive() error: %d\n", res);
+            log_message(LOG_LEVEL_ERROR, "Failed to set timer: %s\n", strerror(errno));
         }
-        else if (res)
+
+        // send everything queued during this iteration, paced data is sent later
+        res = conn_api->f_flush(conn_api);
+        if (res > 0 && event_loop_set_timer_min(event_loop, res) != 0)
         {
-            rest_lock(&rest);
-            lwm2m_handle_packet(rest.lwm2m, buffer, res, connection);
-            rest_unlock(&rest);
+            log_message(LOG_LEVEL_ERROR, "Failed to set timer: %s\n", strerror(errno));
         }
     }
 
@@ -604,9 +828,13 @@ int main(int argc, char *argv[])
     basic_plugin_manager_delete(plugin_manager);
     basic_punica_core_delete(punica_core);
 
+    rest_notifications_close(&rest);
     ulfius_stop_framework(&instance);
     ulfius_clean_instance(&instance);
 
+    rest.event_loop = NULL;
+    event_loop_delete(event_loop);
+
     conn_api->f_stop(conn_api);
     api_deinit(settings.coap.security_mode, conn_api);
     lwm2m_close(rest.lwm2m);
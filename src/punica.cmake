@@ -10,15 +10,31 @@ set(PUNICA_SOURCES_DIR ${CMAKE_CURRENT_LIST_DIR})
 set(PUNICA_SOURCES
     ${PUNICA_SOURCES}
     ${PUNICA_SOURCES_DIR}/punica.c
+    ${PUNICA_SOURCES_DIR}/dtls_session_cache.c
+    ${PUNICA_SOURCES_DIR}/egress_queue.c
+    ${PUNICA_SOURCES_DIR}/event_loop.c
+    ${PUNICA_SOURCES_DIR}/handshake_limiter.c
+    ${PUNICA_SOURCES_DIR}/hash_table.c
+    ${PUNICA_SOURCES_DIR}/key_pool.c
     ${PUNICA_SOURCES_DIR}/linked_list.c
     ${PUNICA_SOURCES_DIR}/logging.c
     ${PUNICA_SOURCES_DIR}/settings.c
+    ${PUNICA_SOURCES_DIR}/sockaddr_key.c
     ${PUNICA_SOURCES_DIR}/security.c
+    ${PUNICA_SOURCES_DIR}/timer_wheel.c
     ${PUNICA_SOURCES_DIR}/database.c
+    ${PUNICA_SOURCES_DIR}/database_file_storage.c
+    ${PUNICA_SOURCES_DIR}/database_journal.c
+    ${PUNICA_SOURCES_DIR}/database_snapshot.c
     ${PUNICA_SOURCES_DIR}/udp_connection_api.c
     ${PUNICA_SOURCES_DIR}/dtls_connection_api.c
     )
 
+if(LMDB)
+    set(PUNICA_SOURCES ${PUNICA_SOURCES} ${PUNICA_SOURCES_DIR}/database_lmdb_storage.c)
+    add_definitions(-DPUNICA_LMDB)
+endif()
+
 set(PUNICA_SOURCES ${PUNICA_SOURCES} ${REST_SOURCES})
 set(PUNICA_SOURCES ${PUNICA_SOURCES} ${PLUGIN_MANAGER_SOURCES})
 
@@ -25,7 +25,11 @@
 #include <ulfius.h>
 
 #include "rest/rest_core_types.h"
+#include "rest/rest_dispatcher.h"
+#include "rest/rest_events.h"
+#include "rest/rest_subscribers.h"
 #include "rest/rest_utils.h"
+#include "event_loop.h"
 #include "settings.h"
 
 /*
@@ -54,7 +58,7 @@ typedef void *session_t;
  *      context - connection context pointer
  *
  * Returns:
- *      0 on success,
+ *      listening socket file descriptor on success,
  *      negative value on error
 */
 typedef int (*f_start_t)(void *context);
@@ -78,7 +82,36 @@ typedef int (*f_start_t)(void *context);
 typedef int (*f_receive_t)(void *context, uint8_t *buffer, size_t size, session_t *connection,
                            struct timeval *tv);
 /*
- * Send data to peer
+ * Received datagram, filled by f_receive_batch_t
+ */
+typedef struct
+{
+    uint8_t *buffer;
+    size_t length;
+    session_t connection;
+} connection_packet_t;
+
+/*
+ * Non-blocking batched receive. Pulls up to 'count' datagrams at once.
+ * Packet buffers are owned by connection context and stay valid until
+ * the next call
+ *
+ * Parameters:
+ *      context - connection context pointer,
+ *      packets - preallocated array of at least 'count' packets. Has set values after return,
+ *      count - maximum number of packets to receive
+ *
+ * Returns:
+ *      0 on no data available,
+ *      positive number of packets received,
+ *      negative value on error
+ *
+ * Notes:
+ *      This function is optional, connection API may set it to NULL
+*/
+typedef int (*f_receive_batch_t)(void *context, connection_packet_t *packets, size_t count);
+/*
+ * Queue data to be sent to peer on the next f_flush_t call
  *
  * Parameters:
  *      context - connection context pointer,
@@ -103,6 +136,43 @@ typedef int (*f_send_t)(void *context, session_t connection, uint8_t *buffer, si
  *      negative value on error
 */
 typedef int (*f_close_t)(void *context, session_t connection);
+/*
+ * Sends data queued by f_send_t, as far as pacing allows
+ *
+ * Parameters:
+ *      context - connection context pointer
+ *
+ * Returns:
+ *      0 if all queued data was sent,
+ *      positive number of milliseconds until the next flush is due
+*/
+typedef int (*f_flush_t)(void *context);
+/*
+ * Called by connection API to check whether an idle connection is still used
+ * by upper communications layers
+ *
+ * Parameters:
+ *      connection - server/client connection context for upper communications layers,
+ *      data - pointer to data provided to f_reap_t
+ *
+ * Returns:
+ *      true if connection has to be kept,
+ *      false if it can be closed
+*/
+typedef bool (*f_session_in_use_cb_t)(session_t connection, void *data);
+/*
+ * Closes connections which were idle for longer than configured timeout
+ * and are not in use
+ *
+ * Parameters:
+ *      context - connection context pointer,
+ *      in_use_cb - callback called for every idle connection,
+ *      data - pointer to data later provided to in_use_cb
+ *
+ * Returns:
+ *      number of closed connections
+*/
+typedef int (*f_reap_t)(void *context, f_session_in_use_cb_t in_use_cb, void *data);
 /*
  * Stops and deinitializes communication context. Closes connections with all peers
  *
@@ -148,8 +218,11 @@ typedef struct connection_api_t
 {
     f_start_t    f_start;
     f_receive_t  f_receive;
+    f_receive_batch_t f_receive_batch;
     f_send_t     f_send;
     f_close_t    f_close;
+    f_flush_t    f_flush;
+    f_reap_t     f_reap;
     f_stop_t     f_stop;
     f_get_identifier_t f_get_identifier;
     f_set_identifier_t f_set_identifier;
@@ -158,7 +231,9 @@ typedef struct connection_api_t
 /*
  * Called during DTLS handshake with PSK key exchange. User has to search for user 'name'
  * credentials in database 'data', which was provided to connection context during
- * initialization. Found psk has to be pointed at by 'psk', and it's length set in 'psk_len'
+ * initialization. Found psk has to be copied to a buffer allocated with malloc() and pointed
+ * at by 'psk', and it's length set in 'psk_len'. Buffer is freed by connection api.
+ * Might be called from DTLS crypto worker threads.
  *
  * Parameters:
  *      name - DTLS client name,
@@ -200,13 +275,22 @@ typedef struct
 
     // rest_core
     json_t *callback;
+    rest_dispatcher_t *dispatcher;
 
     // rest_notifications
-    linked_list_t *registrationList;
-    linked_list_t *updateList;
-    linked_list_t *deregistrationList;
-    linked_list_t *timeoutList;
-    linked_list_t *asyncResponseList;
+    rest_event_ring_t *events;
+    rest_event_log_t *event_log;
+    // last event sent to the callback or pulled without a cursor
+    uint64_t notified_sequence;
+    // events were pulled without a cursor, so block overflow waits for such pulls too
+    bool cursorless_pull;
+    // rest_subscriber_t list of /notification/callbacks collection
+    linked_list_t *subscribers;
+    // serializes collection changes, which start and stop dispatchers without REST lock
+    pthread_mutex_t subscribers_mutex;
+    // signaled when new events are added to the log or server is stopping
+    pthread_cond_t events_cond;
+    bool closing;
 
     // rest_resources
     linked_list_t *pendingResponseList;
@@ -215,11 +299,16 @@ typedef struct
     linked_list_t *observeList;
 
     // rest_devices
-    linked_list_t *devicesList;
+    device_database_t *devices;
+    device_signer_t *signer;
+    key_pool_t *key_pool;
 
     settings_t *settings;
 
     connection_api_t *connection_api;
+
+    // core event loop, woken up after REST handlers start new LwM2M transactions
+    event_loop_t *event_loop;
 } rest_context_t;
 
 lwm2m_client_t *rest_endpoints_find_client(lwm2m_client_t *list, const char *name);
@@ -231,31 +320,99 @@ int rest_endpoints_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *c
 int rest_resources_rwe_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 
 
-void rest_notify_registration(rest_context_t *rest, rest_notif_registration_t *reg);
-void rest_notify_update(rest_context_t *rest, rest_notif_update_t *update);
-void rest_notify_deregistration(rest_context_t *rest, rest_notif_deregistration_t *dereg);
-void rest_notify_timeout(rest_context_t *rest, rest_notif_timeout_t *timeout);
-void rest_notify_async_response(rest_context_t *rest, rest_notif_async_response_t *resp);
+void rest_notify_registration(rest_context_t *rest, const char *name);
+void rest_notify_update(rest_context_t *rest, const char *name);
+void rest_notify_deregistration(rest_context_t *rest, const char *name);
+void rest_notify_async_response(rest_context_t *rest, const char *name,
+                                rest_async_response_t *resp);
+
+/*
+ * Checks if CoAP packets have to be held back, because notification queue is
+ * full and configured not to drop notifications
+ */
+bool rest_notifications_congested(rest_context_t *rest);
+
+/*
+ * Returns how many events can be queued before CoAP packets have to be held
+ * back, SIZE_MAX if notifications are dropped instead
+ */
+size_t rest_notifications_space(rest_context_t *rest);
+
+/*
+ * Moves queued events to the notification log, must be called with REST lock held
+ */
+void rest_notifications_collect(rest_context_t *rest);
 
-json_t *rest_notifications_json(rest_context_t *rest);
+/*
+ * Builds notification object from logged events
+ *
+ * Parameters:
+ *      rest - REST context pointer,
+ *      after - sequence number of the last event already seen by consumer,
+ *      max - maximum number of included events,
+ *      last - sequence number of the last included event, is set after return
+ *
+ * Returns:
+ *      notification object
+ */
+json_t *rest_notifications_json(rest_context_t *rest, uint64_t after, size_t max,
+                                uint64_t *last);
 
-void rest_notifications_clear(rest_context_t *rest);
+/*
+ * Serializes logged events into a callback batch, same as object built by
+ * rest_notifications_json()
+ *
+ * Parameters:
+ *      rest - REST context pointer,
+ *      subscriber - subscriber whose filters are applied, NULL to include all events,
+ *      after - sequence number of the last event already delivered,
+ *      max_events - maximum number of included events,
+ *      max_bytes - body size after which no more events are included,
+ *      last - sequence number of the last included event, is set after return,
+ *      body - batch body, is set after return and must be freed by caller,
+ *      length - body length, is set after return
+ *
+ * Returns:
+ *      0 on success,
+ *      positive value if no event passed the filters, body is not set then,
+ *      negative value on error
+ */
+int rest_notifications_batch(rest_context_t *rest, const rest_subscriber_t *subscriber,
+                             uint64_t after, size_t max_events, size_t max_bytes,
+                             uint64_t *last, char **body, size_t *length);
 
 int rest_notifications_get_callback_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 int rest_notifications_put_callback_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 int rest_notifications_delete_callback_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
                                           void *context);
 
+int rest_notifications_get_callbacks_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                        void *context);
+int rest_notifications_get_callbacks_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                             void *context);
+int rest_notifications_put_callbacks_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                             void *context);
+int rest_notifications_delete_callbacks_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                                void *context);
+
 
 int rest_notifications_pull_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
+int rest_notifications_stream_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
+/*
+ * Ends notification streams and pull requests that are waiting for events
+ */
+void rest_notifications_close(rest_context_t *rest);
 
 int rest_subscriptions_put_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 int rest_subscriptions_delete_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 
 int rest_version_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 
-void rest_init(rest_context_t *rest, settings_t *settings);
+int rest_init(rest_context_t *rest, settings_t *settings);
 void rest_cleanup(rest_context_t *rest);
+void rest_wakeup(rest_context_t *rest);
+// rest_wakeup() for callbacks with untyped context, e.g. dispatcher wakeups
+void rest_wakeup_cb(void *context);
 int rest_step(rest_context_t *rest, struct timeval *tv);
 
 void rest_lock(rest_context_t *rest);
@@ -265,6 +422,7 @@ int rest_devices_get_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *cont
 int rest_devices_get_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 int rest_devices_put_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 int rest_devices_post_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
+int rest_devices_batch_post_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 int rest_devices_delete_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context);
 
 #endif // PUNICA_H
@@ -6,8 +6,13 @@ set(REST_SOURCES
     ${REST_SOURCES}
     ${REST_SOURCES_DIR}/rest_core.c
     ${REST_SOURCES_DIR}/rest_core_types.c
+    ${REST_SOURCES_DIR}/rest_dispatcher.c
     ${REST_SOURCES_DIR}/rest_endpoints.c
+    ${REST_SOURCES_DIR}/rest_events.c
     ${REST_SOURCES_DIR}/rest_resources.c
+    ${REST_SOURCES_DIR}/rest_spool.c
+    ${REST_SOURCES_DIR}/rest_stream.c
+    ${REST_SOURCES_DIR}/rest_subscribers.c
     ${REST_SOURCES_DIR}/rest_notifications.c
     ${REST_SOURCES_DIR}/rest_subscriptions.c
     ${REST_SOURCES_DIR}/rest_utils.c
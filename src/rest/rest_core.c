@@ -18,118 +18,269 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "../logging.h"
 #include "../punica.h"
 #include "../database.h"
 
-void rest_init(rest_context_t *rest, settings_t *settings)
+int rest_init(rest_context_t *rest, settings_t *settings)
 {
+    pthread_condattr_t cond_attr;
+
     memset(rest, 0, sizeof(rest_context_t));
 
-    rest->registrationList = linked_list_new();
-    rest->updateList = linked_list_new();
-    rest->deregistrationList = linked_list_new();
-    rest->timeoutList = linked_list_new();
-    rest->asyncResponseList = linked_list_new();
     rest->pendingResponseList = linked_list_new();
     rest->observeList = linked_list_new();
+    rest->subscribers = linked_list_new();
     rest->settings = settings;
 
+    rest->events = rest_event_ring_new(settings->http.notifications.queue_size);
+    if (rest->events == NULL)
+    {
+        log_message(LOG_LEVEL_FATAL, "Failed to allocate notification queue!\n");
+        return -1;
+    }
+
+    rest->event_log = rest_event_log_new(settings->http.notifications.retention);
+    if (rest->event_log == NULL)
+    {
+        log_message(LOG_LEVEL_FATAL, "Failed to allocate notification log!\n");
+        return -1;
+    }
+
+    rest->dispatcher = rest_dispatcher_new(&settings->http.security, &settings->http.callback,
+                                           REST_DISPATCHER_QUEUE_SIZE, rest_wakeup_cb, rest);
+    if (rest->dispatcher == NULL)
+    {
+        log_message(LOG_LEVEL_FATAL, "Failed to start notification dispatcher!\n");
+        return -1;
+    }
+
     assert(pthread_mutex_init(&rest->mutex, NULL) == 0);
+    assert(pthread_mutex_init(&rest->subscribers_mutex, NULL) == 0);
+
+    // pull timeouts must not depend on wall clock changes
+    assert(pthread_condattr_init(&cond_attr) == 0);
+    assert(pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) == 0);
+    assert(pthread_cond_init(&rest->events_cond, &cond_attr) == 0);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (database_load_file(rest) != 0)
+    {
+        log_message(LOG_LEVEL_FATAL, "Failed to load device database!\n");
+        return -1;
+    }
+
+    // device keys are only needed if server can issue certificates
+    if (settings->coap.certificate_file != NULL && settings->coap.private_key_file != NULL)
+    {
+        rest->key_pool = key_pool_new(settings->coap.key_pool_size);
+    }
+
+    return 0;
+}
+
+static void rest_flush_pending(rest_context_t *rest, rest_dispatcher_t *dispatcher,
+                               const rest_subscriber_t *subscriber, uint64_t *notified_sequence)
+{
+    const rest_dispatcher_settings_t *batch = &rest->settings->http.callback;
+    uint64_t last;
+    char *body;
+    size_t length;
+    int res;
+
+    while (rest_event_log_last(rest->event_log) > *notified_sequence)
+    {
+        res = rest_notifications_batch(rest, subscriber, *notified_sequence, batch->max_events,
+                                       batch->max_bytes, &last, &body, &length);
+        if (res < 0)
+        {
+            break;
+        }
 
-    database_load_file(rest);
+        if (res == 0 && rest_dispatcher_enqueue(dispatcher, body, length) != 0)
+        {
+            free(body);
+            break;
+        }
+
+        *notified_sequence = last;
+    }
 }
 
 void rest_cleanup(rest_context_t *rest)
 {
+    linked_list_entry_t *entry;
+    rest_subscriber_t *subscriber;
+    bool spool = (rest->settings->http.callback.spool_directory != NULL);
+
+    // events still waiting for a batch are kept in the spool over restart
+    if (spool)
+    {
+        rest_notifications_collect(rest);
+    }
+
+    if (spool && rest->callback != NULL)
+    {
+        rest_flush_pending(rest, rest->dispatcher, NULL, &rest->notified_sequence);
+    }
+
+    for (entry = rest->subscribers->head; entry != NULL; entry = entry->next)
+    {
+        subscriber = entry->data;
+
+        if (spool)
+        {
+            rest_flush_pending(rest, subscriber->dispatcher, subscriber,
+                               &subscriber->notified_sequence);
+        }
+        rest_subscriber_delete(subscriber);
+    }
+    linked_list_delete(rest->subscribers);
+    rest->subscribers = NULL;
+
+    rest_dispatcher_delete(rest->dispatcher);
+    rest->dispatcher = NULL;
+
     if (rest->callback)
     {
         json_decref(rest->callback);
         rest->callback = NULL;
     }
 
-    rest_notifications_clear(rest);
-    linked_list_delete(rest->registrationList);
-    linked_list_delete(rest->updateList);
-    linked_list_delete(rest->deregistrationList);
-    linked_list_delete(rest->timeoutList);
-    linked_list_delete(rest->asyncResponseList);
+    rest_event_ring_delete(rest->events);
+    rest->events = NULL;
+    rest_event_log_delete(rest->event_log);
+    rest->event_log = NULL;
     linked_list_delete(rest->pendingResponseList);
     linked_list_delete(rest->observeList);
 
-    devices_database_unload(rest->devicesList);
+    database_delete(rest->devices);
+    device_signer_delete(rest->signer);
+    key_pool_delete(rest->key_pool);
 
+    assert(pthread_cond_destroy(&rest->events_cond) == 0);
+    assert(pthread_mutex_destroy(&rest->subscribers_mutex) == 0);
     assert(pthread_mutex_destroy(&rest->mutex) == 0);
 }
 
-int rest_step(rest_context_t *rest, struct timeval *tv)
+static uint64_t rest_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Moves batches of events after notified_sequence to the dispatcher while
+ * they are due and the dispatcher has space. Linger and size limits are
+ * checked against all pending events, so a filtered batch may be sent
+ * before it fills up.
+ */
+static int rest_step_deliver(rest_context_t *rest, rest_dispatcher_t *dispatcher,
+                             const rest_subscriber_t *subscriber, uint64_t *notified_sequence)
 {
-    ulfius_req_t request;
-    ulfius_resp_t response;
-    json_t *jbody;
-    json_t *jheaders;
-    json_t *value;
-    const char *header;
-    struct _u_map headers;
+    const rest_dispatcher_settings_t *batch = &rest->settings->http.callback;
+    const rest_event_record_t *oldest;
+    uint64_t pending, last, now, deadline;
+    char *body;
+    size_t length;
     int res;
 
-    if ((rest->registrationList->head != NULL
-         || rest->updateList->head != NULL
-         || rest->deregistrationList->head != NULL
-         || rest->asyncResponseList->head != NULL)
-        && rest->callback != NULL)
+    now = rest_now();
+
+    while ((pending = rest_event_log_last(rest->event_log) - *notified_sequence) > 0)
     {
-        const char *url = json_string_value(json_object_get(rest->callback, "url"));
-        jheaders = json_object_get(rest->callback, "headers");
-        u_map_init(&headers);
-        json_object_foreach(jheaders, header, value)
+        // keep notifications until dispatcher wakes the loop up with space for another batch
+        if (rest_dispatcher_is_full(dispatcher))
         {
-            u_map_put(&headers, header, json_string_value(value));
+            return 0;
         }
 
-        log_message(LOG_LEVEL_INFO, "[CALLBACK] Sending to %s\n", url);
+        // partial batch waits for more events until its oldest event lingered long enough
+        oldest = rest_event_log_get(rest->event_log, *notified_sequence + 1);
+        deadline = (oldest != NULL) ? oldest->time + batch->linger : now;
+        if (pending < batch->max_events
+            && rest_event_log_bytes(rest->event_log, *notified_sequence) < batch->max_bytes
+            && now < deadline)
+        {
+            if (rest->event_loop != NULL
+                && event_loop_set_timer_min(rest->event_loop, deadline - now) != 0)
+            {
+                log_message(LOG_LEVEL_WARN, "Failed to set timer\n");
+            }
+            return 0;
+        }
 
-        jbody = rest_notifications_json(rest);
+        res = rest_notifications_batch(rest, subscriber, *notified_sequence, batch->max_events,
+                                       batch->max_bytes, &last, &body, &length);
+        if (res < 0)
+        {
+            return -1;
+        }
 
-        ulfius_init_request(&request);
-        request.http_verb = strdup("PUT");
-        request.http_url = strdup(url);
-        request.timeout = 20;
-        request.check_server_certificate = 0;
-        request.client_cert_file = o_strdup(rest->settings->http.security.certificate);
-        request.client_key_file = o_strdup(rest->settings->http.security.private_key);
-        if ((rest->settings->http.security.certificate != NULL && request.client_cert_file == NULL) ||
-            (rest->settings->http.security.private_key != NULL && request.client_key_file == NULL))
+        if (res == 0 && rest_dispatcher_enqueue(dispatcher, body, length) != 0)
         {
-            log_message(LOG_LEVEL_ERROR, "[CALLBACK] Failed to set client security credentials\n");
+            free(body);
+            return 0;
+        }
 
-            json_decref(jbody);
-            u_map_clean(&headers);
-            ulfius_clean_request(&request);
+        *notified_sequence = last;
+    }
 
-            return -1;
-        }
+    return 0;
+}
+
+int rest_step(rest_context_t *rest, struct timeval *tv)
+{
+    linked_list_entry_t *entry;
+    rest_subscriber_t *subscriber;
+    int res = 0;
 
-        u_map_copy_into(request.map_header, &headers);
+    rest_notifications_collect(rest);
 
-        ulfius_set_json_body_request(&request, jbody);
-        json_decref(jbody);
+    if (rest->callback != NULL
+        && rest_step_deliver(rest, rest->dispatcher, NULL, &rest->notified_sequence) != 0)
+    {
+        res = -1;
+    }
 
-        ulfius_init_response(&response);
-        res = ulfius_send_http_request(&request, &response);
-        if (res == U_OK)
+    // subscribers don't wait for each other, each has its own dispatcher
+    for (entry = rest->subscribers->head; entry != NULL; entry = entry->next)
+    {
+        subscriber = entry->data;
+
+        if (rest_step_deliver(rest, subscriber->dispatcher, subscriber,
+                              &subscriber->notified_sequence) != 0)
         {
-            rest_notifications_clear(rest);
+            res = -1;
         }
+    }
 
-        u_map_clean(&headers);
-        ulfius_clean_request(&request);
-        ulfius_clean_response(&response);
+    return res;
+}
+
+void rest_wakeup(rest_context_t *rest)
+{
+    if (rest->event_loop == NULL)
+    {
+        return;
     }
 
-    return 0;
+    if (event_loop_wakeup(rest->event_loop) != 0)
+    {
+        log_message(LOG_LEVEL_WARN, "Failed to wake up event loop\n");
+    }
+}
+
+void rest_wakeup_cb(void *context)
+{
+    rest_wakeup((rest_context_t *)context);
 }
 
 void rest_lock(rest_context_t *rest)
@@ -276,141 +276,3 @@ int rest_async_response_set(rest_async_response_t *response, int status,
     return 0;
 }
 
-rest_notif_registration_t *rest_notif_registration_new(void)
-{
-    rest_notif_registration_t *registration;
-
-    registration = malloc(sizeof(rest_notif_registration_t));
-    if (registration == NULL)
-    {
-        return NULL;
-    }
-
-    memset(registration, 0, sizeof(rest_notif_registration_t));
-
-    return registration;
-}
-
-void rest_notif_registration_delete(rest_notif_registration_t *registration)
-{
-    if (registration->name)
-    {
-        free((void *)registration->name);
-        registration->name = NULL;
-    }
-
-    free(registration);
-}
-
-int rest_notif_registration_set(rest_notif_registration_t *registration, const char *name)
-{
-    if (registration->name)
-    {
-        free((void *)registration->name);
-        registration->name = NULL;
-    }
-
-    if (name != NULL)
-    {
-        registration->name = strdup(name);
-        if (registration->name == NULL)
-        {
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-rest_notif_update_t *rest_notif_update_new(void)
-{
-    rest_notif_update_t *update;
-
-    update = malloc(sizeof(rest_notif_update_t));
-    if (update == NULL)
-    {
-        return NULL;
-    }
-
-    memset(update, 0, sizeof(rest_notif_update_t));
-
-    return update;
-}
-
-void rest_notif_update_delete(rest_notif_update_t *update)
-{
-    if (update->name)
-    {
-        free((void *)update->name);
-        update->name = NULL;
-    }
-
-    free(update);
-}
-
-int rest_notif_update_set(rest_notif_update_t *update, const char *name)
-{
-    if (update->name)
-    {
-        free((void *)update->name);
-        update->name = NULL;
-    }
-
-    if (name != NULL)
-    {
-        update->name = strdup(name);
-        if (update->name == NULL)
-        {
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-rest_notif_deregistration_t *rest_notif_deregistration_new(void)
-{
-    rest_notif_deregistration_t *deregistration;
-
-    deregistration = malloc(sizeof(rest_notif_deregistration_t));
-    if (deregistration == NULL)
-    {
-        return NULL;
-    }
-
-    memset(deregistration, 0, sizeof(rest_notif_deregistration_t));
-
-    return deregistration;
-}
-
-void rest_notif_deregistration_delete(rest_notif_deregistration_t *deregistration)
-{
-    if (deregistration->name)
-    {
-        free((void *)deregistration->name);
-        deregistration->name = NULL;
-    }
-
-    free(deregistration);
-}
-
-int rest_notif_deregistration_set(rest_notif_deregistration_t *deregistration, const char *name)
-{
-    if (deregistration->name)
-    {
-        free((void *)deregistration->name);
-        deregistration->name = NULL;
-    }
-
-    if (name != NULL)
-    {
-        deregistration->name = strdup(name);
-        if (deregistration->name == NULL)
-        {
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
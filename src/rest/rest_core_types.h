@@ -36,7 +36,6 @@ enum base64_error_t
 
 typedef struct
 {
-    linked_list_t list;
     time_t timestamp;
     char id[40];
     int status;
@@ -45,30 +44,6 @@ typedef struct
 
 typedef rest_notif_async_response_t rest_async_response_t;
 
-typedef struct
-{
-    linked_list_t list;
-    const char *name;
-} rest_notif_registration_t;
-
-typedef struct
-{
-    linked_list_t list;
-    const char *name;
-} rest_notif_update_t;
-
-typedef struct
-{
-    linked_list_t list;
-    const char *name;
-} rest_notif_deregistration_t;
-
-typedef struct
-{
-    linked_list_t list;
-    const char *name;
-} rest_notif_timeout_t;
-
 size_t rest_get_random(void *buf, size_t buflen);
 
 rest_async_response_t *rest_async_response_new(void);
@@ -80,27 +55,6 @@ void rest_async_response_delete(rest_async_response_t *response);
 int rest_async_response_set(rest_async_response_t *resp, int status,
                             const uint8_t *payload, size_t length);
 
-
-rest_notif_registration_t *rest_notif_registration_new(void);
-
-void rest_notif_registration_delete(rest_notif_registration_t *registration);
-
-int rest_notif_registration_set(rest_notif_registration_t *registration, const char *name);
-
-
-rest_notif_update_t *rest_notif_update_new(void);
-
-void rest_notif_update_delete(rest_notif_update_t *update);
-
-int rest_notif_update_set(rest_notif_update_t *update, const char *name);
-
-
-rest_notif_deregistration_t *rest_notif_deregistration_new(void);
-
-void rest_notif_deregistration_delete(rest_notif_deregistration_t *deregistration);
-
-int rest_notif_deregistration_set(rest_notif_deregistration_t *deregistration, const char *name);
-
 /*
  * Decodes base64 string into binary buffer and calculates its length.
  * base64_string [in] - a null-terminated base64 string.
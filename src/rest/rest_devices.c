@@ -17,7 +17,14 @@
  *
  */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <gnutls/gnutls.h>
 
@@ -25,116 +32,75 @@
 #include "../punica.h"
 #include "../linked_list.h"
 #include "../settings.h"
+#include "rest_stream.h"
 
-static int rest_devices_save_list_to_file(linked_list_t *device_list, const char *database_file)
-{
-    json_t *j_database_list;
-
-    j_database_list = json_array();
-
-    if (j_database_list == NULL)
-    {
-        return -1;
-    }
-
-    if (database_list_to_json_array(device_list, j_database_list))
-    {
-        json_decref(j_database_list);
-        return -1;
-    }
-
-    if (json_dump_file(j_database_list, database_file, 0) != 0)
-    {
-        json_decref(j_database_list);
-        return -1;
-    }
-
-    json_decref(j_database_list);
-    return 0;
-}
+#define DEVICES_BATCH_SIZE_MAX      1024
+#define DEVICES_BATCH_WORKERS_MAX   16
+#define DEVICES_STREAM_SCAN_SIZE    256
+#define DEVICES_STREAM_BUFFER_SIZE  4096
 
-static int rest_devices_update_list(linked_list_t *list, const char *id, const char *name)
+typedef struct
 {
-    linked_list_entry_t *device_entry;
-    database_entry_t *device_data;
-    char *new_name;
-
-    for (device_entry = list->head; device_entry != NULL; device_entry = device_entry->next)
-    {
-        device_data = (database_entry_t *)device_entry->data;
-
-        if (strcmp(device_data->uuid, id) == 0)
-        {
-            new_name = strdup(name);
-            if (new_name == NULL)
-            {
-                return -1;
-            }
-
-            free(device_data->name);
-            device_data->name = new_name;
-
-            return 0;
-        }
-    }
-
-    return -1;
-}
-
-static int rest_devices_remove_list(linked_list_t *list, const char *id)
+    json_t *j_devices;
+    database_entry_t **entries;
+    size_t count;
+    atomic_size_t next;
+    const device_signer_t *signer;
+} rest_devices_batch_t;
+
+typedef struct
 {
-    linked_list_entry_t *device_entry;
-    database_entry_t *device_data;
+    rest_context_t *rest;
+    // filters, undefined mode and NULL prefix match every device
+    credentials_mode_t mode;
+    char *name_prefix;
+    size_t remaining;
+    // last device looked at, listing continues after it
+    char *last_uuid;
+    uint64_t last_sequence;
+    size_t count;
+    char *server_key;
+    rest_stream_t output;
+} rest_devices_stream_t;
+
+static json_t *server_key_object(const char *certificate_file)
+{
+    gnutls_datum_t cert_buffer = {NULL, 0};
+    static json_t *j_string;
 
-    for (device_entry = list->head; device_entry != NULL; device_entry = device_entry->next)
+    if (j_string == NULL)
     {
-        device_data = (database_entry_t *)device_entry->data;
-
-        if (strcmp(id, device_data->uuid) == 0)
+        if (gnutls_load_file(certificate_file, &cert_buffer) != 0)
         {
-            linked_list_remove(list, (void *)device_data);
-            database_free_entry(device_data);
-            return 0;
+            return NULL;
         }
+
+        j_string = json_object_from_binary(cert_buffer.data,
+                                           "server_key",
+                                           cert_buffer.size + 1);
+        gnutls_free(cert_buffer.data);
     }
 
-    return -1;
+    return j_string;
 }
 
 static int append_server_key(json_t *j_object, const char *certificate_file)
 {
-    gnutls_datum_t cert_buffer = {NULL, 0};
-    static json_t *j_string;
-    static bool cert_loaded = false;
+    json_t *j_string;
 
     if (!json_is_object(j_object))
     {
         return -1;
     }
 
-    if (cert_loaded == false)
+    j_string = server_key_object(certificate_file);
+    if (j_string == NULL)
     {
-        if (gnutls_load_file(certificate_file, &cert_buffer) != 0)
-        {
-            return -1;
-        }
-
-        j_string = json_object_from_binary(cert_buffer.data,
-                                           "server_key",
-                                           cert_buffer.size + 1);
-        gnutls_free(cert_buffer.data);
-        if (j_string == NULL)
-        {
-            return -1;
-        }
-
-        cert_loaded = true;
+        return -1;
     }
 
     if (json_object_update(j_object, j_string) != 0)
     {
-        json_decref(j_string);
-        cert_loaded = false;
         return -1;
     }
 
@@ -182,8 +148,7 @@ static int json_object_add_binary(json_t *j_object, uint8_t *buffer, const char
     return 0;
 }
 
-static json_t *rest_devices_entry_to_resp(database_entry_t *device_entry,
-                                          const char *certificate_file)
+static json_t *rest_devices_entry_to_json(database_entry_t *device_entry)
 {
     json_t *j_resp_obj = NULL;
     char *mode_string;
@@ -222,6 +187,20 @@ static json_t *rest_devices_entry_to_resp(database_entry_t *device_entry,
         return NULL;
     }
 
+    return j_resp_obj;
+}
+
+static json_t *rest_devices_entry_to_resp(database_entry_t *device_entry,
+                                          const char *certificate_file)
+{
+    json_t *j_resp_obj;
+
+    j_resp_obj = rest_devices_entry_to_json(device_entry);
+    if (j_resp_obj == NULL)
+    {
+        return NULL;
+    }
+
     if (device_entry->mode == DEVICE_CREDENTIALS_CERT)
     {
         if (append_server_key(j_resp_obj, certificate_file))
@@ -260,46 +239,330 @@ static int append_client_key(json_t *j_object, database_entry_t *device_entry)
     return 0;
 }
 
-int rest_devices_get_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
+static device_signer_t *rest_devices_signer(rest_context_t *rest)
 {
-    rest_context_t *rest = (rest_context_t *)context;
-    linked_list_t *device_list = rest->devicesList;
-    database_entry_t *device_data;
-    linked_list_entry_t *device_entry;
-    json_t *j_devices = NULL;
-    json_t *j_entry_object;
+    // CA files are only needed for certificate devices, loading is retried until it succeeds
+    if (rest->signer == NULL)
+    {
+        rest->signer = device_signer_new(rest->settings->coap.certificate_file,
+                                         rest->settings->coap.private_key_file, rest->key_pool);
+    }
+
+    return rest->signer;
+}
+
+static json_t *rest_devices_new_entry_to_resp(database_entry_t *device_entry,
+                                              const char *certificate_file)
+{
+    json_t *j_resp_obj;
+
+    j_resp_obj = rest_devices_entry_to_resp(device_entry, certificate_file);
+    if (j_resp_obj == NULL)
+    {
+        return NULL;
+    }
+
+    if (append_client_key(j_resp_obj, device_entry) != 0)
+    {
+        json_decref(j_resp_obj);
+        return NULL;
+    }
+
+    // private key of the device is only known to the device from now on
+    if (device_entry->mode == DEVICE_CREDENTIALS_CERT)
+    {
+        free(device_entry->secret_key);
+        device_entry->secret_key = NULL;
+        device_entry->secret_key_len = 0;
+    }
+
+    return j_resp_obj;
+}
+
+static const char *rest_devices_entry_fragment(database_entry_t *device_entry)
+{
+    json_t *j_entry;
+
+    if (device_entry->json == NULL)
+    {
+        j_entry = rest_devices_entry_to_json(device_entry);
+        if (j_entry == NULL)
+        {
+            return NULL;
+        }
+
+        device_entry->json = json_dumps(j_entry, JSON_COMPACT);
+        json_decref(j_entry);
+    }
+
+    return device_entry->json;
+}
+
+static bool rest_devices_stream_match(rest_devices_stream_t *stream,
+                                      database_entry_t *device_entry)
+{
+    if (stream->mode != DEVICE_CREDENTIALS_UNDEFINED && stream->mode != device_entry->mode)
+    {
+        return false;
+    }
+
+    if (stream->name_prefix != NULL
+        && strncmp(device_entry->name, stream->name_prefix, strlen(stream->name_prefix)) != 0)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+static int rest_devices_stream_append_entry(rest_devices_stream_t *stream,
+                                            database_entry_t *device_entry)
+{
+    const char *fragment;
+    json_t *j_server_key;
+    char cursor[32];
+    size_t length;
+
+    fragment = rest_devices_entry_fragment(device_entry);
+    if (fragment == NULL)
+    {
+        return -1;
+    }
+    length = strlen(fragment);
+
+    if (stream->count > 0 && rest_stream_append(&stream->output, ",", 1))
+    {
+        return -1;
+    }
+    stream->count++;
+
+    // list cursor and server key are spliced into the cached object
+    if (rest_stream_append(&stream->output, fragment, length - 1))
+    {
+        return -1;
+    }
+
+    // server key is the same for every device
+    if (device_entry->mode == DEVICE_CREDENTIALS_CERT && stream->server_key == NULL)
+    {
+        j_server_key = server_key_object(stream->rest->settings->coap.certificate_file);
+        if (j_server_key == NULL)
+        {
+            return -1;
+        }
+
+        stream->server_key = json_dumps(json_object_get(j_server_key, "server_key"),
+                                        JSON_ENCODE_ANY);
+        if (stream->server_key == NULL)
+        {
+            return -1;
+        }
+    }
+
+    if (device_entry->mode == DEVICE_CREDENTIALS_CERT
+        && (rest_stream_append(&stream->output, ",\"server_key\":", 14)
+            || rest_stream_append(&stream->output, stream->server_key,
+                                          strlen(stream->server_key))))
+    {
+        return -1;
+    }
+
+    length = snprintf(cursor, sizeof(cursor), ",\"sequence\":%" PRIu64 "}",
+                      device_entry->sequence);
+
+    return rest_stream_append(&stream->output, cursor, length);
+}
+
+/*
+ * Appends next devices to the stream buffer. Lock is only held while a
+ * limited number of entries is looked at, so that listing a large database
+ * does not hold up CoAP processing.
+ */
+static int rest_devices_stream_fill(void *context)
+{
+    rest_devices_stream_t *stream = (rest_devices_stream_t *)context;
+    rest_context_t *rest = stream->rest;
+    linked_list_entry_t *list_entry;
+    database_entry_t *device_entry = NULL;
+    size_t scanned;
+    int ret = -1;
 
     rest_lock(rest);
 
-    j_devices = json_array();
-    for (device_entry = device_list->head; device_entry != NULL; device_entry = device_entry->next)
+    list_entry = database_list_after(rest->devices, stream->last_uuid, stream->last_sequence);
+    for (scanned = 0; list_entry != NULL && scanned < DEVICES_STREAM_SCAN_SIZE
+         && stream->remaining > 0; list_entry = list_entry->next, scanned++)
     {
-        device_data = (database_entry_t *)device_entry->data;
+        device_entry = (database_entry_t *)list_entry->data;
 
-        j_entry_object = rest_devices_entry_to_resp(device_data, rest->settings->coap.certificate_file);
-        if (j_entry_object == NULL)
+        if (!rest_devices_stream_match(stream, device_entry))
+        {
+            continue;
+        }
+
+        if (rest_devices_stream_append_entry(stream, device_entry))
         {
-            ulfius_set_empty_body_response(resp, 500);
             goto exit;
         }
+        stream->remaining--;
+    }
+
+    if (list_entry == NULL || stream->remaining == 0)
+    {
+        stream->output.done = true;
+        ret = rest_stream_append(&stream->output, "]", 1);
+        goto exit;
+    }
 
-        json_array_append_new(j_devices, j_entry_object);
+    // uuid may point into a database file, which can be unmapped once lock is released
+    free(stream->last_uuid);
+    stream->last_uuid = strdup(device_entry->uuid);
+    stream->last_sequence = device_entry->sequence;
+    if (stream->last_uuid == NULL)
+    {
+        goto exit;
     }
 
-    ulfius_set_json_body_response(resp, 200, j_devices);
+    ret = 0;
 exit:
-    json_decref(j_devices);
     rest_unlock(rest);
 
+    return ret;
+}
+
+static ssize_t rest_devices_stream_cb(void *context, uint64_t offset, char *buffer,
+                                      size_t max_length)
+{
+    rest_devices_stream_t *stream = (rest_devices_stream_t *)context;
+
+    return rest_stream_read(&stream->output, buffer, max_length);
+}
+
+static void rest_devices_stream_free(void *context)
+{
+    rest_devices_stream_t *stream = (rest_devices_stream_t *)context;
+
+    free(stream->name_prefix);
+    free(stream->last_uuid);
+    free(stream->server_key);
+    rest_stream_clear(&stream->output);
+    free(stream);
+}
+
+static int rest_devices_stream_parse(rest_context_t *rest, const ulfius_req_t *req,
+                                     rest_devices_stream_t *stream)
+{
+    const char *limit, *after, *mode, *name_prefix;
+    database_entry_t *device_entry;
+    char *end;
+
+    stream->remaining = SIZE_MAX;
+    limit = u_map_get(req->map_url, "limit");
+    if (limit != NULL)
+    {
+        errno = 0;
+        stream->remaining = strtoul(limit, &end, 10);
+        if (errno != 0 || *limit < '1' || *limit > '9' || *end != '\0')
+        {
+            return -1;
+        }
+    }
+
+    mode = u_map_get(req->map_url, "mode");
+    if (mode != NULL)
+    {
+        stream->mode = credentials_type_from_string(mode);
+        if (stream->mode == DEVICE_CREDENTIALS_UNDEFINED)
+        {
+            return -1;
+        }
+    }
+
+    name_prefix = u_map_get(req->map_url, "name_prefix");
+    if (name_prefix != NULL)
+    {
+        stream->name_prefix = strdup(name_prefix);
+        if (stream->name_prefix == NULL)
+        {
+            return -1;
+        }
+    }
+
+    // listing continues after a device returned in the previous page, its
+    // sequence number is used if the device may have been removed meanwhile,
+    // anything that is not a whole number is a uuid
+    after = u_map_get(req->map_url, "after");
+    if (after == NULL)
+    {
+        return 0;
+    }
+
+    errno = 0;
+    stream->last_sequence = strtoull(after, &end, 10);
+    if (*after < '0' || *after > '9' || errno != 0 || *end != '\0')
+    {
+        device_entry = database_get_entry_by_uuid(rest->devices, after);
+        if (device_entry == NULL)
+        {
+            return -1;
+        }
+
+        stream->last_uuid = strdup(after);
+        stream->last_sequence = device_entry->sequence;
+        if (stream->last_uuid == NULL)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int rest_devices_get_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
+{
+    rest_context_t *rest = (rest_context_t *)context;
+    rest_devices_stream_t *stream;
+
+    stream = calloc(1, sizeof(rest_devices_stream_t));
+    if (stream == NULL)
+    {
+        ulfius_set_empty_body_response(resp, 500);
+        return U_CALLBACK_COMPLETE;
+    }
+    stream->rest = rest;
+    rest_stream_init(&stream->output, rest_devices_stream_fill, stream);
+
+    rest_lock(rest);
+
+    if (rest_devices_stream_parse(rest, req, stream))
+    {
+        rest_unlock(rest);
+        rest_devices_stream_free(stream);
+        ulfius_set_empty_body_response(resp, 400);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    rest_unlock(rest);
+
+    if (rest_stream_append(&stream->output, "[", 1)
+        || ulfius_set_stream_response(resp, 200, rest_devices_stream_cb, rest_devices_stream_free,
+                                      U_STREAM_SIZE_UNKOWN, DEVICES_STREAM_BUFFER_SIZE,
+                                      stream) != U_OK)
+    {
+        rest_devices_stream_free(stream);
+        ulfius_set_empty_body_response(resp, 500);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    u_map_put(resp->map_header, "Content-Type", "application/json");
+
     return U_CALLBACK_COMPLETE;
 }
 
 int rest_devices_get_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
 {
     rest_context_t *rest = (rest_context_t *)context;
-    linked_list_t *device_list = rest->devicesList;
     database_entry_t *device_data;
-    linked_list_entry_t *device_entry;
     json_t *j_entry_object = NULL;
 
     rest_lock(rest);
@@ -312,25 +575,22 @@ int rest_devices_get_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void
         goto exit;
     }
 
-    for (device_entry = device_list->head; device_entry != NULL; device_entry = device_entry->next)
+    device_data = database_get_entry_by_uuid(rest->devices, id);
+    if (device_data == NULL)
     {
-        device_data = (database_entry_t *)device_entry->data;
-        if (strcmp(id, device_data->uuid) == 0)
-        {
-            j_entry_object = rest_devices_entry_to_resp(device_data, rest->settings->coap.certificate_file);
-            if (j_entry_object == NULL)
-            {
-                ulfius_set_empty_body_response(resp, 500);
-                goto exit;
-            }
+        ulfius_set_empty_body_response(resp, 404);
+        goto exit;
+    }
 
-            ulfius_set_json_body_response(resp, 200, j_entry_object);
-            json_decref(j_entry_object);
-            goto exit;
-        }
+    j_entry_object = rest_devices_entry_to_resp(device_data, rest->settings->coap.certificate_file);
+    if (j_entry_object == NULL)
+    {
+        ulfius_set_empty_body_response(resp, 500);
+        goto exit;
     }
 
-    ulfius_set_empty_body_response(resp, 404);
+    ulfius_set_json_body_response(resp, 200, j_entry_object);
+    json_decref(j_entry_object);
 exit:
     rest_unlock(rest);
 
@@ -368,39 +628,29 @@ int rest_devices_post_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *con
         goto exit;
     }
 
-    device_entry = database_create_new_entry(jdevice_list, rest->devicesList,
-                                             rest->settings->coap.certificate_file, rest->settings->coap.private_key_file);
+    device_entry = database_create_new_entry(jdevice_list, rest->devices,
+                                             rest_devices_signer(rest));
     if (device_entry == NULL)
     {
         ulfius_set_empty_body_response(resp, 500);
         goto exit;
     }
 
-    j_post_resp = rest_devices_entry_to_resp(device_entry, rest->settings->coap.certificate_file);
+    j_post_resp = rest_devices_new_entry_to_resp(device_entry,
+                                                 rest->settings->coap.certificate_file);
     if (j_post_resp == NULL)
     {
         ulfius_set_empty_body_response(resp, 500);
         goto exit;
     }
 
-    if (append_client_key(j_post_resp, device_entry) != 0)
+    if (database_add_entry(rest->devices, device_entry))
     {
         ulfius_set_empty_body_response(resp, 500);
         goto exit;
     }
 
-    if (device_entry->mode == DEVICE_CREDENTIALS_CERT)
-    {
-        free(device_entry->secret_key);
-        device_entry->secret_key = NULL;
-        device_entry->secret_key_len = 0;
-    }
-
-    linked_list_add(rest->devicesList, device_entry);
-
-//  if database file not specified then only save locally
-    if (rest->settings->coap.database_file != NULL
-        && rest_devices_save_list_to_file(rest->devicesList, rest->settings->coap.database_file) != 0)
+    if (database_save_added_entry(rest->devices, device_entry) != 0)
     {
         log_message(LOG_LEVEL_ERROR, "[DEVICES POST] Failed to write to database file.\n");
     }
@@ -428,9 +678,214 @@ exit:
     return U_CALLBACK_COMPLETE;
 }
 
+static void *rest_devices_batch_worker(void *arg)
+{
+    rest_devices_batch_t *batch = (rest_devices_batch_t *)arg;
+    device_signer_t *signer = NULL;
+    size_t index;
+
+    // every worker signs with its own copy of parsed CA credentials
+    if (batch->signer != NULL)
+    {
+        signer = device_signer_copy(batch->signer);
+    }
+
+    while ((index = atomic_fetch_add(&batch->next, 1)) < batch->count)
+    {
+        // serial uniqueness is checked once entries are added to the database
+        batch->entries[index] = database_create_new_entry(json_array_get(batch->j_devices, index),
+                                                          NULL, signer);
+    }
+
+    device_signer_delete(signer);
+
+    return NULL;
+}
+
+static void rest_devices_batch_create(rest_devices_batch_t *batch)
+{
+    pthread_t workers[DEVICES_BATCH_WORKERS_MAX];
+    long workers_count, started = 0;
+
+    workers_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers_count > DEVICES_BATCH_WORKERS_MAX)
+    {
+        workers_count = DEVICES_BATCH_WORKERS_MAX;
+    }
+    if (workers_count > (long)batch->count)
+    {
+        workers_count = batch->count;
+    }
+
+    for (started = 0; started < workers_count; started++)
+    {
+        if (pthread_create(&workers[started], NULL, rest_devices_batch_worker, batch) != 0)
+        {
+            break;
+        }
+    }
+
+    // calling thread takes part as well, and finishes the batch alone if no worker started
+    rest_devices_batch_worker(batch);
+
+    while (started > 0)
+    {
+        pthread_join(workers[--started], NULL);
+    }
+}
+
+static bool rest_devices_batch_serial_is_unique(rest_context_t *rest,
+                                                database_entry_t *device_entry)
+{
+    return device_entry->serial == NULL
+           || database_get_entry_by_serial(rest->devices, device_entry->serial,
+                                           device_entry->serial_len) == NULL;
+}
+
+int rest_devices_batch_post_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
+{
+    rest_context_t *rest = (rest_context_t *)context;
+    rest_devices_batch_t batch = { 0 };
+    key_pool_stats_t key_stats;
+    const device_signer_t *signer;
+    json_t *j_devices = NULL;
+    json_t *j_post_resp = NULL;
+    json_t *j_entry_object;
+    json_t *j_device;
+    size_t index, added = 0;
+
+    const char *ct;
+    ct = u_map_get_case(req->map_header, "Content-Type");
+    if (ct == NULL || strcmp(ct, "application/json") != 0)
+    {
+        ulfius_set_empty_body_response(resp, 415);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    j_devices = json_loadb(req->binary_body, req->binary_body_length, 0, NULL);
+    if (!json_is_array(j_devices))
+    {
+        ulfius_set_empty_body_response(resp, 400);
+        goto exit;
+    }
+
+    if (json_array_size(j_devices) > DEVICES_BATCH_SIZE_MAX)
+    {
+        ulfius_set_empty_body_response(resp, 413);
+        goto exit;
+    }
+
+    json_array_foreach(j_devices, index, j_device)
+    {
+        if (database_validate_new_entry(j_device) != 0)
+        {
+            ulfius_set_empty_body_response(resp, 400);
+            goto exit;
+        }
+    }
+
+    batch.count = json_array_size(j_devices);
+    batch.j_devices = j_devices;
+    batch.entries = calloc(batch.count + 1, sizeof(database_entry_t *));
+    j_post_resp = json_array();
+    if (batch.entries == NULL || j_post_resp == NULL)
+    {
+        ulfius_set_empty_body_response(resp, 500);
+        goto exit;
+    }
+
+    // signer is only read by workers, keys are generated without holding the lock
+    rest_lock(rest);
+    signer = rest_devices_signer(rest);
+    rest_unlock(rest);
+
+    batch.signer = signer;
+    atomic_init(&batch.next, 0);
+    rest_devices_batch_create(&batch);
+
+    for (index = 0; index < batch.count; index++)
+    {
+        if (batch.entries[index] == NULL)
+        {
+            ulfius_set_empty_body_response(resp, 500);
+            goto exit;
+        }
+    }
+
+    rest_lock(rest);
+
+    for (index = 0; index < batch.count; index++)
+    {
+        // serials are random, a clash with another device is only theoretically possible
+        if (!rest_devices_batch_serial_is_unique(rest, batch.entries[index]))
+        {
+            database_free_entry(batch.entries[index]);
+            batch.entries[index] = database_create_new_entry(json_array_get(j_devices, index),
+                                                             rest->devices,
+                                                             rest_devices_signer(rest));
+            if (batch.entries[index] == NULL)
+            {
+                ulfius_set_empty_body_response(resp, 500);
+                goto unlock;
+            }
+        }
+
+        j_entry_object = rest_devices_new_entry_to_resp(batch.entries[index],
+                                                        rest->settings->coap.certificate_file);
+        if (j_entry_object == NULL
+            || json_array_append_new(j_post_resp, j_entry_object)
+            || database_add_entry(rest->devices, batch.entries[index]))
+        {
+            ulfius_set_empty_body_response(resp, 500);
+            goto unlock;
+        }
+
+        added++;
+    }
+
+    if (database_save_added_entries(rest->devices, batch.entries, batch.count) != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "[DEVICES BATCH POST] Failed to write to database file.\n");
+    }
+
+    ulfius_set_json_body_response(resp, 201, j_post_resp);
+
+    if (rest->key_pool != NULL)
+    {
+        key_pool_get_stats(rest->key_pool, &key_stats);
+        log_message(LOG_LEVEL_INFO, "Key pool: %zu ready, %lu taken, %lu generated on demand\n",
+                    key_stats.available, key_stats.taken, key_stats.empty);
+    }
+
+unlock:
+    // batch is added as a whole or not at all
+    if (added < batch.count)
+    {
+        while (added > 0)
+        {
+            database_remove_entry(rest->devices, batch.entries[--added]);
+        }
+    }
+    rest_unlock(rest);
+exit:
+    if (batch.entries != NULL && added < batch.count)
+    {
+        for (index = 0; index < batch.count; index++)
+        {
+            database_free_entry(batch.entries[index]);
+        }
+    }
+    free(batch.entries);
+    json_decref(j_post_resp);
+    json_decref(j_devices);
+
+    return U_CALLBACK_COMPLETE;
+}
+
 int rest_devices_put_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
 {
     rest_context_t *rest = (rest_context_t *)context;
+    database_entry_t *device_entry;
     json_t *jdevice = NULL;
     const char *name;
 
@@ -466,15 +921,15 @@ int rest_devices_put_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *cont
         goto exit;
     }
 
-    if (rest_devices_update_list(rest->devicesList, id, name))
+    device_entry = database_get_entry_by_uuid(rest->devices, id);
+    if (device_entry == NULL
+        || database_rename_entry(rest->devices, device_entry, name))
     {
         ulfius_set_empty_body_response(resp, 400);
         goto exit;
     }
 
-//  if database file does not exist then only save locally
-    if (rest->settings->coap.database_file != NULL
-        && rest_devices_save_list_to_file(rest->devicesList, rest->settings->coap.database_file) != 0)
+    if (database_save_renamed_entry(rest->devices, device_entry) != 0)
     {
         log_message(LOG_LEVEL_ERROR, "[DEVICES PUT] Failed to write to database file.\n");
     }
@@ -493,6 +948,7 @@ exit:
 int rest_devices_delete_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
 {
     rest_context_t *rest = (rest_context_t *)context;
+    database_entry_t *device_entry;
 
     rest_lock(rest);
 
@@ -504,20 +960,23 @@ int rest_devices_delete_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *c
         goto exit;
     }
 
-    if (rest_devices_remove_list(rest->devicesList, id))
+    device_entry = database_get_entry_by_uuid(rest->devices, id);
+    if (device_entry == NULL)
     {
         //  device not found
         ulfius_set_empty_body_response(resp, 404);
         goto exit;
     }
 
-//  if database file not specified then only save locally
-    if (rest->settings->coap.database_file != NULL
-        && rest_devices_save_list_to_file(rest->devicesList, rest->settings->coap.database_file) != 0)
+    database_remove_entry(rest->devices, device_entry);
+
+    if (database_save_removed_entry(rest->devices, device_entry) != 0)
     {
         log_message(LOG_LEVEL_ERROR, "[DEVICES DELETE] Failed to write to database file.\n");
     }
 
+    database_free_entry(device_entry);
+
     ulfius_set_empty_body_response(resp, 200);
 exit:
     rest_unlock(rest);
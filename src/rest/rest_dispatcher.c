@@ -0,0 +1,820 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rest_dispatcher.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ulfius.h>
+#include <zlib.h>
+
+#include "../logging.h"
+#include "rest_spool.h"
+
+#define REST_DISPATCHER_TIMEOUT         20
+#define REST_DISPATCHER_SEGMENT_SIZE    (4 * 1024 * 1024)
+// smaller bodies are sent as they are, compression would not pay off
+#define REST_DISPATCHER_COMPRESSION_MIN 256
+
+typedef struct
+{
+    char *body;
+    size_t length;
+} rest_dispatcher_batch_t;
+
+// batch waiting to be written to the spool by the delivery thread
+typedef struct rest_dispatcher_spill_t
+{
+    struct rest_dispatcher_spill_t *next;
+    char *body;
+    size_t length;
+} rest_dispatcher_spill_t;
+
+struct rest_dispatcher_t
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool quit;
+
+    const http_security_settings_t *security;
+    const rest_dispatcher_settings_t *settings;
+    json_t *callback;
+    rest_dispatcher_wakeup_cb_t wakeup;
+    void *context;
+
+    rest_dispatcher_batch_t *queue;
+    size_t queue_size;
+    size_t head;
+    size_t count;
+    size_t bytes;
+    // batches over memory limit, older batches are always in memory. Spool is
+    // only used by the delivery thread, so that disk I/O never holds up producers.
+    rest_spool_t *spool;
+    // batches handed over to be spilled, oldest first
+    rest_dispatcher_spill_t *spill_head;
+    rest_dispatcher_spill_t **spill_tail;
+    // bytes handed over and not written yet, limited by memory limit like the queue
+    size_t spill_bytes;
+    // monotonic time of the next attempt after spool write failed
+    uint64_t spill_retry_time;
+    // spool or spill list holds batches, newer batches have to follow them
+    bool spooling;
+    // queue was flushed, spool has to be cleared by the delivery thread
+    bool clear_spool;
+    // incremented every time the queue is flushed, to detect stale deliveries
+    unsigned long generation;
+
+    // consecutive failed deliveries and monotonic time of the next attempt
+    unsigned int failures;
+    uint64_t retry_time;
+    unsigned int seed;
+};
+
+static uint64_t rest_dispatcher_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void rest_dispatcher_spill_free(rest_dispatcher_spill_t *spill)
+{
+    rest_dispatcher_spill_t *next;
+
+    for (; spill != NULL; spill = next)
+    {
+        next = spill->next;
+        free(spill->body);
+        free(spill);
+    }
+}
+
+static rest_dispatcher_spill_t *rest_dispatcher_spill_take(rest_dispatcher_t *dispatcher)
+{
+    rest_dispatcher_spill_t *spill = dispatcher->spill_head;
+
+    dispatcher->spill_head = NULL;
+    dispatcher->spill_tail = &dispatcher->spill_head;
+
+    return spill;
+}
+
+static void rest_dispatcher_flush_unsafe(rest_dispatcher_t *dispatcher)
+{
+    while (dispatcher->count > 0)
+    {
+        free(dispatcher->queue[dispatcher->head].body);
+        dispatcher->queue[dispatcher->head].body = NULL;
+        dispatcher->head = (dispatcher->head + 1) % dispatcher->queue_size;
+        dispatcher->count--;
+    }
+
+    rest_dispatcher_spill_free(rest_dispatcher_spill_take(dispatcher));
+    dispatcher->spill_bytes = 0;
+    if (dispatcher->spool != NULL)
+    {
+        dispatcher->clear_spool = true;
+    }
+
+    dispatcher->spooling = false;
+    dispatcher->head = 0;
+    dispatcher->bytes = 0;
+    dispatcher->failures = 0;
+    dispatcher->retry_time = 0;
+    dispatcher->generation++;
+}
+
+static bool rest_dispatcher_memory_is_full(rest_dispatcher_t *dispatcher)
+{
+    return dispatcher->count == dispatcher->queue_size
+           || dispatcher->bytes >= dispatcher->settings->memory_limit;
+}
+
+static bool rest_dispatcher_spill_is_full(rest_dispatcher_t *dispatcher)
+{
+    return dispatcher->spill_bytes >= dispatcher->settings->memory_limit;
+}
+
+static void rest_dispatcher_backoff(rest_dispatcher_t *dispatcher)
+{
+    uint64_t delay = dispatcher->settings->retry_min;
+
+    if (dispatcher->failures < 32)
+    {
+        dispatcher->failures++;
+    }
+
+    delay <<= dispatcher->failures - 1;
+    if (delay > dispatcher->settings->retry_max)
+    {
+        delay = dispatcher->settings->retry_max;
+    }
+
+    // random half of the delay keeps restarted receivers from being hit all at once
+    delay = delay / 2 + rand_r(&dispatcher->seed) % (delay / 2 + 1);
+
+    dispatcher->retry_time = rest_dispatcher_now() + delay;
+}
+
+static int rest_dispatcher_compress(rest_dispatcher_compression_t compression,
+                                    const char *data, size_t length,
+                                    char **compressed, size_t *compressed_length)
+{
+    z_stream stream;
+    uLong bound;
+    char *buffer;
+    int res;
+
+    memset(&stream, 0, sizeof(stream));
+
+    // window bits above 15 select gzip wrapper instead of zlib
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     (compression == REST_DISPATCHER_COMPRESSION_GZIP) ? 15 + 16 : 15,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return -1;
+    }
+
+    bound = deflateBound(&stream, length);
+    buffer = malloc(bound);
+    if (buffer == NULL)
+    {
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = length;
+    stream.next_out = (Bytef *)buffer;
+    stream.avail_out = bound;
+
+    res = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if (res != Z_STREAM_END)
+    {
+        free(buffer);
+        return -1;
+    }
+
+    *compressed = buffer;
+    *compressed_length = stream.total_out;
+
+    return 0;
+}
+
+static int rest_dispatcher_send(rest_dispatcher_t *dispatcher, json_t *callback,
+                                const rest_dispatcher_batch_t *batch)
+{
+    rest_dispatcher_compression_t compression = dispatcher->settings->compression;
+    char *compressed = NULL;
+    size_t compressed_length;
+    struct _u_request request;
+    struct _u_response response;
+    json_t *jheaders;
+    json_t *value;
+    const char *header;
+    const char *url;
+    struct _u_map headers;
+    int res;
+
+    url = json_string_value(json_object_get(callback, "url"));
+    jheaders = json_object_get(callback, "headers");
+
+    u_map_init(&headers);
+    json_object_foreach(jheaders, header, value)
+    {
+        u_map_put(&headers, header, json_string_value(value));
+    }
+
+    log_message(LOG_LEVEL_INFO, "[CALLBACK] Sending to %s\n", url);
+
+    ulfius_init_request(&request);
+    request.http_verb = strdup("PUT");
+    request.http_url = strdup(url);
+    request.timeout = REST_DISPATCHER_TIMEOUT;
+    request.check_server_certificate = 0;
+    request.client_cert_file = o_strdup(dispatcher->security->certificate);
+    request.client_key_file = o_strdup(dispatcher->security->private_key);
+    if ((dispatcher->security->certificate != NULL && request.client_cert_file == NULL) ||
+        (dispatcher->security->private_key != NULL && request.client_key_file == NULL))
+    {
+        log_message(LOG_LEVEL_ERROR, "[CALLBACK] Failed to set client security credentials\n");
+
+        u_map_clean(&headers);
+        ulfius_clean_request(&request);
+
+        return -1;
+    }
+
+    if (compression != REST_DISPATCHER_COMPRESSION_NONE
+        && batch->length >= REST_DISPATCHER_COMPRESSION_MIN
+        && rest_dispatcher_compress(compression, batch->body, batch->length,
+                                    &compressed, &compressed_length) != 0)
+    {
+        log_message(LOG_LEVEL_WARN, "[CALLBACK] Failed to compress notifications, sending as is\n");
+    }
+
+    u_map_copy_into(request.map_header, &headers);
+    u_map_put(request.map_header, "Content-Type", "application/json");
+    if (compressed != NULL)
+    {
+        u_map_put(request.map_header, "Content-Encoding",
+                  (compression == REST_DISPATCHER_COMPRESSION_GZIP) ? "gzip" : "deflate");
+        ulfius_set_binary_body_request(&request, compressed, compressed_length);
+        free(compressed);
+    }
+    else
+    {
+        ulfius_set_binary_body_request(&request, batch->body, batch->length);
+    }
+
+    ulfius_init_response(&response);
+    res = ulfius_send_http_request(&request, &response);
+    if (res != U_OK)
+    {
+        log_message(LOG_LEVEL_WARN, "[CALLBACK] Failed to deliver notifications to %s\n", url);
+    }
+
+    u_map_clean(&headers);
+    ulfius_clean_request(&request);
+    ulfius_clean_response(&response);
+
+    return (res == U_OK) ? 0 : -1;
+}
+
+static void rest_dispatcher_wait(rest_dispatcher_t *dispatcher, uint64_t time)
+{
+    struct timespec deadline;
+    uint64_t now;
+
+    if (time == UINT64_MAX)
+    {
+        pthread_cond_wait(&dispatcher->cond, &dispatcher->mutex);
+        return;
+    }
+
+    now = rest_dispatcher_now();
+    if (time <= now)
+    {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time - now) / 1000;
+    deadline.tv_nsec += ((time - now) % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&dispatcher->cond, &dispatcher->mutex, &deadline);
+}
+
+/*
+ * Writes handed over batches to the spool, called with the mutex unlocked.
+ * Returns batches that could not be written, written bytes are added to written.
+ */
+static rest_dispatcher_spill_t *rest_dispatcher_spill(rest_dispatcher_t *dispatcher,
+                                                      rest_dispatcher_spill_t *spill,
+                                                      size_t *written)
+{
+    rest_dispatcher_spill_t *next;
+
+    for (; spill != NULL; spill = next)
+    {
+        if (rest_spool_push(dispatcher->spool, spill->body, spill->length) != 0)
+        {
+            return spill;
+        }
+
+        *written += spill->length;
+        next = spill->next;
+        free(spill->body);
+        free(spill);
+    }
+
+    return NULL;
+}
+
+/*
+ * Runs spool maintenance that was requested while the thread was busy,
+ * returns true if anything was done. Mutex is unlocked meanwhile.
+ */
+static bool rest_dispatcher_spool_step(rest_dispatcher_t *dispatcher)
+{
+    rest_dispatcher_spill_t *spill, *tail;
+    unsigned long generation;
+    size_t written = 0;
+    bool full;
+
+    if (dispatcher->clear_spool)
+    {
+        dispatcher->clear_spool = false;
+
+        pthread_mutex_unlock(&dispatcher->mutex);
+        rest_spool_clear(dispatcher->spool);
+        pthread_mutex_lock(&dispatcher->mutex);
+
+        return true;
+    }
+
+    if (dispatcher->spill_head == NULL || dispatcher->spill_retry_time > rest_dispatcher_now())
+    {
+        return false;
+    }
+
+    spill = rest_dispatcher_spill_take(dispatcher);
+    generation = dispatcher->generation;
+
+    pthread_mutex_unlock(&dispatcher->mutex);
+    spill = rest_dispatcher_spill(dispatcher, spill, &written);
+    pthread_mutex_lock(&dispatcher->mutex);
+
+    // flushed queue has dropped the spill list and its bytes already
+    if (generation == dispatcher->generation)
+    {
+        full = rest_dispatcher_spill_is_full(dispatcher);
+        dispatcher->spill_bytes -= written;
+
+        // producers keep their events while the spill list is over the limit
+        if (full && !rest_dispatcher_spill_is_full(dispatcher) && dispatcher->wakeup != NULL)
+        {
+            dispatcher->wakeup(dispatcher->context);
+        }
+    }
+
+    if (spill == NULL)
+    {
+        dispatcher->spill_retry_time = 0;
+        return true;
+    }
+
+    // batches that failed are older than those handed over meanwhile
+    if (generation == dispatcher->generation)
+    {
+        log_message(LOG_LEVEL_ERROR, "[CALLBACK] Failed to spool notification batches\n");
+
+        tail = spill;
+        while (tail->next != NULL)
+        {
+            tail = tail->next;
+        }
+        tail->next = dispatcher->spill_head;
+        if (dispatcher->spill_head == NULL)
+        {
+            dispatcher->spill_tail = &tail->next;
+        }
+        dispatcher->spill_head = spill;
+        dispatcher->spill_retry_time = rest_dispatcher_now() + dispatcher->settings->retry_max;
+    }
+    else
+    {
+        rest_dispatcher_spill_free(spill);
+    }
+
+    return true;
+}
+
+static void *rest_dispatcher_thread(void *context)
+{
+    rest_dispatcher_t *dispatcher = (rest_dispatcher_t *)context;
+    unsigned long generation;
+    json_t *callback;
+    rest_dispatcher_batch_t batch;
+    bool spooled, full;
+    uint64_t wake;
+    int res;
+
+    pthread_mutex_lock(&dispatcher->mutex);
+
+    while (!dispatcher->quit)
+    {
+        if (dispatcher->spool != NULL && rest_dispatcher_spool_step(dispatcher))
+        {
+            continue;
+        }
+
+        // spool is only touched by this thread, so it can be looked at without the mutex
+        spooled = (dispatcher->count == 0);
+        wake = (dispatcher->spill_head != NULL) ? dispatcher->spill_retry_time : UINT64_MAX;
+
+        if (dispatcher->callback == NULL
+            || (spooled && (dispatcher->spool == NULL || rest_spool_is_empty(dispatcher->spool))))
+        {
+            rest_dispatcher_wait(dispatcher, wake);
+            continue;
+        }
+
+        if (dispatcher->retry_time > rest_dispatcher_now())
+        {
+            rest_dispatcher_wait(dispatcher, (dispatcher->retry_time < wake)
+                                 ? dispatcher->retry_time : wake);
+            continue;
+        }
+
+        // queue may be flushed while sending, so the body is held outside of it
+        if (!spooled)
+        {
+            batch = dispatcher->queue[dispatcher->head];
+            dispatcher->queue[dispatcher->head].body = NULL;
+        }
+        callback = json_incref(dispatcher->callback);
+        generation = dispatcher->generation;
+
+        pthread_mutex_unlock(&dispatcher->mutex);
+
+        res = spooled ? rest_spool_peek(dispatcher->spool, &batch.body, &batch.length) : 0;
+        if (res == 0)
+        {
+            res = rest_dispatcher_send(dispatcher, callback, &batch);
+            if (res == 0 && spooled)
+            {
+                rest_spool_pop(dispatcher->spool);
+            }
+            free(spooled ? batch.body : NULL);
+        }
+        else if (res < 0)
+        {
+            log_message(LOG_LEVEL_ERROR, "[CALLBACK] Failed to read notification spool\n");
+        }
+
+        pthread_mutex_lock(&dispatcher->mutex);
+
+        json_decref(callback);
+
+        // queue could have been flushed while sending
+        if (generation != dispatcher->generation)
+        {
+            free(spooled ? NULL : batch.body);
+            continue;
+        }
+
+        if (res > 0)
+        {
+            continue;
+        }
+
+        if (res != 0)
+        {
+            // spooled record stays in the spool and is read again
+            if (!spooled)
+            {
+                dispatcher->queue[dispatcher->head] = batch;
+            }
+
+            rest_dispatcher_backoff(dispatcher);
+            continue;
+        }
+
+        full = rest_dispatcher_memory_is_full(dispatcher);
+        if (spooled)
+        {
+            dispatcher->spooling = (dispatcher->spill_head != NULL
+                                    || !rest_spool_is_empty(dispatcher->spool));
+        }
+        else
+        {
+            dispatcher->head = (dispatcher->head + 1) % dispatcher->queue_size;
+            dispatcher->count--;
+            dispatcher->bytes -= batch.length;
+            free(batch.body);
+        }
+
+        // producers wait for a free slot only if batches can't be spooled
+        if (full && !spooled && dispatcher->spool == NULL && dispatcher->wakeup != NULL)
+        {
+            dispatcher->wakeup(dispatcher->context);
+        }
+
+        if (dispatcher->failures > 0)
+        {
+            log_message(LOG_LEVEL_INFO,
+                        "[CALLBACK] Delivered notifications after %u failed attempts\n",
+                        dispatcher->failures);
+        }
+        dispatcher->failures = 0;
+        dispatcher->retry_time = 0;
+    }
+
+    pthread_mutex_unlock(&dispatcher->mutex);
+
+    return NULL;
+}
+
+static void rest_dispatcher_spool_queue(rest_dispatcher_t *dispatcher)
+{
+    rest_dispatcher_spill_t *spill;
+    char **bodies;
+    size_t *lengths;
+    size_t index, position, written = 0;
+
+    if (dispatcher->clear_spool)
+    {
+        rest_spool_clear(dispatcher->spool);
+        dispatcher->clear_spool = false;
+    }
+
+    spill = rest_dispatcher_spill(dispatcher, rest_dispatcher_spill_take(dispatcher), &written);
+    dispatcher->spill_bytes = 0;
+    if (spill != NULL)
+    {
+        log_message(LOG_LEVEL_ERROR, "[CALLBACK] Failed to spool notification batches\n");
+        rest_dispatcher_spill_free(spill);
+    }
+
+    if (dispatcher->count == 0)
+    {
+        return;
+    }
+
+    bodies = calloc(dispatcher->count, sizeof(char *));
+    lengths = calloc(dispatcher->count, sizeof(size_t));
+
+    if (bodies != NULL && lengths != NULL)
+    {
+        for (index = 0; index < dispatcher->count; index++)
+        {
+            position = (dispatcher->head + index) % dispatcher->queue_size;
+            bodies[index] = dispatcher->queue[position].body;
+            lengths[index] = dispatcher->queue[position].length;
+        }
+    }
+
+    if (bodies == NULL || lengths == NULL
+        || rest_spool_prepend(dispatcher->spool, bodies, lengths, dispatcher->count) != 0)
+    {
+        log_message(LOG_LEVEL_ERROR,
+                    "[CALLBACK] Failed to spool %zu undelivered notification batches\n",
+                    dispatcher->count);
+    }
+
+    free(bodies);
+    free(lengths);
+}
+
+rest_dispatcher_t *rest_dispatcher_new(const http_security_settings_t *security,
+                                       const rest_dispatcher_settings_t *settings,
+                                       size_t queue_size, rest_dispatcher_wakeup_cb_t wakeup,
+                                       void *context)
+{
+    rest_dispatcher_t *dispatcher;
+    pthread_condattr_t cond_attr;
+
+    if (queue_size == 0)
+    {
+        return NULL;
+    }
+
+    dispatcher = calloc(1, sizeof(rest_dispatcher_t));
+    if (dispatcher == NULL)
+    {
+        return NULL;
+    }
+
+    dispatcher->queue = calloc(queue_size, sizeof(rest_dispatcher_batch_t));
+    if (dispatcher->queue == NULL)
+    {
+        free(dispatcher);
+        return NULL;
+    }
+
+    if (settings->spool_directory != NULL)
+    {
+        dispatcher->spool = rest_spool_new(settings->spool_directory,
+                                           REST_DISPATCHER_SEGMENT_SIZE);
+        if (dispatcher->spool == NULL)
+        {
+            log_message(LOG_LEVEL_ERROR, "[CALLBACK] Failed to open notification spool at %s\n",
+                        settings->spool_directory);
+            free(dispatcher->queue);
+            free(dispatcher);
+            return NULL;
+        }
+    }
+
+    dispatcher->spill_tail = &dispatcher->spill_head;
+    dispatcher->spooling = (dispatcher->spool != NULL && !rest_spool_is_empty(dispatcher->spool));
+    dispatcher->queue_size = queue_size;
+    dispatcher->security = security;
+    dispatcher->settings = settings;
+    dispatcher->wakeup = wakeup;
+    dispatcher->context = context;
+    dispatcher->seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)dispatcher;
+
+    pthread_mutex_init(&dispatcher->mutex, NULL);
+
+    // retry deadlines must not depend on wall clock changes
+    assert(pthread_condattr_init(&cond_attr) == 0);
+    assert(pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) == 0);
+    assert(pthread_cond_init(&dispatcher->cond, &cond_attr) == 0);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (pthread_create(&dispatcher->thread, NULL, rest_dispatcher_thread, dispatcher) != 0)
+    {
+        pthread_cond_destroy(&dispatcher->cond);
+        pthread_mutex_destroy(&dispatcher->mutex);
+        rest_spool_delete(dispatcher->spool);
+        free(dispatcher->queue);
+        free(dispatcher);
+        return NULL;
+    }
+
+    return dispatcher;
+}
+
+void rest_dispatcher_delete(rest_dispatcher_t *dispatcher)
+{
+    if (dispatcher == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&dispatcher->mutex);
+    dispatcher->quit = true;
+    pthread_cond_signal(&dispatcher->cond);
+    pthread_mutex_unlock(&dispatcher->mutex);
+
+    pthread_join(dispatcher->thread, NULL);
+
+    if (dispatcher->spool != NULL)
+    {
+        rest_dispatcher_spool_queue(dispatcher);
+        rest_spool_delete(dispatcher->spool);
+        dispatcher->spool = NULL;
+    }
+
+    rest_dispatcher_flush_unsafe(dispatcher);
+
+    if (dispatcher->callback != NULL)
+    {
+        json_decref(dispatcher->callback);
+    }
+
+    pthread_cond_destroy(&dispatcher->cond);
+    pthread_mutex_destroy(&dispatcher->mutex);
+    free(dispatcher->queue);
+    free(dispatcher);
+}
+
+void rest_dispatcher_set_callback(rest_dispatcher_t *dispatcher, const json_t *callback)
+{
+    pthread_mutex_lock(&dispatcher->mutex);
+
+    if (dispatcher->callback != NULL)
+    {
+        json_decref(dispatcher->callback);
+        dispatcher->callback = NULL;
+    }
+
+    if (callback != NULL)
+    {
+        dispatcher->callback = json_deep_copy(callback);
+        dispatcher->failures = 0;
+        dispatcher->retry_time = 0;
+    }
+    else if (dispatcher->count > 0 || dispatcher->spooling)
+    {
+        log_message(LOG_LEVEL_WARN, "[CALLBACK] Dropping undelivered notification batches\n");
+        rest_dispatcher_flush_unsafe(dispatcher);
+    }
+
+    pthread_cond_signal(&dispatcher->cond);
+    pthread_mutex_unlock(&dispatcher->mutex);
+}
+
+bool rest_dispatcher_is_full(rest_dispatcher_t *dispatcher)
+{
+    bool full;
+
+    pthread_mutex_lock(&dispatcher->mutex);
+    if (dispatcher->spool == NULL)
+    {
+        full = rest_dispatcher_memory_is_full(dispatcher);
+    }
+    else
+    {
+        full = ((dispatcher->spooling || rest_dispatcher_memory_is_full(dispatcher))
+                && rest_dispatcher_spill_is_full(dispatcher));
+    }
+    pthread_mutex_unlock(&dispatcher->mutex);
+
+    return full;
+}
+
+int rest_dispatcher_enqueue(rest_dispatcher_t *dispatcher, char *body, size_t length)
+{
+    rest_dispatcher_spill_t *spill;
+    size_t tail;
+
+    pthread_mutex_lock(&dispatcher->mutex);
+
+    // once anything is spooled, newer batches follow it to keep the order, they
+    // are written by the delivery thread
+    if (dispatcher->spool != NULL
+        && (dispatcher->spooling || rest_dispatcher_memory_is_full(dispatcher)))
+    {
+        // batches wait in memory until they are written, so they are limited too
+        if (rest_dispatcher_spill_is_full(dispatcher))
+        {
+            pthread_mutex_unlock(&dispatcher->mutex);
+            return -1;
+        }
+
+        spill = malloc(sizeof(rest_dispatcher_spill_t));
+        if (spill == NULL)
+        {
+            pthread_mutex_unlock(&dispatcher->mutex);
+            return -1;
+        }
+
+        spill->next = NULL;
+        spill->body = body;
+        spill->length = length;
+        *dispatcher->spill_tail = spill;
+        dispatcher->spill_tail = &spill->next;
+        dispatcher->spill_bytes += length;
+        dispatcher->spooling = true;
+    }
+    else if (rest_dispatcher_memory_is_full(dispatcher))
+    {
+        pthread_mutex_unlock(&dispatcher->mutex);
+        return -1;
+    }
+    else
+    {
+        tail = (dispatcher->head + dispatcher->count) % dispatcher->queue_size;
+        dispatcher->queue[tail].body = body;
+        dispatcher->queue[tail].length = length;
+        dispatcher->count++;
+        dispatcher->bytes += length;
+    }
+
+    pthread_cond_signal(&dispatcher->cond);
+    pthread_mutex_unlock(&dispatcher->mutex);
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REST_DISPATCHER_H
+#define REST_DISPATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <jansson.h>
+
+#include "../security.h"
+
+/*
+ * Notification dispatcher delivers notification batches to the registered
+ * callback from a dedicated thread, so that slow or unreachable callback
+ * receivers never block CoAP packet handling or REST request handlers.
+ *
+ * Batches are kept in a bounded queue. Failed deliveries are retried with
+ * exponential backoff and jitter, in order. Once the queue is full, batches
+ * are handed over to the delivery thread, which spills them to an on-disk
+ * spool if it is configured, so producers never wait for disk I/O. Without
+ * the spool, producers are expected to keep their events until a slot is
+ * freed. Spooled batches
+ * survive restarts, a batch that was being sent during shutdown may be
+ * delivered twice.
+ */
+typedef struct rest_dispatcher_t rest_dispatcher_t;
+
+// batches kept in memory by a dispatcher, unless memory limit is reached first
+#define REST_DISPATCHER_QUEUE_SIZE 64
+
+typedef enum
+{
+    REST_DISPATCHER_COMPRESSION_NONE,
+    REST_DISPATCHER_COMPRESSION_GZIP,
+    REST_DISPATCHER_COMPRESSION_DEFLATE,
+} rest_dispatcher_compression_t;
+
+/*
+ * Called from the delivery thread when the queue was full and a batch was
+ * delivered or spilled, so that producers can queue the events they held back
+ *
+ * Parameters:
+ *      context - user data passed to rest_dispatcher_new()
+ */
+typedef void (*rest_dispatcher_wakeup_cb_t)(void *context);
+
+typedef struct
+{
+    // batch is sent once it reaches max_events or max_bytes...
+    uint32_t max_events;
+    uint32_t max_bytes;
+    // ...or when its oldest event has waited for linger milliseconds
+    uint32_t linger;
+    rest_dispatcher_compression_t compression;
+    // failed deliveries are retried after retry_min milliseconds, doubling up to retry_max
+    uint32_t retry_min;
+    uint32_t retry_max;
+    // bytes of undelivered batches kept in memory
+    uint32_t memory_limit;
+    // batches over memory limit are spilled to this directory, NULL to keep them waiting
+    char *spool_directory;
+} rest_dispatcher_settings_t;
+
+/*
+ * Creates a dispatcher and starts its delivery thread
+ *
+ * Parameters:
+ *      security - HTTP security settings, used for client credentials,
+ *      settings - callback delivery settings,
+ *      queue_size - maximum number of undelivered batches,
+ *      wakeup - callback called when the queue has space again, may be NULL,
+ *      context - user data passed to wakeup callback
+ *
+ * Returns:
+ *      pointer to a new dispatcher on success,
+ *      NULL on error
+ */
+rest_dispatcher_t *rest_dispatcher_new(const http_security_settings_t *security,
+                                       const rest_dispatcher_settings_t *settings,
+                                       size_t queue_size, rest_dispatcher_wakeup_cb_t wakeup,
+                                       void *context);
+
+/*
+ * Stops delivery thread and frees the dispatcher. Undelivered batches are
+ * moved to the spool if it is configured, dropped otherwise.
+ *
+ * Parameters:
+ *      dispatcher - dispatcher pointer
+ */
+void rest_dispatcher_delete(rest_dispatcher_t *dispatcher);
+
+/*
+ * Sets callback to which batches are delivered. Batches are held in the queue
+ * while no callback is set. Removing the callback drops undelivered batches,
+ * including spooled ones.
+ *
+ * Parameters:
+ *      dispatcher - dispatcher pointer,
+ *      callback - callback object with "url" and "headers" keys (copied),
+ *      or NULL to remove the callback
+ */
+void rest_dispatcher_set_callback(rest_dispatcher_t *dispatcher, const json_t *callback);
+
+/*
+ * Checks whether there is space for another batch in the queue. With the
+ * spool, queue is full only while batches waiting to be spilled reach the
+ * memory limit too.
+ *
+ * Parameters:
+ *      dispatcher - dispatcher pointer
+ *
+ * Returns:
+ *      true if the queue is full,
+ *      false otherwise
+ */
+bool rest_dispatcher_is_full(rest_dispatcher_t *dispatcher);
+
+/*
+ * Queues notifications batch for delivery
+ *
+ * Parameters:
+ *      dispatcher - dispatcher pointer,
+ *      body - serialized notifications batch, freed by dispatcher on success,
+ *      length - body length in bytes
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value if the queue is full
+ */
+int rest_dispatcher_enqueue(rest_dispatcher_t *dispatcher, char *body, size_t length);
+
+#endif // REST_DISPATCHER_H
@@ -0,0 +1,344 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rest_events.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Every slot holds a turn counter, which tells whose turn it is to use the
+ * slot: a producer with ring position equal to turn, or the consumer with
+ * ring position one below it. Producers claim positions by advancing the
+ * tail with compare-and-swap.
+ */
+typedef struct
+{
+    atomic_uint_fast64_t turn;
+    rest_event_t event;
+} rest_event_slot_t;
+
+struct rest_event_ring_t
+{
+    rest_event_slot_t *slots;
+    size_t mask;
+    atomic_uint_fast64_t tail;
+    atomic_uint_fast64_t head;
+    atomic_ulong overflows;
+};
+
+struct rest_event_log_t
+{
+    rest_event_record_t *records;
+    size_t mask;
+    uint64_t first;
+    uint64_t last;
+    // position of the next appended record
+    uint64_t position;
+};
+
+rest_event_ring_t *rest_event_ring_new(size_t size)
+{
+    rest_event_ring_t *ring;
+    size_t capacity = 1, index;
+
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    while (capacity < size)
+    {
+        capacity <<= 1;
+    }
+
+    ring = calloc(1, sizeof(rest_event_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    ring->slots = calloc(capacity, sizeof(rest_event_slot_t));
+    if (ring->slots == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    for (index = 0; index < capacity; index++)
+    {
+        atomic_init(&ring->slots[index].turn, index);
+    }
+
+    ring->mask = capacity - 1;
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->overflows, 0);
+
+    return ring;
+}
+
+void rest_event_ring_delete(rest_event_ring_t *ring)
+{
+    rest_event_t event;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    while (rest_event_ring_pop(ring, &event))
+    {
+        rest_event_clear(&event);
+    }
+
+    free(ring->slots);
+    free(ring);
+}
+
+int rest_event_ring_push(rest_event_ring_t *ring, rest_event_t *event)
+{
+    rest_event_slot_t *slot;
+    uint_fast64_t position, turn;
+
+    position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    for (;;)
+    {
+        slot = &ring->slots[position & ring->mask];
+        turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+
+        if (turn == position)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (turn < position)
+        {
+            // slot still holds an event from the previous lap
+            atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+            return -1;
+        }
+        else
+        {
+            position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+
+    event->sequence = position + 1;
+    slot->event = *event;
+    atomic_store_explicit(&slot->turn, position + 1, memory_order_release);
+
+    return 0;
+}
+
+bool rest_event_ring_pop(rest_event_ring_t *ring, rest_event_t *event)
+{
+    rest_event_slot_t *slot;
+    uint_fast64_t position;
+
+    position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    slot = &ring->slots[position & ring->mask];
+
+    if (atomic_load_explicit(&slot->turn, memory_order_acquire) != position + 1)
+    {
+        return false;
+    }
+
+    *event = slot->event;
+    atomic_store_explicit(&slot->turn, position + ring->mask + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, position + 1, memory_order_release);
+
+    return true;
+}
+
+bool rest_event_ring_is_empty(rest_event_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire)
+           == atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+bool rest_event_ring_is_full(rest_event_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_acquire)
+           - atomic_load_explicit(&ring->head, memory_order_acquire) > ring->mask;
+}
+
+size_t rest_event_ring_space(rest_event_ring_t *ring)
+{
+    uint_fast64_t used;
+
+    used = atomic_load_explicit(&ring->tail, memory_order_acquire)
+           - atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    return (used > ring->mask) ? 0 : ring->mask + 1 - used;
+}
+
+unsigned long rest_event_ring_take_overflows(rest_event_ring_t *ring)
+{
+    return atomic_exchange_explicit(&ring->overflows, 0, memory_order_relaxed);
+}
+
+void rest_event_clear(rest_event_t *event)
+{
+    free(event->name);
+    event->name = NULL;
+
+    if (event->response != NULL)
+    {
+        rest_async_response_delete(event->response);
+        event->response = NULL;
+    }
+}
+
+rest_event_log_t *rest_event_log_new(size_t size)
+{
+    rest_event_log_t *log;
+    size_t capacity = 1;
+
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    while (capacity < size)
+    {
+        capacity <<= 1;
+    }
+
+    log = calloc(1, sizeof(rest_event_log_t));
+    if (log == NULL)
+    {
+        return NULL;
+    }
+
+    log->records = calloc(capacity, sizeof(rest_event_record_t));
+    if (log->records == NULL)
+    {
+        free(log);
+        return NULL;
+    }
+
+    log->mask = capacity - 1;
+    log->first = 1;
+    log->last = 0;
+
+    return log;
+}
+
+void rest_event_log_delete(rest_event_log_t *log)
+{
+    size_t index;
+
+    if (log == NULL)
+    {
+        return;
+    }
+
+    for (index = 0; index <= log->mask; index++)
+    {
+        json_decref(log->records[index].json);
+        free(log->records[index].text);
+        free(log->records[index].name);
+    }
+
+    free(log->records);
+    free(log);
+}
+
+static uint64_t rest_event_log_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void rest_event_log_append(rest_event_log_t *log, uint64_t sequence, rest_event_type_t type,
+                           char *name, json_t *json)
+{
+    rest_event_record_t *record = &log->records[sequence & log->mask];
+
+    if (log->last - log->first + 1 > log->mask)
+    {
+        log->first++;
+    }
+
+    json_decref(record->json);
+    free(record->text);
+    free(record->name);
+    record->sequence = sequence;
+    record->type = type;
+    record->name = name;
+    record->json = json;
+
+    // every consumer that sends text would serialize the same object again
+    record->text = json_dumps(json, JSON_COMPACT);
+    record->length = (record->text != NULL) ? strlen(record->text) : 0;
+    record->position = log->position;
+    record->time = rest_event_log_now();
+
+    log->position += record->length;
+    log->last = sequence;
+}
+
+const rest_event_record_t *rest_event_log_get(rest_event_log_t *log, uint64_t sequence)
+{
+    if (sequence < log->first || sequence > log->last)
+    {
+        return NULL;
+    }
+
+    return &log->records[sequence & log->mask];
+}
+
+uint64_t rest_event_log_first(rest_event_log_t *log)
+{
+    return log->first;
+}
+
+uint64_t rest_event_log_last(rest_event_log_t *log)
+{
+    return log->last;
+}
+
+size_t rest_event_log_size(rest_event_log_t *log)
+{
+    return log->mask + 1;
+}
+
+uint64_t rest_event_log_bytes(rest_event_log_t *log, uint64_t after)
+{
+    const rest_event_record_t *record;
+
+    record = rest_event_log_get(log, (after < log->first) ? log->first : after + 1);
+    if (record == NULL)
+    {
+        return 0;
+    }
+
+    return log->position - record->position;
+}
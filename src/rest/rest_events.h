@@ -0,0 +1,237 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REST_EVENTS_H
+#define REST_EVENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <jansson.h>
+
+#include "rest_core_types.h"
+
+typedef enum
+{
+    REST_EVENT_REGISTRATION,
+    REST_EVENT_UPDATE,
+    REST_EVENT_DEREGISTRATION,
+    REST_EVENT_ASYNC_RESPONSE,
+} rest_event_type_t;
+
+typedef enum
+{
+    // events that do not fit are dropped and counted
+    REST_EVENTS_OVERFLOW_DROP,
+    // CoAP packets are not read while events do not fit
+    REST_EVENTS_OVERFLOW_BLOCK,
+} rest_events_overflow_t;
+
+typedef struct
+{
+    uint32_t queue_size;
+    rest_events_overflow_t overflow;
+    uint32_t retention;
+} rest_events_settings_t;
+
+typedef struct
+{
+    // assigned on push, increases by one with every queued event
+    uint64_t sequence;
+    rest_event_type_t type;
+    // endpoint name the event is about, may be NULL for async responses
+    char *name;
+    // response of REST_EVENT_ASYNC_RESPONSE
+    rest_async_response_t *response;
+} rest_event_t;
+
+/*
+ * Bounded multi-producer single-consumer queue of events. Events are popped
+ * in the order they were pushed.
+ *
+ * Pushing is lock free and can be done from any thread, popping must only be
+ * done by one thread at a time.
+ */
+typedef struct rest_event_ring_t rest_event_ring_t;
+
+/*
+ * Creates an event ring
+ *
+ * Parameters:
+ *      size - maximum number of queued events, rounded up to a power of two
+ *
+ * Returns:
+ *      pointer to a new ring on success,
+ *      NULL on error
+ */
+rest_event_ring_t *rest_event_ring_new(size_t size);
+
+/*
+ * Frees event ring and all queued events
+ *
+ * Parameters:
+ *      ring - ring pointer
+ */
+void rest_event_ring_delete(rest_event_ring_t *ring);
+
+/*
+ * Queues an event, ownership of event name and response passes to the ring
+ *
+ * Parameters:
+ *      ring - ring pointer,
+ *      event - event to queue, sequence is set after return
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value if the ring is full, event is then not taken
+ */
+int rest_event_ring_push(rest_event_ring_t *ring, rest_event_t *event);
+
+/*
+ * Takes the oldest event from the ring
+ *
+ * Parameters:
+ *      ring - ring pointer,
+ *      event - event pointer, is set after return and must be cleared with
+ *              rest_event_clear()
+ *
+ * Returns:
+ *      true if event was taken,
+ *      false if the ring is empty
+ */
+bool rest_event_ring_pop(rest_event_ring_t *ring, rest_event_t *event);
+
+bool rest_event_ring_is_empty(rest_event_ring_t *ring);
+bool rest_event_ring_is_full(rest_event_ring_t *ring);
+
+/*
+ * Returns number of events that can be pushed before the ring is full
+ *
+ * Parameters:
+ *      ring - ring pointer
+ */
+size_t rest_event_ring_space(rest_event_ring_t *ring);
+
+/*
+ * Returns number of events that did not fit since last call and resets it
+ *
+ * Parameters:
+ *      ring - ring pointer
+ */
+unsigned long rest_event_ring_take_overflows(rest_event_ring_t *ring);
+
+/*
+ * Frees event name and response
+ *
+ * Parameters:
+ *      event - event pointer
+ */
+void rest_event_clear(rest_event_t *event);
+
+typedef struct
+{
+    uint64_t sequence;
+    rest_event_type_t type;
+    // endpoint name the event is about, NULL if unknown
+    char *name;
+    // notification object, e.g. {"name": "..."} for registration events
+    json_t *json;
+    // compact serialization of json, NULL if it failed
+    char *text;
+    size_t length;
+    // total length of texts of all records appended before this one
+    uint64_t position;
+    // monotonic time in milliseconds when the record was appended
+    uint64_t time;
+} rest_event_record_t;
+
+/*
+ * Window of the most recent events, kept after they leave the ring so that
+ * several consumers can read them by sequence number. Appending to a full
+ * log drops the oldest record.
+ *
+ * Log functions are not thread safe, calls must be serialized by caller.
+ */
+typedef struct rest_event_log_t rest_event_log_t;
+
+/*
+ * Creates an event log
+ *
+ * Parameters:
+ *      size - number of retained events, rounded up to a power of two
+ *
+ * Returns:
+ *      pointer to a new log on success,
+ *      NULL on error
+ */
+rest_event_log_t *rest_event_log_new(size_t size);
+
+/*
+ * Frees event log and all retained records
+ *
+ * Parameters:
+ *      log - log pointer
+ */
+void rest_event_log_delete(rest_event_log_t *log);
+
+/*
+ * Appends a record, sequence must be one above the last appended record
+ *
+ * Parameters:
+ *      log - log pointer,
+ *      sequence - event sequence number,
+ *      type - event type,
+ *      name - endpoint name or NULL, freed by the log,
+ *      json - notification object, reference is stolen by the log
+ */
+void rest_event_log_append(rest_event_log_t *log, uint64_t sequence, rest_event_type_t type,
+                           char *name, json_t *json);
+
+/*
+ * Finds a retained record
+ *
+ * Parameters:
+ *      log - log pointer,
+ *      sequence - event sequence number
+ *
+ * Returns:
+ *      pointer to record, valid until the next append,
+ *      NULL if event is not retained
+ */
+const rest_event_record_t *rest_event_log_get(rest_event_log_t *log, uint64_t sequence);
+
+// sequence number of the oldest retained event, one above the last if log is empty
+uint64_t rest_event_log_first(rest_event_log_t *log);
+// sequence number of the newest event, zero if nothing was appended
+uint64_t rest_event_log_last(rest_event_log_t *log);
+size_t rest_event_log_size(rest_event_log_t *log);
+
+/*
+ * Sums text lengths of retained records after the given one
+ *
+ * Parameters:
+ *      log - log pointer,
+ *      after - sequence number of the last record not counted
+ *
+ * Returns:
+ *      number of bytes
+ */
+uint64_t rest_event_log_bytes(rest_event_log_t *log, uint64_t after);
+
+#endif // REST_EVENTS_H
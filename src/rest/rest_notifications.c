@@ -17,10 +17,58 @@
  *
  */
 
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include "../logging.h"
 #include "../punica.h"
+#include "rest_stream.h"
+
+// longest time in milliseconds a pull request is held open
+#define REST_NOTIFICATIONS_MAX_WAIT 60000
+// milliseconds after which an idle stream sends a comment, so that broken connections are noticed
+#define REST_NOTIFICATIONS_KEEPALIVE 15000
+// events formatted per REST lock
+#define REST_NOTIFICATIONS_STREAM_BATCH 64
+#define REST_NOTIFICATIONS_STREAM_BUFFER_SIZE 4096
+
+typedef struct
+{
+    rest_context_t *rest;
+    // bit per rest_event_type_t
+    unsigned int types;
+    // last event looked at, stream continues after it
+    uint64_t sequence;
+    rest_stream_t output;
+} rest_notifications_stream_t;
+
+// indexed by rest_event_type_t
+static const char *rest_event_names[] =
+{
+    "registrations",
+    "reg-updates",
+    "de-registrations",
+    "async-responses",
+};
+
+static int rest_event_type_from_name(const char *name, size_t length)
+{
+    int type;
+
+    for (type = REST_EVENT_REGISTRATION; type <= REST_EVENT_ASYNC_RESPONSE; type++)
+    {
+        if (strlen(rest_event_names[type]) == length
+            && strncmp(rest_event_names[type], name, length) == 0)
+        {
+            return type;
+        }
+    }
+
+    return -1;
+}
 
 bool valid_callback_url(const char *url)
 {
@@ -185,11 +233,15 @@ int rest_notifications_put_callback_cb(const ulfius_req_t *req, ulfius_resp_t *r
     }
 
     rest->callback = jcallback;
+    rest_dispatcher_set_callback(rest->dispatcher, jcallback);
 
     ulfius_set_empty_body_response(resp, 204);
 
     rest_unlock(rest);
 
+    // pending notifications can be delivered right away
+    rest_wakeup(rest);
+
     return U_CALLBACK_COMPLETE;
 }
 
@@ -207,6 +259,7 @@ int rest_notifications_delete_callback_cb(const ulfius_req_t *req, ulfius_resp_t
 
         json_decref(rest->callback);
         rest->callback = NULL;
+        rest_dispatcher_set_callback(rest->dispatcher, NULL);
 
         ulfius_set_empty_body_response(resp, 204);
     }
@@ -222,47 +275,728 @@ int rest_notifications_delete_callback_cb(const ulfius_req_t *req, ulfius_resp_t
     return U_CALLBACK_COMPLETE;
 }
 
+static rest_subscriber_t *rest_subscribers_find(rest_context_t *rest, const char *name)
+{
+    linked_list_entry_t *entry;
+    rest_subscriber_t *subscriber;
+
+    for (entry = rest->subscribers->head; entry != NULL; entry = entry->next)
+    {
+        subscriber = entry->data;
+        if (strcmp(subscriber->name, name) == 0)
+        {
+            return subscriber;
+        }
+    }
+
+    return NULL;
+}
+
+static bool validate_subscriber(json_t *jsubscriber, rest_context_t *rest, uint32_t *types)
+{
+    json_t *jcallback, *jevents, *jheaders, *url, *value;
+    const char *key;
+    regex_t regex;
+    size_t index;
+    int type;
+    bool valid;
+
+    if (!json_is_object(jsubscriber))
+    {
+        return false;
+    }
+
+    json_object_foreach(jsubscriber, key, value)
+    {
+        if (strcmp(key, "url") != 0 && strcmp(key, "headers") != 0
+            && strcmp(key, "events") != 0 && strcmp(key, "endpoint") != 0
+            && strcmp(key, "endpoint_regex") != 0)
+        {
+            return false;
+        }
+    }
+
+    // "events" is an optional non-empty array of event type names
+    *types = ~0u;
+    jevents = json_object_get(jsubscriber, "events");
+    if (jevents != NULL)
+    {
+        if (!json_is_array(jevents) || json_array_size(jevents) == 0)
+        {
+            return false;
+        }
+
+        *types = 0;
+        json_array_foreach(jevents, index, value)
+        {
+            if (!json_is_string(value))
+            {
+                return false;
+            }
+
+            type = rest_event_type_from_name(json_string_value(value), json_string_length(value));
+            if (type < 0)
+            {
+                return false;
+            }
+            *types |= 1u << type;
+        }
+    }
+
+    value = json_object_get(jsubscriber, "endpoint");
+    if (value != NULL && !json_is_string(value))
+    {
+        return false;
+    }
+
+    value = json_object_get(jsubscriber, "endpoint_regex");
+    if (value != NULL)
+    {
+        if (!json_is_string(value)
+            || regcomp(&regex, json_string_value(value), REG_EXTENDED | REG_NOSUB) != 0)
+        {
+            return false;
+        }
+        regfree(&regex);
+    }
+
+    url = json_object_get(jsubscriber, "url");
+    if (!json_is_string(url))
+    {
+        return false;
+    }
+
+    // unlike single callback, headers may be left out
+    jheaders = json_object_get(jsubscriber, "headers");
+    jcallback = json_pack("{s:O, s:o}", "url", url,
+                          "headers", (jheaders != NULL) ? json_incref(jheaders) : json_object());
+    if (jcallback == NULL)
+    {
+        return false;
+    }
+
+    valid = validate_callback(jcallback, rest);
+    json_decref(jcallback);
+
+    return valid;
+}
+
+int rest_notifications_get_callbacks_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                        void *context)
+{
+    rest_context_t *rest = (rest_context_t *)context;
+    linked_list_entry_t *entry;
+    rest_subscriber_t *subscriber;
+    json_t *jsubscribers, *jsubscriber;
+
+    jsubscribers = json_array();
+
+    rest_lock(rest);
+
+    for (entry = rest->subscribers->head; entry != NULL; entry = entry->next)
+    {
+        subscriber = entry->data;
+
+        jsubscriber = json_deep_copy(subscriber->jsubscriber);
+        json_object_set_new(jsubscriber, "name", json_string(subscriber->name));
+        json_array_append_new(jsubscribers, jsubscriber);
+    }
+
+    rest_unlock(rest);
+
+    ulfius_set_json_body_response(resp, 200, jsubscribers);
+    json_decref(jsubscribers);
+
+    return U_CALLBACK_COMPLETE;
+}
+
+int rest_notifications_get_callbacks_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                             void *context)
+{
+    rest_context_t *rest = (rest_context_t *)context;
+    rest_subscriber_t *subscriber;
+
+    rest_lock(rest);
+
+    subscriber = rest_subscribers_find(rest, u_map_get(req->map_url, "name"));
+    if (subscriber == NULL)
+    {
+        ulfius_set_empty_body_response(resp, 404);
+    }
+    else
+    {
+        ulfius_set_json_body_response(resp, 200, subscriber->jsubscriber);
+    }
+
+    rest_unlock(rest);
+
+    return U_CALLBACK_COMPLETE;
+}
+
+int rest_notifications_put_callbacks_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                             void *context)
+{
+    rest_context_t *rest = (rest_context_t *)context;
+    rest_subscriber_t *subscriber, *previous;
+    const char *ct, *name;
+    json_t *jsubscriber;
+    uint64_t sequence;
+    uint32_t types;
+
+    ct = u_map_get_case(req->map_header, "Content-Type");
+    if (ct == NULL || strcmp(ct, "application/json") != 0)
+    {
+        ulfius_set_empty_body_response(resp, 415);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    name = u_map_get(req->map_url, "name");
+    jsubscriber = json_loadb(req->binary_body, req->binary_body_length, 0, NULL);
+    if (!rest_subscriber_valid_name(name) || !validate_subscriber(jsubscriber, rest, &types))
+    {
+        if (jsubscriber != NULL)
+        {
+            json_decref(jsubscriber);
+        }
+
+        ulfius_set_empty_body_response(resp, 400);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    log_message(LOG_LEVEL_INFO, "[SET-CALLBACK] name=%s url=%s\n", name,
+                json_string_value(json_object_get(jsubscriber, "url")));
+
+    // dispatchers are stopped and started without REST lock, it can take a while
+    assert(pthread_mutex_lock(&rest->subscribers_mutex) == 0);
+
+    rest_lock(rest);
+
+    rest_notifications_collect(rest);
+
+    // existing subscriber keeps its dispatcher, queued batches and log position
+    previous = rest_subscribers_find(rest, name);
+    if (previous != NULL)
+    {
+        if (rest_subscriber_update(previous, jsubscriber, types))
+        {
+            log_message(LOG_LEVEL_ERROR, "[SET-CALLBACK] Failed to update \"%s\"\n", name);
+
+            ulfius_set_empty_body_response(resp, 500);
+        }
+        else
+        {
+            ulfius_set_empty_body_response(resp, 204);
+        }
+
+        rest_unlock(rest);
+        json_decref(jsubscriber);
+    }
+    else
+    {
+        sequence = rest_event_log_last(rest->event_log);
+
+        rest_unlock(rest);
+
+        subscriber = rest_subscriber_new(name, jsubscriber, types,
+                                         &rest->settings->http.security,
+                                         &rest->settings->http.callback,
+                                         REST_DISPATCHER_QUEUE_SIZE, rest_wakeup_cb, rest);
+        json_decref(jsubscriber);
+
+        if (subscriber == NULL)
+        {
+            log_message(LOG_LEVEL_ERROR, "[SET-CALLBACK] Failed to start delivery to \"%s\"\n",
+                        name);
+
+            ulfius_set_empty_body_response(resp, 500);
+        }
+        else
+        {
+            rest_lock(rest);
+
+            subscriber->notified_sequence = sequence;
+            linked_list_add(rest->subscribers, subscriber);
+
+            rest_unlock(rest);
+
+            ulfius_set_empty_body_response(resp, 204);
+        }
+    }
+
+    assert(pthread_mutex_unlock(&rest->subscribers_mutex) == 0);
+
+    // pending notifications can be delivered right away
+    rest_wakeup(rest);
+
+    return U_CALLBACK_COMPLETE;
+}
+
+int rest_notifications_delete_callbacks_name_cb(const ulfius_req_t *req, ulfius_resp_t *resp,
+                                                void *context)
+{
+    rest_context_t *rest = (rest_context_t *)context;
+    rest_subscriber_t *subscriber;
+    const char *name;
+
+    name = u_map_get(req->map_url, "name");
+
+    assert(pthread_mutex_lock(&rest->subscribers_mutex) == 0);
+
+    rest_lock(rest);
+
+    subscriber = rest_subscribers_find(rest, name);
+    if (subscriber != NULL)
+    {
+        linked_list_remove(rest->subscribers, subscriber);
+    }
+
+    rest_unlock(rest);
+
+    if (subscriber != NULL)
+    {
+        log_message(LOG_LEVEL_INFO, "[DELETE-CALLBACK] name=%s\n", name);
+
+        // undelivered events of a removed subscriber are dropped, like with single callback
+        rest_dispatcher_set_callback(subscriber->dispatcher, NULL);
+        rest_subscriber_delete(subscriber);
+
+        ulfius_set_empty_body_response(resp, 204);
+    }
+    else
+    {
+        ulfius_set_empty_body_response(resp, 404);
+    }
+
+    assert(pthread_mutex_unlock(&rest->subscribers_mutex) == 0);
+
+    return U_CALLBACK_COMPLETE;
+}
+
+static int rest_notifications_pull_parse(const ulfius_req_t *req, uint64_t *after,
+                                         long *wait, size_t *max)
+{
+    const char *value;
+    char *end;
+
+    value = u_map_get(req->map_url, "after");
+    errno = 0;
+    *after = strtoull(value, &end, 10);
+    if (errno != 0 || *value < '0' || *value > '9' || *end != '\0')
+    {
+        return -1;
+    }
+
+    *wait = 0;
+    value = u_map_get(req->map_url, "wait");
+    if (value != NULL)
+    {
+        errno = 0;
+        *wait = strtol(value, &end, 10);
+        if (errno != 0 || *value < '0' || *value > '9' || *end != '\0'
+            || *wait > REST_NOTIFICATIONS_MAX_WAIT)
+        {
+            return -1;
+        }
+    }
+
+    *max = SIZE_MAX;
+    value = u_map_get(req->map_url, "max");
+    if (value != NULL)
+    {
+        errno = 0;
+        *max = strtoul(value, &end, 10);
+        if (errno != 0 || *value < '1' || *value > '9' || *end != '\0')
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void rest_notifications_deadline(struct timespec *deadline, long wait)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += wait / 1000;
+    deadline->tv_nsec += (wait % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Waits with REST lock held until an event after the given one is logged.
+ * Returns false if deadline passed or server is stopping.
+ */
+static bool rest_notifications_wait(rest_context_t *rest, uint64_t after,
+                                    const struct timespec *deadline)
+{
+    while (rest_event_log_last(rest->event_log) <= after)
+    {
+        if (rest->closing
+            || pthread_cond_timedwait(&rest->events_cond, &rest->mutex, deadline) == ETIMEDOUT)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 int rest_notifications_pull_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
 {
     rest_context_t *rest = (rest_context_t *)context;
+    json_t *jbody;
+    uint64_t after, first, last;
+    struct timespec deadline;
+    long wait;
+    size_t max;
+
+    // without a cursor pulled events are gone, like with the callback
+    if (u_map_get(req->map_url, "after") == NULL)
+    {
+        rest_lock(rest);
+
+        rest->cursorless_pull = true;
+        rest_notifications_collect(rest);
+        jbody = rest_notifications_json(rest, rest->notified_sequence, SIZE_MAX,
+                                        &rest->notified_sequence);
+
+        rest_unlock(rest);
+
+        // notification log has space again, CoAP socket may be resumed
+        rest_wakeup(rest);
+
+        ulfius_set_json_body_response(resp, 200, jbody);
+        json_decref(jbody);
+
+        return U_CALLBACK_COMPLETE;
+    }
+
+    if (rest_notifications_pull_parse(req, &after, &wait, &max))
+    {
+        ulfius_set_empty_body_response(resp, 400);
+        return U_CALLBACK_COMPLETE;
+    }
 
     rest_lock(rest);
 
-    json_t *jbody = rest_notifications_json(rest);
+    rest_notifications_collect(rest);
 
-    rest_notifications_clear(rest);
+    // sequence numbers start over after restart
+    if (after > rest_event_log_last(rest->event_log))
+    {
+        rest_unlock(rest);
+        ulfius_set_empty_body_response(resp, 400);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    if (wait > 0)
+    {
+        rest_notifications_deadline(&deadline, wait);
+        rest_notifications_wait(rest, after, &deadline);
+    }
+
+    first = rest_event_log_first(rest->event_log);
+    jbody = rest_notifications_json(rest, after, max, &last);
+
+    rest_unlock(rest);
+
+    json_object_set_new(jbody, "sequence", json_integer(last));
+    json_object_set_new(jbody, "missed", json_integer((first > after + 1) ? first - after - 1 : 0));
 
     ulfius_set_json_body_response(resp, 200, jbody);
     json_decref(jbody);
 
+    return U_CALLBACK_COMPLETE;
+}
+
+static int rest_notifications_stream_append_event(rest_notifications_stream_t *stream,
+                                                  uint64_t sequence, const char *name,
+                                                  const char *data, size_t data_length)
+{
+    char header[64];
+    int length;
+
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    // compact json has no line breaks, so it fits in a single data field
+    length = snprintf(header, sizeof(header), "id: %llu\nevent: %s\ndata: ",
+                      (unsigned long long)sequence, name);
+
+    if (rest_stream_append(&stream->output, header, length)
+        || rest_stream_append(&stream->output, data, data_length)
+        || rest_stream_append(&stream->output, "\n\n", 2))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int rest_notifications_stream_fill(void *context)
+{
+    rest_notifications_stream_t *stream = (rest_notifications_stream_t *)context;
+    rest_context_t *rest = stream->rest;
+    const rest_event_record_t *record;
+    struct timespec deadline;
+    char missed[48];
+    uint64_t first;
+    size_t count;
+    int res = 0;
+
+    rest_notifications_deadline(&deadline, REST_NOTIFICATIONS_KEEPALIVE);
+
+    rest_lock(rest);
+
+    // filtered out events don't end the wait
+    while (res == 0 && stream->output.length == 0)
+    {
+        if (!rest_notifications_wait(rest, stream->sequence, &deadline))
+        {
+            stream->output.done = rest->closing;
+            break;
+        }
+
+        first = rest_event_log_first(rest->event_log);
+        if (stream->sequence + 1 < first)
+        {
+            snprintf(missed, sizeof(missed), "{\"missed\":%llu}",
+                     (unsigned long long)(first - stream->sequence - 1));
+            res = rest_notifications_stream_append_event(stream, first - 1, "missed", missed,
+                                                         strlen(missed));
+            stream->sequence = first - 1;
+        }
+
+        for (count = 0; res == 0 && count < REST_NOTIFICATIONS_STREAM_BATCH; count++)
+        {
+            record = rest_event_log_get(rest->event_log, stream->sequence + 1);
+            if (record == NULL)
+            {
+                break;
+            }
+
+            stream->sequence = record->sequence;
+            if (stream->types & (1u << record->type))
+            {
+                res = rest_notifications_stream_append_event(stream, record->sequence,
+                                                             rest_event_names[record->type],
+                                                             record->text, record->length);
+            }
+        }
+    }
+
     rest_unlock(rest);
 
+    if (res == 0 && stream->output.length == 0 && !stream->output.done)
+    {
+        res = rest_stream_append(&stream->output, ": keepalive\n\n", 13);
+    }
+
+    return res;
+}
+
+static ssize_t rest_notifications_stream_read(void *context, uint64_t offset, char *buffer,
+                                              size_t max_length)
+{
+    rest_notifications_stream_t *stream = (rest_notifications_stream_t *)context;
+
+    return rest_stream_read(&stream->output, buffer, max_length);
+}
+
+static void rest_notifications_stream_free(void *context)
+{
+    rest_notifications_stream_t *stream = (rest_notifications_stream_t *)context;
+
+    rest_stream_clear(&stream->output);
+    free(stream);
+}
+
+static int rest_notifications_stream_parse(const ulfius_req_t *req,
+                                           rest_notifications_stream_t *stream,
+                                           bool *resume)
+{
+    const char *types, *after;
+    char *end;
+    size_t length;
+    int type;
+
+    stream->types = 0;
+    types = u_map_get(req->map_url, "types");
+    while (types != NULL && *types != '\0')
+    {
+        length = strcspn(types, ",");
+        type = rest_event_type_from_name(types, length);
+        if (type < 0)
+        {
+            return -1;
+        }
+        stream->types |= 1u << type;
+
+        types += (types[length] == ',') ? length + 1 : length;
+    }
+
+    if (stream->types == 0)
+    {
+        stream->types = ~0u;
+    }
+
+    // reconnecting EventSource clients resume with Last-Event-ID header
+    after = u_map_get(req->map_url, "after");
+    if (after == NULL)
+    {
+        after = u_map_get_case(req->map_header, "Last-Event-ID");
+    }
+
+    *resume = (after != NULL);
+    if (after != NULL)
+    {
+        errno = 0;
+        stream->sequence = strtoull(after, &end, 10);
+        if (errno != 0 || *after < '0' || *after > '9' || *end != '\0')
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int rest_notifications_stream_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *context)
+{
+    rest_context_t *rest = (rest_context_t *)context;
+    rest_notifications_stream_t *stream;
+    bool resume;
+
+    stream = calloc(1, sizeof(rest_notifications_stream_t));
+    if (stream == NULL)
+    {
+        ulfius_set_empty_body_response(resp, 500);
+        return U_CALLBACK_COMPLETE;
+    }
+    stream->rest = rest;
+    rest_stream_init(&stream->output, rest_notifications_stream_fill, stream);
+
+    if (rest_notifications_stream_parse(req, stream, &resume))
+    {
+        rest_notifications_stream_free(stream);
+        ulfius_set_empty_body_response(resp, 400);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    rest_lock(rest);
+
+    rest_notifications_collect(rest);
+
+    if (!resume)
+    {
+        stream->sequence = rest_event_log_last(rest->event_log);
+    }
+    else if (stream->sequence > rest_event_log_last(rest->event_log))
+    {
+        rest_unlock(rest);
+        rest_notifications_stream_free(stream);
+        ulfius_set_empty_body_response(resp, 400);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    rest_unlock(rest);
+
+    if (ulfius_set_stream_response(resp, 200, rest_notifications_stream_read,
+                                   rest_notifications_stream_free, U_STREAM_SIZE_UNKOWN,
+                                   REST_NOTIFICATIONS_STREAM_BUFFER_SIZE, stream) != U_OK)
+    {
+        rest_notifications_stream_free(stream);
+        ulfius_set_empty_body_response(resp, 500);
+        return U_CALLBACK_COMPLETE;
+    }
+
+    u_map_put(resp->map_header, "Content-Type", "text/event-stream");
+    u_map_put(resp->map_header, "Cache-Control", "no-cache");
+
     return U_CALLBACK_COMPLETE;
 }
 
-void rest_notify_registration(rest_context_t *rest, rest_notif_registration_t *reg)
+void rest_notifications_close(rest_context_t *rest)
 {
-    linked_list_add(rest->registrationList, reg);
+    rest_lock(rest);
+
+    rest->closing = true;
+    pthread_cond_broadcast(&rest->events_cond);
+
+    rest_unlock(rest);
 }
 
-void rest_notify_update(rest_context_t *rest, rest_notif_update_t *update)
+static void rest_notify(rest_context_t *rest, rest_event_t *event)
 {
-    linked_list_add(rest->updateList, update);
+    if (rest_event_ring_push(rest->events, event) != 0)
+    {
+        rest_event_clear(event);
+    }
 }
 
-void rest_notify_deregistration(rest_context_t *rest, rest_notif_deregistration_t *dereg)
+static void rest_notify_name(rest_context_t *rest, rest_event_type_t type, const char *name)
 {
-    linked_list_add(rest->deregistrationList, dereg);
+    rest_event_t event = { .type = type };
+
+    event.name = strdup(name);
+    if (event.name == NULL)
+    {
+        log_message(LOG_LEVEL_ERROR, "[NOTIFY] Failed to allocate notification!\n");
+        return;
+    }
+
+    rest_notify(rest, &event);
+}
+
+void rest_notify_registration(rest_context_t *rest, const char *name)
+{
+    rest_notify_name(rest, REST_EVENT_REGISTRATION, name);
 }
 
-void rest_notify_timeout(rest_context_t *rest, rest_notif_timeout_t *timeout)
+void rest_notify_update(rest_context_t *rest, const char *name)
 {
-    linked_list_add(rest->timeoutList, timeout);
+    rest_notify_name(rest, REST_EVENT_UPDATE, name);
 }
 
-void rest_notify_async_response(rest_context_t *rest, rest_notif_async_response_t *resp)
+void rest_notify_deregistration(rest_context_t *rest, const char *name)
 {
-    linked_list_add(rest->asyncResponseList, resp);
+    rest_notify_name(rest, REST_EVENT_DEREGISTRATION, name);
+}
+
+void rest_notify_async_response(rest_context_t *rest, const char *name,
+                                rest_async_response_t *response)
+{
+    rest_event_t event = { .type = REST_EVENT_ASYNC_RESPONSE, .response = response };
+
+    // without a name the response is still delivered, only name filters skip it
+    if (name != NULL)
+    {
+        event.name = strdup(name);
+    }
+
+    rest_notify(rest, &event);
+}
+
+bool rest_notifications_congested(rest_context_t *rest)
+{
+    return rest->settings->http.notifications.overflow == REST_EVENTS_OVERFLOW_BLOCK
+           && rest_event_ring_is_full(rest->events);
+}
+
+size_t rest_notifications_space(rest_context_t *rest)
+{
+    if (rest->settings->http.notifications.overflow != REST_EVENTS_OVERFLOW_BLOCK)
+    {
+        return SIZE_MAX;
+    }
+
+    return rest_event_ring_space(rest->events);
 }
 
 static json_t *rest_async_response_to_json(rest_async_response_t *async)
@@ -277,120 +1011,243 @@ static json_t *rest_async_response_to_json(rest_async_response_t *async)
     return jasync;
 }
 
-static json_t *rest_registration_notification_to_json(rest_notif_registration_t *registration)
+static json_t *rest_name_notification_to_json(const char *name)
 {
-    json_t *jreg = json_object();
+    json_t *jname = json_object();
 
-    json_object_set_new(jreg, "name", json_string(registration->name));
+    json_object_set_new(jname, "name", json_string(name));
 
-    return jreg;
+    return jname;
 }
 
-static json_t *rest_update_notification_to_json(rest_notif_update_t *update)
+static json_t *rest_event_to_json(rest_event_t *event)
 {
-    json_t *jupdate = json_object();
-
-    json_object_set_new(jupdate, "name", json_string(update->name));
+    if (event->type == REST_EVENT_ASYNC_RESPONSE)
+    {
+        return rest_async_response_to_json(event->response);
+    }
 
-    return jupdate;
+    return rest_name_notification_to_json(event->name);
 }
 
-static json_t *rest_deregistration_notification_to_json(rest_notif_deregistration_t *deregistration)
+/*
+ * In block mode, events not yet taken by callbacks or pull must not be
+ * overwritten. Pulls with a cursor and streams are not tracked, so without
+ * a callback or a pull without a cursor nothing is waited for.
+ */
+static bool rest_notifications_log_full(rest_context_t *rest)
 {
-    json_t *jdereg = json_object();
+    linked_list_entry_t *entry;
+    rest_subscriber_t *subscriber;
+    uint64_t oldest = rest->notified_sequence;
+    bool consumed = (rest->callback != NULL || rest->cursorless_pull);
+
+    if (rest->settings->http.notifications.overflow != REST_EVENTS_OVERFLOW_BLOCK)
+    {
+        return false;
+    }
+
+    for (entry = rest->subscribers->head; entry != NULL; entry = entry->next)
+    {
+        subscriber = entry->data;
+        if (!consumed || subscriber->notified_sequence < oldest)
+        {
+            oldest = subscriber->notified_sequence;
+        }
+        consumed = true;
+    }
+
+    if (!consumed)
+    {
+        return false;
+    }
 
-    json_object_set_new(jdereg, "name", json_string(deregistration->name));
+    return rest_event_log_last(rest->event_log) - oldest >= rest_event_log_size(rest->event_log);
+}
 
-    return jdereg;
+static void rest_notifications_expire(uint64_t *sequence, uint64_t first, const char *consumer)
+{
+    if (*sequence + 1 < first)
+    {
+        log_message(LOG_LEVEL_WARN, "[NOTIFY] %llu notifications expired before delivery%s\n",
+                    (unsigned long long)(first - *sequence - 1), consumer);
+        *sequence = first - 1;
+    }
 }
 
-json_t *rest_notifications_json(rest_context_t *rest)
+void rest_notifications_collect(rest_context_t *rest)
 {
-    json_t *jnotifs;
-    json_t *jarray;
     linked_list_entry_t *entry;
-    rest_notif_registration_t *reg;
-    rest_notif_update_t *upd;
-    rest_notif_deregistration_t *dereg;
-    rest_notif_async_response_t *async;
+    rest_subscriber_t *subscriber;
+    rest_event_t event;
+    unsigned long overflows;
+    uint64_t first;
+    char consumer[REST_SUBSCRIBER_NAME_MAX + 8];
+    bool collected = false;
+
+    while (!rest_notifications_log_full(rest) && rest_event_ring_pop(rest->events, &event))
+    {
+        rest_event_log_append(rest->event_log, event.sequence, event.type, event.name,
+                              rest_event_to_json(&event));
+        event.name = NULL;
+        rest_event_clear(&event);
+        collected = true;
+    }
 
-    jnotifs = json_object();
+    overflows = rest_event_ring_take_overflows(rest->events);
+    if (overflows > 0)
+    {
+        log_message(LOG_LEVEL_WARN, "[NOTIFY] Notification queue is full, dropped %lu notifications\n",
+                    overflows);
+    }
 
-    if (rest->registrationList)
+    first = rest_event_log_first(rest->event_log);
+    rest_notifications_expire(&rest->notified_sequence, first, "");
+
+    for (entry = rest->subscribers->head; entry != NULL; entry = entry->next)
     {
-        jarray = json_array();
-        for (entry = rest->registrationList->head; entry != NULL; entry = entry->next)
-        {
-            reg = entry->data;
-            json_array_append_new(jarray, rest_registration_notification_to_json(reg));
-        }
-        json_object_set_new(jnotifs, "registrations", jarray);
+        subscriber = entry->data;
+        snprintf(consumer, sizeof(consumer), " to %s", subscriber->name);
+        rest_notifications_expire(&subscriber->notified_sequence, first, consumer);
     }
 
-    if (rest->updateList)
+    if (collected)
     {
-        jarray = json_array();
-        for (entry = rest->updateList->head; entry != NULL; entry = entry->next)
-        {
-            upd = entry->data;
-            json_array_append_new(jarray, rest_update_notification_to_json(upd));
-        }
-        json_object_set_new(jnotifs, "reg-updates", jarray);
+        pthread_cond_broadcast(&rest->events_cond);
     }
+}
 
-    if (rest->deregistrationList)
+int rest_notifications_batch(rest_context_t *rest, const rest_subscriber_t *subscriber,
+                             uint64_t after, size_t max_events, size_t max_bytes,
+                             uint64_t *last, char **body, size_t *length)
+{
+    const rest_event_record_t *record;
+    uint64_t first, sequence, end;
+    size_t size, count = 0, bytes = 0;
+    bool empty;
+    char *buffer, *position;
+    int type;
+
+    first = after + 1;
+    if (first < rest_event_log_first(rest->event_log))
     {
-        jarray = json_array();
-        for (entry = rest->deregistrationList->head; entry != NULL; entry = entry->next)
-        {
-            dereg = entry->data;
-            json_array_append_new(jarray, rest_deregistration_notification_to_json(dereg));
-        }
-        json_object_set_new(jnotifs, "de-registrations", jarray);
+        first = rest_event_log_first(rest->event_log);
     }
 
-    if (rest->asyncResponseList)
+    // batch holds at least one event, even if it is larger than max_bytes
+    for (end = first; count < max_events; end++)
     {
-        jarray = json_array();
-        for (entry = rest->asyncResponseList->head; entry != NULL; entry = entry->next)
+        record = rest_event_log_get(rest->event_log, end);
+        if (record == NULL)
         {
-            async = entry->data;
-            json_array_append_new(jarray, rest_async_response_to_json(async));
+            break;
         }
-        json_object_set_new(jnotifs, "async-responses", jarray);
+
+        if (subscriber != NULL && !rest_subscriber_match(subscriber, record))
+        {
+            continue;
+        }
+
+        if (count > 0 && bytes + record->length + 1 > max_bytes)
+        {
+            break;
+        }
+        bytes += record->length + 1;
+        count++;
     }
 
-    return jnotifs;
-}
+    *last = end - 1;
 
-void rest_notifications_clear(rest_context_t *rest)
-{
-    while (rest->registrationList->head != NULL)
+    // filtered out events are skipped without sending an empty batch
+    if (count == 0)
     {
-        rest_notif_registration_t *reg = rest->registrationList->head->data;
-        linked_list_remove(rest->registrationList, reg);
-        rest_notif_registration_delete(reg);
+        return 1;
     }
 
-    while (rest->updateList->head != NULL)
+    size = 2 + bytes;
+    for (type = REST_EVENT_REGISTRATION; type <= REST_EVENT_ASYNC_RESPONSE; type++)
     {
-        rest_notif_update_t *upd = rest->updateList->head->data;
-        linked_list_remove(rest->updateList, upd);
-        rest_notif_update_delete(upd);
+        size += strlen(rest_event_names[type]) + 6;
     }
 
-    while (rest->deregistrationList->head != NULL)
+    buffer = malloc(size);
+    if (buffer == NULL)
     {
-        rest_notif_deregistration_t *dereg = rest->deregistrationList->head->data;
-        linked_list_remove(rest->deregistrationList, dereg);
-        rest_notif_deregistration_delete(dereg);
+        return -1;
     }
 
-    while (rest->asyncResponseList->head != NULL)
+    // texts are spliced in, so that the batch is not built as another json tree
+    position = buffer;
+    *position++ = '{';
+    for (type = REST_EVENT_REGISTRATION; type <= REST_EVENT_ASYNC_RESPONSE; type++)
     {
-        rest_notif_async_response_t *async = rest->asyncResponseList->head->data;
-        linked_list_remove(rest->asyncResponseList, async);
-        rest_async_response_delete(async);
+        position += sprintf(position, "%s\"%s\":[", (type > 0) ? "," : "", rest_event_names[type]);
+
+        empty = true;
+        for (sequence = first; sequence < end; sequence++)
+        {
+            record = rest_event_log_get(rest->event_log, sequence);
+            if (record->type != type || record->text == NULL
+                || (subscriber != NULL && !rest_subscriber_match(subscriber, record)))
+            {
+                continue;
+            }
+
+            if (!empty)
+            {
+                *position++ = ',';
+            }
+            memcpy(position, record->text, record->length);
+            position += record->length;
+            empty = false;
+        }
+
+        *position++ = ']';
     }
+    *position++ = '}';
+
+    *body = buffer;
+    *length = position - buffer;
+
+    return 0;
 }
 
+json_t *rest_notifications_json(rest_context_t *rest, uint64_t after, size_t max,
+                                uint64_t *last)
+{
+    json_t *jnotifs, *jarrays[REST_EVENT_ASYNC_RESPONSE + 1];
+    const rest_event_record_t *record;
+    uint64_t sequence;
+    size_t count = 0;
+
+    jnotifs = json_object();
+    jarrays[REST_EVENT_REGISTRATION] = json_array();
+    jarrays[REST_EVENT_UPDATE] = json_array();
+    jarrays[REST_EVENT_DEREGISTRATION] = json_array();
+    jarrays[REST_EVENT_ASYNC_RESPONSE] = json_array();
+
+    json_object_set_new(jnotifs, rest_event_names[REST_EVENT_REGISTRATION],
+                        jarrays[REST_EVENT_REGISTRATION]);
+    json_object_set_new(jnotifs, rest_event_names[REST_EVENT_UPDATE],
+                        jarrays[REST_EVENT_UPDATE]);
+    json_object_set_new(jnotifs, rest_event_names[REST_EVENT_DEREGISTRATION],
+                        jarrays[REST_EVENT_DEREGISTRATION]);
+    json_object_set_new(jnotifs, rest_event_names[REST_EVENT_ASYNC_RESPONSE],
+                        jarrays[REST_EVENT_ASYNC_RESPONSE]);
+
+    sequence = after + 1;
+    if (sequence < rest_event_log_first(rest->event_log))
+    {
+        sequence = rest_event_log_first(rest->event_log);
+    }
+
+    for (; count < max && (record = rest_event_log_get(rest->event_log, sequence)) != NULL;
+         sequence++, count++)
+    {
+        json_array_append(jarrays[record->type], record->json);
+    }
+
+    *last = sequence - 1;
+
+    return jnotifs;
+}
@@ -64,6 +64,7 @@ static void rest_async_cb(uint16_t clientID, lwm2m_uri_t *uriP, int status,
                           void *context)
 {
     rest_async_context_t *ctx = (rest_async_context_t *)context;
+    lwm2m_client_t *client;
     int err;
 
     log_message(LOG_LEVEL_INFO, "[ASYNC-RESPONSE] id=%s status=%d\n",
@@ -74,7 +75,9 @@ static void rest_async_cb(uint16_t clientID, lwm2m_uri_t *uriP, int status,
     err = rest_async_response_set(ctx->response, coap_to_http_status(status), data, dataLength);
     assert(err == 0);
 
-    rest_notify_async_response(ctx->rest, ctx->response);
+    client = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)ctx->rest->lwm2m->clientList,
+                                               clientID);
+    rest_notify_async_response(ctx->rest, (client != NULL) ? client->name : NULL, ctx->response);
 
     // Free rest_async_context_t which was allocated in rest_resources_read_cb
     if (ctx->payload != NULL)
@@ -301,6 +304,9 @@ int rest_resources_rwe_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void *co
     ret = rest_resources_rwe_cb_unsafe(rest, req, resp);
     rest_unlock(rest);
 
+    // let the core rearm its timer for the new transaction
+    rest_wakeup(rest);
+
     return ret;
 }
 
@@ -0,0 +1,647 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rest_spool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPOOL_SEGMENT_SUFFIX    ".seg"
+// read position within a partly read segment, kept over restarts
+#define SPOOL_POSITION_FILE     "position"
+// numbering starts in the middle, so that segments can be prepended
+#define SPOOL_FIRST_SEGMENT     ((uint64_t)1 << 32)
+
+typedef struct
+{
+    uint32_t length;
+} spool_record_header_t;
+
+struct rest_spool_t
+{
+    char *directory;
+    size_t segment_size;
+
+    // segments from head to tail exist, spool has no segments if head > tail
+    uint64_t head;
+    uint64_t tail;
+
+    int read_fd;
+    off_t read_offset;
+    off_t read_size;
+    // length of the record returned by the last peek
+    size_t peeked;
+
+    int write_fd;
+    off_t write_size;
+
+    // reading of this segment continues from the offset once it is opened
+    uint64_t resume_segment;
+    off_t resume_offset;
+
+    // bytes not yet popped, including record headers
+    uint64_t bytes;
+};
+
+static char *rest_spool_path(rest_spool_t *spool, uint64_t segment)
+{
+    char *path;
+    size_t length;
+
+    length = strlen(spool->directory) + 1 + 16 + strlen(SPOOL_SEGMENT_SUFFIX) + 1;
+    path = malloc(length);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    snprintf(path, length, "%s/%016" PRIx64 SPOOL_SEGMENT_SUFFIX, spool->directory, segment);
+
+    return path;
+}
+
+static char *rest_spool_position_path(rest_spool_t *spool)
+{
+    char *path;
+    size_t length;
+
+    length = strlen(spool->directory) + 1 + strlen(SPOOL_POSITION_FILE) + 1;
+    path = malloc(length);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    snprintf(path, length, "%s/" SPOOL_POSITION_FILE, spool->directory);
+
+    return path;
+}
+
+static void rest_spool_load_position(rest_spool_t *spool)
+{
+    unsigned long long offset;
+    uint64_t segment;
+    char *path;
+    FILE *file;
+
+    path = rest_spool_position_path(spool);
+    if (path == NULL)
+    {
+        return;
+    }
+
+    file = fopen(path, "r");
+    free(path);
+    if (file == NULL)
+    {
+        return;
+    }
+
+    if (fscanf(file, "%" SCNx64 " %llu", &segment, &offset) == 2)
+    {
+        spool->resume_segment = segment;
+        spool->resume_offset = offset;
+    }
+
+    fclose(file);
+}
+
+static void rest_spool_store_position(rest_spool_t *spool)
+{
+    char *path;
+    FILE *file;
+
+    path = rest_spool_position_path(spool);
+    if (path == NULL)
+    {
+        return;
+    }
+
+    if (spool->resume_offset == 0)
+    {
+        unlink(path);
+        free(path);
+        return;
+    }
+
+    file = fopen(path, "w");
+    free(path);
+    if (file == NULL)
+    {
+        return;
+    }
+
+    fprintf(file, "%016" PRIx64 " %llu\n", spool->resume_segment,
+            (unsigned long long)spool->resume_offset);
+    fflush(file);
+    fdatasync(fileno(file));
+    fclose(file);
+}
+
+static int rest_spool_parse_name(const char *name, uint64_t *segment)
+{
+    char *end;
+
+    if (strlen(name) != 16 + strlen(SPOOL_SEGMENT_SUFFIX)
+        || strcmp(name + 16, SPOOL_SEGMENT_SUFFIX) != 0)
+    {
+        return -1;
+    }
+
+    errno = 0;
+    *segment = strtoull(name, &end, 16);
+    if (errno != 0 || end != name + 16)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int rest_spool_write(int fd, const void *data, size_t length)
+{
+    size_t written = 0;
+    ssize_t ret;
+
+    while (written < length)
+    {
+        ret = write(fd, (const uint8_t *)data + written, length - written);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        written += ret;
+    }
+
+    return 0;
+}
+
+static int rest_spool_write_record(int fd, const char *data, size_t length)
+{
+    spool_record_header_t header = { .length = length };
+
+    if (rest_spool_write(fd, &header, sizeof(header))
+        || rest_spool_write(fd, data, length))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void rest_spool_unlink(rest_spool_t *spool, uint64_t segment)
+{
+    char *path;
+
+    path = rest_spool_path(spool, segment);
+    if (path != NULL)
+    {
+        unlink(path);
+        free(path);
+    }
+}
+
+// drops the rest of the head segment, including records that can't be read
+static void rest_spool_finish_segment(rest_spool_t *spool)
+{
+    uint64_t remaining = spool->read_size - spool->read_offset;
+
+    spool->bytes = (spool->bytes > remaining) ? spool->bytes - remaining : 0;
+
+    if (spool->read_fd >= 0)
+    {
+        close(spool->read_fd);
+        spool->read_fd = -1;
+    }
+
+    // segment that is still appended to is started over
+    if (spool->head == spool->tail && spool->write_fd >= 0)
+    {
+        close(spool->write_fd);
+        spool->write_fd = -1;
+    }
+
+    if (spool->resume_segment == spool->head)
+    {
+        spool->resume_offset = 0;
+    }
+
+    rest_spool_unlink(spool, spool->head);
+    spool->head++;
+    spool->read_offset = 0;
+    spool->read_size = 0;
+}
+
+static int rest_spool_open_head(rest_spool_t *spool)
+{
+    struct stat file_stat;
+    char *path;
+
+    while (spool->head <= spool->tail)
+    {
+        path = rest_spool_path(spool, spool->head);
+        if (path == NULL)
+        {
+            return -1;
+        }
+
+        spool->read_fd = open(path, O_RDONLY | O_CLOEXEC);
+        free(path);
+
+        if (spool->read_fd >= 0)
+        {
+            if (fstat(spool->read_fd, &file_stat) != 0)
+            {
+                close(spool->read_fd);
+                spool->read_fd = -1;
+                return -1;
+            }
+
+            spool->read_offset = 0;
+            spool->read_size = file_stat.st_size;
+
+            if (spool->head == spool->resume_segment && spool->resume_offset > 0)
+            {
+                spool->read_offset = (spool->resume_offset < spool->read_size)
+                                     ? spool->resume_offset : spool->read_size;
+                spool->bytes = (spool->bytes > (uint64_t)spool->read_offset)
+                               ? spool->bytes - spool->read_offset : 0;
+                spool->resume_offset = 0;
+            }
+            return 0;
+        }
+
+        if (errno != ENOENT)
+        {
+            return -1;
+        }
+
+        spool->head++;
+    }
+
+    // nothing left to read, whatever was counted is gone
+    spool->bytes = 0;
+
+    return 1;
+}
+
+rest_spool_t *rest_spool_new(const char *directory, size_t segment_size)
+{
+    rest_spool_t *spool;
+    struct dirent *entry;
+    struct stat file_stat;
+    uint64_t segment;
+    char *path;
+    DIR *dir;
+
+    if (mkdir(directory, 0700) != 0 && errno != EEXIST)
+    {
+        return NULL;
+    }
+
+    spool = calloc(1, sizeof(rest_spool_t));
+    if (spool == NULL)
+    {
+        return NULL;
+    }
+
+    spool->directory = strdup(directory);
+    if (spool->directory == NULL)
+    {
+        free(spool);
+        return NULL;
+    }
+
+    spool->segment_size = segment_size;
+    spool->read_fd = -1;
+    spool->write_fd = -1;
+    spool->head = UINT64_MAX;
+    spool->tail = 0;
+
+    dir = opendir(directory);
+    if (dir == NULL)
+    {
+        free(spool->directory);
+        free(spool);
+        return NULL;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (rest_spool_parse_name(entry->d_name, &segment))
+        {
+            continue;
+        }
+
+        path = rest_spool_path(spool, segment);
+        if (path == NULL || stat(path, &file_stat) != 0)
+        {
+            free(path);
+            continue;
+        }
+        free(path);
+
+        spool->bytes += file_stat.st_size;
+        if (segment < spool->head)
+        {
+            spool->head = segment;
+        }
+        if (segment > spool->tail)
+        {
+            spool->tail = segment;
+        }
+    }
+
+    closedir(dir);
+
+    rest_spool_load_position(spool);
+
+    if (spool->head > spool->tail)
+    {
+        spool->head = SPOOL_FIRST_SEGMENT;
+        spool->tail = SPOOL_FIRST_SEGMENT - 1;
+    }
+
+    // new records never go to an old segment, its end could be damaged
+    return spool;
+}
+
+void rest_spool_delete(rest_spool_t *spool)
+{
+    if (spool == NULL)
+    {
+        return;
+    }
+
+    if (spool->write_fd >= 0)
+    {
+        fdatasync(spool->write_fd);
+        close(spool->write_fd);
+    }
+
+    if (spool->read_fd >= 0)
+    {
+        spool->resume_segment = spool->head;
+        spool->resume_offset = spool->read_offset;
+        close(spool->read_fd);
+    }
+
+    rest_spool_store_position(spool);
+
+    free(spool->directory);
+    free(spool);
+}
+
+int rest_spool_push(rest_spool_t *spool, const char *data, size_t length)
+{
+    char *path;
+
+    if (length > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    if (spool->write_fd < 0
+        || (spool->write_size > 0
+            && spool->write_size + sizeof(spool_record_header_t) + length > spool->segment_size))
+    {
+        if (spool->write_fd >= 0)
+        {
+            fdatasync(spool->write_fd);
+            close(spool->write_fd);
+            spool->write_fd = -1;
+        }
+
+        path = rest_spool_path(spool, spool->tail + 1);
+        if (path == NULL)
+        {
+            return -1;
+        }
+
+        spool->write_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+        free(path);
+        if (spool->write_fd < 0)
+        {
+            return -1;
+        }
+
+        spool->tail++;
+        spool->write_size = 0;
+    }
+
+    if (rest_spool_write_record(spool->write_fd, data, length))
+    {
+        // partial record is skipped by readers, later records go to a new segment
+        close(spool->write_fd);
+        spool->write_fd = -1;
+        return -1;
+    }
+
+    spool->write_size += sizeof(spool_record_header_t) + length;
+    spool->bytes += sizeof(spool_record_header_t) + length;
+
+    // reader of the same segment has to see appended records
+    if (spool->read_fd >= 0 && spool->head == spool->tail)
+    {
+        spool->read_size = spool->write_size;
+    }
+
+    return 0;
+}
+
+int rest_spool_prepend(rest_spool_t *spool, char *const *data, const size_t *lengths,
+                       size_t count)
+{
+    char *path;
+    size_t index;
+    uint64_t bytes = 0;
+    int fd;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    // partly read head segment continues where it was left once it is reached again
+    if (spool->read_fd >= 0)
+    {
+        spool->resume_segment = spool->head;
+        spool->resume_offset = spool->read_offset;
+        close(spool->read_fd);
+        spool->read_fd = -1;
+        spool->bytes += spool->read_offset;
+    }
+
+    path = rest_spool_path(spool, spool->head - 1);
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        free(path);
+        return -1;
+    }
+
+    for (index = 0; index < count; index++)
+    {
+        if (lengths[index] > UINT32_MAX
+            || rest_spool_write_record(fd, data[index], lengths[index]))
+        {
+            close(fd);
+            unlink(path);
+            free(path);
+            return -1;
+        }
+
+        bytes += sizeof(spool_record_header_t) + lengths[index];
+    }
+
+    fdatasync(fd);
+    close(fd);
+    free(path);
+
+    spool->head--;
+    spool->bytes += bytes;
+
+    return 0;
+}
+
+int rest_spool_peek(rest_spool_t *spool, char **data, size_t *length)
+{
+    spool_record_header_t header;
+    char *buffer;
+    int res;
+
+    while (spool->bytes > 0)
+    {
+        if (spool->read_fd < 0)
+        {
+            res = rest_spool_open_head(spool);
+            if (res != 0)
+            {
+                return res;
+            }
+
+            if (spool->head == spool->tail && spool->write_fd >= 0)
+            {
+                spool->read_size = spool->write_size;
+            }
+        }
+
+        if (spool->read_offset + (off_t)sizeof(header) > spool->read_size
+            || pread(spool->read_fd, &header, sizeof(header), spool->read_offset)
+            != sizeof(header)
+            || spool->read_offset + (off_t)sizeof(header) + header.length > spool->read_size)
+        {
+            rest_spool_finish_segment(spool);
+            continue;
+        }
+
+        buffer = malloc(header.length > 0 ? header.length : 1);
+        if (buffer == NULL)
+        {
+            return -1;
+        }
+
+        if (pread(spool->read_fd, buffer, header.length, spool->read_offset + sizeof(header))
+            != header.length)
+        {
+            free(buffer);
+            rest_spool_finish_segment(spool);
+            continue;
+        }
+
+        spool->peeked = header.length;
+        *data = buffer;
+        *length = header.length;
+
+        return 0;
+    }
+
+    return 1;
+}
+
+void rest_spool_pop(rest_spool_t *spool)
+{
+    uint64_t size = sizeof(spool_record_header_t) + spool->peeked;
+
+    if (spool->read_fd < 0)
+    {
+        return;
+    }
+
+    spool->read_offset += size;
+    spool->bytes = (spool->bytes > size) ? spool->bytes - size : 0;
+    spool->peeked = 0;
+
+    if (spool->read_offset >= spool->read_size)
+    {
+        rest_spool_finish_segment(spool);
+    }
+}
+
+void rest_spool_clear(rest_spool_t *spool)
+{
+    if (spool->read_fd >= 0)
+    {
+        close(spool->read_fd);
+        spool->read_fd = -1;
+    }
+
+    if (spool->write_fd >= 0)
+    {
+        close(spool->write_fd);
+        spool->write_fd = -1;
+    }
+
+    while (spool->head <= spool->tail)
+    {
+        rest_spool_unlink(spool, spool->head++);
+    }
+
+    spool->read_offset = 0;
+    spool->read_size = 0;
+    spool->peeked = 0;
+    spool->bytes = 0;
+    spool->resume_offset = 0;
+    rest_spool_store_position(spool);
+}
+
+bool rest_spool_is_empty(rest_spool_t *spool)
+{
+    return spool->bytes == 0;
+}
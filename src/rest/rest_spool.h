@@ -0,0 +1,124 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REST_SPOOL_H
+#define REST_SPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * First-in first-out queue of binary records kept on disk, as a series of
+ * segment files "<directory>/<number>.seg". Records are appended to the
+ * newest segment and read from the oldest one, fully read segments are
+ * removed.
+ *
+ * Records that were read but not removed before the spool was closed are
+ * read again after it is reopened. Spool functions are not thread safe,
+ * calls must be serialized by caller.
+ */
+typedef struct rest_spool_t rest_spool_t;
+
+/*
+ * Opens spool directory, creates it if needed. Records left by previous
+ * run are read first.
+ *
+ * Parameters:
+ *      directory - spool directory path,
+ *      segment_size - size after which a new segment file is started
+ *
+ * Returns:
+ *      pointer to a new spool on success,
+ *      NULL on error
+ */
+rest_spool_t *rest_spool_new(const char *directory, size_t segment_size);
+
+/*
+ * Syncs appended records to disk and closes the spool, records are kept
+ *
+ * Parameters:
+ *      spool - spool pointer
+ */
+void rest_spool_delete(rest_spool_t *spool);
+
+/*
+ * Appends record to the end of the spool
+ *
+ * Parameters:
+ *      spool - spool pointer,
+ *      data - record data,
+ *      length - record length
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int rest_spool_push(rest_spool_t *spool, const char *data, size_t length);
+
+/*
+ * Stores records in front of all other records, in given order. Must not be
+ * called between rest_spool_peek() and rest_spool_pop().
+ *
+ * Parameters:
+ *      spool - spool pointer,
+ *      data - array of record data,
+ *      lengths - array of record lengths,
+ *      count - number of records
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int rest_spool_prepend(rest_spool_t *spool, char *const *data, const size_t *lengths,
+                       size_t count);
+
+/*
+ * Reads the oldest record without removing it
+ *
+ * Parameters:
+ *      spool - spool pointer,
+ *      data - record data, is set after return and must be freed by caller,
+ *      length - record length, is set after return
+ *
+ * Returns:
+ *      0 on success,
+ *      positive value if spool is empty,
+ *      negative value on error
+ */
+int rest_spool_peek(rest_spool_t *spool, char **data, size_t *length);
+
+/*
+ * Removes the record returned by the last rest_spool_peek()
+ *
+ * Parameters:
+ *      spool - spool pointer
+ */
+void rest_spool_pop(rest_spool_t *spool);
+
+/*
+ * Removes all records and segment files
+ *
+ * Parameters:
+ *      spool - spool pointer
+ */
+void rest_spool_clear(rest_spool_t *spool);
+
+bool rest_spool_is_empty(rest_spool_t *spool);
+
+#endif // REST_SPOOL_H
@@ -0,0 +1,102 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rest_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ulfius.h>
+
+#define REST_STREAM_BUFFER_SIZE 4096
+
+void rest_stream_init(rest_stream_t *stream, rest_stream_fill_cb_t fill, void *context)
+{
+    memset(stream, 0, sizeof(rest_stream_t));
+    stream->fill = fill;
+    stream->context = context;
+}
+
+void rest_stream_clear(rest_stream_t *stream)
+{
+    free(stream->buffer);
+    stream->buffer = NULL;
+    stream->size = 0;
+    stream->length = 0;
+    stream->offset = 0;
+}
+
+int rest_stream_append(rest_stream_t *stream, const char *data, size_t length)
+{
+    size_t size;
+    char *buffer;
+
+    if (stream->length + length > stream->size)
+    {
+        size = (stream->size > 0) ? stream->size : REST_STREAM_BUFFER_SIZE;
+        while (size < stream->length + length)
+        {
+            size *= 2;
+        }
+
+        buffer = realloc(stream->buffer, size);
+        if (buffer == NULL)
+        {
+            return -1;
+        }
+
+        stream->buffer = buffer;
+        stream->size = size;
+    }
+
+    memcpy(stream->buffer + stream->length, data, length);
+    stream->length += length;
+
+    return 0;
+}
+
+ssize_t rest_stream_read(rest_stream_t *stream, char *buffer, size_t max_length)
+{
+    size_t length;
+
+    while (stream->offset == stream->length)
+    {
+        if (stream->done)
+        {
+            return U_STREAM_END;
+        }
+
+        stream->offset = 0;
+        stream->length = 0;
+        if (stream->fill(stream->context))
+        {
+            return U_STREAM_ERROR;
+        }
+    }
+
+    length = stream->length - stream->offset;
+    if (length > max_length)
+    {
+        length = max_length;
+    }
+
+    memcpy(buffer, stream->buffer + stream->offset, length);
+    stream->offset += length;
+
+    return length;
+}
@@ -0,0 +1,95 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REST_STREAM_H
+#define REST_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Output buffer of a streamed response. Response is produced in parts by
+ * the fill callback whenever everything produced before was read, so the
+ * whole response never has to be in memory.
+ */
+typedef int (*rest_stream_fill_cb_t)(void *context);
+
+typedef struct
+{
+    rest_stream_fill_cb_t fill;
+    void *context;
+    // fill callback produced the last part
+    bool done;
+    char *buffer;
+    size_t size;
+    size_t length;
+    size_t offset;
+} rest_stream_t;
+
+/*
+ * Initializes an empty stream buffer
+ *
+ * Parameters:
+ *      stream - stream buffer pointer,
+ *      fill - callback appending next part of the response, returns non-zero
+ *             on error and sets done flag after the last part,
+ *      context - user data passed to fill callback
+ */
+void rest_stream_init(rest_stream_t *stream, rest_stream_fill_cb_t fill, void *context);
+
+/*
+ * Frees buffered data
+ *
+ * Parameters:
+ *      stream - stream buffer pointer
+ */
+void rest_stream_clear(rest_stream_t *stream);
+
+/*
+ * Appends data to the stream buffer, growing it if needed
+ *
+ * Parameters:
+ *      stream - stream buffer pointer,
+ *      data - data to append,
+ *      length - length of data
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error
+ */
+int rest_stream_append(rest_stream_t *stream, const char *data, size_t length);
+
+/*
+ * Copies buffered data out, calling fill callback if buffer is empty.
+ * Meant to be called from ulfius stream callback.
+ *
+ * Parameters:
+ *      stream - stream buffer pointer,
+ *      buffer - output buffer,
+ *      max_length - size of output buffer
+ *
+ * Returns:
+ *      number of bytes copied,
+ *      U_STREAM_END after the last part,
+ *      U_STREAM_ERROR on error
+ */
+ssize_t rest_stream_read(rest_stream_t *stream, char *buffer, size_t max_length);
+
+#endif // REST_STREAM_H
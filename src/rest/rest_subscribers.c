@@ -0,0 +1,273 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rest_subscribers.h"
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool rest_subscriber_valid_name(const char *name)
+{
+    size_t length;
+
+    length = strlen(name);
+    if (length == 0 || length > REST_SUBSCRIBER_NAME_MAX)
+    {
+        return false;
+    }
+
+    for (; *name != '\0'; name++)
+    {
+        if (!isalnum((unsigned char)*name) && *name != '-' && *name != '_')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static char *rest_subscriber_spool_path(const char *directory, const char *name)
+{
+    char *path;
+    size_t length;
+
+    length = strlen(directory) + 1 + strlen(name) + 1;
+    path = malloc(length);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    snprintf(path, length, "%s/%s", directory, name);
+
+    return path;
+}
+
+/*
+ * Compiles endpoint filters of a subscriber object, so that they can be
+ * swapped in at once
+ */
+static int rest_subscriber_filters(json_t *jsubscriber, char **endpoint, regex_t *endpoint_regex,
+                                   bool *has_regex)
+{
+    const char *pattern;
+
+    *endpoint = NULL;
+    *has_regex = false;
+
+    pattern = json_string_value(json_object_get(jsubscriber, "endpoint"));
+    if (pattern != NULL)
+    {
+        *endpoint = strdup(pattern);
+        if (*endpoint == NULL)
+        {
+            return -1;
+        }
+    }
+
+    pattern = json_string_value(json_object_get(jsubscriber, "endpoint_regex"));
+    if (pattern != NULL)
+    {
+        if (regcomp(endpoint_regex, pattern, REG_EXTENDED | REG_NOSUB) != 0)
+        {
+            free(*endpoint);
+            *endpoint = NULL;
+            return -1;
+        }
+        *has_regex = true;
+    }
+
+    return 0;
+}
+
+static json_t *rest_subscriber_callback(json_t *jsubscriber)
+{
+    json_t *jheaders;
+
+    jheaders = json_object_get(jsubscriber, "headers");
+
+    return json_pack("{s:O, s:o}", "url", json_object_get(jsubscriber, "url"),
+                     "headers", (jheaders != NULL) ? json_deep_copy(jheaders) : json_object());
+}
+
+rest_subscriber_t *rest_subscriber_new(const char *name, json_t *jsubscriber, uint32_t types,
+                                       const http_security_settings_t *security,
+                                       const rest_dispatcher_settings_t *settings,
+                                       size_t queue_size, rest_dispatcher_wakeup_cb_t wakeup,
+                                       void *context)
+{
+    rest_subscriber_t *subscriber;
+    json_t *jcallback;
+
+    subscriber = calloc(1, sizeof(rest_subscriber_t));
+    if (subscriber == NULL)
+    {
+        return NULL;
+    }
+
+    subscriber->types = types;
+    subscriber->settings = *settings;
+    subscriber->settings.spool_directory = NULL;
+    subscriber->name = strdup(name);
+    if (subscriber->name == NULL)
+    {
+        goto error;
+    }
+
+    if (rest_subscriber_filters(jsubscriber, &subscriber->endpoint, &subscriber->endpoint_regex,
+                                &subscriber->has_regex))
+    {
+        goto error;
+    }
+
+    // every subscriber spools to its own directory
+    if (settings->spool_directory != NULL)
+    {
+        subscriber->settings.spool_directory = rest_subscriber_spool_path(
+                                                   settings->spool_directory, name);
+        if (subscriber->settings.spool_directory == NULL)
+        {
+            goto error;
+        }
+    }
+
+    subscriber->dispatcher = rest_dispatcher_new(security, &subscriber->settings, queue_size,
+                                                 wakeup, context);
+    if (subscriber->dispatcher == NULL)
+    {
+        goto error;
+    }
+
+    jcallback = rest_subscriber_callback(jsubscriber);
+    if (jcallback == NULL)
+    {
+        goto error;
+    }
+
+    rest_dispatcher_set_callback(subscriber->dispatcher, jcallback);
+    json_decref(jcallback);
+
+    subscriber->jsubscriber = json_incref(jsubscriber);
+
+    return subscriber;
+
+error:
+    rest_subscriber_delete(subscriber);
+    return NULL;
+}
+
+int rest_subscriber_update(rest_subscriber_t *subscriber, json_t *jsubscriber, uint32_t types)
+{
+    json_t *jcallback;
+    char *endpoint;
+    regex_t endpoint_regex;
+    bool has_regex;
+
+    if (rest_subscriber_filters(jsubscriber, &endpoint, &endpoint_regex, &has_regex))
+    {
+        return -1;
+    }
+
+    jcallback = rest_subscriber_callback(jsubscriber);
+    if (jcallback == NULL)
+    {
+        free(endpoint);
+        if (has_regex)
+        {
+            regfree(&endpoint_regex);
+        }
+        return -1;
+    }
+
+    // batches already queued are delivered to the new callback
+    rest_dispatcher_set_callback(subscriber->dispatcher, jcallback);
+    json_decref(jcallback);
+
+    if (subscriber->has_regex)
+    {
+        regfree(&subscriber->endpoint_regex);
+    }
+    free(subscriber->endpoint);
+    json_decref(subscriber->jsubscriber);
+
+    subscriber->types = types;
+    subscriber->endpoint = endpoint;
+    subscriber->endpoint_regex = endpoint_regex;
+    subscriber->has_regex = has_regex;
+    subscriber->jsubscriber = json_incref(jsubscriber);
+
+    return 0;
+}
+
+void rest_subscriber_delete(rest_subscriber_t *subscriber)
+{
+    if (subscriber == NULL)
+    {
+        return;
+    }
+
+    rest_dispatcher_delete(subscriber->dispatcher);
+
+    if (subscriber->has_regex)
+    {
+        regfree(&subscriber->endpoint_regex);
+    }
+
+    if (subscriber->jsubscriber != NULL)
+    {
+        json_decref(subscriber->jsubscriber);
+    }
+
+    free(subscriber->settings.spool_directory);
+    free(subscriber->endpoint);
+    free(subscriber->name);
+    free(subscriber);
+}
+
+bool rest_subscriber_match(const rest_subscriber_t *subscriber,
+                           const rest_event_record_t *record)
+{
+    if ((subscriber->types & (1u << record->type)) == 0)
+    {
+        return false;
+    }
+
+    if (subscriber->endpoint == NULL && !subscriber->has_regex)
+    {
+        return true;
+    }
+
+    // name filters can't tell about events of unknown endpoints
+    if (record->name == NULL)
+    {
+        return false;
+    }
+
+    if (subscriber->endpoint != NULL && fnmatch(subscriber->endpoint, record->name, 0) != 0)
+    {
+        return false;
+    }
+
+    return !subscriber->has_regex
+           || regexec(&subscriber->endpoint_regex, record->name, 0, NULL, 0) == 0;
+}
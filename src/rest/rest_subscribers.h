@@ -0,0 +1,137 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REST_SUBSCRIBERS_H
+#define REST_SUBSCRIBERS_H
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <jansson.h>
+
+#include "../security.h"
+#include "rest_dispatcher.h"
+#include "rest_events.h"
+
+#define REST_SUBSCRIBER_NAME_MAX    64
+
+/*
+ * Notification subscriber is a named callback from the /notification/callbacks
+ * collection. Every subscriber has its own event filter, dispatcher and
+ * position in the notification log, so a slow or unreachable receiver only
+ * delays its own events.
+ */
+typedef struct
+{
+    char *name;
+    // subscriber object as registered
+    json_t *jsubscriber;
+
+    // bit mask of accepted event types, bit number is rest_event_type_t value
+    uint32_t types;
+    // endpoint name glob, NULL to accept any name
+    char *endpoint;
+    // endpoint name regular expression, used if has_regex is set
+    regex_t endpoint_regex;
+    bool has_regex;
+
+    // copy of callback settings with subscriber's own spool directory
+    rest_dispatcher_settings_t settings;
+    rest_dispatcher_t *dispatcher;
+
+    // last event delivered or filtered out
+    uint64_t notified_sequence;
+} rest_subscriber_t;
+
+/*
+ * Checks whether the name can be used for a subscriber, names are part of
+ * URL and spool directory path
+ *
+ * Parameters:
+ *      name - subscriber name
+ *
+ * Returns:
+ *      true if the name is valid,
+ *      false otherwise
+ */
+bool rest_subscriber_valid_name(const char *name);
+
+/*
+ * Creates a subscriber and starts its dispatcher
+ *
+ * Parameters:
+ *      name - subscriber name,
+ *      jsubscriber - validated subscriber object with "url" and optional
+ *                    "headers", "endpoint" or "endpoint_regex" keys,
+ *      types - bit mask of accepted event types,
+ *      security - HTTP security settings, used for client credentials,
+ *      settings - callback delivery settings,
+ *      queue_size - maximum number of undelivered batches kept in memory,
+ *      wakeup - called when dispatcher queue has space again,
+ *      context - user data passed to wakeup callback
+ *
+ * Returns:
+ *      pointer to a new subscriber on success,
+ *      NULL on error
+ */
+rest_subscriber_t *rest_subscriber_new(const char *name, json_t *jsubscriber, uint32_t types,
+                                       const http_security_settings_t *security,
+                                       const rest_dispatcher_settings_t *settings,
+                                       size_t queue_size, rest_dispatcher_wakeup_cb_t wakeup,
+                                       void *context);
+
+/*
+ * Replaces subscriber's filters and callback. Dispatcher keeps running, so
+ * undelivered batches are kept and delivered to the new callback.
+ *
+ * Parameters:
+ *      subscriber - subscriber pointer,
+ *      jsubscriber - validated subscriber object, same as for rest_subscriber_new(),
+ *      types - bit mask of accepted event types
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on error, subscriber is left unchanged
+ */
+int rest_subscriber_update(rest_subscriber_t *subscriber, json_t *jsubscriber, uint32_t types);
+
+/*
+ * Stops subscriber's dispatcher and frees the subscriber. Undelivered batches
+ * are handled the same as by rest_dispatcher_delete().
+ *
+ * Parameters:
+ *      subscriber - subscriber pointer
+ */
+void rest_subscriber_delete(rest_subscriber_t *subscriber);
+
+/*
+ * Checks whether the event passes subscriber's filters
+ *
+ * Parameters:
+ *      subscriber - subscriber pointer,
+ *      record - logged event
+ *
+ * Returns:
+ *      true if the event is delivered to the subscriber,
+ *      false otherwise
+ */
+bool rest_subscriber_match(const rest_subscriber_t *subscriber,
+                           const rest_event_record_t *record);
+
+#endif // REST_SUBSCRIBERS_H
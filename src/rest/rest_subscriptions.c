@@ -34,6 +34,7 @@ static void rest_observe_cb(uint16_t clientID, lwm2m_uri_t *uriP, int count,
 {
     rest_observe_context_t *ctx = (rest_observe_context_t *)context;
     rest_async_response_t *response;
+    lwm2m_client_t *client;
 
     log_message(LOG_LEVEL_INFO, "[OBSERVE-RESPONSE] id=%s count=%d data=%p\n",
                 ctx->response->id, count, data);
@@ -50,7 +51,9 @@ static void rest_observe_cb(uint16_t clientID, lwm2m_uri_t *uriP, int count,
                             (data == NULL) ? coap_to_http_status(count) : HTTP_200_OK,
                             data, dataLength);
 
-    rest_notify_async_response(ctx->rest, response);
+    client = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)ctx->rest->lwm2m->clientList,
+                                               clientID);
+    rest_notify_async_response(ctx->rest, (client != NULL) ? client->name : NULL, response);
 }
 
 static void rest_unobserve_cb(uint16_t clientID, lwm2m_uri_t *uriP, int count,
@@ -203,6 +206,9 @@ int rest_subscriptions_put_cb(const ulfius_req_t *req, ulfius_resp_t *resp, void
     ret = rest_subscriptions_put_cb_unsafe(rest, req, resp);
     rest_unlock(rest);
 
+    // let the core rearm its timer for the new transaction
+    rest_wakeup(rest);
+
     return ret;
 }
 
@@ -320,5 +326,8 @@ int rest_subscriptions_delete_cb(const ulfius_req_t *req, ulfius_resp_t *resp, v
     ret = rest_subscriptions_delete_cb_unsafe(rest, req, resp);
     rest_unlock(rest);
 
+    // let the core rearm its timer for the new transaction
+    rest_wakeup(rest);
+
     return ret;
 }
@@ -20,31 +20,12 @@
 
 #include "rest_utils.h"
 
+#include "../database.h"
 #include "../punica.h"
 
 #define PSK_ID_BUFFER_LENGTH      12
 #define PSK_BUFFER_LENGTH         16
 
-static int find_existing_serial(uint8_t *serial, size_t length, linked_list_t *list)
-{
-    linked_list_entry_t *device_entry;
-    database_entry_t *device_data;
-
-    for (device_entry = list->head; device_entry != NULL; device_entry = device_entry->next)
-    {
-        device_data = (database_entry_t *)device_entry->data;
-
-        if (device_data
-            && device_data->serial_len == length
-            && memcmp(device_data->serial, serial, length) == 0)
-        {
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
 static void generate_serial(uint8_t *buffer, size_t *length)
 {
     int ret;
@@ -102,41 +83,147 @@ static int device_new_psk(database_entry_t *device_entry)
     return 0;
 }
 
-static int device_new_certificate(database_entry_t *device_entry, linked_list_t *device_list,
-                                  const char *certificate, const char *private_key)
+struct device_signer_t
+{
+    gnutls_datum_t ca_cert_buffer;
+    gnutls_datum_t ca_key_buffer;
+    gnutls_x509_crt_t ca_cert;
+    gnutls_x509_privkey_t ca_key;
+    // device keys are taken from the pool, it is shared by all copies
+    key_pool_t *key_pool;
+};
+
+static int device_signer_import(device_signer_t *signer)
+{
+    if (gnutls_x509_crt_init(&signer->ca_cert))
+    {
+        signer->ca_cert = NULL;
+        return -1;
+    }
+
+    if (gnutls_x509_privkey_init(&signer->ca_key))
+    {
+        signer->ca_key = NULL;
+        return -1;
+    }
+
+    if (gnutls_x509_crt_import(signer->ca_cert, &signer->ca_cert_buffer, GNUTLS_X509_FMT_PEM)
+        || gnutls_x509_privkey_import(signer->ca_key, &signer->ca_key_buffer, GNUTLS_X509_FMT_PEM))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int device_signer_copy_datum(gnutls_datum_t *destination, const gnutls_datum_t *source)
+{
+    destination->data = gnutls_malloc(source->size);
+    if (destination->data == NULL)
+    {
+        return -1;
+    }
+
+    memcpy(destination->data, source->data, source->size);
+    destination->size = source->size;
+
+    return 0;
+}
+
+device_signer_t *device_signer_new(const char *certificate, const char *private_key,
+                                   key_pool_t *key_pool)
+{
+    device_signer_t *signer;
+
+    if (certificate == NULL || private_key == NULL)
+    {
+        return NULL;
+    }
+
+    signer = calloc(1, sizeof(device_signer_t));
+    if (signer == NULL)
+    {
+        return NULL;
+    }
+
+    signer->key_pool = key_pool;
+
+    if (gnutls_load_file(certificate, &signer->ca_cert_buffer)
+        || gnutls_load_file(private_key, &signer->ca_key_buffer)
+        || device_signer_import(signer))
+    {
+        device_signer_delete(signer);
+        return NULL;
+    }
+
+    return signer;
+}
+
+device_signer_t *device_signer_copy(const device_signer_t *signer)
+{
+    device_signer_t *copy;
+
+    copy = calloc(1, sizeof(device_signer_t));
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    copy->key_pool = signer->key_pool;
+
+    if (device_signer_copy_datum(&copy->ca_cert_buffer, &signer->ca_cert_buffer)
+        || device_signer_copy_datum(&copy->ca_key_buffer, &signer->ca_key_buffer)
+        || device_signer_import(copy))
+    {
+        device_signer_delete(copy);
+        return NULL;
+    }
+
+    return copy;
+}
+
+void device_signer_delete(device_signer_t *signer)
+{
+    if (signer == NULL)
+    {
+        return;
+    }
+
+    gnutls_free(signer->ca_cert_buffer.data);
+    gnutls_free(signer->ca_key_buffer.data);
+    if (signer->ca_cert != NULL)
+    {
+        gnutls_x509_crt_deinit(signer->ca_cert);
+    }
+    if (signer->ca_key != NULL)
+    {
+        gnutls_x509_privkey_deinit(signer->ca_key);
+    }
+    free(signer);
+}
+
+static int device_new_certificate(database_entry_t *device_entry,
+                                  device_database_t *device_database,
+                                  device_signer_t *signer)
 {
     gnutls_x509_crt_t device_cert = NULL;
     gnutls_x509_privkey_t device_key = NULL;
-    gnutls_x509_crt_t ca_cert = NULL;
-    gnutls_x509_privkey_t ca_key = NULL;
-    gnutls_datum_t ca_key_buffer = {NULL, 0};
-    gnutls_datum_t ca_cert_buffer = {NULL, 0};
     time_t activation_time;
     int ret = -1;
 
-    if (gnutls_x509_crt_init(&device_cert)
-        || gnutls_x509_privkey_init(&device_key)
-        || gnutls_x509_crt_init(&ca_cert)
-        || gnutls_x509_privkey_init(&ca_key))
-    {
-        goto exit;
-    }
-
-    if (gnutls_load_file(certificate, &ca_cert_buffer)
-        || gnutls_load_file(private_key, &ca_key_buffer))
+    if (signer == NULL)
     {
-        goto exit;
+        return -1;
     }
 
-    if (gnutls_x509_crt_import(ca_cert, &ca_cert_buffer, GNUTLS_X509_FMT_PEM)
-        || gnutls_x509_privkey_import(ca_key, &ca_key_buffer, GNUTLS_X509_FMT_PEM))
+    if (gnutls_x509_crt_init(&device_cert))
     {
         goto exit;
     }
 
-    if (gnutls_x509_privkey_generate(device_key, GNUTLS_PK_EC,
-                                     GNUTLS_CURVE_TO_BITS(GNUTLS_ECC_CURVE_SECP256R1), 0))
+    if (key_pool_take(signer->key_pool, &device_key))
     {
+        device_key = NULL;
         goto exit;
     }
 
@@ -149,7 +236,9 @@ static int device_new_certificate(database_entry_t *device_entry, linked_list_t
     do
     {
         generate_serial(device_entry->serial, &device_entry->serial_len);
-    } while (find_existing_serial(device_entry->serial, device_entry->serial_len, device_list));
+    } while (device_database != NULL
+             && database_get_entry_by_serial(device_database, device_entry->serial,
+                                             device_entry->serial_len) != NULL);
 
     activation_time = time(NULL);
 
@@ -168,7 +257,7 @@ static int device_new_certificate(database_entry_t *device_entry, linked_list_t
         goto exit;
     }
 
-    if (gnutls_x509_crt_sign(device_cert, ca_cert, ca_key))
+    if (gnutls_x509_crt_sign(device_cert, signer->ca_cert, signer->ca_key))
     {
         goto exit;
     }
@@ -195,18 +284,17 @@ static int device_new_certificate(database_entry_t *device_entry, linked_list_t
 
     ret = 0;
 exit:
-    gnutls_free(ca_cert_buffer.data);
-    gnutls_free(ca_key_buffer.data);
     gnutls_x509_crt_deinit(device_cert);
-    gnutls_x509_privkey_deinit(device_key);
-    gnutls_x509_crt_deinit(ca_cert);
-    gnutls_x509_privkey_deinit(ca_key);
+    if (device_key != NULL)
+    {
+        gnutls_x509_privkey_deinit(device_key);
+    }
 
     return ret;
 }
 
-int device_new_credentials(database_entry_t *device_entry, linked_list_t *device_list,
-                           const char *certificate, const char *private_key)
+int device_new_credentials(database_entry_t *device_entry, device_database_t *device_database,
+                           device_signer_t *signer)
 {
     if (device_entry->mode == DEVICE_CREDENTIALS_PSK)
     {
@@ -214,7 +302,7 @@ int device_new_credentials(database_entry_t *device_entry, linked_list_t *device
     }
     else if (device_entry->mode == DEVICE_CREDENTIALS_CERT)
     {
-        return device_new_certificate(device_entry, device_list, certificate, private_key);
+        return device_new_certificate(device_entry, device_database, signer);
     }
     else if (device_entry->mode == DEVICE_CREDENTIALS_NONE)
     {
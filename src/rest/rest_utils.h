@@ -20,8 +20,10 @@
 #ifndef REST_UTILS_H
 #define REST_UTILS_H
 
+#include "../key_pool.h"
 #include "../settings.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 
@@ -33,7 +35,10 @@ typedef enum
     DEVICE_CREDENTIALS_NONE = 3,
 } credentials_mode_t;
 
-typedef struct
+// number of device database indexes
+#define DATABASE_ENTRY_INDEX_COUNT  5
+
+typedef struct database_entry_t
 {
     char *uuid;
     char *name;
@@ -44,12 +49,37 @@ typedef struct
     uint8_t *serial;
     size_t serial_len;
     credentials_mode_t mode;
+    // uuid and credentials point into a mapped database file
+    bool mapped;
+    // position in device database list, set by database_add_entry()
+    struct linked_list_entry_t *list_entry;
+    uint64_t sequence;
+    // entries sharing the key of an index, oldest one is indexed, its prev is
+    // the newest one, prev is NULL if entry has no key
+    struct database_entry_t *index_next[DATABASE_ENTRY_INDEX_COUNT];
+    struct database_entry_t *index_prev[DATABASE_ENTRY_INDEX_COUNT];
+    // cached GET /devices fragment, freed whenever entry changes
+    char *json;
 } database_entry_t;
 
+typedef struct device_database_t device_database_t;
+
+/*
+ * CA certificate and key issuing device certificates, files are read and
+ * parsed once. Signer must not be used by several threads at once, every
+ * thread can get its own with device_signer_copy().
+ */
+typedef struct device_signer_t device_signer_t;
+
 int coap_to_http_status(int status);
 
-int device_new_credentials(database_entry_t *device_entry, linked_list_t *device_list,
-                           const char *certificate, const char *private_key);
+device_signer_t *device_signer_new(const char *certificate, const char *private_key,
+                                   key_pool_t *key_pool);
+device_signer_t *device_signer_copy(const device_signer_t *signer);
+void device_signer_delete(device_signer_t *signer);
+
+int device_new_credentials(database_entry_t *device_entry, device_database_t *device_database,
+                           device_signer_t *signer);
 
 json_t *json_object_from_string(const char *string, const char *key);
 
@@ -47,6 +47,139 @@ static struct argp_option options[] =
     { 0 }
 };
 
+static void set_coap_pacing_settings(json_t *j_section, egress_pacing_settings_t *settings)
+{
+    const char *key;
+    const char *section_name = "coap.pacing";
+    json_t *j_value;
+
+    json_object_foreach(j_section, key, j_value)
+    {
+        if (strcasecmp(key, "rate") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->rate = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "peer_rate") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->peer_rate = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "Unrecognised configuration file key: %s.%s\n",
+                    section_name, key);
+        }
+    }
+}
+
+static void set_coap_journal_settings(json_t *j_section, database_journal_settings_t *settings)
+{
+    const char *key;
+    const char *section_name = "coap.journal";
+    json_t *j_value;
+
+    json_object_foreach(j_section, key, j_value)
+    {
+        if (strcasecmp(key, "sync_interval") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->sync_interval = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "compaction_size") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->compaction_size = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "Unrecognised configuration file key: %s.%s\n",
+                    section_name, key);
+        }
+    }
+}
+
+static void set_coap_handshake_limits_settings(json_t *j_section,
+                                               handshake_limiter_settings_t *settings)
+{
+    const char *key;
+    const char *section_name = "coap.handshake_limits";
+    json_t *j_value;
+
+    json_object_foreach(j_section, key, j_value)
+    {
+        if (strcasecmp(key, "rate") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->rate = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "host_rate") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->host_rate = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "half_open") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->half_open = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "Unrecognised configuration file key: %s.%s\n",
+                    section_name, key);
+        }
+    }
+}
+
 static void set_coap_settings(json_t *j_section, coap_settings_t *settings)
 {
     const char *key;
@@ -137,6 +270,162 @@ static void set_coap_settings(json_t *j_section, coap_settings_t *settings)
                         section_name, key);
             }
         }
+        else if (strcasecmp(key, "database_format") == 0)
+        {
+            string_value = json_string_value(j_value);
+
+            if (string_value != NULL && strcasecmp(string_value, "json") == 0)
+            {
+                settings->database_format = PUNICA_DATABASE_FORMAT_JSON;
+            }
+            else if (string_value != NULL && strcasecmp(string_value, "binary") == 0)
+            {
+                settings->database_format = PUNICA_DATABASE_FORMAT_BINARY;
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be \"json\" or \"binary\"",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "database_storage") == 0)
+        {
+            string_value = json_string_value(j_value);
+
+            if (string_value != NULL && strcasecmp(string_value, "file") == 0)
+            {
+                settings->database_storage = PUNICA_DATABASE_STORAGE_FILE;
+            }
+            else if (string_value != NULL && strcasecmp(string_value, "lmdb") == 0)
+            {
+                settings->database_storage = PUNICA_DATABASE_STORAGE_LMDB;
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be \"file\" or \"lmdb\"",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "idle_timeout") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->idle_timeout = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "handshake_timeout") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->handshake_timeout = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "session_cache_size") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->session_cache_size = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "session_lifetime") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->session_lifetime = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "session_tickets") == 0)
+        {
+            if (json_is_boolean(j_value))
+            {
+                settings->session_tickets = json_is_true(j_value) ? true : false;
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a boolean",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "crypto_workers") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->crypto_workers = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "key_pool_size") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0)
+            {
+                settings->key_pool_size = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "journal") == 0)
+        {
+            if (json_is_object(j_value))
+            {
+                set_coap_journal_settings(j_value, &settings->journal);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be an object",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "handshake_limits") == 0)
+        {
+            if (json_is_object(j_value))
+            {
+                set_coap_handshake_limits_settings(j_value, &settings->handshake_limits);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be an object",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "pacing") == 0)
+        {
+            if (json_is_object(j_value))
+            {
+                set_coap_pacing_settings(j_value, &settings->pacing);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be an object",
+                        section_name, key);
+            }
+        }
         else
         {
             fprintf(stdout, "Unrecognised configuration file key: %s.%s\n",
@@ -375,6 +664,203 @@ static void set_http_security_settings(json_t *j_section, http_security_settings
     }
 }
 
+static void set_http_notifications_settings(json_t *j_section, rest_events_settings_t *settings)
+{
+    const char *key;
+    const char *section_name = "http.notifications";
+    const char *string_value;
+    json_t *j_value;
+
+    json_object_foreach(j_section, key, j_value)
+    {
+        if (strcasecmp(key, "queue_size") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) > 0
+                && json_integer_value(j_value) <= UINT32_MAX / 2)
+            {
+                settings->queue_size = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a positive integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "overflow") == 0)
+        {
+            string_value = json_string_value(j_value);
+
+            if (string_value != NULL && strcasecmp(string_value, "drop") == 0)
+            {
+                settings->overflow = REST_EVENTS_OVERFLOW_DROP;
+            }
+            else if (string_value != NULL && strcasecmp(string_value, "block") == 0)
+            {
+                settings->overflow = REST_EVENTS_OVERFLOW_BLOCK;
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be \"drop\" or \"block\"",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "retention") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) > 0
+                && json_integer_value(j_value) <= UINT32_MAX / 2)
+            {
+                settings->retention = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a positive integer",
+                        section_name, key);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "Unrecognised configuration file key: %s.%s\n",
+                    section_name, key);
+        }
+    }
+}
+
+static void set_http_callback_settings(json_t *j_section, rest_dispatcher_settings_t *settings)
+{
+    const char *key;
+    const char *section_name = "http.callback";
+    const char *string_value;
+    json_t *j_value;
+
+    json_object_foreach(j_section, key, j_value)
+    {
+        if (strcasecmp(key, "max_events") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) > 0
+                && json_integer_value(j_value) <= UINT32_MAX)
+            {
+                settings->max_events = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a positive integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "max_bytes") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) > 0
+                && json_integer_value(j_value) <= UINT32_MAX)
+            {
+                settings->max_bytes = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a positive integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "linger") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) >= 0
+                && json_integer_value(j_value) <= UINT32_MAX)
+            {
+                settings->linger = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a non-negative integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "compression") == 0)
+        {
+            string_value = json_string_value(j_value);
+
+            if (string_value != NULL && strcasecmp(string_value, "none") == 0)
+            {
+                settings->compression = REST_DISPATCHER_COMPRESSION_NONE;
+            }
+            else if (string_value != NULL && strcasecmp(string_value, "gzip") == 0)
+            {
+                settings->compression = REST_DISPATCHER_COMPRESSION_GZIP;
+            }
+            else if (string_value != NULL && strcasecmp(string_value, "deflate") == 0)
+            {
+                settings->compression = REST_DISPATCHER_COMPRESSION_DEFLATE;
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be \"none\", \"gzip\" or \"deflate\"",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "retry_min") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) > 0
+                && json_integer_value(j_value) <= UINT32_MAX)
+            {
+                settings->retry_min = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a positive integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "retry_max") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) > 0
+                && json_integer_value(j_value) <= UINT32_MAX)
+            {
+                settings->retry_max = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a positive integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "memory_limit") == 0)
+        {
+            if (json_is_integer(j_value) && json_integer_value(j_value) > 0
+                && json_integer_value(j_value) <= UINT32_MAX)
+            {
+                settings->memory_limit = (uint32_t) json_integer_value(j_value);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a positive integer",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "spool_directory") == 0)
+        {
+            if (json_is_string(j_value))
+            {
+                string_value = json_string_value(j_value);
+
+                settings->spool_directory = strdup(string_value);
+                if (settings->spool_directory == NULL)
+                {
+                    fprintf(stderr, "fatal error while parsing value at key %s:%s",
+                            section_name, key);
+                }
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be a string",
+                        section_name, key);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "Unrecognised configuration file key: %s.%s\n",
+                    section_name, key);
+        }
+    }
+}
+
 static void set_http_settings(json_t *j_section, http_settings_t *settings)
 {
     const char *key, *section_name = "http";
@@ -390,6 +876,30 @@ static void set_http_settings(json_t *j_section, http_settings_t *settings)
         {
             set_http_security_settings(j_value, &settings->security);
         }
+        else if (strcasecmp(key, "notifications") == 0)
+        {
+            if (json_is_object(j_value))
+            {
+                set_http_notifications_settings(j_value, &settings->notifications);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be an object",
+                        section_name, key);
+            }
+        }
+        else if (strcasecmp(key, "callback") == 0)
+        {
+            if (json_is_object(j_value))
+            {
+                set_http_callback_settings(j_value, &settings->callback);
+            }
+            else
+            {
+                fprintf(stdout, "value at key %s:%s must be an object",
+                        section_name, key);
+            }
+        }
         else
         {
             fprintf(stdout, "Unrecognised configuration file key: %s.%s\n",
@@ -25,9 +25,14 @@
 #include <jansson.h>
 #include <argp.h>
 
+#include "database_journal.h"
+#include "egress_queue.h"
+#include "handshake_limiter.h"
 #include "logging.h"
 #include "security.h"
 #include "plugin_manager/basic_plugin_manager.h"
+#include "rest/rest_dispatcher.h"
+#include "rest/rest_events.h"
 #include "rest/rest_utils.h"
 
 typedef enum
@@ -37,10 +42,24 @@ typedef enum
     PUNICA_COAP_MODE_BOTH
 } punica_coap_mode_t;
 
+typedef enum
+{
+    PUNICA_DATABASE_FORMAT_JSON,
+    PUNICA_DATABASE_FORMAT_BINARY
+} punica_database_format_t;
+
+typedef enum
+{
+    PUNICA_DATABASE_STORAGE_FILE,
+    PUNICA_DATABASE_STORAGE_LMDB
+} punica_database_storage_t;
+
 typedef struct
 {
     uint16_t port;
     http_security_settings_t security;
+    rest_events_settings_t notifications;
+    rest_dispatcher_settings_t callback;
 } http_settings_t;
 
 typedef struct
@@ -50,6 +69,18 @@ typedef struct
     char *private_key_file;
     char *certificate_file;
     char *database_file;
+    punica_database_format_t database_format;
+    punica_database_storage_t database_storage;
+    database_journal_settings_t journal;
+    uint32_t idle_timeout;
+    uint32_t handshake_timeout;
+    uint32_t session_cache_size;
+    uint32_t session_lifetime;
+    bool session_tickets;
+    uint32_t crypto_workers;
+    uint32_t key_pool_size;
+    egress_pacing_settings_t pacing;
+    handshake_limiter_settings_t handshake_limits;
 } coap_settings_t;
 
 typedef struct
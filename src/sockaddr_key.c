@@ -0,0 +1,60 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sockaddr_key.h"
+
+#include <string.h>
+#include <netinet/in.h>
+
+int sockaddr_key_init(sockaddr_key_t *key, const struct sockaddr *addr, socklen_t addr_len)
+{
+    const struct sockaddr_in *addr4;
+    const struct sockaddr_in6 *addr6;
+
+    memset(key, 0, sizeof(sockaddr_key_t));
+
+    if (addr->sa_family == AF_INET6 && addr_len >= sizeof(struct sockaddr_in6))
+    {
+        addr6 = (const struct sockaddr_in6 *)addr;
+
+        memcpy(key->address, &addr6->sin6_addr, sizeof(key->address));
+        key->port = addr6->sin6_port;
+        if (!IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr))
+        {
+            key->scope_id = addr6->sin6_scope_id;
+        }
+    }
+    else if (addr->sa_family == AF_INET && addr_len >= sizeof(struct sockaddr_in))
+    {
+        addr4 = (const struct sockaddr_in *)addr;
+
+        key->address[10] = 0xff;
+        key->address[11] = 0xff;
+        memcpy(&key->address[12], &addr4->sin_addr, sizeof(addr4->sin_addr));
+        key->port = addr4->sin_port;
+    }
+    else
+    {
+        return -1;
+    }
+
+    key->family = AF_INET6;
+
+    return 0;
+}
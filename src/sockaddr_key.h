@@ -0,0 +1,56 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SOCKADDR_KEY_H
+#define SOCKADDR_KEY_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * Canonical (family, address, port) tuple of a peer address, suitable as
+ * a hash table key. Unlike raw sockaddr structures, it has no padding or
+ * unused fields, so equal addresses always have equal keys.
+ *
+ * IPv4 addresses are stored as IPv4-mapped IPv6 addresses, so that a peer
+ * has the same key on AF_INET and dual stack AF_INET6 sockets.
+ */
+typedef struct
+{
+    uint8_t address[16];
+    uint32_t scope_id;
+    uint16_t port;
+    uint16_t family;
+} sockaddr_key_t;
+
+/*
+ * Fills canonical key of an address
+ *
+ * Parameters:
+ *      key - key pointer, is set after return,
+ *      addr - peer address,
+ *      addr_len - length of addr
+ *
+ * Returns:
+ *      0 on success,
+ *      negative value on unsupported address family
+ */
+int sockaddr_key_init(sockaddr_key_t *key, const struct sockaddr *addr, socklen_t addr_len);
+
+#endif // SOCKADDR_KEY_H
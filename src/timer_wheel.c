@@ -0,0 +1,193 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TIMER_WHEEL_LEVEL0_BITS     8
+#define TIMER_WHEEL_LEVEL1_BITS     6
+#define TIMER_WHEEL_LEVEL0_SIZE     (1 << TIMER_WHEEL_LEVEL0_BITS)
+#define TIMER_WHEEL_LEVEL1_SIZE     (1 << TIMER_WHEEL_LEVEL1_BITS)
+// timers further away are parked in the last level 1 slot and re-sorted on cascade
+#define TIMER_WHEEL_SPAN            (TIMER_WHEEL_LEVEL0_SIZE * TIMER_WHEEL_LEVEL1_SIZE)
+
+struct timer_wheel_t
+{
+    time_t current;
+    // slot heads are list sentinels, empty slot points to itself
+    timer_wheel_timer_t level0[TIMER_WHEEL_LEVEL0_SIZE];
+    timer_wheel_timer_t level1[TIMER_WHEEL_LEVEL1_SIZE];
+};
+
+static void timer_wheel_link(timer_wheel_timer_t *head, timer_wheel_timer_t *timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void timer_wheel_unlink(timer_wheel_timer_t *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void timer_wheel_insert(timer_wheel_t *wheel, timer_wheel_timer_t *timer)
+{
+    time_t expires = timer->expires;
+    time_t delta;
+
+    // overdue timers expire on the next tick
+    if (expires <= wheel->current)
+    {
+        expires = wheel->current + 1;
+    }
+
+    delta = expires - wheel->current;
+    if (delta < TIMER_WHEEL_LEVEL0_SIZE)
+    {
+        timer_wheel_link(&wheel->level0[expires & (TIMER_WHEEL_LEVEL0_SIZE - 1)], timer);
+        return;
+    }
+
+    if (delta >= TIMER_WHEEL_SPAN)
+    {
+        expires = wheel->current + TIMER_WHEEL_SPAN - 1;
+    }
+
+    timer_wheel_link(&wheel->level1[(expires >> TIMER_WHEEL_LEVEL0_BITS)
+                                    & (TIMER_WHEEL_LEVEL1_SIZE - 1)], timer);
+}
+
+time_t timer_wheel_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec;
+}
+
+timer_wheel_t *timer_wheel_new(time_t now)
+{
+    timer_wheel_t *wheel;
+    int i;
+
+    wheel = malloc(sizeof(timer_wheel_t));
+    if (wheel == NULL)
+    {
+        return NULL;
+    }
+
+    wheel->current = now;
+
+    for (i = 0; i < TIMER_WHEEL_LEVEL0_SIZE; i++)
+    {
+        wheel->level0[i].next = &wheel->level0[i];
+        wheel->level0[i].prev = &wheel->level0[i];
+    }
+
+    for (i = 0; i < TIMER_WHEEL_LEVEL1_SIZE; i++)
+    {
+        wheel->level1[i].next = &wheel->level1[i];
+        wheel->level1[i].prev = &wheel->level1[i];
+    }
+
+    return wheel;
+}
+
+void timer_wheel_delete(timer_wheel_t *wheel)
+{
+    free(wheel);
+}
+
+void timer_wheel_schedule(timer_wheel_t *wheel, timer_wheel_timer_t *timer, time_t expires)
+{
+    if (timer_wheel_is_scheduled(timer))
+    {
+        timer_wheel_unlink(timer);
+    }
+
+    timer->expires = expires;
+    timer_wheel_insert(wheel, timer);
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_wheel_timer_t *timer)
+{
+    if (timer_wheel_is_scheduled(timer))
+    {
+        timer_wheel_unlink(timer);
+    }
+}
+
+bool timer_wheel_is_scheduled(const timer_wheel_timer_t *timer)
+{
+    return timer->next != NULL;
+}
+
+void timer_wheel_advance(timer_wheel_t *wheel, time_t now, f_timer_wheel_cb_t callback,
+                         void *data)
+{
+    timer_wheel_timer_t expired;
+    timer_wheel_timer_t *head, *timer;
+
+    while (wheel->current < now)
+    {
+        wheel->current++;
+
+        // level 0 wrapped around, move timers of the next level 1 slot down
+        if ((wheel->current & (TIMER_WHEEL_LEVEL0_SIZE - 1)) == 0)
+        {
+            head = &wheel->level1[(wheel->current >> TIMER_WHEEL_LEVEL0_BITS)
+                                  & (TIMER_WHEEL_LEVEL1_SIZE - 1)];
+            while (head->next != head)
+            {
+                timer = head->next;
+                timer_wheel_unlink(timer);
+                timer_wheel_insert(wheel, timer);
+            }
+        }
+
+        head = &wheel->level0[wheel->current & (TIMER_WHEEL_LEVEL0_SIZE - 1)];
+        if (head->next == head)
+        {
+            continue;
+        }
+
+        // detach slot, so that callbacks can safely reschedule timers
+        expired.next = head->next;
+        expired.prev = head->prev;
+        expired.next->prev = &expired;
+        expired.prev->next = &expired;
+        head->next = head;
+        head->prev = head;
+
+        while (expired.next != &expired)
+        {
+            timer = expired.next;
+            timer_wheel_unlink(timer);
+            callback(timer, data);
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Punica - LwM2M server with REST API
+ * Copyright (C) 2019 8devices
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * Two level hierarchical timer wheel with one second resolution.
+ * Scheduling, cancelling and expiring a timer are O(1).
+ *
+ * Timers are embedded into user structures, so the wheel never allocates
+ * memory after creation. Timer wheel is not thread safe.
+ */
+typedef struct timer_wheel_t timer_wheel_t;
+
+typedef struct timer_wheel_timer_t
+{
+    struct timer_wheel_timer_t *next;
+    struct timer_wheel_timer_t *prev;
+    time_t expires;
+} timer_wheel_timer_t;
+
+/*
+ * Called for every expired timer. Timer is unscheduled before the call
+ * and can be rescheduled from the callback.
+ *
+ * Parameters:
+ *      timer - expired timer,
+ *      data - pointer to data provided to timer_wheel_advance()
+ */
+typedef void (*f_timer_wheel_cb_t)(timer_wheel_timer_t *timer, void *data);
+
+/*
+ * Returns monotonic time in seconds, to be used with timer wheel
+ */
+time_t timer_wheel_now(void);
+
+/*
+ * Creates a new timer wheel
+ *
+ * Parameters:
+ *      now - current time in seconds
+ *
+ * Returns:
+ *      pointer to a new timer wheel on success,
+ *      NULL on error
+ */
+timer_wheel_t *timer_wheel_new(time_t now);
+
+/*
+ * Frees timer wheel, scheduled timers are left untouched
+ *
+ * Parameters:
+ *      wheel - timer wheel pointer
+ */
+void timer_wheel_delete(timer_wheel_t *wheel);
+
+/*
+ * Schedules timer, reschedules if it is already scheduled
+ *
+ * Parameters:
+ *      wheel - timer wheel pointer,
+ *      timer - zero initialized or previously used timer,
+ *      expires - expiration time in seconds
+ */
+void timer_wheel_schedule(timer_wheel_t *wheel, timer_wheel_timer_t *timer, time_t expires);
+
+/*
+ * Unschedules timer, does nothing if it is not scheduled
+ *
+ * Parameters:
+ *      wheel - timer wheel pointer,
+ *      timer - timer pointer
+ */
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_wheel_timer_t *timer);
+
+/*
+ * Checks whether timer is scheduled
+ *
+ * Parameters:
+ *      timer - timer pointer
+ */
+bool timer_wheel_is_scheduled(const timer_wheel_timer_t *timer);
+
+/*
+ * Advances wheel to the current time and expires due timers
+ *
+ * Parameters:
+ *      wheel - timer wheel pointer,
+ *      now - current time in seconds,
+ *      callback - called for every expired timer,
+ *      data - pointer to data later provided to callback
+ */
+void timer_wheel_advance(timer_wheel_t *wheel, time_t now, f_timer_wheel_cb_t callback,
+                         void *data);
+
+#endif // TIMER_WHEEL_H
@@ -17,69 +17,108 @@
  *
  */
 
+#define _GNU_SOURCE // recvmmsg()
+
 #include "udp_connection_api.h"
+#include <errno.h>
 #include <netdb.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include "linked_list.h"
+#include "egress_queue.h"
+#include "hash_table.h"
+#include "sockaddr_key.h"
+#include "timer_wheel.h"
+
+#define UDP_CONNECTION_BATCH_SIZE   32
+#define UDP_CONNECTION_BUFFER_SIZE  1500
+#define UDP_CONNECTION_EGRESS_SIZE  1024
 
 typedef struct _connection_t
 {
     int                     sock;
     struct sockaddr_in6     addr;
     size_t                  addr_len;
+    egress_bucket_t         bucket;
+    sockaddr_key_t          key;
+    timer_wheel_timer_t     idle_timer;
+    time_t                  last_activity;
 } connection_t;
 
 typedef struct connection_context_t
 {
     connection_api_t api;
-    linked_list_t *connection_list;
+    hash_table_t *connection_table;
     int port;
     int address_family;
     int listen_socket;
+    egress_pacing_settings_t pacing;
+    egress_queue_t *egress;
+    timer_wheel_t *idle_wheel;
+    uint32_t idle_timeout;
+    unsigned long reaped_count;
+
+    // receive buffers reused by every batch, valid until the next batch is received
+    struct mmsghdr batch_msgs[UDP_CONNECTION_BATCH_SIZE];
+    struct iovec batch_iovecs[UDP_CONNECTION_BATCH_SIZE];
+    struct sockaddr_storage batch_addrs[UDP_CONNECTION_BATCH_SIZE];
+    uint8_t batch_buffers[UDP_CONNECTION_BATCH_SIZE][UDP_CONNECTION_BUFFER_SIZE];
 } connection_context_t;
 
 static int udp_connection_start(void *context_p);
 static int udp_connection_close(void *context_p, void *connection);
 static int udp_connection_receive(void *context_p, uint8_t *buffer, size_t size, void **connection,
                                   struct timeval *tv);
+static int udp_connection_receive_batch(void *context_p, connection_packet_t *packets,
+                                        size_t count);
 static int udp_connection_send(void *context_p, void *connection, uint8_t *buffer, size_t length);
+static int udp_connection_flush(void *context_p);
+static int udp_connection_reap(void *context_p, f_session_in_use_cb_t in_use_cb, void *data);
 static int udp_connection_stop(void *context_p);
 
 static connection_t *udp_connection_find(connection_context_t *context,
-                                         struct sockaddr_storage *addr, size_t addr_len)
+                                         struct sockaddr_storage *addr, size_t addr_len,
+                                         time_t now)
 {
     connection_t *conn;
-    linked_list_entry_t *conn_entry;
+    sockaddr_key_t key;
 
-    for (conn_entry = context->connection_list->head; conn_entry != NULL; conn_entry = conn_entry->next)
+    if (sockaddr_key_init(&key, (struct sockaddr *)addr, addr_len) != 0)
     {
-        conn = conn_entry->data;
+        return NULL;
+    }
 
-        if ((conn->addr_len == addr_len) && (memcmp(&(conn->addr), addr, addr_len) == 0))
-        {
-            return conn;
-        }
+    conn = hash_table_get(context->connection_table, &key, sizeof(key));
+    if (conn != NULL)
+    {
+        // idle timer is not touched, it checks last activity once it expires
+        conn->last_activity = now;
+        return conn;
     }
 
-    return NULL;
-}
+    conn = (connection_t *)calloc(1, sizeof(connection_t));
+    if (conn == NULL)
+    {
+        return NULL;
+    }
 
-static connection_t *udp_connection_new_incoming(connection_context_t *context,
-                                                 struct sockaddr *addr, size_t addr_len)
-{
-    connection_t *conn;
+    conn->sock = context->listen_socket;
+    memcpy(&(conn->addr), addr, addr_len);
+    conn->addr_len = addr_len;
+    conn->key = key;
+    conn->last_activity = now;
 
-    conn = (connection_t *)malloc(sizeof(connection_t));
-    if (conn != NULL)
+    if (hash_table_put(context->connection_table, &conn->key, sizeof(conn->key), conn) != 0)
     {
-        conn->sock = context->listen_socket;
-        memcpy(&(conn->addr), addr, addr_len);
-        conn->addr_len = addr_len;
+        free(conn);
+        return NULL;
+    }
 
-        linked_list_add(context->connection_list, conn);
+    if (context->idle_timeout > 0)
+    {
+        timer_wheel_schedule(context->idle_wheel, &conn->idle_timer, now + context->idle_timeout);
     }
 
     return conn;
@@ -102,21 +141,17 @@ static int udp_connection_socket_receive(connection_context_t *context, uint8_t
         return -1;
     }
 
-    conn = udp_connection_find(context, &addr, addr_len);
+    conn = udp_connection_find(context, &addr, addr_len, timer_wheel_now());
     if (conn == NULL)
     {
-        conn = udp_connection_new_incoming(context, (struct sockaddr *)&addr, addr_len);
-        if (conn == NULL)
-        {
-            return -1;
-        }
+        return -1;
     }
 
     *connection = conn;
     return ret;
 }
 
-connection_api_t *udp_connection_api_init(int port, int address_family)
+connection_api_t *udp_connection_api_init(const coap_settings_t *settings, int address_family)
 {
     connection_context_t *context;
     context = calloc(1, sizeof(connection_context_t));
@@ -125,13 +160,18 @@ connection_api_t *udp_connection_api_init(int port, int address_family)
         return NULL;
     }
 
-    context->port = port;
+    context->port = settings->port;
     context->address_family = address_family;
+    context->pacing = settings->pacing;
+    context->idle_timeout = settings->idle_timeout;
 
     context->api.f_start = udp_connection_start;
     context->api.f_receive = udp_connection_receive;
+    context->api.f_receive_batch = udp_connection_receive_batch;
     context->api.f_send = udp_connection_send;
     context->api.f_close = udp_connection_close;
+    context->api.f_flush = udp_connection_flush;
+    context->api.f_reap = udp_connection_reap;
     context->api.f_stop = udp_connection_stop;
     context->api.f_get_identifier = NULL;
     context->api.f_set_identifier = NULL;
@@ -180,11 +220,23 @@ static int udp_connection_start(void *context_p)
         }
     }
 
-    context->connection_list = linked_list_new();
-    if (context->connection_list == NULL)
+    if (sock >= 0)
     {
-        close(sock);
-        sock = -1;
+        context->connection_table = hash_table_new();
+        context->egress = egress_queue_new(sock, UDP_CONNECTION_EGRESS_SIZE, &context->pacing);
+        context->idle_wheel = timer_wheel_new(timer_wheel_now());
+        if (context->connection_table == NULL || context->egress == NULL
+            || context->idle_wheel == NULL)
+        {
+            hash_table_delete(context->connection_table);
+            egress_queue_delete(context->egress);
+            timer_wheel_delete(context->idle_wheel);
+            context->connection_table = NULL;
+            context->egress = NULL;
+            context->idle_wheel = NULL;
+            close(sock);
+            sock = -1;
+        }
     }
 
     freeaddrinfo(res);
@@ -203,7 +255,9 @@ static int udp_connection_close(void *context_p, void *connection)
         return 0;
     }
 
-    linked_list_remove(context->connection_list, conn);
+    hash_table_remove(context->connection_table, &conn->key, sizeof(conn->key));
+    timer_wheel_cancel(context->idle_wheel, &conn->idle_timer);
+    egress_queue_forget(context->egress, &conn->bucket);
 
     free(conn);
     return 0;
@@ -211,19 +265,18 @@ static int udp_connection_close(void *context_p, void *connection)
 
 static int udp_connection_send(void *context_p, void *connection, uint8_t *buffer, size_t length)
 {
+    connection_context_t *context = (connection_context_t *)context_p;
     connection_t *conn = (connection_t *)connection;
-    int nbSent;
-    size_t offset;
 
-    offset = 0;
-    while (offset != length)
-    {
-        nbSent = sendto(conn->sock, buffer + offset, length - offset, 0,
-                        (struct sockaddr *) & (conn->addr), conn->addr_len);
-        if (nbSent == -1) { return -1; }
-        offset += nbSent;
-    }
-    return 0;
+    return egress_queue_push(context->egress, &conn->bucket, (struct sockaddr *) & (conn->addr),
+                             conn->addr_len, buffer, length);
+}
+
+static int udp_connection_flush(void *context_p)
+{
+    connection_context_t *context = (connection_context_t *)context_p;
+
+    return egress_queue_flush(context->egress);
 }
 
 static int udp_connection_receive(void *context_p, uint8_t *buffer, size_t size, void **connection,
@@ -250,21 +303,139 @@ static int udp_connection_receive(void *context_p, uint8_t *buffer, size_t size,
     return 0;
 }
 
-static int udp_connection_stop(void *context_p)
+static int udp_connection_receive_batch(void *context_p, connection_packet_t *packets,
+                                        size_t count)
 {
     connection_context_t *context = (connection_context_t *)context_p;
     connection_t *conn;
-    linked_list_entry_t *conn_entry, *conn_next;
+    time_t now;
+    int received, packet_count;
+    size_t i;
+
+    if (count > UDP_CONNECTION_BATCH_SIZE)
+    {
+        count = UDP_CONNECTION_BATCH_SIZE;
+    }
+
+    memset(context->batch_msgs, 0, count * sizeof(struct mmsghdr));
+    for (i = 0; i < count; i++)
+    {
+        context->batch_iovecs[i].iov_base = context->batch_buffers[i];
+        context->batch_iovecs[i].iov_len = UDP_CONNECTION_BUFFER_SIZE;
+        context->batch_msgs[i].msg_hdr.msg_iov = &context->batch_iovecs[i];
+        context->batch_msgs[i].msg_hdr.msg_iovlen = 1;
+        context->batch_msgs[i].msg_hdr.msg_name = &context->batch_addrs[i];
+        context->batch_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    received = recvmmsg(context->listen_socket, context->batch_msgs, count, MSG_DONTWAIT, NULL);
+    if (received < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 0;
+        }
+
+        log_message(LOG_LEVEL_ERROR, "recvmmsg() error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    now = timer_wheel_now();
+    packet_count = 0;
+    for (i = 0; i < (size_t)received; i++)
+    {
+        conn = udp_connection_find(context, &context->batch_addrs[i],
+                                   context->batch_msgs[i].msg_hdr.msg_namelen, now);
+        if (conn == NULL)
+        {
+            continue;
+        }
+
+        packets[packet_count].buffer = context->batch_buffers[i];
+        packets[packet_count].length = context->batch_msgs[i].msg_len;
+        packets[packet_count].connection = conn;
+        packet_count++;
+    }
+
+    return packet_count;
+}
+
+typedef struct
+{
+    connection_context_t *context;
+    f_session_in_use_cb_t in_use_cb;
+    void *data;
+    time_t now;
+    int reaped;
+} udp_connection_reaper_t;
+
+static void udp_connection_idle_cb(timer_wheel_timer_t *timer, void *data)
+{
+    udp_connection_reaper_t *reaper = (udp_connection_reaper_t *)data;
+    connection_context_t *context = reaper->context;
+    connection_t *conn;
 
-    for (conn_entry = context->connection_list->head; conn_entry != NULL; conn_entry = conn_next)
+    conn = (connection_t *)((uint8_t *)timer - offsetof(connection_t, idle_timer));
+
+    if (conn->last_activity + context->idle_timeout > reaper->now)
     {
-        conn_next = conn_entry->next;
-        conn = conn_entry->data;
+        timer_wheel_schedule(context->idle_wheel, timer,
+                             conn->last_activity + context->idle_timeout);
+        return;
+    }
 
+    if (reaper->in_use_cb != NULL && reaper->in_use_cb(conn, reaper->data))
+    {
+        timer_wheel_schedule(context->idle_wheel, timer, reaper->now + context->idle_timeout);
+        return;
+    }
+
+    udp_connection_close(context, conn);
+    reaper->reaped++;
+}
+
+static int udp_connection_reap(void *context_p, f_session_in_use_cb_t in_use_cb, void *data)
+{
+    connection_context_t *context = (connection_context_t *)context_p;
+    udp_connection_reaper_t reaper =
+    {
+        .context = context,
+        .in_use_cb = in_use_cb,
+        .data = data,
+        .now = timer_wheel_now(),
+        .reaped = 0,
+    };
+
+    timer_wheel_advance(context->idle_wheel, reaper.now, udp_connection_idle_cb, &reaper);
+
+    if (reaper.reaped > 0)
+    {
+        context->reaped_count += reaper.reaped;
+        log_message(LOG_LEVEL_INFO, "Reaped %d idle peers (%lu in total, %zu connected)\n",
+                    reaper.reaped, context->reaped_count,
+                    hash_table_size(context->connection_table));
+    }
+
+    return reaper.reaped;
+}
+
+static int udp_connection_stop(void *context_p)
+{
+    connection_context_t *context = (connection_context_t *)context_p;
+    hash_table_iterator_t iterator;
+    void *conn;
+
+    hash_table_iterator_init(&iterator, context->connection_table);
+    while (hash_table_iterator_next(&iterator, &conn))
+    {
         udp_connection_close(context, conn);
     }
 
-    linked_list_delete(context->connection_list);
+    hash_table_delete(context->connection_table);
+    timer_wheel_delete(context->idle_wheel);
+
+    egress_queue_flush(context->egress);
+    egress_queue_delete(context->egress);
 
     close(context->listen_socket);
 
@@ -27,14 +27,14 @@
  *
  * Parameters:
  *      api - API context pointer. Is set after return,
- *      port - UDP port to bind to,
+ *      settings - CoAP settings (port, pacing and idle timeout),
  *      address_family - UDP socket family. Can be: AF_INET, AF_INET6 or AF_UNSPEC
  *
  * Returns:
  *      0 on success,
  *      negative value on error
  */
-connection_api_t *udp_connection_api_init(int port, int address_family);
+connection_api_t *udp_connection_api_init(const coap_settings_t *settings, int address_family);
 
 /*
  * Deinitialize a UDP connection context
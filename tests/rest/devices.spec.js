@@ -274,6 +274,7 @@ describe('Devices interface', () => {
               res.body[i].should.have.property('name');
               res.body[i].should.have.property('mode');
               res.body[i].should.have.property('public_key');
+              res.body[i].should.have.property('sequence');
 
               res.body[i]['uuid'].should.match(id_regex);
           }
@@ -281,6 +282,116 @@ describe('Devices interface', () => {
           done();
         });
     });
+
+    it('should return pages of device entries continued with \'after\'', (done) => {
+      chai.request(server)
+        .get('/devices?limit=1')
+        .end((err, res) => {
+          res.should.have.status(200);
+          res.body.should.be.a('array');
+          res.body.length.should.equal(1);
+
+          const first = res.body[0];
+          chai.request(server)
+            .get('/devices?limit=1&after=' + first['uuid'])
+            .end((err, res) => {
+              res.should.have.status(200);
+              res.body.should.be.a('array');
+              res.body.length.should.equal(1);
+              res.body[0]['uuid'].should.not.equal(first['uuid']);
+
+              done();
+            });
+        });
+    });
+
+    it('should return pages of device entries continued with \'sequence\' of removed device', (done) => {
+      chai.request(server)
+        .post('/devices')
+        .set('Content-Type', 'application/json')
+        .send('{"name":"client-paging-removed","mode":"none"}')
+        .end((err, res) => {
+          res.should.have.status(201);
+          const removed = res.body;
+
+          chai.request(server)
+            .get('/devices?limit=1')
+            .end((err, res) => {
+              res.should.have.status(200);
+              res.body.length.should.equal(1);
+              res.body[0]['uuid'].should.equal(removed['uuid']);
+              const sequence = res.body[0]['sequence'];
+
+              chai.request(server)
+                .delete('/devices/' + removed['uuid'])
+                .end((err, res) => {
+                  res.should.have.status(200);
+
+                  chai.request(server)
+                    .get('/devices?limit=1&after=' + sequence)
+                    .end((err, res) => {
+                      res.should.have.status(200);
+                      res.body.should.be.a('array');
+                      res.body.length.should.equal(1);
+                      res.body[0]['sequence'].should.be.below(sequence);
+
+                      done();
+                    });
+                });
+            });
+        });
+    });
+
+    it('should return only device entries matching \'mode\' and \'name_prefix\'', (done) => {
+      chai.request(server)
+        .get('/devices?mode=none&name_prefix=client-none-1')
+        .end((err, res) => {
+          res.should.have.status(200);
+          res.body.should.be.a('array');
+          res.body.length.should.equal(1);
+          res.body[0]['name'].should.equal('client-none-1');
+
+          chai.request(server)
+            .get('/devices?mode=psk&name_prefix=client-none')
+            .end((err, res) => {
+              res.should.have.status(200);
+              res.body.should.be.a('array');
+              res.body.length.should.equal(0);
+
+              done();
+            });
+        });
+    });
+
+    it('should return 400 if \'limit\' is not a positive number', (done) => {
+      chai.request(server)
+        .get('/devices?limit=0')
+        .end((err, res) => {
+          res.should.have.status(400);
+
+          done();
+        });
+    });
+
+    it('should return 400 if \'after\' is non-existing', (done) => {
+      chai.request(server)
+        .get('/devices?after=non-existing')
+        .end((err, res) => {
+          res.should.have.status(400);
+
+          done();
+        });
+    });
+
+    it('should return 400 if \'mode\' is invalid', (done) => {
+      chai.request(server)
+        .get('/devices?mode=invalid-mode')
+        .end((err, res) => {
+          res.should.have.status(400);
+
+          done();
+        });
+    });
   });
 
   describe('GET /devices:uuid', function() {
@@ -451,5 +562,101 @@ describe('Devices interface', () => {
           done();
         });
     });
+
+    it('should not list previously deleted device entry', (done) => {
+      chai.request(server)
+        .get('/devices')
+        .end((err, res) => {
+          res.should.have.status(200);
+          res.body.should.be.a('array');
+          res.body.map((device) => device['uuid']).should.not.include(test_uuid);
+          done();
+        });
+    });
+  });
+
+  describe('POST /devices/batch', function() {
+    it('should return 201 and credentials of every device', (done) => {
+      const id_regex = /^[0-9a-z]{8}-[0-9a-z]{4}-[0-9a-z]{4}-[0-9a-z]{4}-[0-9a-z]{12}$/;
+      const request = [
+        {"name": "client-batch-cert", "mode": "cert"},
+        {"name": "client-batch-psk", "mode": "psk"},
+        {"name": "client-batch-none", "mode": "none"},
+      ];
+
+      chai.request(server)
+        .post('/devices/batch')
+        .set('Content-Type', 'application/json')
+        .send(JSON.stringify(request))
+        .end((err, res) => {
+          res.should.have.status(201);
+          res.body.should.be.a('array');
+          res.body.length.should.equal(3);
+
+          for (i = 0; i < res.body.length; i++) {
+            res.body[i]['uuid'].should.match(id_regex);
+            res.body[i]['name'].should.be.equal(request[i]['name']);
+            res.body[i]['mode'].should.be.equal(request[i]['mode']);
+            res.body[i].should.have.property('public_key');
+            res.body[i].should.have.property('secret_key');
+          }
+          res.body[0].should.have.property('server_key');
+
+          const deletions = res.body.map((device) => {
+            return service.delete('/devices/' + device['uuid']).then((dataAndResponse) => {
+              dataAndResponse.resp.statusCode.should.equal(200);
+            });
+          });
+
+          Promise.all(deletions).then(() => {
+            done();
+          }).catch((err) => {
+            done(err);
+          });
+        });
+    });
+
+    it('should return 400 and add no devices if any entry is invalid', (done) => {
+      const request = [
+        {"name": "client-batch-valid", "mode": "psk"},
+        {"name": "client-batch-invalid", "mode": "invalid"},
+      ];
+
+      chai.request(server)
+        .post('/devices/batch')
+        .set('Content-Type', 'application/json')
+        .send(JSON.stringify(request))
+        .end((err, res) => {
+          res.should.have.status(400);
+
+          chai.request(server)
+            .get('/devices')
+            .end((error, response) => {
+              response.should.have.status(200);
+              response.body.map((device) => device['name']).should.not.include('client-batch-valid');
+              done();
+            });
+        });
+    });
+
+    it('should return 400 if payload is an object instead of an array', (done) => {
+      chai.request(server)
+        .post('/devices/batch')
+        .set('Content-Type', 'application/json')
+        .send('{"name": "client-batch", "mode": "psk"}')
+        .end((err, res) => {
+          res.should.have.status(400);
+          done();
+        });
+    });
+
+    it('should return 415 if missing header', (done) => {
+      chai.request(server)
+        .post('/devices/batch')
+        .end((err, res) => {
+          res.should.have.status(415);
+          done();
+        });
+    });
   });
 });
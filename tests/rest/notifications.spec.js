@@ -1,3 +1,4 @@
+const http = require('http');
 const chai = require('chai');
 const chai_http = require('chai-http');
 const express = require('express');
@@ -310,5 +311,274 @@ describe('Notifications interface', function () {
         });
       });
     });
+
+    it('should return events after cursor without clearing them', function(done) {
+      chai.request(server)
+      .get('/notification/pull?after=0')
+      .end(function (err, res) {
+        should.not.exist(err);
+        res.should.have.status(200);
+        res.body.should.be.a('object');
+        res.body.should.have.property('sequence');
+        res.body['sequence'].should.be.a('number');
+        res.body.should.have.property('missed');
+        const cursor = res.body['sequence'];
+
+        client.sendUpdate()
+        .then(() => {
+          chai.request(server)
+          .get('/notification/pull?after=' + cursor)
+          .end(function (err, res) {
+            should.not.exist(err);
+            res.should.have.status(200);
+            res.body['sequence'].should.be.above(cursor);
+            res.body['reg-updates'].should.be.a('array');
+            res.body['reg-updates'][0]['name'].should.be.equal(client.name);
+
+            chai.request(server)
+            .get('/notification/pull?after=' + cursor)
+            .end(function (err, res) {
+              should.not.exist(err);
+              res.should.have.status(200);
+              res.body['reg-updates'][0]['name'].should.be.equal(client.name);
+
+              done();
+            });
+          });
+        })
+        .catch((err) => {
+          should.not.exist(err);
+        });
+      });
+    });
+
+    it('should hold request open until an event arrives', function(done) {
+      chai.request(server)
+      .get('/notification/pull?after=0&max=1000000')
+      .end(function (err, res) {
+        should.not.exist(err);
+        const cursor = res.body['sequence'];
+
+        chai.request(server)
+        .get('/notification/pull?after=' + cursor + '&wait=10000')
+        .end(function (err, res) {
+          should.not.exist(err);
+          res.should.have.status(200);
+          res.body['sequence'].should.be.above(cursor);
+          res.body['reg-updates'][0]['name'].should.be.equal(client.name);
+
+          done();
+        });
+
+        setTimeout(() => {
+          client.sendUpdate()
+          .catch((err) => {
+            should.not.exist(err);
+          });
+        }, 200);
+      });
+    });
+
+    it('should return 400 for invalid cursor', function(done) {
+      chai.request(server)
+        .get('/notification/pull?after=abc')
+        .end(function (err, res) {
+          err.should.have.status(400);
+
+          done();
+        });
+    });
+  });
+
+  describe('/notification/callbacks', function() {
+
+    it('should return 204 and list registered callback', function(done) {
+      chai.request(server)
+        .put('/notification/callbacks/analytics')
+        .set('Content-Type', 'application/json')
+        .send('{"url": "http://localhost:9999/test_callback", "events": ["registrations"]}')
+        .end(function (err, res) {
+          should.not.exist(err);
+          res.should.have.status(204);
+
+          chai.request(server)
+            .get('/notification/callbacks')
+            .end(function (err, res) {
+              should.not.exist(err);
+              res.should.have.status(200);
+
+              res.body.should.deep.include(
+                {url: "http://localhost:9999/test_callback", events: ["registrations"], name: "analytics"}
+              );
+
+              chai.request(server)
+                .delete('/notification/callbacks/analytics')
+                .end(function (err, res) {
+                  should.not.exist(err);
+                  res.should.have.status(204);
+
+                  done();
+                });
+            });
+        });
+    });
+
+    it('should deliver only events passing the filters', function(done) {
+      let delivered = false;
+
+      express_server.put('/test_callbacks_filtered', (req, resp) => {
+        resp.send();
+
+        if (delivered || req.body['reg-updates'] === undefined || req.body['reg-updates'].length === 0) {
+          return;
+        }
+        delivered = true;
+
+        req.body['registrations'].should.be.eql([]);
+        req.body['async-responses'].should.be.eql([]);
+        req.body['reg-updates'].should.deep.include({name: client.name});
+
+        chai.request(server)
+          .delete('/notification/callbacks/filtered')
+          .end(function (err, res) {
+            done();
+          });
+      });
+
+      chai.request(server)
+        .put('/notification/callbacks/filtered')
+        .set('Content-Type', 'application/json')
+        .send(JSON.stringify({
+          url: 'http://localhost:9999/test_callbacks_filtered',
+          events: ['reg-updates'],
+          endpoint: client.name.slice(0, 4) + '*',
+        }))
+        .end(function (err, res) {
+          should.not.exist(err);
+          res.should.have.status(204);
+
+          client.sendUpdate()
+          .catch((err) => {
+            should.not.exist(err);
+          });
+        });
+    });
+
+    it('should return 400 for unknown event type', function(done) {
+      chai.request(server)
+        .put('/notification/callbacks/unknown')
+        .set('Content-Type', 'application/json')
+        .send('{"url": "http://localhost:9999/test_callback", "events": ["unknown"]}')
+        .end(function (err, res) {
+          err.should.have.status(400);
+
+          done();
+        });
+    });
+
+    it('should return 400 for invalid name', function(done) {
+      chai.request(server)
+        .put('/notification/callbacks/no.dots')
+        .set('Content-Type', 'application/json')
+        .send('{"url": "http://localhost:9999/test_callback"}')
+        .end(function (err, res) {
+          err.should.have.status(400);
+
+          done();
+        });
+    });
+
+    it('should return 404 for not existing callback', function(done) {
+      chai.request(server)
+        .delete('/notification/callbacks/not-existing')
+        .end(function (err, res) {
+          err.should.have.status(404);
+
+          done();
+        });
+    });
+  });
+
+  describe('GET /notification/stream', function() {
+
+    it('should stream filtered events as they happen', function(done) {
+      const req = http.get({
+        host: server.address().address,
+        port: server.address().port,
+        path: '/notification/stream?types=reg-updates',
+      }, (res) => {
+        let data = '';
+
+        res.statusCode.should.be.equal(200);
+        res.headers['content-type'].should.be.equal('text/event-stream');
+
+        res.setEncoding('utf8');
+        res.on('data', (chunk) => {
+          data += chunk;
+
+          if (data.indexOf('\n\n') < 0) {
+            return;
+          }
+
+          data.should.match(/^id: \d+\nevent: reg-updates\ndata: /);
+          data.should.include(client.name);
+          req.abort();
+          done();
+        });
+
+        client.sendUpdate()
+        .catch((err) => {
+          should.not.exist(err);
+        });
+      });
+    });
+
+    it('should resume after given sequence', function(done) {
+      chai.request(server)
+      .get('/notification/pull?after=0')
+      .end(function (err, res) {
+        should.not.exist(err);
+        const cursor = res.body['sequence'];
+
+        client.sendUpdate()
+        .then(() => {
+          const req = http.get({
+            host: server.address().address,
+            port: server.address().port,
+            path: '/notification/stream',
+            headers: { 'Last-Event-ID': String(cursor) },
+          }, (res) => {
+            let data = '';
+
+            res.statusCode.should.be.equal(200);
+
+            res.setEncoding('utf8');
+            res.on('data', (chunk) => {
+              data += chunk;
+
+              if (data.indexOf('event: reg-updates') < 0) {
+                return;
+              }
+
+              req.abort();
+              done();
+            });
+          });
+        })
+        .catch((err) => {
+          should.not.exist(err);
+        });
+      });
+    });
+
+    it('should return 400 for unknown event type', function(done) {
+      chai.request(server)
+        .get('/notification/stream?types=unknown')
+        .end(function (err, res) {
+          err.should.have.status(400);
+
+          done();
+        });
+    });
   });
 });